@@ -12,12 +12,26 @@
 
 #define CACHE_BLOCKS 64
 
+// Most blocks a cache grows to while every block is locked or held. It trims
+// itself back to CACHE_BLOCKS as they are released.
+
+#ifndef CACHE_MAX_BLOCKS
+#define CACHE_MAX_BLOCKS (4 * CACHE_BLOCKS)
+#endif
+
+// Blocks up to this size come from the kernel heap, larger ones get pages
+
+#ifndef CACHE_HEAP_MAX
+#define CACHE_HEAP_MAX 2048
+#endif
+
 struct cache_block {
     unsigned long long pos;         // Position in backing device
     int dirty;                      // CACHE_CLEAN or CACHE_DIRTY
     long count;                     // Reference count or usage flag
-    char block[CACHE_BLKSZ];        // Pointer to cached block
+    char * block;                   // Pointer to cached block
     struct lock cnm;
+    int waiters;                    // threads in cache_lookup waiting for cnm
     struct cache_block *next;
 };
 
@@ -25,27 +39,41 @@ struct cache_block {
 struct cache {
     struct io *bkgio;              // Backing I/O device
     struct cache_block *block_list;
+    unsigned long blksz;            // Block size, fixed by create_cache
     int blkcnt;  
+    int (*hold)(void *, unsigned long long); // see cache_set_hold
+    void *hold_arg;
 };
+
+static int cache_lookup(struct cache * cache, unsigned long long pos, struct cache_block ** bptr);
+static int cache_held(struct cache * cache, struct cache_block * blk);
+static void cache_trim(struct cache * cache);
 //==================================================================================================
-// int create_cache(struct io * bkgio, struct cache ** cptr)
+// int create_cache(struct io * bkgio, unsigned long blksz, struct cache ** cptr)
 // inputs:
 //     struct io * bkgio:pointer to io.
+//     unsigned long blksz:block size, a power of two from CACHE_MIN_BLKSZ to CACHE_MAX_BLKSZ.
 //     struct cache ** cptr:pointer to a cache pointer.
 // outputs:
 //     int: 0 :success
-//          -EINVAL :invalid input
+//          -EINVAL :invalid input or block size
 // description:
 //     allocates and initializes a cache structure.
 //==================================================================================================
 
-int create_cache(struct io * bkgio, struct cache ** cptr) {
+int create_cache(struct io * bkgio, unsigned long blksz, struct cache ** cptr) {
     // Implementation stub
     if (bkgio == NULL || cptr == NULL)
         return -EINVAL;
+    if (blksz < CACHE_MIN_BLKSZ || blksz > CACHE_MAX_BLKSZ || (blksz & (blksz - 1)) != 0)
+        return -EINVAL;
+    long devblksz = ioctl(bkgio, IOCTL_GETBLKSZ, NULL);
+    if (devblksz > 0 && blksz % devblksz != 0)
+        return -EINVAL;
 
     struct cache *c = kcalloc(1, sizeof(struct cache));
     c->bkgio = ioaddref(bkgio);  
+    c->blksz = blksz;
     c->blkcnt = 0;
 
     c->block_list = NULL;
@@ -54,6 +82,34 @@ int create_cache(struct io * bkgio, struct cache ** cptr) {
     return 0;
 }
 //==================================================================================================
+// void destroy_cache(struct cache * cache)
+// inputs:
+//     struct cache * cache:pointer to the cache, or NULL.
+// outputs:none
+// description:
+//     frees a cache and its blocks and drops its reference to the backing device. dirty
+//     blocks are not written back; flush first to keep them. no block may be held.
+//==================================================================================================
+
+void destroy_cache(struct cache * cache) {
+    if (cache == NULL)
+        return;
+
+    struct cache_block *curr = cache->block_list;
+    while(curr != NULL){
+        struct cache_block *next = curr->next;
+        if(cache->blksz <= CACHE_HEAP_MAX){
+            kfree(curr->block);
+        }else{
+            free_phys_pages(curr->block, cache->blksz / PAGE_SIZE);
+        }
+        kfree(curr);
+        curr = next;
+    }
+    ioclose(cache->bkgio);
+    kfree(cache);
+}
+//==================================================================================================
 // int cache_get_block(struct cache * cache, unsigned long long pos, void ** pptr)
 // inputs:
 //     struct cache * cache:pointer to cache structure.
@@ -67,80 +123,53 @@ int create_cache(struct io * bkgio, struct cache ** cptr) {
 //==================================================================================================
 
 int cache_get_block(struct cache * cache, unsigned long long pos, void ** pptr) {
-    // Implementation stub
-    if( cache == NULL){
-        return -EINVAL;
+    struct cache_block *blk;
+    int result;
+
+    result = cache_lookup(cache, pos, &blk);
+    if(result < 0){
+        return result;
     }
-    if(pos <= 0){
-        return -EINVAL;
+    if(result == 0){
+        *pptr = blk->block;
+        return 0;
     }
 
-    if(pos % CACHE_BLKSZ != 0){
+    // not cached: fill the slot from the device
+    int read = ioreadat(cache->bkgio, pos, blk->block, cache->blksz);
+    if(read <= 0){
+        blk->pos = 0; // nothing valid is cached here
+        blk->count--;
+        lock_release(&blk->cnm);
         return -EINVAL;
     }
+    *pptr = blk->block;
+    return 0;
+}
+//==================================================================================================
+// int cache_claim_block(struct cache * cache, unsigned long long pos, void ** pptr)
+// inputs:
+//     struct cache * cache:pointer to cache structure.
+//     unsigned long long pos:position in the device.
+//     void ** pptr:output pointer.
+// outputs:
+//     int: 0: sucess
+//          -EINVAL: invalid input or pos is not aligned
+// description:
+//     like cache_get_block, but for a caller that overwrites the whole block. a block that is
+//     not cached is not read from the device, so its contents are undefined until the caller
+//     fills it and releases it dirty.
+//==================================================================================================
 
-    struct cache_block *curr = cache->block_list; 
-    if(curr != NULL){
-        while(curr != NULL){
-            if(curr->pos == pos) {
-               lock_acquire(&curr->cnm);
-                curr->count++;
-                *pptr = curr->block;
-                return 0;
-            }
-            curr = curr->next;
-        }
-    }
-
-    curr = cache->block_list;
-    if(cache->blkcnt >= 64 && curr != NULL){
-        int min = curr->count;
-        struct cache_block *evict = curr;
-        while(curr != NULL){
-            if(curr->count <= min && curr->cnm.tid == -1){
-                min = evict->count;
-                evict = curr;
-            }
-            curr = curr->next;
-        }
-       
-        lock_acquire(&evict->cnm);
-        if(evict->dirty == CACHE_DIRTY){
-            iowriteat(cache->bkgio, evict->pos, evict->block, CACHE_BLKSZ);
-        }
-        evict->pos = pos;
-        evict->count =1;
-        int read = ioreadat(cache->bkgio, pos, evict->block, CACHE_BLKSZ);
-        if(read <=0){
-            lock_release(&evict->cnm);
-            evict->count--;
-            return -EINVAL;
-        }
-        *pptr = evict->block;
-        return 0;
-
-    }else{
-        struct cache_block *mem_block = kcalloc(1, sizeof(struct cache_block));
-        lock_init(&mem_block->cnm);
-        lock_acquire(&mem_block->cnm);
-        if(curr == NULL){
-            cache->block_list = mem_block;
-        }else{
-            while(curr->next!=NULL){
-                curr = curr->next;
-            }
-            curr->next = mem_block;
-        }
-        mem_block-> pos = pos;
-        mem_block->count = 1;
-        int read = ioreadat(cache->bkgio, pos, mem_block->block, CACHE_BLKSZ);
+int cache_claim_block(struct cache * cache, unsigned long long pos, void ** pptr) {
+    struct cache_block *blk;
+    int result;
 
-        if(read <= 0){
-            return -EINVAL;
-        }
-        *pptr = mem_block-> block;
-        cache->blkcnt++;
+    result = cache_lookup(cache, pos, &blk);
+    if(result < 0){
+        return result;
     }
+    *pptr = blk->block;
     return 0;
 }
 //==================================================================================================
@@ -151,7 +180,8 @@ int cache_get_block(struct cache * cache, unsigned long long pos, void ** pptr)
 //     int dirty:indicates whether the block has been modified.
 // Outputs:none
 // description:
-//     releases the lock on the block previously acquired. 
+//     releases the lock on the block previously acquired. a cache grown past CACHE_BLOCKS
+//     gives back clean blocks nobody uses (cache_trim).
 //==================================================================================================
 
 extern void cache_release_block(struct cache * cache, void * pblk, int dirty){
@@ -164,6 +194,7 @@ extern void cache_release_block(struct cache * cache, void * pblk, int dirty){
                 curr->dirty = CACHE_DIRTY;
             }
             lock_release(&curr->cnm);
+            cache_trim(cache);
             return;
         }
         curr = curr->next;
@@ -177,7 +208,8 @@ extern void cache_release_block(struct cache * cache, void * pblk, int dirty){
 //     int: 0:success
 //          -EINVAL:invalid input
 // description:
-//     writes all dirty blocks in the cache back to the device, mark as clean.
+//     writes all dirty blocks in the cache back to the device, mark as clean. blocks the
+//     hold function keeps stay dirty. then trims a cache grown past CACHE_BLOCKS.
 //==================================================================================================
 
 extern int cache_flush(struct cache * cache){
@@ -186,15 +218,16 @@ extern int cache_flush(struct cache * cache){
 
     struct cache_block *curr = cache->block_list;
     while(curr !=NULL){
-        if (curr->dirty == CACHE_DIRTY){
+        if (curr->dirty == CACHE_DIRTY && !cache_held(cache, curr)){
             // Write the block back to the backing device
-            int ret = iowriteat(cache->bkgio, curr->pos, curr->block, CACHE_BLKSZ);
+            int ret = iowriteat(cache->bkgio, curr->pos, curr->block, cache->blksz);
             if (ret < 0)
                 return -EINVAL;
             curr->dirty = CACHE_CLEAN; // Mark as clean after writing
         }
         curr = curr->next;
     }
+    cache_trim(cache);
     //curr = cache->block_list;
     // while(curr != NULL){
     //     struct cache_block *prev = curr;
@@ -204,4 +237,170 @@ extern int cache_flush(struct cache * cache){
     // // Flush the cache
     // kfree(cache);
     return 0;
-}
\ No newline at end of file
+}
+//==================================================================================================
+// int cache_lookup(struct cache * cache, unsigned long long pos, struct cache_block ** bptr)
+// inputs:
+//     struct cache * cache:pointer to cache structure.
+//     unsigned long long pos:position in the device.
+//     struct cache_block ** bptr:output block, locked.
+// outputs:
+//     int: 0: the block was cached
+//          1: the block was not cached; *bptr is a clean slot for pos whose data is not read
+//          -EINVAL: invalid input or pos is not aligned
+//          -ENOMEM: CACHE_MAX_BLOCKS are in use and every one is locked or held
+// description:
+//     finds the cached block at pos or takes a slot for it, evicting (and writing back) the
+//     least used unlocked block that is not held once CACHE_BLOCKS are in use. when there
+//     is none, the cache grows, up to CACHE_MAX_BLOCKS.
+//==================================================================================================
+
+static int cache_lookup(struct cache * cache, unsigned long long pos, struct cache_block ** bptr) {
+    if( cache == NULL){
+        return -EINVAL;
+    }
+    if(pos <= 0){
+        return -EINVAL;
+    }
+
+    if(pos % cache->blksz != 0){
+        return -EINVAL;
+    }
+
+    struct cache_block *curr = cache->block_list; 
+    while(curr != NULL){
+        if(curr->pos == pos) {
+            curr->waiters++; // keeps cache_trim from freeing it while we wait
+            lock_acquire(&curr->cnm);
+            curr->waiters--;
+            curr->count++;
+            *bptr = curr;
+            return 0;
+        }
+        curr = curr->next;
+    }
+
+    curr = cache->block_list;
+    struct cache_block *evict = NULL;
+    if(cache->blkcnt >= CACHE_BLOCKS){
+        for(; curr != NULL; curr = curr->next){
+            if(curr->cnm.tid != -1 || curr->waiters != 0 || (evict != NULL && curr->count > evict->count)){
+                continue;
+            }
+            if(curr->dirty == CACHE_DIRTY && cache_held(cache, curr)){
+                continue;
+            }
+            evict = curr;
+        }
+    }
+    if(evict != NULL){
+        lock_acquire(&evict->cnm);
+        if(evict->dirty == CACHE_DIRTY){
+            iowriteat(cache->bkgio, evict->pos, evict->block, cache->blksz);
+            evict->dirty = CACHE_CLEAN;
+        }
+        evict->pos = pos;
+        evict->count =1;
+        *bptr = evict;
+        return 1;
+    }
+
+    // below capacity, or every block is locked or held: add one
+    if(cache->blkcnt >= CACHE_MAX_BLOCKS){
+        return -ENOMEM;
+    }
+    curr = cache->block_list;
+    struct cache_block *mem_block = kcalloc(1, sizeof(struct cache_block));
+    if(mem_block == NULL){
+        return -ENOMEM;
+    }
+    if(cache->blksz <= CACHE_HEAP_MAX){
+        mem_block->block = kmalloc(cache->blksz);
+    }else{
+        mem_block->block = alloc_phys_pages(cache->blksz / PAGE_SIZE);
+    }
+    if(mem_block->block == NULL){
+        kfree(mem_block);
+        return -ENOMEM;
+    }
+    lock_init(&mem_block->cnm);
+    lock_acquire(&mem_block->cnm);
+    if(curr == NULL){
+        cache->block_list = mem_block;
+    }else{
+        while(curr->next!=NULL){
+            curr = curr->next;
+        }
+        curr->next = mem_block;
+    }
+    mem_block->pos = pos;
+    mem_block->count = 1;
+    cache->blkcnt++;
+    *bptr = mem_block;
+    return 1;
+}
+//==================================================================================================
+// void cache_set_hold(struct cache * cache, int (*hold)(void * arg, unsigned long long pos), void * arg)
+// inputs:
+//     struct cache * cache:pointer to the cache.
+//     int (*hold)(void *, unsigned long long):function deciding if a dirty block may be written
+//         back, or NULL.
+//     void * arg:first argument of hold.
+// outputs:none
+// description:
+//     sets the function cache_held asks before a dirty block is written back.
+//==================================================================================================
+
+void cache_set_hold (
+    struct cache * cache, int (*hold)(void * arg, unsigned long long pos), void * arg)
+{
+    cache->hold = hold;
+    cache->hold_arg = arg;
+}
+//==================================================================================================
+// int cache_held(struct cache * cache, struct cache_block * blk)
+// inputs:
+//     struct cache * cache:pointer to the cache.
+//     struct cache_block * blk:dirty block to be written back.
+// outputs:
+//     int: 1 if the block must stay dirty for now, else 0
+//==================================================================================================
+
+static int cache_held(struct cache * cache, struct cache_block * blk) {
+    return cache->hold != NULL && cache->hold(cache->hold_arg, blk->pos) != 0;
+}
+//==================================================================================================
+// void cache_trim(struct cache * cache)
+// inputs:
+//     struct cache * cache:pointer to the cache.
+// outputs:none
+// description:
+//     frees clean blocks that are neither locked nor waited for, until the cache is back to
+//     CACHE_BLOCKS. dirty ones stay until they are written back.
+//==================================================================================================
+
+static void cache_trim(struct cache * cache) {
+    struct cache_block *curr = cache->block_list;
+    struct cache_block *prev = NULL;
+
+    while(curr != NULL && cache->blkcnt > CACHE_BLOCKS){
+        struct cache_block *next = curr->next;
+        if(curr->cnm.tid == -1 && curr->waiters == 0 && curr->dirty == CACHE_CLEAN){
+            if(prev == NULL){
+                cache->block_list = next;
+            }else{
+                prev->next = next;
+            }
+            if(cache->blksz <= CACHE_HEAP_MAX){
+                kfree(curr->block);
+            }else{
+                free_phys_pages(curr->block, cache->blksz / PAGE_SIZE);
+            }
+            kfree(curr);
+            cache->blkcnt--;
+        }else{
+            prev = curr;
+        }
+        curr = next;
+    }
+}
@@ -7,7 +7,8 @@
 #ifndef _CACHE_H_
 #define _CACHE_H_
 
-#define CACHE_BLKSZ 512UL 
+#define CACHE_MIN_BLKSZ 512UL
+#define CACHE_MAX_BLKSZ 4096UL
 
 #define CACHE_CLEAN 0
 #define CACHE_DIRTY 1
@@ -15,9 +16,31 @@
 struct io; // extern decl.
 struct cache; // opaque decl.
 
-extern int create_cache(struct io * bkgio, struct cache ** cptr);
+// Block size of a cache is fixed when it is created: a power of two from
+// CACHE_MIN_BLKSZ to CACHE_MAX_BLKSZ that is a multiple of the block size of
+// the backing device. All positions are multiples of it.
+
+extern int create_cache(struct io * bkgio, unsigned long blksz, struct cache ** cptr);
+extern void destroy_cache(struct cache * cache);
 extern int cache_get_block(struct cache * cache, unsigned long long pos, void ** pptr);
+
+// Like cache_get_block(), but for a caller that is about to overwrite the
+// whole block: if the block is not cached, it is not read from the device and
+// its contents are undefined. The caller must fill the whole block and
+// release the block as CACHE_DIRTY.
+
+extern int cache_claim_block(struct cache * cache, unsigned long long pos, void ** pptr);
 extern void cache_release_block(struct cache * cache, void * pblk, int dirty);
 extern int cache_flush(struct cache * cache);
 
+// A file system that logs its blocks to a journal must not have them written
+// in place before the log is. If _hold_ is set, the cache calls it for each
+// dirty block it is about to write back, by eviction or cache_flush(), and
+// leaves the block dirty in the cache if it returns nonzero. Held blocks are
+// not evicted; the cache grows past its capacity instead, up to a bound, and
+// shrinks back once they are written.
+
+extern void cache_set_hold (
+    struct cache * cache, int (*hold)(void * arg, unsigned long long pos), void * arg);
+
 #endif // _CACHE_H_
\ No newline at end of file
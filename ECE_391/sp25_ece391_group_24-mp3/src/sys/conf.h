@@ -41,10 +41,13 @@
 #define TIMER_FREQ 10000000UL // qemu/include/hw/intc/riscv_aclint.h
 
 #define PLIC_SRC_CNT 96 // QEMU VIRT_IRQCHIP_NUM_SOURCES
-#define PLIC_CTX_CNT 2
+#define PLIC_CTX_CNT (2*NHART) // M and S mode context of each hart
 
 #define RTC_MMIO_BASE 0x00101000L
 
+#define CLINT_MMIO_BASE 0x02000000UL // PMA
+#define CLINT_MTIMECMP(h) (CLINT_MMIO_BASE + 0x4000 + 8*(h))
+
 // KERNEL CONFIGURATION
 //
 
@@ -64,7 +67,25 @@
 #define UMEM_END ((void*)UMEM_END_VMA)
 #define UMEM_SIZE (UMEM_END - UMEM_START)
 
-// Maximum number of devices
+// User virtual address of the submission/completion ring page (see ioring.h).
+// It sits in the middle of user memory, away from the image and the stack.
+
+#ifndef IORING_VMA
+#define IORING_VMA (UMEM_START_VMA + UMEM_SIZE/2)
+#endif
+
+// File mappings (see mmap.h) are placed in the quarter of user memory below
+// the ring page, well above the program image.
+
+#ifndef MMAP_START_VMA
+#define MMAP_START_VMA (UMEM_START_VMA + UMEM_SIZE/4)
+#endif
+
+#ifndef MMAP_END_VMA
+#define MMAP_END_VMA IORING_VMA
+#endif
+
+// Maximum number of devices
 
 #ifndef NDEV
 #define NDEV 16
@@ -76,12 +97,32 @@
 #define NIRQ PLIC_SRC_CNT
 #endif
 
+// Maximum number of harts. Pass the same number (or fewer) to QEMU with -smp;
+// harts with a larger mhartid are parked in start.s.
+
+#ifndef NHART
+#define NHART 4
+#endif
+
+// Maximum number of mounted file systems (see fsattach)
+
+#ifndef NMOUNT
+#define NMOUNT 8
+#endif
+
 // Maximum number of threads
 
 #ifndef NTHR
 #define NTHR 32
 #endif
 
+// Scheduler time slice in microseconds. The timer is programmed for the
+// earlier of this deadline and the next alarm; there is no periodic tick.
+
+#ifndef QUANTUM_US
+#define QUANTUM_US 10000
+#endif
+
 // Maximum number of processes
 
 #ifndef NPROC
@@ -94,6 +135,22 @@
 #define HEAP_ALIGN 16
 #endif
 
+// UART receive and transmit ring sizes in bytes (powers of two). A reader
+// sleeps until UART_RX_WATERMARK bytes (or the rest of its request) have
+// arrived, so a burst of input wakes it once rather than once per byte.
+
+#ifndef UART_RXBUFSZ
+#define UART_RXBUFSZ 256
+#endif
+
+#ifndef UART_TXBUFSZ
+#define UART_TXBUFSZ 1024
+#endif
+
+#ifndef UART_RX_WATERMARK
+#define UART_RX_WATERMARK 16
+#endif
+
 // Interrupt priorities
 
 #define UART_INTR_PRIO 3
@@ -102,14 +159,79 @@
 #define VIORNG_INTR_PRIO 1
 #define VIOGPU_INTR_PRIO 2
 
-// Maximum number of open io objects
+// Interrupt affinity. Bit i routes the source to the S mode context of hart i
+// (see intr_set_affinity). Only list harts that QEMU actually starts.
+
+#ifndef UART_INTR_HARTMASK
+#define UART_INTR_HARTMASK 0x1
+#endif
+
+#ifndef VIOBLK_INTR_HARTMASK
+#define VIOBLK_INTR_HARTMASK 0x1
+#endif
 
-#define PROCESS_IOMAX 16
+#ifndef VIORNG_INTR_HARTMASK
+#define VIORNG_INTR_HARTMASK 0x1
+#endif
+
+// Maximum number of open io objects per process. The descriptor table grows
+// on demand, so a large limit costs nothing until descriptors are opened.
+
+#ifndef PROCESS_IOMAX
+#define PROCESS_IOMAX 1024
+#endif
 
 // Capacity of block cache
 
 #define CACHE_CAPACITY 64 // must be power of two
 
+// Bytes of new blocks a growing KTFS file may hold before they are given
+// places on the device. They are kept in pages of their own, outside the block
+// cache, so the number of blocks depends on the block size of the image.
+
+#ifndef KTFS_DELALLOC_SIZE
+#define KTFS_DELALLOC_SIZE 32768
+#endif
+
+// Number of file pages KTFS keeps for mmap. Pages that are still mapped by a
+// process are not evicted, so the cache may grow past this while they are.
+
+#ifndef KTFS_PAGE_CACHE_CNT
+#define KTFS_PAGE_CACHE_CNT 64
+#endif
+
+// Blocks of deleted KTFS files freed in one step of the reclaimer thread, and
+// deleted inodes a mount remembers; more are found by scanning the inodes.
+
+#ifndef KTFS_RECLAIM_BATCH
+#define KTFS_RECLAIM_BATCH 256
+#endif
+
+#ifndef KTFS_RECLAIM_QUEUE
+#define KTFS_RECLAIM_QUEUE 32
+#endif
+
+// Bytes of file data a tmpfs mount may hold in pages (see tmpfs.h)
+
+#ifndef TMPFS_SIZE
+#define TMPFS_SIZE (RAM_SIZE/4)
+#endif
+
+// Bytes of metadata journal KTFS reserves at the end of an image that has
+// none when it is mounted, and bytes a transaction may take: the descriptor,
+// the commit block and the blocks it logs, which are kept in pages until the
+// transaction is committed. Reserving takes data blocks from an existing image,
+// so by default (0) an image without a journal keeps writing its metadata
+// through; mkfs gives a new image one.
+
+#ifndef KTFS_JOURNAL_SIZE
+#define KTFS_JOURNAL_SIZE 0
+#endif
+
+#ifndef KTFS_JOURNAL_TXSIZE
+#define KTFS_JOURNAL_TXSIZE 32768
+#endif
+
 // KERNEL FEATURES
 //
 
@@ -43,7 +43,7 @@ struct rtc_device {
 //
 
 static int rtc_open(struct io ** ioptr, void * aux);
-static void rtc_close(struct io * io);
+static int rtc_close(struct io * io);
 static int rtc_cntl(struct io * io, int cmd, void * arg);
 static long rtc_read(struct io * io, void * buf, long bufsz);
 
@@ -83,14 +83,15 @@ int rtc_open(struct io ** ioptr, void * aux) {
     return 0;
 }
 
-// void rtc_close(struct io * io)
+// int rtc_close(struct io * io)
 // Inputs: struct io * io - pointer to the io object
-// Outputs: none
+// Outputs: 0
 // Description: This function closes the RTC device.
 // Side Effects: none
-void rtc_close(struct io * io) {
+int rtc_close(struct io * io) {
     trace("%s()", __func__);
     assert(iorefcnt(io) == 0);
+    return 0;
 }
 
 // int rtc_cntl(struct io * io, int cmd, void * arg)
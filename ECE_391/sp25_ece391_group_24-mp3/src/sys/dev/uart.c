@@ -25,13 +25,24 @@
 
 #include "error.h"
 
+#include "string.h"
+
 #include <stdint.h>
 
-// COMPILE-TIME CONSTANT DEFINITIONS
+// COMPILE-TIME CONSTANT DEFINITIONS
 //
 
-#ifndef UART_RBUFSZ
-#define UART_RBUFSZ 64
+// Depth of the 16550 receive and transmit FIFOs
+
+#ifndef UART_FIFO_DEPTH
+#define UART_FIFO_DEPTH 16
+#endif
+
+// A writer waiting for room in the transmit ring sleeps until this much
+// space (or the rest of its request) is free.
+
+#ifndef UART_TX_WATERMARK
+#define UART_TX_WATERMARK (UART_TXBUFSZ / 2)
 #endif
 
 #ifndef UART_INTR_PRIO
@@ -75,11 +86,16 @@ struct uart_regs {
 #define LSR_THRE (1 << 5)
 #define IER_DRIE (1 << 0)
 #define IER_THREIE (1 << 1)
+#define FCR_FIFOE (1 << 0)
+#define FCR_RXRST (1 << 1)
+#define FCR_TXRST (1 << 2)
+#define FCR_RXTRIG_8 (2 << 6) // receive interrupt at 8 bytes in the FIFO
 
 struct ringbuf {
-    unsigned int hpos; // head of queue (from where elements are removed)
-    unsigned int tpos; // tail of queue (where elements are inserted)
-    char data[UART_RBUFSZ];
+    unsigned int hpos; // head of queue (from where elements are removed)
+    unsigned int tpos; // tail of queue (where elements are inserted)
+    unsigned int size; // size of data, a power of two
+    char * data;
 };
 
 struct uart_device {
@@ -94,25 +110,44 @@ struct uart_device {
     struct ringbuf rxbuf;
     struct ringbuf txbuf;
 
+    // bytes (space) a blocked reader (writer) is waiting for
+    unsigned int rxwant;
+    unsigned int txwant;
+
     struct condition tx_not_full;
     struct condition rx_not_empty;
+
+    struct pollwait * pollers; // poll calls watching this UART
+
+    char rxdata[UART_RXBUFSZ];
+    char txdata[UART_TXBUFSZ];
+
+    struct intr_work wakeup; // deferred from uart_isr
 };
 
 // INTERNAL FUNCTION DEFINITIONS
 //
 
 static int uart_open(struct io ** ioptr, void * aux);
-static void uart_close(struct io * io);
+static int uart_close(struct io * io);
 static long uart_read(struct io * io, void * buf, long bufsz);
 static long uart_write(struct io * io, const void * buf, long len);
+static int uart_cntl(struct io * io, int cmd, void * arg);
+static int uart_poll(struct io * io, struct pollwait * pw);
 
 static void uart_isr(int srcno, void * driver_private);
+static void uart_wakeup(void * aux);
 
-static void rbuf_init(struct ringbuf * rbuf);
+static void rbuf_init(struct ringbuf * rbuf, char * data, unsigned int size);
 static int rbuf_empty(const struct ringbuf * rbuf);
 static int rbuf_full(const struct ringbuf * rbuf);
+static unsigned int rbuf_count(const struct ringbuf * rbuf);
+static unsigned int rbuf_space(const struct ringbuf * rbuf);
 static void rbuf_putc(struct ringbuf * rbuf, char c);
 static char rbuf_getc(struct ringbuf * rbuf);
+static unsigned int rbuf_read(struct ringbuf * rbuf, void * buf, unsigned int n);
+static unsigned int rbuf_write (
+    struct ringbuf * rbuf, const void * buf, unsigned int n);
 
 // EXPORTED FUNCTION DEFINITIONS
 // 
@@ -126,8 +161,10 @@ static char rbuf_getc(struct ringbuf * rbuf);
 void uart_attach(void * mmio_base, int irqno) {
     static const struct iointf uart_iointf = {
         .close = &uart_close,
+        .cntl = &uart_cntl,
         .read = &uart_read,
-        .write = &uart_write
+        .write = &uart_write,
+        .poll = &uart_poll
     };
 
     struct uart_device * uart;
@@ -177,18 +214,25 @@ int uart_open(struct io ** ioptr, void * aux) {
     
     // Reset receive and transmit buffers
     
-    rbuf_init(&uart->rxbuf);
-    rbuf_init(&uart->txbuf);
+    rbuf_init(&uart->rxbuf, uart->rxdata, UART_RXBUFSZ);
+    rbuf_init(&uart->txbuf, uart->txdata, UART_TXBUFSZ);
+    uart->rxwant = 1;
+    uart->txwant = 1;
+    uart->pollers = NULL;
 
-    // Read receive buffer register to flush any stale data in hardware buffer
+    // Enable and reset the FIFOs, then read receive buffer register to flush
+    // any stale data in hardware buffer
 
-    uart->regs->rbr; // forces a read because uart->regs is volatile
+    uart->regs->fcr = FCR_FIFOE | FCR_RXRST | FCR_TXRST | FCR_RXTRIG_8;
+    uart->regs->rbr; // forces a read because uart->regs is volatile
 
     // enable the data ready interrupt
     uart->regs->ier |= IER_DRIE;
 
     // registers the UART's interrupt handler
+    intr_work_init(&uart->wakeup, uart_wakeup, uart);
     enable_intr_source(uart->irqno, UART_INTR_PRIO, uart_isr, uart);
+    intr_set_affinity(uart->irqno, UART_INTR_HARTMASK);
 
     // Provides a UART device reference for system access.
     *ioptr = ioaddref(&uart->io);
@@ -200,12 +244,12 @@ int uart_open(struct io ** ioptr, void * aux) {
     return 0;
 }
 
-// void uart_close(struct io * io)
+// int uart_close(struct io * io)
 // Inputs: struct io * io - pointer to the io interface
-// Outputs: none
+// Outputs: 0
 // Description: Closes the UART device for communication
 // Side Effects: UART device is disabled and unregistered with the interrupt manager
-void uart_close(struct io * io) {
+int uart_close(struct io * io) {
     struct uart_device * const uart =
         (void*)io - offsetof(struct uart_device, io);
 
@@ -215,6 +259,7 @@ void uart_close(struct io * io) {
     // Disable interrupts and unregister the device
     uart->regs->ier = 0;
     disable_intr_source(uart->irqno);
+    return 0;
 }
 
 // long uart_read(struct io * io, void * buf, long bufsz)
@@ -225,27 +270,34 @@ void uart_close(struct io * io) {
 // Description: Reads data from the UART receive ring buffer
 // Side Effects: UART receive ring buffer is read into the provided buffer, can switch to other threads while waiting for data
 long uart_read(struct io * io, void * buf, long bufsz) {
+    unsigned int want;
+    long pos = 0;
     int pie;
-    // check if requested buffer size is valid
+    // check if requested buffer size is valid
     if (bufsz < 1)
         return -EINVAL;
     
     struct uart_device * const uart =
         (void*)io - offsetof(struct uart_device, io);
 
-
     char * cbuf = buf;
 
-    for (long i = 0; i < bufsz; ++i){
-        // wait until the receive ring buffer is not empty
-        while (rbuf_empty(&uart->rxbuf)){
-            pie = disable_interrupts();
+    while (pos < bufsz) {
+        // wait for a batch: the rest of the request or UART_RX_WATERMARK
+        // bytes, whichever is less
+        want = (bufsz - pos < UART_RX_WATERMARK) ?
+            bufsz - pos : UART_RX_WATERMARK;
+
+        pie = disable_interrupts();
+        while (rbuf_count(&uart->rxbuf) < want) {
+            uart->rxwant = want;
             condition_wait(&uart->rx_not_empty);
-            restore_interrupts(pie);
         }
+        uart->rxwant = 1;
+        restore_interrupts(pie);
 
-        // copy characters from the receive ring buffer into the provided buffer
-        cbuf[i] = rbuf_getc(&uart->rxbuf);
+        // copy everything available from the receive ring buffer
+        pos += rbuf_read(&uart->rxbuf, cbuf + pos, bufsz - pos);
         uart->regs->ier |= IER_DRIE;
     }
 
@@ -260,8 +312,10 @@ long uart_read(struct io * io, void * buf, long bufsz) {
 // Description: Writes data to the UART transmit ring buffer
 // Side Effects: UART transmit ring buffer is written into the provided buffer, can switch to other threads while waiting for buffer space
 long uart_write(struct io * io, const void * buf, long len) {
+    unsigned int want;
+    long pos = 0;
     int pie;
-    // check if requested buffer size is valid
+    // check if requested buffer size is valid
     if (len < 1)
         return -EINVAL;
     
@@ -270,21 +324,74 @@ long uart_write(struct io * io, const void * buf, long len) {
 
     const char * cbuf = buf;
 
-    for (long i = 0; i < len; ++i){
-        // wait until the receive ring buffer is not empty
-        while (rbuf_full(&uart->txbuf)){
-            pie = disable_interrupts();
+    while (pos < len) {
+        // wait for room for the rest of the request or UART_TX_WATERMARK
+        // bytes, whichever is less
+        want = (len - pos < UART_TX_WATERMARK) ?
+            len - pos : UART_TX_WATERMARK;
+
+        pie = disable_interrupts();
+        while (rbuf_space(&uart->txbuf) < want) {
+            uart->txwant = want;
             condition_wait(&uart->tx_not_full);
-            restore_interrupts(pie);
         }
+        uart->txwant = 1;
+        restore_interrupts(pie);
 
-        // copy characters from the receive ring buffer into the provided buffer
-        rbuf_putc(&uart->txbuf, cbuf[i]);
+        // copy as much as fits into the transmit ring buffer
+        pos += rbuf_write(&uart->txbuf, cbuf + pos, len - pos);
         uart->regs->ier |= IER_THREIE;
     }
 
     return len;
+}
+
+// int uart_cntl(struct io * io, int cmd, void * arg)
+// Inputs: struct io * io - pointer to the io interface
+//         int cmd - ioctl command
+//         void * arg - long * for IOCTL_GETRDAVAIL and IOCTL_GETWRAVAIL
+// Outputs: int - 0 or block size on success, -ENOTSUP for other commands
+// Description: Reports how much a read or write can transfer without blocking
+// Side Effects: none
+int uart_cntl(struct io * io, int cmd, void * arg) {
+    struct uart_device * const uart =
+        (void*)io - offsetof(struct uart_device, io);
+
+    switch (cmd) {
+    case IOCTL_GETBLKSZ:
+        return 1;
+    case IOCTL_GETRDAVAIL:
+        *(long *)arg = rbuf_count(&uart->rxbuf);
+        return 0;
+    case IOCTL_GETWRAVAIL:
+        *(long *)arg = rbuf_space(&uart->txbuf);
+        return 0;
+    default:
+        return -ENOTSUP;
+    }
+}
+
+// int uart_poll(struct io * io, struct pollwait * pw)
+// Inputs: struct io * io - pointer to the io interface
+//         struct pollwait * pw - waiter to register, or NULL
+// Outputs: int - POLLIN if received data is buffered, POLLOUT if the
+//          transmit buffer has room
+// Description: Readiness operation of the UART
+// Side Effects: _pw_ is woken by uart_wakeup until it is removed
+int uart_poll(struct io * io, struct pollwait * pw) {
+    struct uart_device * const uart =
+        (void*)io - offsetof(struct uart_device, io);
+    int events = 0;
+
+    if (!rbuf_empty(&uart->rxbuf))
+        events |= POLLIN;
+    if (!rbuf_full(&uart->txbuf))
+        events |= POLLOUT;
+
+    if (pw != NULL)
+        pollwait_add(&uart->pollers, pw);
 
+    return events;
 }
 
 // void uart_isr(int srcno, void * aux)
@@ -292,20 +399,26 @@ long uart_write(struct io * io, const void * buf, long len) {
 //         void * aux - pointer to the UART device
 // Outputs: none
 // Description: UART interrupt service routine
-// Side Effects: UART receive and transmit buffers are updated, condition variables are broadcasted to wake up waiting threads
+// Side Effects: UART receive and transmit buffers are updated, waking of waiting threads is deferred to uart_wakeup
 void uart_isr(int srcno, void * aux) {
     struct uart_device * const uart = aux;
+    uint_fast8_t lsr;
+    int n;
     
-    // If data is available and receive buffer isn’t full, Store data from RBR to receive buffer
-    if ((uart->regs->lsr & LSR_DR) && !rbuf_full(&uart->rxbuf)){
-        char c = uart->regs->rbr;
-        rbuf_putc(&uart->rxbuf, c);
+    // Drain the receive FIFO into the receive buffer while it has room
+    lsr = uart->regs->lsr;
+    if (lsr & LSR_OE)
+        uart->rxovrcnt += 1;
+
+    while ((lsr & LSR_DR) && !rbuf_full(&uart->rxbuf)) {
+        rbuf_putc(&uart->rxbuf, uart->regs->rbr);
+        lsr = uart->regs->lsr;
     }
 
-    // If transmit buffer isn’t empty, Write from transmit buffer to THR
-    if ((uart->regs->lsr & LSR_THRE) && !rbuf_empty(&uart->txbuf)){
-        char c = rbuf_getc(&uart->txbuf);
-        uart->regs->thr = c;
+    // THRE means the transmit FIFO is empty, so it takes a full FIFO's worth
+    if (lsr & LSR_THRE) {
+        for (n = 0; n < UART_FIFO_DEPTH && !rbuf_empty(&uart->txbuf); n++)
+            uart->regs->thr = rbuf_getc(&uart->txbuf);
     }
 
     // disable the corresponding interrupt if the transmit buffer is empty or receive buffer is full
@@ -314,16 +427,35 @@ void uart_isr(int srcno, void * aux) {
     if (rbuf_full(&uart->rxbuf))
         uart->regs->ier &= ~IER_DRIE;
 
-    // broadcast the condition variable to wake up the waiting threads
-    if (!rbuf_full(&uart->txbuf))
+    // wake up the waiting threads after the interrupt is done
+    intr_work_schedule(&uart->wakeup);
+}
+
+// void uart_wakeup(void * aux)
+// Inputs: void * aux - pointer to the UART device
+// Outputs: none
+// Description: Deferred part of uart_isr, runs with interrupts enabled
+// Side Effects: condition variables are broadcasted to wake up waiting threads
+//               once the amount they are waiting for is available
+void uart_wakeup(void * aux) {
+    struct uart_device * const uart = aux;
+
+    if (rbuf_space(&uart->txbuf) >= uart->txwant)
         condition_broadcast(&uart->tx_not_full);
-    if (!rbuf_empty(&uart->rxbuf))
+    if (rbuf_count(&uart->rxbuf) >= uart->rxwant)
         condition_broadcast(&uart->rx_not_empty);
+
+    // a poller only needs one byte or one free slot
+    if (!rbuf_empty(&uart->rxbuf) || !rbuf_full(&uart->txbuf))
+        pollwait_wake(uart->pollers);
 }
 
-void rbuf_init(struct ringbuf * rbuf) {
+void rbuf_init(struct ringbuf * rbuf, char * data, unsigned int size) {
+    assert ((size & (size - 1)) == 0);
     rbuf->hpos = 0;
     rbuf->tpos = 0;
+    rbuf->size = size;
+    rbuf->data = data;
 }
 
 int rbuf_empty(const struct ringbuf * rbuf) {
@@ -331,29 +463,85 @@ int rbuf_empty(const struct ringbuf * rbuf) {
 }
 
 int rbuf_full(const struct ringbuf * rbuf) {
-    return ((uint16_t)(rbuf->tpos - rbuf->hpos) == UART_RBUFSZ);
+    return (rbuf->tpos - rbuf->hpos == rbuf->size);
+}
+
+unsigned int rbuf_count(const struct ringbuf * rbuf) {
+    return (rbuf->tpos - rbuf->hpos);
+}
+
+unsigned int rbuf_space(const struct ringbuf * rbuf) {
+    return rbuf->size - (rbuf->tpos - rbuf->hpos);
 }
 
 void rbuf_putc(struct ringbuf * rbuf, char c) {
-    uint_fast16_t tpos;
+    unsigned int tpos;
 
     tpos = rbuf->tpos;
-    rbuf->data[tpos % UART_RBUFSZ] = c;
+    rbuf->data[tpos & (rbuf->size - 1)] = c;
     asm volatile ("" ::: "memory");
     rbuf->tpos = tpos + 1;
 }
 
 char rbuf_getc(struct ringbuf * rbuf) {
-    uint_fast16_t hpos;
+    unsigned int hpos;
     char c;
 
     hpos = rbuf->hpos;
-    c = rbuf->data[hpos % UART_RBUFSZ];
+    c = rbuf->data[hpos & (rbuf->size - 1)];
     asm volatile ("" ::: "memory");
     rbuf->hpos = hpos + 1;
     return c;
 }
 
+// Copies up to n bytes out of the ring, in at most two pieces (before and
+// after the wrap point). Returns the number of bytes copied.
+
+unsigned int rbuf_read(struct ringbuf * rbuf, void * buf, unsigned int n) {
+    unsigned int hpos = rbuf->hpos;
+    unsigned int idx = hpos & (rbuf->size - 1);
+    unsigned int cnt, first;
+
+    cnt = rbuf_count(rbuf);
+    if (n < cnt)
+        cnt = n;
+
+    first = rbuf->size - idx;
+    if (cnt < first)
+        first = cnt;
+
+    memcpy(buf, rbuf->data + idx, first);
+    memcpy(buf + first, rbuf->data, cnt - first);
+    asm volatile ("" ::: "memory");
+    rbuf->hpos = hpos + cnt;
+    return cnt;
+}
+
+// Copies up to n bytes into the ring, in at most two pieces. Returns the
+// number of bytes copied.
+
+unsigned int rbuf_write (
+    struct ringbuf * rbuf, const void * buf, unsigned int n)
+{
+    unsigned int tpos = rbuf->tpos;
+    unsigned int idx = tpos & (rbuf->size - 1);
+    unsigned int cnt, first;
+
+    cnt = rbuf_space(rbuf);
+    if (n < cnt)
+        cnt = n;
+
+    first = rbuf->size - idx;
+    if (cnt < first)
+        first = cnt;
+
+    memcpy(rbuf->data + idx, buf, first);
+    memcpy(rbuf->data, buf + first, cnt - first);
+    asm volatile ("" ::: "memory");
+    rbuf->tpos = tpos + cnt;
+    return cnt;
+}
+
 // The functions below provide polled uart input and output for the console.
 
 #define UART0 (*(volatile struct uart_regs*)UART0_MMIO_BASE)
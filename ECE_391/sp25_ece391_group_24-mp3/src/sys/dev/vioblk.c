@@ -25,6 +25,7 @@
 #include "ioimpl.h"
 #include "io.h"
 #include "conf.h"
+#include "memory.h"
 
 #include <limits.h>
 
@@ -43,6 +44,12 @@
 #define VIOBLK_BUFSZ 512
 #endif
 
+// Maximum number of data descriptors in one vectored request
+
+#ifndef VIOBLK_SEG_MAX
+#define VIOBLK_SEG_MAX 16
+#endif
+
 // INTERNAL CONSTANT DEFINITIONS
 //
 
@@ -67,7 +74,7 @@
 //
 
 static int vioblk_open(struct io ** ioptr, void * aux);
-static void vioblk_close(struct io * io);
+static int vioblk_close(struct io * io);
 
 static long vioblk_readat (
     struct io * io,
@@ -84,7 +91,31 @@ static long vioblk_writeat (
 static int vioblk_cntl (
     struct io * io, int cmd, void * arg);
 
+static long vioblk_preadv (
+    struct io * io,
+    unsigned long long pos,
+    const struct iovec * iov,
+    int iovcnt);
+
+static long vioblk_pwritev (
+    struct io * io,
+    unsigned long long pos,
+    const struct iovec * iov,
+    int iovcnt);
+
+struct vioblk_device;
+
+static long vioblk_xferv (
+    struct vioblk_device * blk,
+    uint32_t type,
+    unsigned long long pos,
+    const struct iovec * iov,
+    int iovcnt);
+
+static void * vioblk_dma_addr(uintptr_t addr, size_t * lenptr, int flags);
+
 static void vioblk_isr(int srcno, void * aux);
+static void vioblk_used_work(void * aux);
 
 // EXPORTED FUNCTION DEFINITIONS
 //
@@ -106,6 +137,7 @@ struct vioblk_device {
 
     struct {
         struct condition used_updated;
+        struct intr_work used_work; // deferred from vioblk_isr
         uint16_t last_used_idx;
 
         union {
@@ -119,6 +151,11 @@ struct vioblk_device {
         };
 
         struct virtq_desc desc[4];
+
+        // Indirect table for vectored requests: header, up to
+        // VIOBLK_SEG_MAX data descriptors, status.
+        struct virtq_desc seg_desc[VIOBLK_SEG_MAX + 2];
+
         struct vioblk_request_header virt_header;
         uint8_t status; 
     } vq;
@@ -152,7 +189,9 @@ void vioblk_attach(volatile struct virtio_mmio_regs * regs, int irqno) {
         .close = vioblk_close,
         .readat = vioblk_readat,
         .writeat = vioblk_writeat,
-        .cntl = vioblk_cntl
+        .cntl = vioblk_cntl,
+        .preadv = vioblk_preadv,
+        .pwritev = vioblk_pwritev
     };
 
     vioblk = (struct vioblk_device *) kmalloc(sizeof(struct vioblk_device));
@@ -249,7 +288,9 @@ int vioblk_open(struct io ** ioptr, void * aux){
 
     virtio_enable_virtq(vioblk->regs, 0);
 
+    intr_work_init(&vioblk->vq.used_work, vioblk_used_work, vioblk);
     enable_intr_source(vioblk->irqno, VIOBLK_INTR_PRIO, vioblk_isr, vioblk);
+    intr_set_affinity(vioblk->irqno, VIOBLK_INTR_HARTMASK);
 
     *ioptr = ioaddref(&vioblk->io);
     lock_init(&vioblk->lock);;
@@ -258,19 +299,20 @@ int vioblk_open(struct io ** ioptr, void * aux){
     return 0;
 }
 //==============================================================================================
-// void vioblk_close(struct io *io)
+// int vioblk_close(struct io *io)
 // inputs:  struct io * io :pointer to io
-// outputs: none
+// outputs: 0
 // description:
 //     closes the VirtIO block device
 //==============================================================================================
 
-void vioblk_close(struct io *io){
+int vioblk_close(struct io *io){
     struct vioblk_device * const blk =
     (void*)io - offsetof(struct vioblk_device, io);
     virtio_reset_virtq(blk->regs, 0);
     disable_intr_source(blk->irqno);
     kfree(blk->blkbuf);
+    return 0;
 }
 
 //==============================================================================================
@@ -281,7 +323,9 @@ void vioblk_close(struct io *io){
 //          long bufsz:number of bytes to read 
 // outputs: long :number of bytes read
 // description:
-//     Reads blocks from the device starting at the pos.
+//     Reads blocks from the device starting at the pos. The blocks go in one
+//     request however large the buffer (see vioblk_xferv), so a file system
+//     block larger than the device block costs a single round trip.
 //==============================================================================================
 
 long vioblk_readat(struct io*io, unsigned long long pos, void * buf,long bufsz){
@@ -292,37 +336,10 @@ long vioblk_readat(struct io*io, unsigned long long pos, void * buf,long bufsz){
     if( bufsz % blk->blksz != 0 || bufsz <= 0){
         return 0;
     }
-    lock_acquire(&blk->lock);
-    unsigned int blkno;
-   // unsigned int blkoff;
-    int pie;
-    char * new_buf = (char *)buf;
-    blkno = pos / blk->blksz;
-   // blkoff = pos % blk->blksz;
-    unsigned int blocks_need = bufsz / blk->blksz;
-
-    for(int i =0; i < blocks_need; i++){
-        blk->vq.virt_header.type = VIRTIO_BLK_T_IN; //read only
-        if(blkno + i > blk->blkcnt){
-            return blk->blksz * i;
-        }
-        blk->vq.status = 0xFF;
-        blk->vq.virt_header.sector = blkno+i;
-        blk->vq.desc[2].flags |= VIRTQ_DESC_F_WRITE;
-        blk->vq.avail.idx +=1;
-        virtio_notify_avail(blk->regs, 0);
-
-        pie = disable_interrupts();
-        while(blk->vq.last_used_idx != blk->vq.avail.idx){
-            condition_wait(&(blk->vq.used_updated));
-        }
-        restore_interrupts(pie);
-        memcpy((new_buf + (i * blk->blksz)), blk->blkbuf, blk->blksz);
-
-    }
-    lock_release(&blk->lock);
-    return bufsz;
-
+    // one request for all the blocks, straight into buf
+    struct iovec iov = { .base = buf, .len = bufsz };
+    long result = vioblk_xferv(blk, VIRTIO_BLK_T_IN, pos, &iov, 1);
+    return (result > 0) ? result : 0;
 }
 //==============================================================================================
 // int vioblk_cntl(struct io * io, int cmd, void * arg)
@@ -358,7 +375,9 @@ int vioblk_cntl(struct io *io, int cmd, void *arg) {
 //          void * aux :pointer to the vioblk_device
 // outputs: none
 // description:
-//     Interrupt service routine (ISR) for the VirtIO block device.
+//     Interrupt service routine (ISR) for the VirtIO block device. Only
+//     acknowledges the interrupt; the used ring is processed by
+//     vioblk_used_work after the interrupt returns.
 //==============================================================================================
 
 void vioblk_isr(int srcno, void *aux){
@@ -372,6 +391,21 @@ void vioblk_isr(int srcno, void *aux){
     
     dev->regs->interrupt_ack = interrupt_status;
     
+    intr_work_schedule(&dev->vq.used_work);
+}
+
+//==============================================================================================
+// void vioblk_used_work(void * aux)
+// Inputs:  void * aux :pointer to the vioblk_device
+// outputs: none
+// description:
+//     Deferred part of vioblk_isr. Consumes the completed request from the
+//     used ring and wakes up the thread waiting for it.
+//==============================================================================================
+
+void vioblk_used_work(void * aux){
+    struct vioblk_device * dev = aux;
+
     __sync_synchronize();
     
     if(dev->vq.last_used_idx != dev->vq.used.idx){
@@ -391,31 +425,206 @@ long vioblk_writeat(struct io *io, unsigned long long pos, const void *buf, long
     if( len % blk->blksz != 0 || len <= 0){
         return 0;
     }
-    lock_acquire(&blk->lock);
-    unsigned int blkno;
-   // unsigned int blkoff;
+    // one request for all the blocks, straight from buf
+    struct iovec iov = { .base = (void *)buf, .len = len };
+    long result = vioblk_xferv(blk, VIRTIO_BLK_T_OUT, pos, &iov, 1);
+    return (result > 0) ? result : 0;
+}
+//==============================================================================================
+// long vioblk_preadv(struct io * io, unsigned long long pos, const struct iovec * iov, int iovcnt)
+// inputs:  struct io * io: pointer to the device I/O interface
+//          unsigned long long pos: byte offset, multiple of the block size
+//          const struct iovec * iov: segments to fill
+//          int iovcnt: number of segments
+// outputs: long :number of bytes read, or negative error code
+// description:
+//     Reads consecutive blocks directly into the segments (no bounce buffer).
+//==============================================================================================
+
+long vioblk_preadv(struct io * io, unsigned long long pos, const struct iovec * iov, int iovcnt){
+    struct vioblk_device * const blk = (void*)io - offsetof(struct vioblk_device, io);
+    return vioblk_xferv(blk, VIRTIO_BLK_T_IN, pos, iov, iovcnt);
+}
+
+//==============================================================================================
+// long vioblk_pwritev(struct io * io, unsigned long long pos, const struct iovec * iov, int iovcnt)
+// inputs:  struct io * io: pointer to the device I/O interface
+//          unsigned long long pos: byte offset, multiple of the block size
+//          const struct iovec * iov: segments to write
+//          int iovcnt: number of segments
+// outputs: long :number of bytes written, or negative error code
+// description:
+//     Writes the segments directly to consecutive blocks (no bounce buffer).
+//==============================================================================================
+
+long vioblk_pwritev(struct io * io, unsigned long long pos, const struct iovec * iov, int iovcnt){
+    struct vioblk_device * const blk = (void*)io - offsetof(struct vioblk_device, io);
+    return vioblk_xferv(blk, VIRTIO_BLK_T_OUT, pos, iov, iovcnt);
+}
+
+//==============================================================================================
+// long vioblk_xferv(struct vioblk_device * blk, uint32_t type, unsigned long long pos,
+//                   const struct iovec * iov, int iovcnt)
+// inputs:  struct vioblk_device * blk: the device
+//          uint32_t type: VIRTIO_BLK_T_IN or VIRTIO_BLK_T_OUT
+//          unsigned long long pos: byte offset, multiple of the block size
+//          const struct iovec * iov: segments to transfer
+//          int iovcnt: number of segments
+// outputs: long :number of bytes transferred, or negative error code
+// description:
+//     Builds one request per VIOBLK_SEG_MAX pieces of the vector as a
+//     descriptor chain in seg_desc: header, one descriptor per physically
+//     contiguous piece, status. Each request covers whole blocks; a piece
+//     that does not complete a block is carried over to the next request.
+//     Stops early (short count) at the end of the device or if the remaining
+//     data is less than one block.
+//==============================================================================================
+
+long vioblk_xferv(struct vioblk_device * blk, uint32_t type, unsigned long long pos, const struct iovec * iov, int iovcnt){
+    struct virtq_desc * const sd = blk->vq.seg_desc;
+    const uint16_t dflags = (type == VIRTIO_BLK_T_IN) ? VIRTQ_DESC_F_WRITE : 0;
+    const int pflags = (type == VIRTIO_BLK_T_IN) ? (PTE_W | PTE_U) : (PTE_R | PTE_U);
+    struct { int seg; size_t off; } src[VIOBLK_SEG_MAX]; // start of each data descriptor
+    uint64_t saved_addr;
+    uint32_t saved_len;
+    unsigned long long blkno;
+    long result = 0;
+    long total = 0;
+    long len;
+    size_t off = 0;
+    size_t n;
+    void * pa;
+    int seg = 0;
+    int cnt;
     int pie;
-    char * new_buf = (char *)buf;
+
+    if (pos % blk->blksz != 0) {
+        return -EINVAL;
+    }
     blkno = pos / blk->blksz;
-   // blkoff = pos % blk->blksz;
-    unsigned int blocks_need = len / blk->blksz;
 
-    for(int i =0; i < blocks_need; i++){
-        blk->vq.virt_header.type = VIRTIO_BLK_T_OUT; // write only
-        if(blkno + i > blk->blkcnt){
-            return blk->blksz * i;
+    lock_acquire(&blk->lock);
+
+    while (seg < iovcnt) {
+        // one data descriptor per physically contiguous piece
+        cnt = 0;
+        len = 0;
+        while (seg < iovcnt && cnt < VIOBLK_SEG_MAX) {
+            if (off == iov[seg].len) {
+                seg++;
+                off = 0;
+                continue;
+            }
+            n = iov[seg].len - off;
+            pa = vioblk_dma_addr((uintptr_t)iov[seg].base + off, &n, pflags);
+            if (pa == NULL) {
+                result = -EINVAL;
+                break;
+            }
+            src[cnt].seg = seg;
+            src[cnt].off = off;
+            sd[1+cnt].addr = (uint64_t)pa;
+            sd[1+cnt].len = n;
+            sd[1+cnt].flags = VIRTQ_DESC_F_NEXT | dflags;
+            sd[1+cnt].next = 2+cnt;
+            cnt++;
+            len += n;
+            off += n;
+        }
+
+        // requests are whole blocks; give back the partial block at the end
+        n = len % blk->blksz;
+        while (n > 0) {
+            seg = src[cnt-1].seg;
+            if (sd[cnt].len <= n) {
+                off = src[cnt-1].off;
+                n -= sd[cnt].len;
+                len -= sd[cnt].len;
+                cnt--;
+            } else {
+                sd[cnt].len -= n;
+                off = src[cnt-1].off + sd[cnt].len;
+                len -= n;
+                n = 0;
+            }
         }
-        blk->vq.virt_header.sector = blkno+i;
-        blk->vq.desc[2].flags &= ~VIRTQ_DESC_F_WRITE;
+
+        if (len == 0 || blkno + len / blk->blksz > blk->blkcnt) {
+            break;
+        }
+
+        sd[0].addr = (uint64_t)&blk->vq.virt_header;
+        sd[0].len = sizeof(blk->vq.virt_header);
+        sd[0].flags = VIRTQ_DESC_F_NEXT;
+        sd[0].next = 1;
+
+        sd[cnt+1].addr = (uint64_t)&blk->vq.status;
+        sd[cnt+1].len = sizeof(blk->vq.status);
+        sd[cnt+1].flags = VIRTQ_DESC_F_WRITE;
+        sd[cnt+1].next = 0;
+
+        blk->vq.virt_header.type = type;
+        blk->vq.virt_header.sector = blkno;
+        blk->vq.status = 0xFF;
+
+        // point the request descriptor at the vectored table for this request
+        saved_addr = blk->vq.desc[0].addr;
+        saved_len = blk->vq.desc[0].len;
+        blk->vq.desc[0].addr = (uint64_t)sd;
+        blk->vq.desc[0].len = (cnt + 2) * sizeof(struct virtq_desc);
+
         blk->vq.avail.idx +=1;
-        memcpy(blk->blkbuf, (new_buf + (i * blk->blksz)), blk->blksz);
         virtio_notify_avail(blk->regs, 0);
         pie = disable_interrupts();
-        while(blk->vq.avail.idx != blk->vq.last_used_idx){
+        while(blk->vq.last_used_idx != blk->vq.avail.idx){
             condition_wait(&(blk->vq.used_updated));
         }
         restore_interrupts(pie);
+
+        blk->vq.desc[0].addr = saved_addr;
+        blk->vq.desc[0].len = saved_len;
+
+        if (blk->vq.status != 0) {
+            result = -EIO;
+            break;
+        }
+
+        total += len;
+        blkno += len / blk->blksz;
+
+        if (result != 0) {
+            break;
+        }
     }
+
     lock_release(&blk->lock);
-    return len;
-}
\ No newline at end of file
+
+    if (total == 0 && result == 0 && seg < iovcnt) {
+        result = -EINVAL; // less than one block, or starts past the end
+    }
+    return (total > 0) ? total : result;
+}
+
+//==============================================================================================
+// void * vioblk_dma_addr(uintptr_t addr, size_t * lenptr, int flags)
+// inputs:  uintptr_t addr: kernel or user virtual address of a buffer
+//          size_t * lenptr: in: bytes wanted, out: bytes contiguous at the result
+//          int flags: PTE flags a user mapping must have
+// outputs: void * :physical address, or NULL if the buffer is not mapped
+// description:
+//     RAM is identity mapped in the kernel, so kernel buffers are used as is.
+//     User buffers are translated a page at a time.
+//==============================================================================================
+
+void * vioblk_dma_addr(uintptr_t addr, size_t * lenptr, int flags){
+    if (RAM_START_PMA <= addr && addr < RAM_END_PMA) {
+        if (RAM_END_PMA - addr < *lenptr) {
+            *lenptr = RAM_END_PMA - addr;
+        }
+        return (void *)addr;
+    }
+    if (PAGE_SIZE - addr % PAGE_SIZE < *lenptr) {
+        *lenptr = PAGE_SIZE - addr % PAGE_SIZE;
+    }
+    return user_to_phys((void *)addr, flags);
+}
@@ -68,15 +68,17 @@ struct viorng_device {
     unsigned int bufcnt;
     char buf[VIORNG_BUFSZ];
     struct condition buf_not_empty;
+    struct intr_work used_work; // deferred from viorng_isr
 };
 
 // INTERNAL FUNCTION DECLARATIONS
 //
 
 static int viorng_open(struct io ** ioptr, void * aux);
-static void viorng_close(struct io * io);
+static int viorng_close(struct io * io);
 static long viorng_read(struct io * io, void * buf, long bufsz);
 static void viorng_isr(int irqno, void * aux);
+static void viorng_used_work(void * aux);
 
 // EXPORTED FUNCTION DEFINITIONS
 //
@@ -173,7 +175,9 @@ int viorng_open(struct io ** ioptr, void * aux) {
     
     
     // enable interrupt
+    intr_work_init(&viorng->used_work, viorng_used_work, viorng);
     enable_intr_source(viorng->irqno, VIORNG_IRQ_PRIO, viorng_isr, viorng);
+    intr_set_affinity(viorng->irqno, VIORNG_INTR_HARTMASK);
 
     // IO operations returned
     *ioptr = ioaddref(&viorng->io);
@@ -184,12 +188,12 @@ int viorng_open(struct io ** ioptr, void * aux) {
     return 0;
 }
 
-// void viorng_close(struct io * io)
+// int viorng_close(struct io * io)
 // Inputs: struct io * io - pointer to the io structure
-// Outputs: none
+// Outputs: 0
 // Description: Closes the VirtIO rng device
 // Side Effects: interrupts are disabled and the device is unregistered
-void viorng_close(struct io * io) {
+int viorng_close(struct io * io) {
     struct viorng_device * viorng = (void*)io - offsetof(struct viorng_device, io);
 
     trace("%s()", __func__);
@@ -198,6 +202,7 @@ void viorng_close(struct io * io) {
     // disable interrupt and unregister device
     disable_intr_source(viorng->irqno);
     virtio_reset_virtq(viorng->regs, 0);
+    return 0;
 }
 
 // long viorng_read(struct io * io, void * buf, long bufsz)
@@ -264,34 +269,43 @@ long viorng_read(struct io * io, void * buf, long bufsz) {
 //         void * aux - pointer to the device
 // Outputs: none
 // Description: VirtIO rng device interrupt service routine
-// Side Effects: update the buffer count and signal the condition variable
-//               acknowledge the interrupt
+// Side Effects: acknowledge the interrupt and schedule viorng_used_work
 void viorng_isr(int irqno, void * aux) {
     struct viorng_device * viorng = aux;
 
     uint32_t status = viorng->regs->interrupt_status;
 
-    // check bit 0 for device buffer usage, if yes, check if the device has serviced a request
-    if (status & (1 << 0)) {
-        // Check if the device has serviced a request
-        if (viorng->vq.last_used_idx != viorng->vq.used.idx) {
-            uint16_t idx = viorng->vq.used.ring[viorng->vq.last_used_idx % 1].id;
+    // check bit 0 for device buffer usage, if yes, process the used ring later
+    if (status & (1 << 0))
+        intr_work_schedule(&viorng->used_work);
 
-            // Check if the descriptor is the one we submitted
-            if (idx == 0) {
-                // Update the buffer count
-                viorng->bufcnt = viorng->vq.used.ring[viorng->vq.last_used_idx % 1].len;
+    // acknowledge the interrupt
+    viorng->regs->interrupt_ack = status & (1 << 0);
 
-                // Update the last used index
-                viorng->vq.last_used_idx++;
+}
 
-                // Signal the condition variable
-                condition_broadcast(&viorng->buf_not_empty);
-            }
-        }
-    }
+// void viorng_used_work(void * aux)
+// Inputs: void * aux - pointer to the device
+// Outputs: none
+// Description: Deferred part of viorng_isr, runs with interrupts enabled
+// Side Effects: update the buffer count and signal the condition variable
+void viorng_used_work(void * aux) {
+    struct viorng_device * viorng = aux;
 
-    // acknowledge the interrupt
-    viorng->regs->interrupt_ack = status & (1 << 0);
+    // Check if the device has serviced a request
+    if (viorng->vq.last_used_idx != viorng->vq.used.idx) {
+        uint16_t idx = viorng->vq.used.ring[viorng->vq.last_used_idx % 1].id;
+
+        // Check if the descriptor is the one we submitted
+        if (idx == 0) {
+            // Update the buffer count
+            viorng->bufcnt = viorng->vq.used.ring[viorng->vq.last_used_idx % 1].len;
 
-}
\ No newline at end of file
+            // Update the last used index
+            viorng->vq.last_used_idx++;
+
+            // Signal the condition variable
+            condition_broadcast(&viorng->buf_not_empty);
+        }
+    }
+}
@@ -101,95 +101,401 @@ struct elf64_phdr {
 // ELF header e_machine values (short list)
 
 #define  EM_RISCV   243
+
+// Number of read-only executable segments kept in the text cache
+
+#ifndef ELF_TEXT_CACHE_CNT
+#define ELF_TEXT_CACHE_CNT 8
+#endif
+
+// A cached segment. The cache holds one reference on each page (see
+// get_phys_page) and every process mapping the segment holds another, so the
+// pages outlive eviction while still in use.
+
+struct text_cache_entry {
+    unsigned long long ino;  // file identity (IOCTL_GETINO)
+    uint64_t offset;         // p_offset of the segment
+    uint64_t filesz;         // p_filesz of the segment
+    uint64_t memsz;          // p_memsz of the segment
+    void * pages;            // first of pagecnt pages, NULL if entry unused
+    unsigned int pagecnt;
+    unsigned long stamp;     // last use, for LRU replacement
+};
+
+static struct text_cache_entry text_cache[ELF_TEXT_CACHE_CNT];
+static unsigned long text_cache_clock;
+
+// Maximum number of program headers elf_load accepts. The ELF header and a
+// program header table of this size are read with a single request.
+
+#ifndef ELF_PHDR_MAX
+#define ELF_PHDR_MAX 16
+#endif
+
+// A PT_LOAD segment being loaded. The segment is read into _pages_, which are
+// mapped at the page containing p_vaddr once every segment has been read.
+
+struct elf_seg {
+    const struct elf64_phdr * phdr;
+    void * pages;           // first of pagecnt pages, NULL if not allocated
+    unsigned int pagecnt;
+    int perm;               // PTE flags of the mapping
+    struct text_cache_entry * cached; // text cache hit, nothing to read
+    char cache;             // insert into the text cache after reading
+};
+
+static void sort_segs(struct elf_seg * segs, int cnt);
+static int read_segs(struct io * elfio, struct elf_seg * segs, int cnt);
+static void zero_range(void * p, size_t n);
+
+static struct text_cache_entry * text_cache_lookup (
+    unsigned long long ino, const struct elf64_phdr * phdr);
+
+static struct text_cache_entry * text_cache_insert (
+    unsigned long long ino, const struct elf64_phdr * phdr,
+    void * pages, unsigned int pagecnt);
+
+static void text_cache_evict(struct text_cache_entry * ent);
+
 //==============================================================================================
 // int elf_load(struct io * elfio, void (**eptr)(void))
 // inputs:struct io * elfio:pointer to an I/O stream 
 //          void (**eptr)(void):pointer to a function pointer for entry point
 // outputs: int: 0 on success,or a negative error code on failure:
 //             :EINVAL    inputs or elf header is invalid
-//             :100       fail to read the ELF header
-//             :1         fail to seek ph offset
-//             :2         fail to read a ph
+//             :ENOMEM    out of physical pages
+//             :2         fail to read the program headers
 //             :3         not in the range of valid address
-//             :4         fail to seek a segament offset
 //             :5         fail to read segament content
 // description: use io to read a ELF file,loads PT_LOAD segments into memory, and stores the entry point address.
+//              - reads the ELF header and program header table in one request
+//              - validates every PT_LOAD segment before loading any of them
+//              - reads segments in file offset order straight into their pages,
+//                one request per run of contiguous segments
+//              - maps read-only text from the text cache
 //===============================================================================================
 
 int elf_load(struct io * elfio, void (**eptr)(void)) {
-    // FIX ME
-    struct elf64_ehdr ehdr;
+    union {
+        struct elf64_ehdr ehdr;
+        char bytes[sizeof(struct elf64_ehdr) + ELF_PHDR_MAX * sizeof(struct elf64_phdr)];
+    } hdr;
+    struct elf64_phdr phtab[ELF_PHDR_MAX];
+    struct elf_seg segs[ELF_PHDR_MAX];
+    const struct elf64_ehdr * ehdr = &hdr.ehdr;
+    const unsigned long phsz = ELF_PHDR_MAX * sizeof(struct elf64_phdr);
+    unsigned long long ino;
+    unsigned long long phend;
+    int cacheable;
+    int segcnt = 0;
+    int result;
+    long len;
+    int i;
 
     if(!elfio || !eptr){
         return -EINVAL;
     }
 
-    if(ioreadat(elfio, 0, &ehdr, sizeof(ehdr)) != sizeof(ehdr)){
+    // only files with an identity can share cached text
+    cacheable = (ioctl(elfio, IOCTL_GETINO, &ino) == 0);
+
+    // The program header table normally follows the ELF header, so one read
+    // usually gets both. A short read just means the file is small.
+
+    len = ioreadat(elfio, 0, hdr.bytes, sizeof(hdr.bytes));
+    if (len < (long)sizeof(struct elf64_ehdr))
         return -EINVAL;
-    }
-        
 
-    if(ehdr.e_ident[0]!=0x7f||ehdr.e_ident[1]!='E'||ehdr.e_ident[2]!='L'||ehdr.e_ident[3]!='F'){
+    if(ehdr->e_ident[0]!=0x7f||ehdr->e_ident[1]!='E'||ehdr->e_ident[2]!='L'||ehdr->e_ident[3]!='F'){
         return -EINVAL;
     }
-        
 
-    if (ehdr.e_ident[EI_CLASS] != ELFCLASS64 ||
-        ehdr.e_ident[EI_DATA] != ELFDATA2LSB ||
-        ehdr.e_ident[EI_VERSION] != EV_CURRENT)
+    if (ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+        ehdr->e_ident[EI_DATA] != ELFDATA2LSB ||
+        ehdr->e_ident[EI_VERSION] != EV_CURRENT)
         return -EINVAL;
 
-    if (ehdr.e_machine!=EM_RISCV||ehdr.e_type!=ET_EXEC||ehdr.e_entry == 0)
+    if (ehdr->e_machine!=EM_RISCV||ehdr->e_type!=ET_EXEC||ehdr->e_entry == 0)
         return -EINVAL;
 
-    *eptr = (void (*)(void))ehdr.e_entry;
+    if (ehdr->e_phentsize != sizeof(struct elf64_phdr) ||
+        ehdr->e_phnum > ELF_PHDR_MAX)
+        return -EINVAL;
 
-    for (int i = 0; i < ehdr.e_phnum; ++i) {
-        struct elf64_phdr phdr;
-        uint64_t offset = ehdr.e_phoff + i * ehdr.e_phentsize;
+    phend = ehdr->e_phoff + ehdr->e_phnum * sizeof(struct elf64_phdr);
 
-        // if (ioseek(elfio, offset) < 0)
-        //     return -1;
+    if (ehdr->e_phoff <= (unsigned long long)len &&
+        phend <= (unsigned long long)len)
+        memcpy(phtab, hdr.bytes + ehdr->e_phoff, phend - ehdr->e_phoff);
+    else if (ioreadat(elfio, ehdr->e_phoff, phtab, phsz) <
+        (long)(phend - ehdr->e_phoff))
+        return -2;
 
-        // if (ioread(elfio, &phdr, sizeof(phdr)) != sizeof(phdr))
-        //     return -2;
+    *eptr = (void (*)(void))ehdr->e_entry;
 
-        if (ioreadat(elfio, offset, &phdr, sizeof(phdr)) != sizeof(phdr))
-            return -2;
+    // Validate all segments before allocating anything
 
-        if (phdr.p_type != PT_LOAD)
+    for (i = 0; i < ehdr->e_phnum; i++) {
+        const struct elf64_phdr * phdr = &phtab[i];
+
+        if (phdr->p_type != PT_LOAD)
             continue;
 
-        if (phdr.p_vaddr < UMEM_START_VMA || phdr.p_vaddr + phdr.p_memsz > UMEM_END_VMA)
+        if (phdr->p_vaddr < UMEM_START_VMA || phdr->p_vaddr + phdr->p_memsz > UMEM_END_VMA ||
+            phdr->p_vaddr + phdr->p_memsz < phdr->p_vaddr)
             return -3;
 
-        // memset((void*)(uintptr_t)phdr.p_vaddr, 0, phdr.p_memsz);
+        if (phdr->p_filesz > phdr->p_memsz)
+            return -EINVAL;
 
-        // void * buf = alloc_and_map_range(phdr.p_vaddr, phdr.p_memsz, PTE_R | PTE_W | PTE_U);
-        // int perm = PTE_U | PTE_V | PTE_A | PTE_D | PTE_X; 
-        // kprintf("Hardcoded perm = 0x%x\n", perm); // Should be 0xd9
-        int perm = PTE_U;
-        if (phdr.p_flags & PF_R) perm |= PTE_R;
-        if (phdr.p_flags & PF_W) perm |= PTE_W;
-        if (phdr.p_flags & PF_X) perm |= PTE_X;
-        int size = ROUND_UP(phdr.p_memsz, PAGE_SIZE);
+        segs[segcnt].phdr = phdr;
+        segs[segcnt].pages = NULL;
+        segs[segcnt].pagecnt = ROUND_UP(phdr->p_vaddr % PAGE_SIZE + phdr->p_memsz, PAGE_SIZE) / PAGE_SIZE;
+        segs[segcnt].cached = NULL;
+        segs[segcnt].cache = 0;
 
-        void * buf = alloc_phys_pages(size/PAGE_SIZE);
-        // void * buf = alloc_and_map_range(phdr.p_vaddr, phdr.p_memsz, perm);
-        if (ioreadat(elfio, phdr.p_offset, buf, phdr.p_filesz) != phdr.p_filesz)
-            return -5;
+        segs[segcnt].perm = PTE_U;
+        if (phdr->p_flags & PF_R) segs[segcnt].perm |= PTE_R;
+        if (phdr->p_flags & PF_W) segs[segcnt].perm |= PTE_W;
+        if (phdr->p_flags & PF_X) segs[segcnt].perm |= PTE_X;
 
-        map_range(phdr.p_vaddr, phdr.p_memsz, buf, perm);        
+        segcnt += 1;
+    }
 
-        // if (i == 1)
-        //     *eptr += (uintptr_t)buf;
-        // kprintf("Mapping [0x%lx - 0x%lx] with perm 0x%x\n", 
-        //     phdr.p_vaddr, phdr.p_vaddr + phdr.p_memsz, perm);
+    sort_segs(segs, segcnt);
 
-        if (phdr.p_memsz > phdr.p_filesz) {
-            memset((void*)(uintptr_t)(phdr.p_vaddr + phdr.p_filesz), 0,
-                   phdr.p_memsz - phdr.p_filesz);
+    // Find cached text and allocate pages for everything else
+
+    for (i = 0; i < segcnt; i++) {
+        const struct elf64_phdr * phdr = segs[i].phdr;
+
+        // read-only text is mapped from the text cache
+        if (cacheable && (phdr->p_flags & PF_X) && !(phdr->p_flags & PF_W) &&
+            phdr->p_vaddr % PAGE_SIZE == 0)
+        {
+            segs[i].cached = text_cache_lookup(ino, phdr);
+            segs[i].cache = (segs[i].cached == NULL);
+        }
+
+        if (segs[i].cached == NULL) {
+            segs[i].pages = alloc_phys_pages(segs[i].pagecnt);
+            if (segs[i].pages == NULL) {
+                result = -ENOMEM;
+                goto fail;
+            }
         }
     }
+
+    result = read_segs(elfio, segs, segcnt);
+    if (result < 0)
+        goto fail;
+
+    for (i = 0; i < segcnt; i++) {
+        const struct elf64_phdr * phdr = segs[i].phdr;
+        const uintptr_t vma = ROUND_DOWN(phdr->p_vaddr, PAGE_SIZE);
+        const size_t pgoff = phdr->p_vaddr % PAGE_SIZE;
+
+        if (segs[i].pages != NULL) {
+            // Clear everything in the pages not read from the file: the
+            // head of the first page and the BSS tail.
+
+            zero_range(segs[i].pages, pgoff);
+            zero_range(segs[i].pages + pgoff + phdr->p_filesz,
+                segs[i].pagecnt * PAGE_SIZE - pgoff - phdr->p_filesz);
+        }
+
+        if (segs[i].cache) {
+            // Another process may have loaded the same segment while we were
+            // waiting for the read.
+
+            segs[i].cached = text_cache_lookup(ino, phdr);
+            if (segs[i].cached == NULL)
+                segs[i].cached = text_cache_insert(ino, phdr,
+                    segs[i].pages, segs[i].pagecnt);
+            else
+                free_phys_pages(segs[i].pages, segs[i].pagecnt);
+            segs[i].pages = NULL;
+        }
+
+        if (segs[i].cached != NULL) {
+            segs[i].cached->stamp = ++text_cache_clock;
+            for (unsigned int k = 0; k < segs[i].pagecnt; k++) {
+                map_shared_page(vma + k * PAGE_SIZE,
+                    segs[i].cached->pages + k * PAGE_SIZE, segs[i].perm);
+            }
+        } else {
+            map_range(vma, segs[i].pagecnt * PAGE_SIZE,
+                segs[i].pages, segs[i].perm);
+        }
+    }
+
     return 0;
-}
\ No newline at end of file
+
+fail:
+    for (i = 0; i < segcnt; i++) {
+        if (segs[i].pages != NULL)
+            free_phys_pages(segs[i].pages, segs[i].pagecnt);
+    }
+
+    return result;
+}
+
+void elf_cache_invalidate(unsigned long long ino) {
+    for (int i = 0; i < ELF_TEXT_CACHE_CNT; i++) {
+        if (text_cache[i].pages != NULL && text_cache[i].ino == ino)
+            text_cache_evict(&text_cache[i]);
+    }
+}
+
+// Insertion sort by file offset; there are at most ELF_PHDR_MAX segments.
+
+static void sort_segs(struct elf_seg * segs, int cnt) {
+    struct elf_seg tmp;
+    int i, j;
+
+    for (i = 1; i < cnt; i++) {
+        tmp = segs[i];
+        for (j = i; j > 0 && segs[j-1].phdr->p_offset > tmp.phdr->p_offset; j--)
+            segs[j] = segs[j-1];
+        segs[j] = tmp;
+    }
+}
+
+//==============================================================================================
+// int read_segs(struct io * elfio, struct elf_seg * segs, int cnt)
+// inputs: struct io * elfio: the executable
+//         struct elf_seg * segs: segments sorted by file offset
+//         int cnt: number of segments
+// outputs: int: 0 on success, -5 if a segment cannot be read
+// description: reads the file contents of every segment that has pages into
+//              them. Segments that are contiguous in the file are read with a
+//              single vectored request, so data sharing a block with the end
+//              of the previous segment is not read twice.
+//===============================================================================================
+
+static int read_segs(struct io * elfio, struct elf_seg * segs, int cnt) {
+    struct iovec iov[IOV_MAX];
+    unsigned long long pos = 0;
+    unsigned long long end = 0;
+    int iovcnt = 0;
+    int i;
+
+    for (i = 0; i <= cnt; i++) {
+        const struct elf64_phdr * phdr = (i < cnt) ? segs[i].phdr : NULL;
+
+        if (phdr != NULL && (segs[i].pages == NULL || phdr->p_filesz == 0))
+            continue;
+
+        // Issue the pending run unless this segment extends it
+
+        if (iovcnt != 0 && (phdr == NULL || iovcnt == IOV_MAX ||
+            phdr->p_offset != end))
+        {
+            if (iopreadv(elfio, pos, iov, iovcnt) != (long)(end - pos))
+                return -5;
+            iovcnt = 0;
+        }
+
+        if (phdr == NULL)
+            break;
+
+        if (iovcnt == 0)
+            pos = phdr->p_offset;
+
+        iov[iovcnt].base = segs[i].pages + phdr->p_vaddr % PAGE_SIZE;
+        iov[iovcnt].len = phdr->p_filesz;
+        iovcnt += 1;
+        end = phdr->p_offset + phdr->p_filesz;
+    }
+
+    return 0;
+}
+
+// Zeroes n bytes at p. Whole aligned pages in the range are cleared a
+// doubleword at a time; memset only handles the partial pages at the ends.
+
+static void zero_range(void * p, size_t n) {
+    uintptr_t start = (uintptr_t)p;
+    uintptr_t end = start + n;
+    uintptr_t pgstart = ROUND_UP(start, PAGE_SIZE);
+    uintptr_t pgend = ROUND_DOWN(end, PAGE_SIZE);
+
+    if (pgstart >= pgend) {
+        memset(p, 0, n);
+        return;
+    }
+
+    memset(p, 0, pgstart - start);
+
+    for (uint64_t * q = (uint64_t *)pgstart; q < (uint64_t *)pgend; q += 4) {
+        q[0] = 0;
+        q[1] = 0;
+        q[2] = 0;
+        q[3] = 0;
+    }
+
+    memset((void *)pgend, 0, end - pgend);
+}
+
+static struct text_cache_entry * text_cache_lookup (
+    unsigned long long ino, const struct elf64_phdr * phdr)
+{
+    struct text_cache_entry * ent;
+
+    for (ent = text_cache; ent < text_cache + ELF_TEXT_CACHE_CNT; ent++) {
+        if (ent->pages != NULL && ent->ino == ino &&
+            ent->offset == phdr->p_offset &&
+            ent->filesz == phdr->p_filesz &&
+            ent->memsz == phdr->p_memsz)
+        {
+            return ent;
+        }
+    }
+
+    return NULL;
+}
+
+// Puts _pages_ in a free entry, or in place of the least recently used one.
+// The cache takes its own reference on each page.
+
+static struct text_cache_entry * text_cache_insert (
+    unsigned long long ino, const struct elf64_phdr * phdr,
+    void * pages, unsigned int pagecnt)
+{
+    struct text_cache_entry * victim = &text_cache[0];
+    struct text_cache_entry * ent;
+
+    for (ent = text_cache; ent < text_cache + ELF_TEXT_CACHE_CNT; ent++) {
+        if (ent->pages == NULL) {
+            victim = ent;
+            break;
+        }
+        if (ent->stamp < victim->stamp)
+            victim = ent;
+    }
+
+    if (victim->pages != NULL)
+        text_cache_evict(victim);
+
+    victim->ino = ino;
+    victim->offset = phdr->p_offset;
+    victim->filesz = phdr->p_filesz;
+    victim->memsz = phdr->p_memsz;
+    victim->pages = pages;
+    victim->pagecnt = pagecnt;
+
+    for (unsigned int k = 0; k < pagecnt; k++)
+        get_phys_page(pages + k * PAGE_SIZE);
+
+    return victim;
+}
+
+// Drops the cache's references; pages still mapped somewhere stay allocated.
+
+static void text_cache_evict(struct text_cache_entry * ent) {
+    for (unsigned int k = 0; k < ent->pagecnt; k++)
+        put_phys_page(ent->pages + k * PAGE_SIZE);
+
+    ent->pages = NULL;
+    ent->pagecnt = 0;
+}
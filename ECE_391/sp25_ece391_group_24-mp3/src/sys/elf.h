@@ -11,4 +11,11 @@
 
 extern int elf_load(struct io * elfio, void (**eptr)(void));
 
+// elf_load keeps the pages of read-only executable segments in a small cache
+// keyed by (inode, file offset) and maps them shared into every process that
+// loads the same file. The file system calls elf_cache_invalidate() when the
+// contents of inode _ino_ change or the file is deleted.
+
+extern void elf_cache_invalidate(unsigned long long ino);
+
 #endif // _ELF_H_
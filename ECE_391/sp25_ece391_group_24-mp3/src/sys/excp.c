@@ -12,6 +12,7 @@
 #include "console.h"
 #include "assert.h"
 #include "string.h"
+#include "smp.h"
 
 #include <stddef.h>
 
@@ -29,6 +30,13 @@ extern void handle_umode_exception(unsigned int cause, struct trap_frame * tfr);
 
 extern void handle_syscall(struct trap_frame * tfr); // syscall.c
 
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+// Handles a U mode exception with the kernel lock held (see below).
+
+static void dispatch_umode_exception(unsigned int cause, struct trap_frame * tfr);
+
 // INTERNAL GLOBAL VARIABLES
 //
 
@@ -93,12 +101,20 @@ void handle_smode_exception(unsigned int cause, struct trap_frame * tfr) {
 //         struct trap_frame *tfr: pointer to the trap frame 
 // outputs: none
 // description:
-//     handles exceptions occur in U-mode.
+//     handles exceptions occur in U-mode. Takes the kernel lock for the
+//     duration of the handler; it is released on the hart that returns to
+//     U mode, which need not be the hart that took the trap.
 //     - page faults: handle_umode_page_fault().
 //     - system calls: handle_syscall().
 //     - unhandled exceptions: prints an error message .
 //==============================================================================================
 void handle_umode_exception(unsigned int cause, struct trap_frame * tfr) {
+    kernel_lock();
+    dispatch_umode_exception(cause, tfr);
+    kernel_unlock();
+}
+
+void dispatch_umode_exception(unsigned int cause, struct trap_frame * tfr) {
     
     const char * name = NULL;
     char msgbuf[80];
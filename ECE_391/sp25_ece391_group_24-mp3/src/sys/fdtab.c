@@ -0,0 +1,269 @@
+// fdtab.c - Per-process descriptor table
+//
+// Copyright (c) 2024-2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+#ifdef FDTAB_TRACE
+#define TRACE
+#endif
+
+#ifdef FDTAB_DEBUG
+#define DEBUG
+#endif
+
+#include "fdtab.h"
+#include "conf.h"
+#include "heap.h"
+#include "memory.h"
+#include "string.h"
+#include "console.h"
+#include "error.h"
+
+#include <stddef.h>
+
+// COMPILE-TIME CONSTANT DEFINITIONS
+//
+
+// Initial number of descriptor slots
+
+#ifndef FDTAB_MINCAP
+#define FDTAB_MINCAP 16
+#endif
+
+// Tables up to this many bytes come from the heap, larger ones from the page
+// allocator (kmalloc cannot allocate more than a page).
+
+#ifndef FDTAB_HEAP_MAX
+#define FDTAB_HEAP_MAX 2048
+#endif
+
+#define BITS_PER_WORD (8 * sizeof(unsigned long))
+#define BITMAP_WORDS(n) (((n) + BITS_PER_WORD - 1) / BITS_PER_WORD)
+
+// The slots, bitmap and flags of a table share one allocation, in that order
+
+#define FDTAB_SIZE(cap) ((cap) * sizeof(struct io *) + \
+    BITMAP_WORDS(cap) * sizeof(unsigned long) + (cap))
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static int fdtab_grow(struct fdtab * fdt, int mincap);
+static void fdtab_free(struct fdtab * fdt);
+static int fdtab_lowest_free(const struct fdtab * fdt);
+
+static inline int fd_used(const struct fdtab * fdt, int fd);
+static inline void fd_mark(struct fdtab * fdt, int fd);
+static inline void fd_unmark(struct fdtab * fdt, int fd);
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+struct io * fdtab_get(const struct fdtab * fdt, int fd) {
+    if (fd < 0 || fdt->top <= fd)
+        return NULL;
+
+    return fdt->iotab[fd];
+}
+
+int fdtab_install(struct fdtab * fdt, int fd, struct io * io, int flags) {
+    int result;
+
+    if (PROCESS_IOMAX <= fd)
+        return -EBADFD;
+
+    if (fd < 0) {
+        fd = fdtab_lowest_free(fdt);
+        if (fd < 0)
+            return -EMFILE;
+    } else if (fd < fdt->cap && fd_used(fdt, fd))
+        return -EBADFD;
+
+    if (fdt->cap <= fd) {
+        result = fdtab_grow(fdt, fd + 1);
+        if (result < 0)
+            return result;
+    }
+
+    fdt->iotab[fd] = io;
+    fdt->flags[fd] = flags;
+    fd_mark(fdt, fd);
+
+    if (fdt->top <= fd)
+        fdt->top = fd + 1;
+
+    return fd;
+}
+
+struct io * fdtab_remove(struct fdtab * fdt, int fd) {
+    struct io * io;
+
+    io = fdtab_get(fdt, fd);
+    if (io == NULL)
+        return NULL;
+
+    fdt->iotab[fd] = NULL;
+    fdt->flags[fd] = 0;
+    fd_unmark(fdt, fd);
+
+    while (fdt->top > 0 && fdt->iotab[fdt->top - 1] == NULL)
+        fdt->top -= 1;
+
+    return io;
+}
+
+int fdtab_getflags(const struct fdtab * fdt, int fd) {
+    if (fdtab_get(fdt, fd) == NULL)
+        return -EBADFD;
+
+    return fdt->flags[fd];
+}
+
+int fdtab_setflags(struct fdtab * fdt, int fd, int flags) {
+    if (fdtab_get(fdt, fd) == NULL)
+        return -EBADFD;
+
+    fdt->flags[fd] = flags;
+    return 0;
+}
+
+int fdtab_copy(struct fdtab * dst, const struct fdtab * src, int skipflags) {
+    int result;
+    int fd;
+
+    memset(dst, 0, sizeof(struct fdtab));
+
+    if (src->top == 0)
+        return 0;
+
+    result = fdtab_grow(dst, src->top);
+    if (result < 0)
+        return result;
+
+    for (fd = 0; fd < src->top; fd++) {
+        if (src->iotab[fd] == NULL || (src->flags[fd] & skipflags) != 0)
+            continue;
+
+        dst->iotab[fd] = ioaddref(src->iotab[fd]);
+        dst->flags[fd] = src->flags[fd];
+        fd_mark(dst, fd);
+        dst->top = fd + 1;
+    }
+
+    return 0;
+}
+
+void fdtab_close(struct fdtab * fdt, int flags) {
+    int fd;
+
+    for (fd = fdt->top - 1; fd >= 0; fd--) {
+        if (fdt->iotab[fd] != NULL &&
+            (flags == 0 || (fdt->flags[fd] & flags) != 0))
+        {
+            ioclose(fdtab_remove(fdt, fd));
+        }
+    }
+
+    if (fdt->top == 0 && fdt->cap != 0) {
+        fdtab_free(fdt);
+        memset(fdt, 0, sizeof(struct fdtab));
+    }
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+// Grows the table to at least _mincap_ slots, doubling from FDTAB_MINCAP so
+// repeated opens do not copy the table each time.
+
+int fdtab_grow(struct fdtab * fdt, int mincap) {
+    struct fdtab new;
+    size_t size;
+    void * mem;
+
+    new.cap = (fdt->cap != 0) ? fdt->cap : FDTAB_MINCAP;
+    while (new.cap < mincap)
+        new.cap *= 2;
+    if (PROCESS_IOMAX < new.cap)
+        new.cap = PROCESS_IOMAX;
+
+    size = FDTAB_SIZE(new.cap);
+
+    if (size <= FDTAB_HEAP_MAX)
+        mem = kmalloc(size);
+    else
+        mem = alloc_phys_pages(ROUND_UP(size, PAGE_SIZE) / PAGE_SIZE);
+
+    if (mem == NULL)
+        return -ENOMEM;
+
+    memset(mem, 0, size);
+    new.iotab = mem;
+    new.used = (unsigned long *)(new.iotab + new.cap);
+    new.flags = (unsigned char *)(new.used + BITMAP_WORDS(new.cap));
+
+    if (fdt->cap != 0) {
+        memcpy(new.iotab, fdt->iotab, fdt->cap * sizeof(struct io *));
+        memcpy(new.used, fdt->used, BITMAP_WORDS(fdt->cap) * sizeof(unsigned long));
+        memcpy(new.flags, fdt->flags, fdt->cap);
+        fdtab_free(fdt);
+    }
+
+    trace("%s: %d -> %d descriptors", __func__, fdt->cap, new.cap);
+
+    new.top = fdt->top;
+    *fdt = new;
+    return 0;
+}
+
+void fdtab_free(struct fdtab * fdt) {
+    const size_t size = FDTAB_SIZE(fdt->cap);
+
+    if (size <= FDTAB_HEAP_MAX)
+        kfree(fdt->iotab);
+    else
+        free_phys_pages(fdt->iotab, ROUND_UP(size, PAGE_SIZE) / PAGE_SIZE);
+}
+
+// Returns the lowest free descriptor, which may be at or past the end of the
+// table, or -1 if all PROCESS_IOMAX descriptors are open.
+
+int fdtab_lowest_free(const struct fdtab * fdt) {
+    unsigned long word;
+    int i, fd;
+
+    for (i = 0; i < BITMAP_WORDS(fdt->cap); i++) {
+        word = ~fdt->used[i];
+        if (word == 0)
+            continue;
+
+        fd = i * BITS_PER_WORD;
+        while ((word & 1) == 0) {
+            word >>= 1;
+            fd += 1;
+        }
+
+        // the last word may have bits past cap
+        break;
+    }
+
+    if (i == BITMAP_WORDS(fdt->cap))
+        fd = BITMAP_WORDS(fdt->cap) * BITS_PER_WORD;
+    if (fd > fdt->cap)
+        fd = fdt->cap;
+
+    return (fd < PROCESS_IOMAX) ? fd : -1;
+}
+
+static inline int fd_used(const struct fdtab * fdt, int fd) {
+    return (fdt->used[fd / BITS_PER_WORD] >> (fd % BITS_PER_WORD)) & 1;
+}
+
+static inline void fd_mark(struct fdtab * fdt, int fd) {
+    fdt->used[fd / BITS_PER_WORD] |= 1UL << (fd % BITS_PER_WORD);
+}
+
+static inline void fd_unmark(struct fdtab * fdt, int fd) {
+    fdt->used[fd / BITS_PER_WORD] &= ~(1UL << (fd % BITS_PER_WORD));
+}
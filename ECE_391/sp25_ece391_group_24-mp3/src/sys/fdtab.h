@@ -0,0 +1,73 @@
+// fdtab.h - Per-process descriptor table
+//
+// Copyright (c) 2024-2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+#ifndef _FDTAB_H_
+#define _FDTAB_H_
+
+#include "io.h"
+
+// Descriptor flags
+
+#define FD_CLOEXEC  0x1 // closed by process_exec (and not inherited by spawn)
+#define FD_NONBLOCK 0x2 // reads and writes return -EAGAIN instead of blocking
+
+// Commands of the fdctl system call
+
+#define FDCTL_GETFL 0 // returns the flags of fd
+#define FDCTL_SETFL 1 // sets the flags of fd to arg
+
+// EXPORTED TYPE DEFINITIONS
+//
+
+// A descriptor table starts empty and grows (doubling) up to PROCESS_IOMAX
+// descriptors as they are opened. A set bit in _used_ marks an open
+// descriptor, so the lowest free one is found a word at a time. _top_ is one
+// more than the highest open descriptor; operations on every descriptor only
+// look below it. An all-zero struct fdtab is a valid empty table.
+
+struct fdtab {
+    int cap; // number of slots in iotab and flags
+    int top; // one more than the highest open descriptor
+    struct io ** iotab;
+    unsigned char * flags;
+    unsigned long * used;
+};
+
+// EXPORTED FUNCTION DECLARATIONS
+//
+
+// fdtab_get() returns the I/O object of descriptor _fd_, or NULL if _fd_ is
+// not open.
+//
+// fdtab_install() makes _io_ descriptor _fd_ with flags _flags_, taking over
+// the caller's reference. A negative _fd_ picks the lowest free descriptor.
+// Returns the descriptor, -EBADFD if _fd_ is out of range or already open,
+// -EMFILE if the table is full, or -ENOMEM.
+//
+// fdtab_remove() frees descriptor _fd_ and returns its I/O object, whose
+// reference passes to the caller, or NULL if _fd_ was not open.
+
+extern struct io * fdtab_get(const struct fdtab * fdt, int fd);
+extern int fdtab_install(struct fdtab * fdt, int fd, struct io * io, int flags);
+extern struct io * fdtab_remove(struct fdtab * fdt, int fd);
+
+// fdtab_getflags() returns the flags of _fd_, or -EBADFD. fdtab_setflags()
+// replaces them.
+
+extern int fdtab_getflags(const struct fdtab * fdt, int fd);
+extern int fdtab_setflags(struct fdtab * fdt, int fd, int flags);
+
+// fdtab_copy() gives empty table _dst_ a new reference to every descriptor
+// of _src_ that has none of _skipflags_ set, keeping descriptor numbers and
+// flags. Returns 0 or -ENOMEM (then _dst_ is left empty).
+//
+// fdtab_close() closes every descriptor that has any of _flags_ set, or all
+// of them if _flags_ is 0, and frees the table once it is empty.
+
+extern int fdtab_copy(struct fdtab * dst, const struct fdtab * src, int skipflags);
+extern void fdtab_close(struct fdtab * fdt, int flags);
+
+#endif // _FDTAB_H_
@@ -1,7 +1,7 @@
-// fs.h - File system interface
+// fs.h - File system interface
 //
-// Copyright (c) 2024-2025 University of Illinois
-// SPDX-License-identifier: NCSA
+// Copyright (c) 2024-2025 University of Illinois
+// SPDX-License-identifier: NCSA
 //
 
 #ifndef _FS_H_
@@ -12,12 +12,53 @@
 
 #define FILE_OPENED (1<<0)
 
+// EXPORTED TYPE DEFINITIONS
+//
+
+// A mounted file system. Each file system type embeds a struct filesys in
+// its own state (like struct io in an endpoint) and gets it back from the
+// pointer passed to its functions. Names are relative to the mount point.
+
+struct filesys;
+
+struct fsintf {
+    int (*open)(struct filesys * fsys, const char * name, struct io ** ioptr);
+    int (*create)(struct filesys * fsys, const char * name);
+    int (*delete)(struct filesys * fsys, const char * name);
+    int (*mkdir)(struct filesys * fsys, const char * path);
+    int (*flush)(struct filesys * fsys);
+};
+
+struct filesys {
+    const struct fsintf * intf;
+};
+
+// EXPORTED FUNCTION DECLARATIONS
+//
+
 extern char fs_initialized;
 
-extern int fsmount(struct io * io);
+// fsmount() mounts the KTFS image on block device _io_ at _path_ (see
+// fsattach). Returns 0 or a negative error code.
+
+extern int fsmount(const char * path, struct io * io);
+
+// fsattach() adds mounted file system _fsys_ to the mount table at _path_, a
+// directory name such as "scratch" or "" for the root. A name is served by the
+// mount with the longest path that is a whole-component prefix of it, so a
+// mount hides the directory of the same name on the file system below it.
+// Returns 0, -EBUSY if _path_ is already a mount point, or -EMFILE if the
+// table (NMOUNT entries) is full.
+
+extern int fsattach(const char * path, struct filesys * fsys);
+
+// The functions below find the mount of _name_ and call its file system with
+// the rest of the name. fsflush() flushes every mounted file system.
+
 extern int fsopen(const char * name, struct io ** ioptr);
 extern int fsflush(void);
 extern int fscreate(const char * name);
 extern int fsdelete(const char * name);
+extern int fsmkdir(const char * path);
 
 #endif // _FS_H_
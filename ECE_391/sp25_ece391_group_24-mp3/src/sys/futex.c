@@ -0,0 +1,138 @@
+// futex.c - Fast user-space mutex support
+//
+// Copyright (c) 2024-2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+#ifdef FUTEX_TRACE
+#define TRACE
+#endif
+
+#ifdef FUTEX_DEBUG
+#define DEBUG
+#endif
+
+#include "futex.h"
+#include "conf.h"
+#include "memory.h"
+#include "thread.h"
+#include "intr.h"
+#include "console.h"
+#include "error.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// COMPILE-TIME CONSTANT DEFINITIONS
+//
+
+#ifndef FUTEX_HASH_CNT
+#define FUTEX_HASH_CNT 64 // must be a power of two
+#endif
+
+// INTERNAL TYPE DEFINITIONS
+//
+
+// A waiter lives on the stack of the waiting thread. Each waiter has its own
+// condition so futex_wake() can wake exactly _cnt_ threads even when several
+// futex words hash to the same bucket.
+
+struct futex_waiter {
+    struct futex_waiter * next;
+    uintptr_t paddr; // physical address of futex word
+    struct condition woken;
+};
+
+// INTERNAL GLOBAL VARIABLE DEFINITIONS
+//
+
+static struct futex_waiter * futex_hash[FUTEX_HASH_CNT];
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static uintptr_t futex_paddr(const int * uaddr);
+static struct futex_waiter ** futex_bucket(uintptr_t paddr);
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+int futex_wait(const int * uaddr, int expected) {
+    struct futex_waiter waiter;
+    struct futex_waiter ** bucket;
+    uintptr_t paddr;
+    int pie;
+
+    trace("%s(uaddr=%p,expected=%d)", __func__, uaddr, expected);
+
+    paddr = futex_paddr(uaddr);
+    if (paddr == 0)
+        return -EINVAL;
+
+    // Interrupts must be disabled from the time we check the futex word until
+    // we are on the wait list. The kernel lock keeps other harts out.
+
+    pie = disable_interrupts();
+
+    if (*(volatile const int *)paddr != expected) {
+        restore_interrupts(pie);
+        return -EAGAIN;
+    }
+
+    waiter.paddr = paddr;
+    condition_init(&waiter.woken, "futex");
+    bucket = futex_bucket(paddr);
+    waiter.next = *bucket;
+    *bucket = &waiter;
+
+    condition_wait(&waiter.woken);
+    restore_interrupts(pie);
+
+    return 0;
+}
+
+int futex_wake(const int * uaddr, int cnt) {
+    struct futex_waiter ** wptr;
+    struct futex_waiter * waiter;
+    uintptr_t paddr;
+    int woken = 0;
+    int pie;
+
+    trace("%s(uaddr=%p,cnt=%d)", __func__, uaddr, cnt);
+
+    paddr = futex_paddr(uaddr);
+    if (paddr == 0)
+        return -EINVAL;
+
+    pie = disable_interrupts();
+
+    wptr = futex_bucket(paddr);
+    while (woken < cnt && (waiter = *wptr) != NULL) {
+        if (waiter->paddr == paddr) {
+            *wptr = waiter->next;
+            condition_broadcast(&waiter->woken);
+            woken += 1;
+        } else
+            wptr = &waiter->next;
+    }
+
+    restore_interrupts(pie);
+    return woken;
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+// Returns the physical address of the futex word at _uaddr_ in the active
+// memory space, or 0 if it is misaligned or not a readable user page.
+
+static uintptr_t futex_paddr(const int * uaddr) {
+    if ((uintptr_t)uaddr % sizeof(int) != 0)
+        return 0;
+
+    return (uintptr_t)user_to_phys(uaddr, PTE_R | PTE_U);
+}
+
+static struct futex_waiter ** futex_bucket(uintptr_t paddr) {
+    return &futex_hash[(paddr / sizeof(int)) % FUTEX_HASH_CNT];
+}
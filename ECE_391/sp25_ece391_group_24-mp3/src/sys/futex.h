@@ -0,0 +1,30 @@
+// futex.h - Fast user-space mutex support
+//
+// Copyright (c) 2024-2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+// EXPORTED FUNCTION DECLARATIONS
+//
+
+// futex_wait() suspends the running thread if the 32-bit word at user virtual
+// address _uaddr_ still contains _expected_, until a futex_wake() on the same
+// word. Returns 0 after being woken, -EAGAIN if the word did not contain
+// _expected_, or -EINVAL if _uaddr_ is not a mapped, aligned user address.
+//
+// futex_wake() wakes up to _cnt_ threads waiting on the word at _uaddr_ and
+// returns the number woken, or -EINVAL.
+//
+// Waiters are keyed by physical address, so two processes that map the same
+// physical page may synchronize on it. The only such pages are those of a
+// file mapped with mmap (fork keeps them shared, see map_shared_page); fork
+// copies every other page, so a futex in ordinary memory such as the stack,
+// heap or data segment is private to each process after a fork.
+
+extern int futex_wait(const int * uaddr, int expected);
+extern int futex_wake(const int * uaddr, int cnt);
+
+#endif // _FUTEX_H_
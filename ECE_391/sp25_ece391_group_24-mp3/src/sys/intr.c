@@ -19,6 +19,8 @@
 #include "plic.h"
 #include "timer.h"
 #include "thread.h"
+#include "smp.h"
+#include "error.h"
 
 #include <stddef.h>
 
@@ -32,15 +34,26 @@ char intrmgr_initialized = 0;
 
 static struct {
     void (*isr)(int,void*); // isr function
-    void * isr_aux; // isr auxilary var
+    void * isr_aux; // isr auxilary var
+    unsigned long hartmask; // harts the source is routed to (0 means hart 0)
 } isrtab[NIRQ];
 
+// Deferred work queue. Only the hart holding the kernel lock touches it, and
+// only with interrupts disabled. intr_work_running prevents a nested interrupt
+// from draining the queue while an outer handler is already doing so.
+
+static struct intr_work * intr_work_head;
+static struct intr_work ** intr_work_tail = &intr_work_head;
+static char intr_work_running = 0;
+
 // INTERNAL FUNCTION DECLARATIONS
 //
 static void handle_interrupt(unsigned int cause);
 
 static void handle_extern_interrupt(void);
 
+static void run_intr_work(void);
+
 // EXPORTED FUNCTION DEFINITIONS
 //
 
@@ -67,22 +80,110 @@ void enable_intr_source (
 
     isrtab[srcno].isr = isr;
     isrtab[srcno].isr_aux = isr_aux;
+    plic_set_source_affinity(srcno,
+        isrtab[srcno].hartmask ? isrtab[srcno].hartmask : 1);
     plic_enable_source(srcno, prio);
 }
 
+// int intr_set_affinity(int srcno, unsigned long hartmask)
+// Routes interrupt source _srcno_ to the harts whose bits are set in _hartmask_.
+// Any one of them may take a given interrupt. May be called before or after
+// enable_intr_source; the mask is remembered for the source. Returns 0 on
+// success or -EINVAL if the mask names no hart the kernel supports.
+
+int intr_set_affinity(int srcno, unsigned long hartmask) {
+    int pie;
+
+    if (srcno <= 0 || NIRQ <= srcno)
+        return -EINVAL;
+
+    hartmask &= (1UL << NHART) - 1;
+    if (hartmask == 0)
+        return -EINVAL;
+
+    pie = disable_interrupts();
+    isrtab[srcno].hartmask = hartmask;
+    plic_set_source_affinity(srcno, hartmask);
+    restore_interrupts(pie);
+    return 0;
+}
+
+// int intr_set_threshold(int hartid, int prio)
+// Masks interrupts of priority _prio_ and below on hart _hartid_, for example
+// to keep low priority device interrupts off a latency-sensitive hart. A
+// threshold of 0 accepts all interrupts. Returns 0 or -EINVAL.
+
+int intr_set_threshold(int hartid, int prio) {
+    if (hartid < 0 || NHART <= hartid)
+        return -EINVAL;
+    if (prio < 0 || INTR_PRIO_MAX < prio)
+        return -EINVAL;
+
+    plic_set_hart_threshold(hartid, prio);
+    return 0;
+}
+
+// void intr_work_init(struct intr_work * work, void (*fn)(void*), void * aux)
+// Prepares _work_ to call _fn_ with _aux_ when scheduled. Must be called before
+// the interrupt source whose ISR schedules it is enabled.
+
+void intr_work_init (
+    struct intr_work * work,
+    void (*fn)(void * aux),
+    void * aux)
+{
+    work->next = NULL;
+    work->fn = fn;
+    work->aux = aux;
+    work->queued = 0;
+}
+
+// void intr_work_schedule(struct intr_work * work)
+// Appends _work_ to the deferred work queue unless it is already on it. Meant
+// to be called from an ISR, but safe from any kernel code.
+
+void intr_work_schedule(struct intr_work * work) {
+    int pie;
+
+    pie = disable_interrupts();
+
+    if (!work->queued) {
+        work->queued = 1;
+        work->next = NULL;
+        *intr_work_tail = work;
+        intr_work_tail = &work->next;
+    }
+
+    restore_interrupts(pie);
+}
+
 void disable_intr_source(int srcno) {
     plic_disable_source(srcno);
     isrtab[srcno].isr = NULL;
     isrtab[srcno].isr_aux = NULL;
 }
 
+// An interrupt taken in S mode usually finds the kernel lock already held by
+// this hart. The exception is the idle thread, which drops the lock while it
+// waits in wfi.
+
 void handle_smode_interrupt(unsigned int cause) {
+    const int locked = kernel_lock_held();
+
+    if (!locked)
+        kernel_lock();
     handle_interrupt(cause);
+    run_intr_work();
+    if (!locked)
+        kernel_unlock();
 }
 
 void handle_umode_interrupt(unsigned int cause) {
+    kernel_lock();
     handle_interrupt(cause);
+    run_intr_work();
     thread_yield();
+    kernel_unlock();
 }
 
 
@@ -118,4 +219,30 @@ void handle_extern_interrupt(void) {
     isrtab[srcno].isr(srcno, isrtab[srcno].isr_aux);
 
     plic_finish_interrupt(srcno);
-}
\ No newline at end of file
+}
+// Drains the deferred work queue. Called on the way out of an interrupt with
+// interrupts disabled; each work item runs with interrupts enabled, so a
+// nested interrupt may queue more work, which is picked up by this same loop.
+// Returns with interrupts disabled.
+
+void run_intr_work(void) {
+    struct intr_work * work;
+
+    if (intr_work_running)
+        return;
+
+    intr_work_running = 1;
+
+    while ((work = intr_work_head) != NULL) {
+        intr_work_head = work->next;
+        if (intr_work_head == NULL)
+            intr_work_tail = &intr_work_head;
+        work->queued = 0;
+
+        enable_interrupts();
+        work->fn(work->aux);
+        disable_interrupts();
+    }
+
+    intr_work_running = 0;
+}
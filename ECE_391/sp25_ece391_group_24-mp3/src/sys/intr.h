@@ -17,6 +17,23 @@
 #define INTR_PRIO_MAX PLIC_PRIO_MAX
 #define INTR_SRC_CNT PLIC_SRC_CNT
 
+// EXPORTED TYPE DEFINITIONS
+//
+
+// Deferred interrupt work. An ISR should only acknowledge its device and call
+// intr_work_schedule() for the rest (moving data, waking waiting threads). The
+// queued work runs on the same hart when the outermost interrupt handler
+// returns, in FIFO order and with interrupts enabled, so other sources are not
+// held off while it runs. A work function must not sleep. Scheduling a work
+// item that is already queued has no effect.
+
+struct intr_work {
+    struct intr_work * next; // next in queue
+    void (*fn)(void * aux);  // work function
+    void * aux;              // argument to fn
+    char queued;             // set while on the queue
+};
+
 // EXPORTED FUNCTION DECLARATIONS
 // 
 
@@ -30,8 +47,18 @@ extern void enable_intr_source (
 
 extern void disable_intr_source(int srcno);
 
+extern int intr_set_affinity(int srcno, unsigned long hartmask);
+extern int intr_set_threshold(int hartid, int prio);
+
 extern void handle_smode_interrupt(unsigned int cause);
 
+extern void intr_work_init (
+    struct intr_work * work,
+    void (*fn)(void * aux),
+    void * aux);
+
+extern void intr_work_schedule(struct intr_work * work);
+
 static inline long enable_interrupts(void) {
     return csrrsi_sstatus_SIE();
 }
@@ -12,6 +12,7 @@
 #include "error.h"
 #include "thread.h"
 #include "memory.h"
+#include "intr.h"
 
 #include <stddef.h>
 #include <limits.h>
@@ -52,29 +53,39 @@ struct pipe {
 
     unsigned long readers;
     unsigned long writers;
+
+    struct pollwait * pollers; // poll calls watching either end
 };
 // INTERNAL FUNCTION DEFINITIONS
 //
-static void pipeio_close(struct io *io);
+static int pipeio_close(struct io *io);
 static long pipeio_read(struct io *io, void *buf, long bufsz);
 static long pipeio_write(struct io *io, const void *buf, long bufsz);
+static long pipeio_readv(struct io *io, const struct iovec *iov, int iovcnt);
+static long pipeio_writev(struct io *io, const struct iovec *iov, int iovcnt);
+static int pipeio_cntl(struct io *io, int cmd, void *arg);
+static int pipeio_poll(struct io *io, struct pollwait *pw);
 
 static const struct iointf pipeio_intf_reader = {
     .close   = &pipeio_close,
-    .cntl    = NULL,
+    .cntl    = &pipeio_cntl,
     .read    = &pipeio_read,
     .write   = NULL,
     .readat  = NULL,
-    .writeat = NULL
+    .writeat = NULL,
+    .readv   = &pipeio_readv,
+    .poll    = &pipeio_poll
 };
 
 static const struct iointf pipeio_intf_writer = {
     .close   = &pipeio_close,
-    .cntl    = NULL,
+    .cntl    = &pipeio_cntl,
     .read    = NULL,
     .write   = &pipeio_write,
     .readat  = NULL,
-    .writeat = NULL
+    .writeat = NULL,
+    .writev  = &pipeio_writev,
+    .poll    = &pipeio_poll
 };
 
 static int memio_cntl(struct io * io, int cmd, void * arg);
@@ -85,7 +96,7 @@ static long memio_readat (
 static long memio_writeat (
     struct io * io, unsigned long long pos, const void * buf, long len);
 
-static void seekio_close(struct io * io);
+static int seekio_close(struct io * io);
 
 static int seekio_cntl(struct io * io, int cmd, void * arg);
 
@@ -99,6 +110,25 @@ static long seekio_readat (
 static long seekio_writeat (
     struct io * io, unsigned long long pos, const void * buf, long len);
 
+static long seekio_readv (
+    struct io * io, const struct iovec * iov, int iovcnt);
+
+static long seekio_writev (
+    struct io * io, const struct iovec * iov, int iovcnt);
+
+static long seekio_preadv (
+    struct io * io, unsigned long long pos,
+    const struct iovec * iov, int iovcnt);
+
+static long seekio_pwritev (
+    struct io * io, unsigned long long pos,
+    const struct iovec * iov, int iovcnt);
+
+static long iovlen(const struct iovec * iov, int iovcnt);
+
+static int iovtrim (
+    struct iovec * dst, const struct iovec * src, int iovcnt, long len);
+
 
 // INTERNAL GLOBAL CONSTANTS
 static const struct iointf seekio_iointf = {
@@ -107,7 +137,11 @@ static const struct iointf seekio_iointf = {
     .read = &seekio_read,
     .write = &seekio_write,
     .readat = &seekio_readat,
-    .writeat = &seekio_writeat
+    .writeat = &seekio_writeat,
+    .readv = &seekio_readv,
+    .writev = &seekio_writev,
+    .preadv = &seekio_preadv,
+    .pwritev = &seekio_pwritev
 };
 
 // EXPORTED FUNCTION DEFINITIONS
@@ -139,7 +173,7 @@ struct io * ioaddref(struct io * io) {
     return io;
 }
 
-void ioclose(struct io * io) {
+int ioclose(struct io * io) {
     assert (io != NULL);
     assert (io->intf != NULL);
     
@@ -147,7 +181,8 @@ void ioclose(struct io * io) {
     io->refcnt -= 1;
 
     if (io->refcnt == 0 && io->intf->close != NULL)
-        io->intf->close(io);
+        return io->intf->close(io);
+    return 0;
 }
 
 long ioread(struct io * io, void * buf, long bufsz) {
@@ -243,6 +278,197 @@ long iowriteat (
     return io->intf->writeat(io, pos, buf, len);
 }
 
+long ioreadv(struct io * io, const struct iovec * iov, int iovcnt) {
+    long total = 0; // bytes read so far
+    long n; // result of last read
+    int i;
+
+    assert (io != NULL);
+    assert (io->intf != NULL);
+
+    if (iovlen(iov, iovcnt) < 0)
+        return -EINVAL;
+    
+    if (iovlen(iov, iovcnt) == 0)
+        return 0;
+
+    if (io->intf->readv != NULL)
+        return io->intf->readv(io, iov, iovcnt);
+
+    if (io->intf->read == NULL)
+        return -ENOTSUP;
+    
+    // Stop at the first short read, so we do not block waiting for more data
+    // after some has already arrived.
+
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].len == 0)
+            continue;
+        
+        n = io->intf->read(io, iov[i].base, iov[i].len);
+
+        if (n < 0)
+            return (total == 0) ? n : total;
+        
+        total += n;
+
+        if (n < iov[i].len)
+            break;
+    }
+
+    return total;
+}
+
+long iowritev(struct io * io, const struct iovec * iov, int iovcnt) {
+    struct iovec rest[IOV_MAX]; // segments not yet written
+    long total = 0; // bytes written so far
+    long len; // total bytes to write
+    long n; // result of last write
+    int i;
+
+    assert (io != NULL);
+    assert (io->intf != NULL);
+
+    len = iovlen(iov, iovcnt);
+
+    if (len < 0)
+        return -EINVAL;
+
+    if (len == 0)
+        return 0;
+    
+    if (io->intf->writev != NULL) {
+        // A native writev may be partial (e.g. a pipe), so keep going with
+        // what is left, like iowrite() does.
+
+        memcpy(rest, iov, iovcnt * sizeof(struct iovec));
+        i = 0;
+
+        do {
+            n = io->intf->writev(io, rest+i, iovcnt-i);
+
+            if (n <= 0)
+                return (n < 0) ? n : total;
+            
+            total += n;
+
+            while (i < iovcnt && rest[i].len <= n) {
+                n -= rest[i].len;
+                i += 1;
+            }
+
+            if (i < iovcnt) {
+                rest[i].base += n;
+                rest[i].len -= n;
+            }
+        } while (total < len);
+
+        return total;
+    }
+
+    if (io->intf->write == NULL)
+        return -ENOTSUP;
+
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].len == 0)
+            continue;
+        
+        n = iowrite(io, iov[i].base, iov[i].len);
+
+        if (n < 0)
+            return n;
+        
+        total += n;
+
+        if (n < iov[i].len)
+            break;
+    }
+
+    return total;
+}
+
+long iopreadv (
+    struct io * io, unsigned long long pos,
+    const struct iovec * iov, int iovcnt)
+{
+    long total = 0; // bytes read so far
+    long n; // result of last read
+    int i;
+
+    assert (io != NULL);
+    assert (io->intf != NULL);
+
+    if (iovlen(iov, iovcnt) < 0)
+        return -EINVAL;
+    
+    if (iovlen(iov, iovcnt) == 0)
+        return 0;
+
+    if (io->intf->preadv != NULL)
+        return io->intf->preadv(io, pos, iov, iovcnt);
+
+    if (io->intf->readat == NULL)
+        return -ENOTSUP;
+    
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].len == 0)
+            continue;
+        
+        n = io->intf->readat(io, pos + total, iov[i].base, iov[i].len);
+
+        if (n < 0)
+            return (total == 0) ? n : total;
+        
+        total += n;
+
+        if (n < iov[i].len)
+            break;
+    }
+
+    return total;
+}
+
+long iopwritev (
+    struct io * io, unsigned long long pos,
+    const struct iovec * iov, int iovcnt)
+{
+    long total = 0; // bytes written so far
+    long n; // result of last write
+    int i;
+
+    assert (io != NULL);
+    assert (io->intf != NULL);
+
+    if (iovlen(iov, iovcnt) < 0)
+        return -EINVAL;
+    
+    if (iovlen(iov, iovcnt) == 0)
+        return 0;
+
+    if (io->intf->pwritev != NULL)
+        return io->intf->pwritev(io, pos, iov, iovcnt);
+
+    if (io->intf->writeat == NULL)
+        return -ENOTSUP;
+    
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].len == 0)
+            continue;
+        
+        n = io->intf->writeat(io, pos + total, iov[i].base, iov[i].len);
+
+        if (n < 0)
+            return (total == 0) ? n : total;
+        
+        total += n;
+
+        if (n < iov[i].len)
+            break;
+    }
+
+    return total;
+}
+
 int ioctl(struct io * io, int cmd, void * arg) {
     assert (io != NULL);
     assert (io->intf != NULL);
@@ -259,6 +485,49 @@ int ioblksz(struct io * io) {
     return ioctl(io, IOCTL_GETBLKSZ, NULL);
 }
 
+int iopoll(struct io * io, struct pollwait * pw) {
+    assert (io != NULL);
+    assert (io->intf != NULL);
+
+    if (io->intf->poll == NULL)
+        return POLLIN | POLLOUT;
+
+    return io->intf->poll(io, pw);
+}
+
+void pollwait_add(struct pollwait ** list, struct pollwait * pw) {
+    int pie;
+
+    pie = disable_interrupts();
+    pw->next = *list;
+    if (pw->next != NULL)
+        pw->next->pprev = &pw->next;
+    pw->pprev = list;
+    *list = pw;
+    restore_interrupts(pie);
+}
+
+void pollwait_remove(struct pollwait * pw) {
+    int pie;
+
+    pie = disable_interrupts();
+    if (pw->pprev != NULL) {
+        *pw->pprev = pw->next;
+        if (pw->next != NULL)
+            pw->next->pprev = pw->pprev;
+        pw->next = NULL;
+        pw->pprev = NULL;
+    }
+    restore_interrupts(pie);
+}
+
+void pollwait_wake(struct pollwait * list) {
+    while (list != NULL) {
+        condition_broadcast(list->cond);
+        list = list->next;
+    }
+}
+
 int ioseek(struct io * io, unsigned long long pos) {
     return ioctl(io, IOCTL_SETPOS, &pos);
 }
@@ -421,10 +690,11 @@ int memio_cntl(struct io * io, int cmd, void * arg) {
     }
 }
 
-void seekio_close(struct io * io) {
+int seekio_close(struct io * io) {
     struct seekio * const sio = (void*)io - offsetof(struct seekio, io);
-    ioclose(sio->bkgio);
+    int result = ioclose(sio->bkgio);
     kfree(sio);
+    return result;
 }
 
 int seekio_cntl(struct io * io, int cmd, void * arg) {
@@ -541,6 +811,136 @@ long seekio_writeat (
     return iowriteat(sio->bkgio, pos, buf, len);
 }
 
+// The vectored seekio functions follow the same rules as seekio_read and
+// seekio_write, applied to the total length of the vector, and pass the
+// whole vector to the backing endpoint in one call.
+
+long seekio_readv(struct io * io, const struct iovec * iov, int iovcnt) {
+    struct seekio * const sio = (void*)io - offsetof(struct seekio, io);
+    unsigned long long const pos = sio->pos;
+    unsigned long long const end = sio->end;
+    struct iovec trimmed[IOV_MAX];
+    long bufsz;
+    long rcnt;
+
+    bufsz = iovlen(iov, iovcnt);
+
+    // Cannot read past end
+    if (end - pos < bufsz)
+        bufsz = end - pos;
+
+    if (bufsz == 0)
+        return 0;
+    
+    // Request must be for at least blksz bytes if not zero
+    if (bufsz < sio->blksz)
+        return -EINVAL;
+
+    // Truncate buffer size to multiple of blksz
+    bufsz &= ~(sio->blksz - 1);
+
+    iovcnt = iovtrim(trimmed, iov, iovcnt, bufsz);
+    rcnt = iopreadv(sio->bkgio, pos, trimmed, iovcnt);
+    sio->pos = pos + ((rcnt < 0) ? 0 : rcnt);
+    return rcnt;
+}
+
+long seekio_writev(struct io * io, const struct iovec * iov, int iovcnt) {
+    struct seekio * const sio = (void*)io - offsetof(struct seekio, io);
+    unsigned long long const pos = sio->pos;
+    unsigned long long end = sio->end;
+    struct iovec trimmed[IOV_MAX];
+    int result;
+    long wcnt;
+    long len;
+
+    len = iovlen(iov, iovcnt);
+
+    if (len == 0)
+        return 0;
+    
+    // Request must be for at least blksz bytes
+    if (len < sio->blksz)
+        return -EINVAL;
+    
+    // Truncate length to multiple of blksz
+    len &= ~(sio->blksz - 1);
+
+    // Check if write is past end. If it is, we need to change end position.
+
+    if (end - pos < len) {
+        if (ULLONG_MAX - pos < len)
+            return -EINVAL;
+        
+        end = pos + len;
+
+        result = ioctl(sio->bkgio, IOCTL_SETEND, &end);
+        
+        if (result != 0)
+            return result;
+        
+        sio->end = end;
+    }
+
+    iovcnt = iovtrim(trimmed, iov, iovcnt, len);
+    wcnt = iopwritev(sio->bkgio, pos, trimmed, iovcnt);
+    sio->pos = pos + ((wcnt < 0) ? 0 : wcnt);
+    return wcnt;
+}
+
+long seekio_preadv (
+    struct io * io, unsigned long long pos,
+    const struct iovec * iov, int iovcnt)
+{
+    struct seekio * const sio = (void*)io - offsetof(struct seekio, io);
+    return iopreadv(sio->bkgio, pos, iov, iovcnt);
+}
+
+long seekio_pwritev (
+    struct io * io, unsigned long long pos,
+    const struct iovec * iov, int iovcnt)
+{
+    struct seekio * const sio = (void*)io - offsetof(struct seekio, io);
+    return iopwritev(sio->bkgio, pos, iov, iovcnt);
+}
+
+// Returns the total length of an I/O vector, or -EINVAL if _iovcnt_ is out of
+// range or the total does not fit in a long.
+
+long iovlen(const struct iovec * iov, int iovcnt) {
+    long total = 0;
+    int i;
+
+    if (iovcnt < 0 || IOV_MAX < iovcnt)
+        return -EINVAL;
+    
+    for (i = 0; i < iovcnt; i++) {
+        if (LONG_MAX - total < iov[i].len)
+            return -EINVAL;
+        total += iov[i].len;
+    }
+
+    return total;
+}
+
+// Copies the first _len_ bytes worth of I/O vector _src_ to _dst_, shortening
+// the last segment if needed. Returns the number of segments in _dst_.
+
+int iovtrim (
+    struct iovec * dst, const struct iovec * src, int iovcnt, long len)
+{
+    int i;
+
+    for (i = 0; i < iovcnt && 0 < len; i++) {
+        dst[i] = src[i];
+        if (len < dst[i].len)
+            dst[i].len = len;
+        len -= dst[i].len;
+    }
+
+    return i;
+}
+
 
 void create_pipe(struct io ** wioptr, struct io ** rioptr){
     struct pipe *p = kmalloc(sizeof(struct pipe));
@@ -565,6 +965,7 @@ void create_pipe(struct io ** wioptr, struct io ** rioptr){
     
     p->readers=1;
     p->writers=1;
+    p->pollers=NULL;
 
     struct pipeio *r=kcalloc(1,sizeof(struct pipeio));
     struct pipeio *w=kcalloc(1,sizeof(struct pipeio));
@@ -610,6 +1011,7 @@ static long pipeio_read(struct io *io, void *buf, long bufsz) {
         }
         // kprintf("read %ld bytes\n", byte_read);
         condition_broadcast(&p->write_condition);
+        pollwait_wake(p->pollers);
     }
     lock_release(&p->lock);
     return byte_read;
@@ -652,12 +1054,13 @@ static long pipeio_write(struct io *io, const void *buf, long bufsz) {
         }
         // kprintf("wrote %ld bytes\n", byte_written);
         condition_broadcast(&p->read_condition);
+        pollwait_wake(p->pollers);
     }
     lock_release(&p->lock);
     return byte_written;
 }
 
-static void pipeio_close(struct io *io) {
+static int pipeio_close(struct io *io) {
     struct pipeio *pio = (struct pipeio *)((char *)io - offsetof(struct pipeio, io));
     struct pipe *p = pio->pipe;
     lock_acquire(&p->lock);
@@ -666,12 +1069,14 @@ static void pipeio_close(struct io *io) {
         // kprintf("reader closed. Remaining readers: %d\n", p->readers);
         if(p->readers==0){
             condition_broadcast(&p->write_condition);
+            pollwait_wake(p->pollers);
         }
     }else{
         p->writers--;
         // kprintf("writer closed. Remaining writers: %d\n", p->writers);
         if(p->writers==0){
             condition_broadcast(&p->read_condition);
+            pollwait_wake(p->pollers);
         }
     }
     lock_release(&p->lock);
@@ -681,5 +1086,135 @@ static void pipeio_close(struct io *io) {
         kfree(p);
     }
     kfree(pio);
+    return 0;
+}
+
+
+static long pipeio_readv(struct io *io, const struct iovec *iov, int iovcnt) {
+    struct pipeio *pio = (struct pipeio *)((char *)io - offsetof(struct pipeio, io));
+    struct pipe *p = pio->pipe;
+    long byte_read = 0;
+    size_t off;
+    char *c;
+    int i;
+
+    lock_acquire(&p->lock);
+
+    while(p->len==0&&p->writers>0){
+        lock_release(&p->lock);
+        condition_wait(&p->read_condition);
+        lock_acquire(&p->lock);
+    }
+    //no more writers, pipe is done
+    if(p->len==0&&p->writers==0){
+        lock_release(&p->lock);
+        return -EPIPE;
+    }
+
+    // fill the segments in order with whatever is in the pipe
+    for(i=0;i<iovcnt&&p->len>0;i++){
+        c=iov[i].base;
+        for(off=0;off<iov[i].len&&p->len>0;off++){
+            c[off]=p->buffer[p->start];
+            p->start=(p->start+1)%PAGE_SIZE;
+            p->len--;
+        }
+        byte_read+=off;
+    }
+
+    condition_broadcast(&p->write_condition);
+    pollwait_wake(p->pollers);
+    lock_release(&p->lock);
+    return byte_read;
 }
 
+static long pipeio_writev(struct io *io, const struct iovec *iov, int iovcnt) {
+    struct pipeio *pio=(struct pipeio *)((char *)io - offsetof(struct pipeio, io));
+    struct pipe *p=pio->pipe;
+    long byte_written=0;
+    const char *s;
+    size_t off;
+    int i;
+
+    lock_acquire(&p->lock);
+
+    if (p->readers==0){
+        lock_release(&p->lock);
+        return -EPIPE;
+    }
+    while(p->len==PAGE_SIZE&&p->readers>0){
+        lock_release(&p->lock);
+        condition_wait(&p->write_condition);
+        lock_acquire(&p->lock);
+    }
+    if(p->len==PAGE_SIZE&&p->readers==0){
+        lock_release(&p->lock);
+        return 0;
+    }
+
+    // copy as much of the segments as fits; iowritev() calls again for the rest
+    for(i=0;i<iovcnt&&p->len<PAGE_SIZE;i++){
+        s=iov[i].base;
+        for(off=0;off<iov[i].len&&p->len<PAGE_SIZE;off++){
+            p->buffer[p->tail]=s[off];
+            p->tail=(p->tail+1)%PAGE_SIZE;
+            p->len++;
+        }
+        byte_written+=off;
+    }
+
+    condition_broadcast(&p->read_condition);
+    pollwait_wake(p->pollers);
+    lock_release(&p->lock);
+    return byte_written;
+}
+
+// The read end reports the bytes in the pipe, the write end the free space.
+// Once the other end is closed a transfer no longer blocks, so the whole
+// request is reported as available.
+
+static int pipeio_cntl(struct io *io, int cmd, void *arg) {
+    struct pipeio *pio=(struct pipeio *)((char *)io - offsetof(struct pipeio, io));
+    struct pipe *p=pio->pipe;
+    long *avail=arg;
+
+    switch(cmd){
+    case IOCTL_GETBLKSZ:
+        return 1;
+    case IOCTL_GETRDAVAIL:
+        if(pio->flag!=1)
+            return -ENOTSUP;
+        *avail=(p->writers==0)?LONG_MAX:(long)p->len;
+        return 0;
+    case IOCTL_GETWRAVAIL:
+        if(pio->flag!=0)
+            return -ENOTSUP;
+        *avail=(p->readers==0)?LONG_MAX:(long)(PAGE_SIZE-p->len);
+        return 0;
+    default:
+        return -ENOTSUP;
+    }
+}
+
+static int pipeio_poll(struct io *io, struct pollwait *pw) {
+    struct pipeio *pio=(struct pipeio *)((char *)io - offsetof(struct pipeio, io));
+    struct pipe *p=pio->pipe;
+    int events=0;
+
+    if(pio->flag==1){
+        if(p->len>0)
+            events|=POLLIN;
+        if(p->writers==0)
+            events|=POLLIN|POLLHUP;
+    }else{
+        if(p->len<PAGE_SIZE)
+            events|=POLLOUT;
+        if(p->readers==0)
+            events|=POLLOUT|POLLERR;
+    }
+
+    if(pw!=NULL)
+        pollwait_add(&p->pollers,pw);
+
+    return events;
+}
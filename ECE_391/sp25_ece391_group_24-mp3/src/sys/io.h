@@ -13,19 +13,56 @@
 //
 
 struct io; // opaque (defined in ioimpl.h)
+struct pollwait; // ioimpl.h
+
+// A struct iovec describes one segment of a scatter-gather buffer. The
+// vectored I/O functions take an array of at most IOV_MAX segments.
+
+struct iovec {
+    void * base;
+    size_t len;
+};
+
+#define IOV_MAX 16
 
 #define IOCTL_GETBLKSZ  0 // arg is ignored
 #define IOCTL_GETEND    2 // arg is unsigned long long *
 #define IOCTL_SETEND    3 // arg is const unsigned long long *
 #define IOCTL_GETPOS    4 // arg is unsigned long long *
 #define IOCTL_SETPOS    5 // arg is const unsigned long long *
+#define IOCTL_GETINO    6 // arg is unsigned long long * (file identity)
+#define IOCTL_GETRDAVAIL 7 // arg is long * (bytes readable without blocking)
+#define IOCTL_GETWRAVAIL 8 // arg is long * (bytes writable without blocking)
+#define IOCTL_GETPAGE   9 // arg is struct iopage * (page of a mapped file)
+#define IOCTL_SYNC      10 // arg is const struct iopage * (write back pages)
+
+// Argument of IOCTL_GETPAGE and IOCTL_SYNC, used by mmap. IOCTL_GETPAGE returns
+// the cached page holding file offset _pos_ in _page_ with a reference taken
+// for the caller (see get_phys_page); a NULL argument only asks whether the
+// endpoint has a page cache. IOCTL_SYNC writes the cached pages covering _len_
+// bytes at _pos_ back to the file.
+
+struct iopage {
+    unsigned long long pos; // file offset, multiple of PAGE_SIZE
+    unsigned long long len; // IOCTL_SYNC: bytes to write back
+    int write;              // IOCTL_GETPAGE: the page will be mapped writable
+    void * page;            // IOCTL_GETPAGE: the page
+};
+
+// Readiness bits returned by iopoll()
+
+#define POLLIN      0x01 // a read will not block
+#define POLLOUT     0x02 // a write will not block
+#define POLLERR     0x04 // a write will fail (no reader)
+#define POLLHUP     0x08 // the other end is closed; a read returns at once
+#define POLLNVAL    0x10 // descriptor not open (poll system call only)
 
 // EXPORTED FUNCTION DECLARATIONS
 //
 
 extern unsigned long iorefcnt(const struct io * io);
 extern struct io * ioaddref(struct io * io);
-extern void ioclose(struct io * io);
+extern int ioclose(struct io * io);
 
 extern int ioctl (
     struct io * io,
@@ -65,11 +102,50 @@ extern long iowriteat (
     long len
 );
 
+// The vectored variants transfer to or from each segment of _iov_ in order, as
+// if the segments were one contiguous buffer. ioreadv() and iopreadv() may
+// return a short count like ioread(); iowritev() writes everything like
+// iowrite(). If the endpoint does not implement a vectored operation, it is
+// emulated with the corresponding single-buffer one.
+
+extern long ioreadv (
+    struct io * io,
+    const struct iovec * iov,
+    int iovcnt
+);
+
+extern long iowritev (
+    struct io * io,
+    const struct iovec * iov,
+    int iovcnt
+);
+
+extern long iopreadv (
+    struct io * io,
+    unsigned long long pos,
+    const struct iovec * iov,
+    int iovcnt
+);
+
+extern long iopwritev (
+    struct io * io,
+    unsigned long long pos,
+    const struct iovec * iov,
+    int iovcnt
+);
+
 extern int ioseek (
     struct io * io,
     unsigned long long pos
 );
 
+// iopoll() returns the POLL* bits that currently hold for _io_. If _pw_ is not
+// NULL, it is also added to the waiters of _io_, which wakes it whenever the
+// bits may have changed until it is removed with pollwait_remove(). An
+// endpoint without a poll operation never blocks and is always ready.
+
+extern int iopoll(struct io * io, struct pollwait * pw);
+
 extern int ioblksz(struct io * io);
 extern struct io * create_memory_io(void * buf, size_t size);
 extern struct io * create_seekable_io(struct io * io);
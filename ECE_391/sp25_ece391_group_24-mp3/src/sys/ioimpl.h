@@ -12,13 +12,26 @@
 // EXPORTED TYPE DEFINITIONS
 //
 
+struct condition; // thread.h
+
+// A struct pollwait links a thread sleeping in poll to an endpoint it
+// watches. The endpoint keeps a list of them and calls pollwait_wake() on
+// every change that may make it readable or writable. All waiters of one
+// poll call share the condition it sleeps on.
+
+struct pollwait {
+    struct condition * cond; // broadcast by pollwait_wake()
+    struct pollwait * next;
+    struct pollwait ** pprev; // link that points to us, NULL if not listed
+};
+
 struct io {
     const struct iointf * intf;
     unsigned long refcnt; 
 };
 
 struct iointf {
-    void (*close) (
+    int (*close) (
         struct io * io
     );
     int (*cntl) (
@@ -48,6 +61,45 @@ struct iointf {
         const void * buf,
         long len
     );
+
+    // Optional vectored operations. The _iov_ array has already been checked
+    // by io.c: 0 < iovcnt <= IOV_MAX and the total length fits in a long.
+
+    long (*readv) (
+        struct io * io,
+        const struct iovec * iov,
+        int iovcnt
+    );
+
+    long (*writev) (
+        struct io * io,
+        const struct iovec * iov,
+        int iovcnt
+    );
+
+    long (*preadv) (
+        struct io * io,
+        unsigned long long pos,
+        const struct iovec * iov,
+        int iovcnt
+    );
+
+    long (*pwritev) (
+        struct io * io,
+        unsigned long long pos,
+        const struct iovec * iov,
+        int iovcnt
+    );
+
+    // Optional readiness operation. Returns the POLL* bits of the endpoint
+    // and, if _pw_ is not NULL, adds it to the endpoint's waiters with
+    // pollwait_add(). Called with interrupts disabled, so that no wakeup is
+    // lost between checking the state and going to sleep.
+
+    int (*poll) (
+        struct io * io,
+        struct pollwait * pw
+    );
 };
 
 // EXPORTED FUNCTION DECLARATIONS
@@ -62,4 +114,13 @@ struct iointf {
 extern struct io * ioinit0(struct io * io, const struct iointf * intf);
 extern struct io * ioinit1(struct io * io, const struct iointf * intf);
 
+// pollwait_add() puts _pw_ on waiter list _list_, pollwait_remove() takes it
+// off whatever list it is on (if any), and pollwait_wake() broadcasts the
+// condition of every waiter on _list_. The list is changed with interrupts
+// disabled, so an ISR or deferred work may call pollwait_wake().
+
+extern void pollwait_add(struct pollwait ** list, struct pollwait * pw);
+extern void pollwait_remove(struct pollwait * pw);
+extern void pollwait_wake(struct pollwait * list);
+
 #endif // _IOIMPL_H_
\ No newline at end of file
@@ -13,6 +13,7 @@
 #endif
 
 
+#include "conf.h"
 #include "heap.h"
 #include "fs.h"
 #include "ioimpl.h"
@@ -22,233 +23,414 @@
 #include "string.h"
 #include "console.h"
 #include "cache.h"
+#include "elf.h"
+#include "memory.h"
 
 // INTERNAL TYPE DEFINITIONS
 //
 
 struct ktfs_fs{
+    struct filesys filesys; // mount table entry (see fsattach)
     struct cache * cache;
     struct ktfs_file *open_file;
     struct ktfs_superblock super;
     struct io *vioblk;
     unsigned long long inode_blk_pos;
     unsigned long long data_blk_pos;
+    uint32_t inode_start;   // inodes below this may be files of the image with no flags set
+    unsigned long blksz;    // block size of the image
+    uint32_t nptrs;         // block numbers in an indirect block
+    uint32_t ndptrs;        // data blocks under a doubly indirect block
+    uint32_t ndents;        // dentries in a directory block
+    unsigned long long max_size;
+    unsigned int npages;    // pages in the page caches of the open files
+    unsigned long page_clock;
+    uint32_t jstart;        // first block of the journal, 0 for none
+    uint32_t jblocks;       // blocks in the journal
+    uint32_t jhead;         // journal block the next transaction is written at
+    uint32_t jseq;          // sequence number of the running transaction
+    uint32_t jcount;        // blocks logged in the running transaction
+    uint32_t jmax;          // most blocks a transaction logs
+    int jdepth;             // operations in progress (ktfs_journal_begin)
+    char *jbuf;             // running transaction: descriptor, block copies, commit block
+    uint32_t *jlive;        // data region blocks logged since the journal was last reset
+    uint32_t nlive;
+    uint32_t nfree;         // free data blocks, kept wherever a bitmap bit changes
+    uint32_t nreserved;     // free blocks promised to delayed blocks (ktfs_reserve)
+    uint16_t reclaim[KTFS_RECLAIM_QUEUE]; // deleted inodes whose blocks are not freed yet
+    unsigned int nreclaim;
+    int rescan;             // there may be more of them than the queue holds
+    struct lock reclaim_lock; // one ktfs_reclaim step at a time
+    struct condition reclaim_cond; // an inode was queued
+    uint32_t rbatch[KTFS_RECLAIM_BATCH]; // blocks freed by a ktfs_reclaim step
+};
+
+// A page of a file kept for mmap. The page cache holds one reference on the page
+// (see get_phys_page) and every mapping of it another, so a page with a count of
+// one is not mapped anywhere and may be evicted.
+
+struct ktfs_page {
+    struct ktfs_page *next; // next page of the same file
+    void *pp;
+    uint32_t pgno;          // page number in the file
+    int dirty;              // mapped writable since it was last written back
+    unsigned long stamp;    // last use, for LRU replacement
 };
 
 struct ktfs_file {
     // Fill to fulfill spec
     struct io io;
+    struct ktfs_fs *fs; // file system the file is on
     unsigned long long size;
     struct ktfs_dir_entry *dentry;
     uint32_t flags;
     uint32_t pos;
     struct ktfs_file *next;
     struct ktfs_dir_entry dentry_local;
+    uint32_t nalloc;    // file blocks that have a place on the device
+    uint32_t ndelay;    // blocks after those whose allocation is delayed
+    uint32_t nresv;     // blocks of fs->nreserved held for them
+    char * delay_buf;   // contents of the delayed blocks (KTFS_DELALLOC_SIZE bytes)
+    struct ktfs_page *pages; // page cache of the file, for mmap
 };
 
-static struct ktfs_fs file_sys = {
-    .cache = NULL,
-    .open_file = NULL,
-    .super = { 0 },
-    .vioblk = NULL,
-    .data_blk_pos = 0,
-    .inode_blk_pos = 0
-};
+// Pointer blocks ktfs_place_blocks may have to allocate before a data block
+
+#define KTFS_META_NONE      0
+#define KTFS_META_INDIRECT  1
+#define KTFS_META_DINDIRECT 2
+#define KTFS_META_DCHILD    3   // indirect block under a doubly indirect block
+
+#define KTFS_DELALLOC_PAGES ((KTFS_DELALLOC_SIZE + PAGE_SIZE - 1) / PAGE_SIZE)
+#define KTFS_DELALLOC_MAX(fs) (KTFS_DELALLOC_SIZE / (fs)->blksz)
+
+// Blocks an operation usually logs. A transaction with less room than this left
+// is committed when the operation that filled it ends, so operations are rarely
+// split across transactions.
+
+#define KTFS_JOURNAL_OP_BLOCKS 8
+#define KTFS_JOURNAL_PAGES ((KTFS_JOURNAL_TXSIZE + PAGE_SIZE - 1) / PAGE_SIZE)
 
+// Buffers up to this size come from the kernel heap, larger ones get pages
+
+#ifndef KTFS_HEAP_MAX
+#define KTFS_HEAP_MAX 2048
+#endif
 
 // INTERNAL FUNCTION DECLARATIONS
 //
 
 
-int ktfs_mount(struct io * io);
+int ktfs_mount(const char * path, struct io * io);
 
-int ktfs_open(const char * name, struct io ** ioptr);
-void ktfs_close(struct io* io);
+static int ktfs_open(struct filesys *fsys, const char * name, struct io ** ioptr);
+int ktfs_close(struct io* io);
 long ktfs_readat(struct io* io, unsigned long long pos, void * buf, long len);
 long ktfs_writeat(struct io* io, unsigned long long pos, const void *buf, long len);
-int ktfs_create(const char* name);
-int ktfs_delete(const char *name);
+long ktfs_preadv(struct io* io, unsigned long long pos, const struct iovec *iov, int iovcnt);
+long ktfs_pwritev(struct io* io, unsigned long long pos, const struct iovec *iov, int iovcnt);
+static int ktfs_create(struct filesys *fsys, const char* name);
+static int ktfs_delete(struct filesys *fsys, const char *name);
+static int ktfs_mkdir(struct filesys *fsys, const char *path);
 int ktfs_cntl(struct io *io, int cmd, void *arg);
+static unsigned long long ktfs_ino_id(struct ktfs_fs *fs, uint16_t index);
 
 int ktfs_getblksz(struct ktfs_file *fd);
 int ktfs_getend(struct ktfs_file *fd, void *arg);
-uint32_t ktfs_get_data_block(uint32_t block_num,struct ktfs_inode *target_inode,void **block );
-int ktfs_add_new_block(struct io *io, void * arg);
-int ktfs_update_bitmap(uint32_t block_num, int delete_or_add);
-
-int ktfs_flush(void);
+uint32_t ktfs_get_data_block(struct ktfs_fs *fs, uint32_t block_num,struct ktfs_inode *target_inode,void **block );
+static int ktfs_claim_data_block(struct ktfs_fs *fs, uint32_t block_num, struct ktfs_inode *target_inode, void **block);
+static int ktfs_data_block_pos(struct ktfs_fs *fs, uint32_t block_num, struct ktfs_inode *target_inode, unsigned long long *pos);
+static void ktfs_zero_new_block(struct ktfs_fs *fs, uint32_t data_block);
+int ktfs_add_new_block(struct ktfs_fs *fs, struct io *io, void * arg);
+int ktfs_update_bitmap(struct ktfs_fs *fs, uint32_t block_num, int delete_or_add);
+static int ktfs_file_block(struct ktfs_fs *fs, struct ktfs_file *fd, struct ktfs_inode *target_inode, uint32_t block_num, int claim, void **block);
+static int ktfs_delalloc_flush(struct ktfs_fs *fs, struct ktfs_file *fd);
+static int ktfs_reserve(struct ktfs_fs *fs, struct ktfs_file *fd, uint32_t ndelay);
+static long ktfs_place_blocks(struct ktfs_fs *fs, struct ktfs_inode *target_inode, uint32_t first, uint32_t cnt, const char *data);
+static uint32_t ktfs_place_goal(struct ktfs_fs *fs, struct ktfs_inode *target_inode, uint32_t first);
+static uint32_t ktfs_run_length(struct ktfs_fs *fs, const struct ktfs_inode *target_inode, uint32_t first, uint32_t cnt);
+static int ktfs_meta_missing(struct ktfs_fs *fs, const struct ktfs_inode *target_inode, uint32_t block_num);
+static void ktfs_meta_install(struct ktfs_fs *fs, struct ktfs_inode *target_inode, uint32_t block_num, int which, uint32_t data_block);
+static void ktfs_data_install(struct ktfs_fs *fs, struct ktfs_inode *target_inode, uint32_t block_num, uint32_t data_block);
+static int ktfs_find_run(struct ktfs_fs *fs, uint32_t goal, uint32_t want, uint32_t *got);
+static int ktfs_block_used(struct ktfs_fs *fs, uint32_t data_block, void **bitmap_block, int *bitmap_num);
+static void ktfs_mark_run(struct ktfs_fs *fs, uint32_t start, uint32_t cnt, int used);
+static int ktfs_make(struct ktfs_fs *fs, const char *path, uint32_t flags);
+static int ktfs_unlink(struct ktfs_fs *fs, const char *name);
+static int ktfs_alloc_inode(struct ktfs_fs *fs, uint32_t flags);
+static int ktfs_get_inode(struct ktfs_fs *fs, uint16_t index, void **inodes, struct ktfs_inode **inode);
+static void ktfs_put_inode(struct ktfs_fs *fs, uint16_t index, void *inodes, int write);
+static int ktfs_is_dir(struct ktfs_fs *fs, uint16_t index, const struct ktfs_inode *inode);
+static int ktfs_resolve(struct ktfs_fs *fs, const char *path, uint16_t *dir_ino, char *leaf);
+static uint32_t ktfs_dir_hash(const char *name);
+static uint32_t ktfs_dir_nblocks(struct ktfs_fs *fs, const struct ktfs_inode *dir);
+static int ktfs_dir_get(struct ktfs_fs *fs, struct ktfs_inode *dir, uint32_t block_num, unsigned long long *pos, void **block);
+static int ktfs_dirblk_find(struct ktfs_fs *fs, const struct ktfs_dir_entry *dentries, const char *name);
+static int ktfs_dir_lookup(struct ktfs_fs *fs, uint16_t dir_ino, const char *name, uint16_t *index, int remove);
+static int ktfs_dir_insert(struct ktfs_fs *fs, uint16_t dir_ino, const char *name, uint16_t index);
+static int ktfs_dir_empty(struct ktfs_fs *fs, uint16_t dir_ino);
+static int ktfs_dir_grow(struct ktfs_fs *fs, struct ktfs_inode *dir, uint32_t from, uint32_t to);
+static int ktfs_dir_split(struct ktfs_fs *fs, uint16_t dir_ino);
+static int ktfs_dir_convert(struct ktfs_fs *fs, uint16_t dir_ino);
+static void ktfs_free_entries(struct ktfs_dir_entry *entries, size_t size);
+static int ktfs_getpage(struct ktfs_fs *fs, struct ktfs_file *fd, struct iopage *pg);
+static int ktfs_page_sync(struct ktfs_fs *fs, struct ktfs_file *fd, unsigned long long pos, unsigned long long len);
+static int ktfs_page_writeback(struct ktfs_fs *fs, struct ktfs_file *fd, struct ktfs_page *page);
+static void ktfs_page_evict(struct ktfs_fs *fs);
+static void ktfs_page_drop(struct ktfs_fs *fs, struct ktfs_file *fd);
+static void ktfs_page_xferv(struct ktfs_file *fd, unsigned long long pos, const struct iovec *iov, int iovcnt, long len, int write);
+static void ktfs_meta_release(struct ktfs_fs *fs, unsigned long long pos, void *block, int through);
+static int ktfs_journal_open(struct ktfs_fs *fs);
+static int ktfs_journal_reserve(struct ktfs_fs *fs);
+static int ktfs_journal_replay(struct ktfs_fs *fs);
+static void ktfs_journal_begin(struct ktfs_fs *fs);
+static void ktfs_journal_end(struct ktfs_fs *fs);
+static void ktfs_journal_log(struct ktfs_fs *fs, unsigned long long pos, const void *block);
+static int ktfs_journal_commit(struct ktfs_fs *fs);
+static int ktfs_journal_checkpoint(struct ktfs_fs *fs);
+static int ktfs_journal_reset(struct ktfs_fs *fs);
+static int ktfs_journal_hold(void *arg, unsigned long long pos);
+static int ktfs_journal_logged(struct ktfs_fs *fs, uint32_t blkno);
+static uint32_t ktfs_journal_sum(const char *buf, unsigned long len);
+static int ktfs_write_super(struct ktfs_fs *fs);
+static void ktfs_reclaim_queue(struct ktfs_fs *fs, uint16_t index);
+static void ktfs_reclaim_drop(struct ktfs_fs *fs, uint16_t index);
+static void ktfs_reclaim_scan(struct ktfs_fs *fs);
+static int ktfs_reclaim(struct ktfs_fs *fs);
+static void ktfs_reclaim_wait(struct ktfs_fs *fs, uint32_t want);
+static void ktfs_reclaimer(struct ktfs_fs *fs);
+static uint32_t ktfs_reclaim_ptr(struct ktfs_fs *fs, uint32_t data_block, uint32_t index);
+static void ktfs_free_blocks(struct ktfs_fs *fs, uint32_t *blocks, uint32_t cnt);
+static int ktfs_sync(struct ktfs_fs *fs);
+static void ktfs_free_fs(struct ktfs_fs *fs);
+
+static int ktfs_flush(struct filesys *fsys);
+static long ktfs_xferv(struct ktfs_fs *fs, struct ktfs_file *fd, unsigned long long pos, const struct iovec *iov, int iovcnt, int write);
 
 static struct iointf ktfs_iointf = {
     .close = &ktfs_close,
     .readat = &ktfs_readat,
     .cntl = &ktfs_cntl,
-    .writeat = &ktfs_writeat
+    .writeat = &ktfs_writeat,
+    .preadv = &ktfs_preadv,
+    .pwritev = &ktfs_pwritev
+
+};
 
+static const struct fsintf ktfs_fsintf = {
+    .open = &ktfs_open,
+    .create = &ktfs_create,
+    .delete = &ktfs_delete,
+    .mkdir = &ktfs_mkdir,
+    .flush = &ktfs_flush
 };
 
 // FUNCTION ALIASES
 //
 
-int fsmount(struct io * io)
+int fsmount(const char * path, struct io * io)
     __attribute__ ((alias("ktfs_mount")));
 
-int fsopen(const char * name, struct io ** ioptr)
-    __attribute__ ((alias("ktfs_open")));
-
-int fsflush(void)
-    __attribute__ ((alias("ktfs_flush")));
-
-int fscreate(const char* name)
-    __attribute__ ((alias("ktfs_create")));
-
-int fsdelete(const char* name)
-    __attribute__ ((alias("ktfs_delete")));
-
 
 // EXPORTED FUNCTION DEFINITIONS
 //
 //==============================================================================================
-// int ktfs_mount(struct io * io)
-// inputs: struct io * io - pointer to io
+// int ktfs_mount(const char * path, struct io * io)
+// inputs: const char * path - mount point (see fsattach)
+//         struct io * io - pointer to io
 // outputs: 0:success
 //          1:invalid input
-//          2:fail to get block size
-//          3:fail to read superblock
+//          2:fail to get block size, or the block size is not supported
+//          3:fail to read superblock, or it does not describe a KTFS image
 //          4:fail to create cache
+//          5:fail to open or replay the journal
+//          or the errors of fsattach
 // description:
-//     mounts a KTFS file system through reading the superblock.
+//     mounts a KTFS file system through reading the superblock. transactions committed
+//     to the journal before a crash are replayed before anything is read through the cache.
+//     every mount has its own state and block cache, so several devices can be mounted,
+//     and its own thread freeing the blocks of deleted files (ktfs_reclaimer).
 //==============================================================================================
 
-int ktfs_mount(struct io * io)
+int ktfs_mount(const char * path, struct io * io)
 {
-    if(io == NULL){
+    if(io == NULL || path == NULL){
         return -1;
     }
-    uint32_t blksize;
-    blksize = io->intf->cntl(io, IOCTL_GETBLKSZ, &blksize);
-    if(blksize <= 0){
+    long devblksz = ioctl(io, IOCTL_GETBLKSZ, NULL);
+    if(devblksz <= 0 || devblksz > KTFS_MAX_BLKSZ){
         return -2;
     }
-    if (blksize == 1){
-        blksize = CACHE_BLKSZ;
+
+    // read superblock, it is in the first 512 bytes whatever the block size
+    unsigned long readsz = (devblksz > KTFS_BLKSZ) ? devblksz : KTFS_BLKSZ;
+    void * buf = alloc_phys_page();
+    long super = ioreadat(io, 0, buf, readsz);
+    struct ktfs_superblock sb;
+    memcpy(&sb, buf, sizeof(struct ktfs_superblock));
+    free_phys_page(buf);
+    if (super < 0 || super != readsz) {
+        return -3;
+    }
+
+    // the block size is chosen by mkfs; the cache, the pointer math and the bitmap follow it
+    unsigned long blksz = (sb.block_size != 0) ? sb.block_size : KTFS_BLKSZ;
+    if (blksz < KTFS_BLKSZ || blksz > KTFS_MAX_BLKSZ || (blksz & (blksz - 1)) != 0 || blksz % devblksz != 0) {
+        return -2;
     }
 
-    // read superblock
-    void * buf = kmalloc(CACHE_BLKSZ);
-    long super = ioreadat(io, 0, buf, CACHE_BLKSZ);
-    if (super < 0) {
+    // a zeroed or foreign disk must not get this far: block counts past the end of the
+    // image would have the bitmap scans below run for billions of bits, and
+    // ktfs_journal_reserve write to the disk
+    const unsigned long long meta = 1ULL + sb.bitmap_block_count + sb.inode_block_count;
+    if (sb.block_count <= meta || sb.inode_block_count == 0
+        || (unsigned long long)sb.bitmap_block_count * blksz * 8 < sb.block_count //bits are by device block
+        || sb.root_directory_inode >= (unsigned long long)sb.inode_block_count * (blksz / KTFS_INOSZ)) {
         return -3;
     }
-    if( super != CACHE_BLKSZ){
-        return super;
+    struct ktfs_fs * fs = kcalloc(1, sizeof(struct ktfs_fs));
+    if (fs == NULL) {
+        return -4;
+    }
+    fs->super = sb;
+    fs->blksz = blksz;
+    fs->nptrs = KTFS_NUM_INDIRECT_BLOCKS_COUNT(blksz);
+    fs->ndptrs = KTFS_NUM_DINDIRECT_BLOCKS_COUNT(blksz);
+    fs->ndents = KTFS_NUM_DIR_ENTRIES_PER_BLOCK(blksz);
+    fs->max_size = KTFS_MAX_FILE_SIZE(blksz);
+    if (fs->max_size > UINT32_MAX) { // inode sizes are 32 bits
+        fs->max_size = UINT32_MAX;
     }
-    struct ktfs_superblock sb;
-    memcpy(&sb, buf, sizeof(struct ktfs_superblock) < 14 ? sizeof(struct ktfs_superblock) : 14);
-    file_sys.super = sb;
-    if (create_cache(io, &file_sys.cache) != 0){
+    if (create_cache(io, blksz, &fs->cache) != 0){
+        ktfs_free_fs(fs);
         return -4;
     }
-    file_sys.vioblk = io;
-    file_sys.inode_blk_pos = (1 + file_sys.super.bitmap_block_count) * blksize;
-    file_sys.data_blk_pos = file_sys.inode_blk_pos + file_sys.super.inode_block_count * blksize;
-    kfree(buf);
+    fs->vioblk = io;
+    fs->inode_blk_pos = (1 + fs->super.bitmap_block_count) * blksz;
+    fs->data_blk_pos = fs->inode_blk_pos + fs->super.inode_block_count * blksz;
+    if (ktfs_journal_open(fs) != 0) {
+        ktfs_free_fs(fs);
+        return -5;
+    }
 
+    // mkfs_ktfs leaves the flags of its files zero, so an empty one looks free. a root
+    // directory still in its linear form gives their number; ktfs_dir_convert marks them.
+    void * inodes = NULL;
+    struct ktfs_inode * root_inode;
+    if (ktfs_get_inode(fs, fs->super.root_directory_inode, &inodes, &root_inode) != 0) {
+        ktfs_free_fs(fs);
+        return -3;
+    }
+    if ((root_inode->flags & KTFS_FILE_HASHED) == 0) {
+        fs->inode_start = root_inode->size / KTFS_DENSZ;
+    }
+    cache_release_block(fs->cache, inodes, 0);
+
+    // count the free data blocks, and look for files a crash left half reclaimed
+    uint32_t ndata = fs->super.block_count - fs->data_blk_pos / fs->blksz;
+    void * bitmap_block = NULL;
+    int bitmap_num = -1;
+    fs->nfree = 0;
+    for (uint32_t blk = 0; blk < ndata; blk++) {
+        fs->nfree += !ktfs_block_used(fs, blk, &bitmap_block, &bitmap_num);
+    }
+    if (bitmap_block != NULL) {
+        cache_release_block(fs->cache, bitmap_block, 0);
+    }
+    lock_init(&fs->reclaim_lock);
+    condition_init(&fs->reclaim_cond, "ktfs reclaim");
+    fs->rescan = 1;
+
+    fs->filesys.intf = &ktfs_fsintf;
+    int result = fsattach(path, &fs->filesys);
+    if (result != 0) {
+        ktfs_free_fs(fs);
+        return result;
+    }
+    // without the thread, deleted files are reclaimed as space runs out and at flush
+    thread_spawn("ktfs reclaim", (void(*)(void))ktfs_reclaimer, (uint64_t)fs);
     return 0;
 }
 //==============================================================================================
-// int ktfs_open(const char * name, struct io ** ioptr)
-// inputs: const char * name:name of the file
+// int ktfs_open(struct filesys *fsys, const char * name, struct io ** ioptr)
+// inputs: const char * name:path of the file, relative to the root directory
 //         struct io ** ioptr:output io pointer
 // outputs: int 0:success
-//              ENOENT:invlid input 
+//              ENOENT:invlid input or no such file
 //              EBUSY:file already open
+//              EINVAL:the path names a directory
 // description:
-//     open a file in ktfs through searching directory entry in the root directory inode.
+//     open a file in ktfs through looking up each directory on its path, starting at
+//     the root directory inode.
 //==============================================================================================
 
 
-int ktfs_open(const char * name, struct io ** ioptr)
+static int ktfs_open(struct filesys *fsys, const char * name, struct io ** ioptr)
 {
+    struct ktfs_fs * const fs = (void*)fsys - offsetof(struct ktfs_fs, filesys);
     if (name == NULL || ioptr == NULL) {
         return -ENOENT;
     }
 
+    // find the inode of the file
+    char leaf[KTFS_MAX_FILENAME_LEN + 1];
+    uint16_t dir_ino;
+    uint16_t index;
+    int result = ktfs_resolve(fs, name, &dir_ino, leaf);
+    if (result < 0) {
+        return result;
+    }
+    if (ktfs_dir_lookup(fs, dir_ino, leaf, &index, 0) != 0) {
+        return -ENOENT;
+    }
+
     // check if the file is opened
-    struct ktfs_file * cur = file_sys.open_file;
+    struct ktfs_file * cur = fs->open_file;
     while (cur != NULL) {
-        if (strcmp(name, cur->dentry->name) == 0) {
+        if (cur->dentry_local.inode == index) {
             return -EBUSY;
         }
         cur = cur->next;
     }
 
-    struct ktfs_file *fd = kmalloc(sizeof(struct ktfs_file));
-    fd->size = 0;
-    fd->dentry = NULL;
-    fd->pos = 0;
-    fd->flags = 0;
-    fd->next = NULL;
-
-    // extract inodes block from cache
+    // find file size, directories are not opened as files
     void * inodes = NULL;
-    uint32_t root_dir_inode_block_pos = file_sys.super.root_directory_inode / (CACHE_BLKSZ / sizeof(struct ktfs_inode)) * CACHE_BLKSZ; 
-    uint32_t root_dir_inode_block_offset = file_sys.super.root_directory_inode % (CACHE_BLKSZ / sizeof(struct ktfs_inode));
-    cache_get_block(file_sys.cache, file_sys.inode_blk_pos + root_dir_inode_block_pos, &inodes);
-    cache_release_block(file_sys.cache, inodes, 0);
-    struct ktfs_inode * root_inode_block = inodes;
-    
-    // try to find file dentry in direct block
-    void * dentries_ptr = NULL;
-    for (int i = 0; i < KTFS_NUM_DIRECT_DATA_BLOCKS; ++i){
-        cache_get_block(file_sys.cache, file_sys.data_blk_pos + root_inode_block[root_dir_inode_block_offset].block[i] * CACHE_BLKSZ, &dentries_ptr);
-        struct ktfs_dir_entry * dentries = dentries_ptr;
-        for (int j = 0; j < CACHE_BLKSZ / sizeof(struct ktfs_dir_entry); ++j){
-            if (strcmp(name, dentries[j].name) == 0){
-                memcpy(&fd->dentry_local, &dentries[j], sizeof(struct ktfs_dir_entry));
-                fd->dentry = &fd->dentry_local;
-                
-                break;
-            }
-        }
-        cache_release_block(file_sys.cache, dentries, 0);
-        if (fd->dentry != NULL){
-            break;
-        }
+    struct ktfs_inode * target_inode;
+    if (ktfs_get_inode(fs, index, &inodes, &target_inode) != 0) {
+        return -EIO;
     }
-
-
-    // check if the file is found
-    if (fd->dentry == NULL) {
-        //cache_release_block(file_sys.cache, inodes, 0);
-        kfree(fd);
-        return -ENOENT;
+    uint32_t size = target_inode->size;
+    int is_dir = ktfs_is_dir(fs, index, target_inode);
+    cache_release_block(fs->cache, inodes, 0);
+    if (is_dir) {
+        return -EINVAL;
     }
 
-    // find file size
-    void *inode_again = NULL;
-    uint16_t index = fd->dentry->inode;
-    int inode_num = index / (CACHE_BLKSZ / sizeof(struct ktfs_inode));
-    int inode_offset = index % (CACHE_BLKSZ / sizeof(struct ktfs_inode));
-    struct ktfs_inode * actual_inodes = inodes;
-    if(inode_num != 0){
-        cache_get_block(file_sys.cache, file_sys.inode_blk_pos + inode_num, &inode_again);
-        actual_inodes = inode_again;
-        fd->size = actual_inodes[inode_offset].size;
-        cache_release_block(file_sys.cache, inode_again, 0);
-    }else{
-        fd->size = actual_inodes[inode_offset].size;
-       // cache_release_block(file_sys.cache, inodes, 0);
-    }
+    struct ktfs_file *fd = kmalloc(sizeof(struct ktfs_file));
+    fd->fs = fs;
+    fd->size = size;
+    fd->pos = 0;
+    fd->flags = 0;
+    fd->next = NULL;
+    fd->nalloc = (fd->size + fs->blksz - 1) / fs->blksz;
+    fd->ndelay = 0;
+    fd->nresv = 0;
+    fd->delay_buf = NULL;
+    fd->pages = NULL;
+    memset(&fd->dentry_local, 0, sizeof(struct ktfs_dir_entry));
+    memcpy(fd->dentry_local.name, leaf, strlen(leaf) + 1); //ktfs_resolve keeps it to KTFS_MAX_FILENAME_LEN
+    fd->dentry_local.inode = index;
+    fd->dentry = &fd->dentry_local;
 
     // assign io interface
     ioinit0(&fd->io, &ktfs_iointf);
     struct io *smio = create_seekable_io(&fd->io);  
     *ioptr = smio;
     // add file to open file list
-    if (file_sys.open_file == NULL) {
-        file_sys.open_file = fd;
+    if (fs->open_file == NULL) {
+        fs->open_file = fd;
     } else {
-        struct ktfs_file * cur = file_sys.open_file;
+        struct ktfs_file * cur = fs->open_file;
         while (cur->next != NULL) {
             cur = cur->next;
         }
@@ -260,32 +442,43 @@ int ktfs_open(const char * name, struct io ** ioptr)
 //==============================================================================================
 // void ktfs_close(struct io* io)
 // inputs: struct io * io: io returned by open
-// outputs: none
+// outputs: 0, or the error of ktfs_delalloc_flush if delayed blocks could not be placed
 // description:
-//     close a file in ktfs and remove it from the open file list.
+//     close a file in ktfs and remove it from the open file list. the pages of its
+//     page cache are written back, then blocks whose allocation was delayed are placed
+//     on the device. a mapping holds a reference to the file, so none of its pages is
+//     mapped any more.
 //==============================================================================================
 
-void ktfs_close(struct io* io)
+int ktfs_close(struct io* io)
 {
+    int result = 0;
     if (io == NULL) {
-        return;
+        return -EINVAL;
     }
     struct ktfs_file *fd = (struct ktfs_file *)((char *)io - offsetof(struct ktfs_file, io));
-    struct ktfs_file * cur = file_sys.open_file;
+    struct ktfs_fs * const fs = fd->fs;
+    struct ktfs_file * cur = fs->open_file;
     struct ktfs_file * prev = NULL;
     while (cur != NULL) {
         if (cur->dentry_local.inode == fd->dentry_local.inode) {
             if (prev == NULL) {
-                file_sys.open_file = cur->next;
+                fs->open_file = cur->next;
             } else {
                 prev->next = cur->next;
             }
+            ktfs_page_drop(fs, cur);
+            result = ktfs_delalloc_flush(fs, cur);
+            if (cur->delay_buf != NULL) {
+                free_phys_pages(cur->delay_buf, KTFS_DELALLOC_PAGES);
+            }
             kfree(cur);
             break;
         }
         prev = cur;
         cur = cur->next;
     }
+    return result;
 }
 
 
@@ -304,6 +497,7 @@ void ktfs_close(struct io* io)
 long ktfs_readat(struct io* io, unsigned long long pos, void * buf, long len)
 {
     struct ktfs_file *fd = (struct ktfs_file *)((char *)io - offsetof(struct ktfs_file, io));
+    struct ktfs_fs * const fs = fd->fs;
     if (fd == NULL || buf == NULL || len <= 0) {
         return -EINVAL;
     }
@@ -319,332 +513,215 @@ long ktfs_readat(struct io* io, unsigned long long pos, void * buf, long len)
     // find the inode
     uint16_t index = fd->dentry->inode;
     void * inodes = NULL;
-    int inode_num = index / (CACHE_BLKSZ / sizeof(struct ktfs_inode));
-    int inode_offset = index % (CACHE_BLKSZ / sizeof(struct ktfs_inode));
-    cache_get_block(file_sys.cache, file_sys.inode_blk_pos + inode_num * CACHE_BLKSZ, &inodes);
+    int inode_num = index / (fs->blksz / sizeof(struct ktfs_inode));
+    int inode_offset = index % (fs->blksz / sizeof(struct ktfs_inode));
+    if(cache_get_block(fs->cache, fs->inode_blk_pos + inode_num * fs->blksz, &inodes) != 0){
+        return -EIO;
+    }
     struct ktfs_inode * actual_inodes = inodes; 
-    struct ktfs_inode *target_inode = &actual_inodes[inode_offset];
-    cache_release_block(file_sys.cache, inodes, 0);
+    struct ktfs_inode target_inode = actual_inodes[inode_offset]; //the block may be evicted once released
+    cache_release_block(fs->cache, inodes, 0);
 
     // find the block number to read
-    uint32_t block_num = pos / KTFS_BLKSZ;
-    uint32_t block_offset = pos % KTFS_BLKSZ;
+    uint32_t block_num = pos / fs->blksz;
+    uint32_t block_offset = pos % fs->blksz;
 
     long long bits_read = 0;
     // read the block, until reach the len
     while (bits_read < len) {
        void *block = NULL;
-       if(ktfs_get_data_block(block_num, target_inode, &block) <0){
+       int staged = ktfs_file_block(fs, fd, &target_inode, block_num, 0, &block);
+       if(staged <0){
         return -EIO;
        }
         // read the data from the block
         char * actual_block = block;
-        if(len - bits_read< KTFS_BLKSZ-block_offset){
+        if(len - bits_read< fs->blksz-block_offset){
             uint32_t read_len = len - bits_read;
             memcpy(new_buf+bits_read, actual_block + block_offset, read_len);
             bits_read += read_len;
-            //cache_release_block(file_sys.cache, block, 0);
-        // }else if (len - bits_read < KTFS_BLKSZ){
+            //cache_release_block(fs->cache, block, 0);
+        // }else if (len - bits_read < fs->blksz){
         //     uint32_t read_len = len - bits_read;
         //     memcpy(new_buf+bits_read, actual_block + block_offset, read_len);
         //     bits_read += read_len;
-        //     //cache_release_block(file_sys.cache, block, 0);
+        //     //cache_release_block(fs->cache, block, 0);
         }else{
-            uint32_t read_len = KTFS_BLKSZ - block_offset;
+            uint32_t read_len = fs->blksz - block_offset;
             memcpy(new_buf+bits_read, actual_block + block_offset, read_len);
             bits_read += read_len;
-           // cache_release_block(file_sys.cache, block, 0);
+           // cache_release_block(fs->cache, block, 0);
+        }
+        if(staged == 0){
+            cache_release_block(fs->cache, block, 0);
         }
-        cache_release_block(file_sys.cache, block, 0);
         block_offset = 0; 
         block_num++;
     
     }
+    // stores through a mapping are newer than the blocks
+    struct iovec iov = { .base = buf, .len = bits_read };
+    ktfs_page_xferv(fd, pos, &iov, 1, bits_read, 0);
     return bits_read;
 }
 
 //==============================================================================================
-// int ktfs_create(const char* name)
-// inputs: const char* name: name of the file to create
+// int ktfs_create(struct filesys *fsys, const char* name)
+// inputs: const char* name: path of the file to create
 // outputs: int 0: success
-//              EINVAL: if input is invalid or creation fails
+//              EINVAL: if input is invalid or the name is taken
+//              ENOENT: if a directory on the path does not exist
+//              ENOINODEBLKS: if no inode is free
 // description:
-//     creates a new empty file with the given name in the root directory's dentries
+//     creates a new empty file with the given name in its directory's dentries
 //     and allocate a empty inode for use
 //==============================================================================================
 
-int ktfs_create(const char* name){
+static int ktfs_create(struct filesys *fsys, const char* name){
+    struct ktfs_fs * const fs = (void*)fsys - offsetof(struct ktfs_fs, filesys);
+    return ktfs_make(fs, name, KTFS_FILE_IN_USE);
+}
+
+//==============================================================================================
+// int ktfs_mkdir(struct filesys *fsys, const char* path)
+// inputs: const char* path: path of the directory to create
+// outputs: int 0: success, or the errors of ktfs_create
+// description:
+//     creates a new empty directory. it is hashed from the start and gets its first
+//     bucket block when the first entry is added.
+//==============================================================================================
+
+static int ktfs_mkdir(struct filesys *fsys, const char* path){
+    struct ktfs_fs * const fs = (void*)fsys - offsetof(struct ktfs_fs, filesys);
+    return ktfs_make(fs, path, KTFS_FILE_IN_USE | KTFS_FILE_DIR | KTFS_FILE_HASHED);
+}
+
+//==============================================================================================
+// int ktfs_make(struct ktfs_fs *fs, const char* path, uint32_t flags)
+// inputs: const char* path: path of the new inode
+//         uint32_t flags: KTFS_FILE_* flags of the new inode
+// outputs: int 0: success, or the errors of ktfs_create
+// description:
+//     allocates an inode and enters it in the directory the path leads to, as one
+//     journal transaction. when no inode is free, deleted files are reclaimed first.
+//==============================================================================================
 
-    if( name == NULL || strlen(name) > KTFS_MAX_FILENAME_LEN){
+static int ktfs_make(struct ktfs_fs *fs, const char* path, uint32_t flags){
+    if(path == NULL){
         return -EINVAL;
     }
-
-    //get directory inode
-    void * inodes = NULL;
-    uint32_t root_dir_inode_block_pos = file_sys.super.root_directory_inode / (CACHE_BLKSZ / sizeof(struct ktfs_inode)) * CACHE_BLKSZ; 
-    uint32_t root_dir_inode_block_offset = file_sys.super.root_directory_inode % (CACHE_BLKSZ / sizeof(struct ktfs_inode));
-    cache_get_block(file_sys.cache, file_sys.inode_blk_pos + root_dir_inode_block_pos, &inodes);
-    cache_release_block(file_sys.cache, inodes, 0);
-    struct ktfs_inode * root_inode_block = inodes;
-    int inode_start = root_inode_block->size / KTFS_DENSZ;
-    int dentrie_index = -1;
-    int direct_index = -1;
-    
-    // try to find empty file dentry
-    void * dentries_ptr = NULL;
-    for (int i = 0; i < KTFS_NUM_DIRECT_DATA_BLOCKS; ++i){
-        cache_get_block(file_sys.cache, file_sys.data_blk_pos + root_inode_block[root_dir_inode_block_offset].block[i] * CACHE_BLKSZ, &dentries_ptr);
-        struct ktfs_dir_entry * dentries = dentries_ptr;
-        for ( int j = 0; j < CACHE_BLKSZ / sizeof(struct ktfs_dir_entry); ++j){
-            if (strcmp(name, dentries[j].name) == 0){
-                cache_release_block(file_sys.cache, dentries_ptr, 0);
-                return -EINVAL;
-            }else if( dentries[j].name[0]=='\0'){
-                dentrie_index = j;
-                direct_index = i;
-                break;
-            }
-        }
-        cache_release_block(file_sys.cache, dentries_ptr, 0);
-        if(dentrie_index >=0 && direct_index >=0){
-            break;
-        }
+    char leaf[KTFS_MAX_FILENAME_LEN + 1];
+    uint16_t dir_ino;
+    uint16_t index;
+    int result = ktfs_resolve(fs, path, &dir_ino, leaf);
+    if(result < 0){
+        return result;
     }
-        
-    if( dentrie_index <0 && direct_index <0){
+    if(ktfs_dir_lookup(fs, dir_ino, leaf, &index, 0) == 0){
         return -EINVAL;
     }
-    //try to find empty inode
-    int inode_count = -1;
-    struct ktfs_inode * inode_block = NULL;
-    for(int i =0; i < file_sys.super.inode_block_count; i ++){
-        cache_get_block(file_sys.cache, file_sys.inode_blk_pos + KTFS_BLKSZ*i, &inodes);
-        inode_block = inodes;
-        int j =0;
-        if(i ==0){
-            j = inode_start;
-        }
-        for(; j < KTFS_BLKSZ / sizeof(struct ktfs_inode); j ++){
-            if(inode_block[j].flags == 0 && inode_block[j].size == 0){
-                inode_count = (KTFS_BLKSZ / sizeof(struct ktfs_inode)) * i + j;
-                memset(&inode_block[j], 0, sizeof(struct ktfs_inode));
-                inode_block[j].flags = 1;
-                break;
-            }
-        }
-        //found inode, force a write to disk
-        if(inode_count >=0){
-            iowriteat(file_sys.vioblk,file_sys.inode_blk_pos + KTFS_BLKSZ*i , inodes, CACHE_BLKSZ);
-            cache_release_block(file_sys.cache, inodes, 0);
-           
-            break;
+    ktfs_reclaim_wait(fs, 1); //for the directory to grow
+    ktfs_journal_begin(fs);
+    int inode_count = ktfs_alloc_inode(fs, flags);
+    if(inode_count == -ENOINODEBLKS){ //nothing is logged yet, reclaim between operations
+        ktfs_journal_end(fs);
+        while(ktfs_reclaim(fs) > 0){
+            continue;
         }
-        cache_release_block(file_sys.cache, inodes, 0);
+        ktfs_journal_begin(fs);
+        inode_count = ktfs_alloc_inode(fs, flags);
     }
-    if(inode_count <0){
-        return -EINVAL;
+    if(inode_count < 0){
+        ktfs_journal_end(fs);
+        return inode_count;
     }
-    
-    //update found dentry block with filename and inode number
-    cache_get_block(file_sys.cache, file_sys.data_blk_pos + root_inode_block[root_dir_inode_block_offset].block[direct_index] * CACHE_BLKSZ, &dentries_ptr);
-    struct ktfs_dir_entry * dentries = dentries_ptr;
-    memcpy(dentries[dentrie_index].name, name, strlen(name));
-    dentries[dentrie_index].name[KTFS_MAX_FILENAME_LEN - 1] = '\0';
-    dentries[dentrie_index].inode = inode_count;
-    //force a write to disk
-    iowriteat(file_sys.vioblk,file_sys.data_blk_pos + root_inode_block[root_dir_inode_block_offset].block[direct_index] * CACHE_BLKSZ , dentries_ptr, CACHE_BLKSZ);
-    cache_release_block(file_sys.cache, dentries_ptr, 0);
-
-    return 0;
+    result = ktfs_dir_insert(fs, dir_ino, leaf, inode_count);
+    if(result < 0){ //give the inode back
+        void * inodes = NULL;
+        struct ktfs_inode * target_inode;
+        if(ktfs_get_inode(fs, inode_count, &inodes, &target_inode) == 0){
+            target_inode->flags = KTFS_FILE_FREE;
+            ktfs_put_inode(fs, inode_count, inodes, 1);
+        }
+    }
+    ktfs_journal_end(fs);
+    return (result < 0) ? result : 0;
 }
 
 
 //==============================================================================================
-// int ktfs_delete(const char* name)
-// inputs: const char* name: name of the file to delete
+// int ktfs_delete(struct filesys *fsys, const char* name)
+// inputs: const char* name: path of the file or directory to delete
 // outputs: int 0: success
-//              EINVAL: if input is invalid or deletion fails
+//              EINVAL: if input is invalid or there is no such file
+//              EBUSY: if the path names the root or a directory that is not empty
 // description:
-//     deletes the file with the given name from the root directory's dentries 
-//     and frees its data blocks in the inode
+//     deletes the file with the given name from its directory's dentries and flags
+//     its inode KTFS_FILE_RECLAIM, as one journal transaction. this takes the same time
+//     for any file: the data blocks are freed afterwards by ktfs_reclaim.
 //==============================================================================================
-int ktfs_delete(const char *name){
-    if( name == NULL || strlen(name) > KTFS_MAX_FILENAME_LEN){
+static int ktfs_delete(struct filesys *fsys, const char *name){
+    struct ktfs_fs * const fs = (void*)fsys - offsetof(struct ktfs_fs, filesys);
+    ktfs_journal_begin(fs);
+    int result = ktfs_unlink(fs, name);
+    ktfs_journal_end(fs);
+    return result;
+}
+
+//==============================================================================================
+// int ktfs_unlink(struct ktfs_fs *fs, const char* name)
+// inputs: const char* name: path of the file or directory to delete
+// outputs: int 0: success, or the errors of ktfs_delete
+// description:
+//     does the work of ktfs_delete.
+//==============================================================================================
+static int ktfs_unlink(struct ktfs_fs *fs, const char *name){
+    if( name == NULL){
+        return -EINVAL;
+    }
+    char leaf[KTFS_MAX_FILENAME_LEN + 1];
+    uint16_t dir_ino;
+    uint16_t index;
+    if(ktfs_resolve(fs, name, &dir_ino, leaf) < 0 || ktfs_dir_lookup(fs, dir_ino, leaf, &index, 0) != 0){
         return -EINVAL;
     }
 
-    struct ktfs_file *cur = file_sys.open_file;
+    //a directory goes only when it is empty
+    void * inodes = NULL;
+    struct ktfs_inode * dir_inode;
+    if(ktfs_get_inode(fs, index, &inodes, &dir_inode) != 0){
+        return -EIO;
+    }
+    int is_dir = ktfs_is_dir(fs, index, dir_inode);
+    cache_release_block(fs->cache, inodes, 0);
+    if(is_dir && (index == fs->super.root_directory_inode || !ktfs_dir_empty(fs, index))){
+        return -EBUSY;
+    }
+
+    struct ktfs_file *cur = fs->open_file;
     //check if file is currently open, if it is, close it
     while (cur != NULL) {
-        if (cur->dentry != NULL && strncmp(cur->dentry->name, name, KTFS_MAX_FILENAME_LEN) == 0) {
+        if (cur->dentry_local.inode == index) {
             ioclose(&cur->io);
             break;
         }
     cur = cur->next;
     }
 
-    //find directory inode
-    void * inodes = NULL;
-    uint32_t root_dir_inode_block_pos = file_sys.super.root_directory_inode / (CACHE_BLKSZ / sizeof(struct ktfs_inode)) * CACHE_BLKSZ; 
-    uint32_t root_dir_inode_block_offset = file_sys.super.root_directory_inode % (CACHE_BLKSZ / sizeof(struct ktfs_inode));
-    cache_get_block(file_sys.cache, file_sys.inode_blk_pos + root_dir_inode_block_pos, &inodes);
-    cache_release_block(file_sys.cache, inodes, 0);
-    struct ktfs_inode * root_inode_block = inodes;
-    int inode_num = -1;
-    
-    // try to find the dentry with the same name
-    void * dentries_ptr = NULL;
-    for (int i = 0; i < KTFS_NUM_DIRECT_DATA_BLOCKS; ++i){
-        cache_get_block(file_sys.cache, file_sys.data_blk_pos + root_inode_block[root_dir_inode_block_offset].block[i] * CACHE_BLKSZ, &dentries_ptr);
-        struct ktfs_dir_entry * dentries = dentries_ptr;
-        for ( int j = 0; j < CACHE_BLKSZ / sizeof(struct ktfs_dir_entry); ++j){
-            if (strcmp(name, dentries[j].name) == 0){ //found the corresponding dentrie, zero everything and bring the last dentry into its place, to maintain the array
-                inode_num = dentries[j].inode;
-                memcpy(dentries[j].name,dentries[CACHE_BLKSZ / sizeof(struct ktfs_dir_entry) -1].name, KTFS_MAX_FILENAME_LEN);
-                dentries[j].inode = dentries[CACHE_BLKSZ / sizeof(struct ktfs_dir_entry) -1].inode;
-                memset(dentries[CACHE_BLKSZ / sizeof(struct ktfs_dir_entry) -1].name, 0, KTFS_MAX_FILENAME_LEN);
-                dentries[CACHE_BLKSZ / sizeof(struct ktfs_dir_entry) -1].inode = 0;
-                iowriteat(file_sys.vioblk,file_sys.data_blk_pos + root_inode_block[root_dir_inode_block_offset].block[i] * CACHE_BLKSZ , dentries_ptr, CACHE_BLKSZ);
-                cache_release_block(file_sys.cache, dentries_ptr, 0);
-             
-                break;
-            }
-        }
-        if(inode_num >= 0){
-            break;
-        }
-        cache_release_block(file_sys.cache, dentries_ptr, 0);
-    }
-
-    if(inode_num <0){
+    //remove the dentry
+    if(ktfs_dir_lookup(fs, dir_ino, leaf, &index, 1) != 0){
         return -EINVAL;
     }
-    //find the inode of the file
-    void * data_inodes = NULL;
-    int inode_block = inode_num / (CACHE_BLKSZ / sizeof(struct ktfs_inode));
-    int inode_offset = inode_num % (CACHE_BLKSZ / sizeof(struct ktfs_inode));
-    cache_get_block(file_sys.cache, file_sys.inode_blk_pos + inode_block * CACHE_BLKSZ, &data_inodes);
-    struct ktfs_inode * actual_inodes = data_inodes; 
-    struct ktfs_inode *target_inode = &actual_inodes[inode_offset];
-    
-    int finished = 0;
-    //free all indirect and dindirect themselves and direct blocks
-    for(int i =0; i < KTFS_NUM_DIRECT_DATA_BLOCKS; i++){
-        if(target_inode->block[i] != 0){
-            ktfs_update_bitmap(target_inode->block[i],0);
-        }else{
-            finished = 1;
-            break;
-        }
-    }
-    //free all indirect
-    if(target_inode->indirect != 0 && finished == 0){
-        void * indirect_block_ptr = NULL;
-        cache_get_block(file_sys.cache, file_sys.data_blk_pos + target_inode->indirect * CACHE_BLKSZ, &indirect_block_ptr);
-        uint32_t * direct_blocks = indirect_block_ptr;
-        for(int i =0; i < KTFS_NUM_INDIRECT_BLOCKS_COUNT; i++){
-            if(direct_blocks[i] != 0){
-                ktfs_update_bitmap(direct_blocks[i],0);
-            }else{
-                finished = 1;
-                memset(direct_blocks, 0, KTFS_NUM_INDIRECT_BLOCKS_COUNT);
-                break;
-            }
-        }
-        iowriteat(file_sys.vioblk,file_sys.data_blk_pos + target_inode->indirect * CACHE_BLKSZ , indirect_block_ptr, CACHE_BLKSZ);
-        cache_release_block(file_sys.cache, indirect_block_ptr, 0);
-    }
-    //free all double indirect index 0
-    if(target_inode->dindirect[0] != 0&& finished == 0){
-        void * dindirect_block_ptr = NULL;
-        cache_get_block(file_sys.cache, file_sys.data_blk_pos + target_inode->dindirect[0] * CACHE_BLKSZ, &dindirect_block_ptr);
-        uint32_t * indirect_blocks = dindirect_block_ptr;
-        for(int i =0; i < KTFS_NUM_INDIRECT_BLOCKS_COUNT && finished ==0; i++){ //for loop for all the indirect 
-            if(indirect_blocks[i]!= 0){
-                void * indirect_block_ptr = NULL;
-                cache_get_block(file_sys.cache, file_sys.data_blk_pos + indirect_blocks[i] * CACHE_BLKSZ, &indirect_block_ptr);
-                uint32_t * direct_blocks = indirect_block_ptr;
-                for(int j =0; j < KTFS_NUM_INDIRECT_BLOCKS_COUNT&& finished ==0; j++){//for loop for all the direct
-                    if(direct_blocks[j] != 0){
-                        ktfs_update_bitmap(direct_blocks[j],0);
-                    }else{
-                        memset(direct_blocks, 0, KTFS_NUM_INDIRECT_BLOCKS_COUNT);// must also clear the indirect content
-                        finished = 1;
-                        break;
-                    }
-                }
-                ktfs_update_bitmap(indirect_blocks[i],0);
-                iowriteat(file_sys.vioblk,file_sys.data_blk_pos + indirect_blocks[i] * CACHE_BLKSZ , indirect_block_ptr, CACHE_BLKSZ);
-                cache_release_block(file_sys.cache, indirect_block_ptr, 0);
-            }else{
-                finished = 1;
-                memset(indirect_blocks, 0, KTFS_NUM_INDIRECT_BLOCKS_COUNT); // finished, clear all the indirect pointers of doubleindrect[0]
-                ktfs_update_bitmap(target_inode->dindirect[0],0);
-                break;
-            }
-        }
-        //force write back to disk
-        iowriteat(file_sys.vioblk,file_sys.data_blk_pos + target_inode->dindirect[0] * CACHE_BLKSZ , dindirect_block_ptr, CACHE_BLKSZ);
-        cache_release_block(file_sys.cache, dindirect_block_ptr, 0);
-    
-    }
-    //free all double indirect[1], same logic as above
-    if(target_inode->dindirect[1] != 0&& finished == 0){
-        void * dindirect_block_ptr = NULL;
-        cache_get_block(file_sys.cache, file_sys.data_blk_pos + target_inode->dindirect[1] * CACHE_BLKSZ, &dindirect_block_ptr);
-        uint32_t * indirect_blocks = dindirect_block_ptr;
-        for(int i =0; i < KTFS_NUM_INDIRECT_BLOCKS_COUNT && finished ==0; i++){
-            if(indirect_blocks[i]!= 0){
-                void * indirect_block_ptr = NULL;
-                cache_get_block(file_sys.cache, file_sys.data_blk_pos + indirect_blocks[i] * CACHE_BLKSZ, &indirect_block_ptr);
-                uint32_t * direct_blocks = indirect_block_ptr;
-                for(int j =0; j < KTFS_NUM_INDIRECT_BLOCKS_COUNT&& finished ==0; j++){
-                    if(direct_blocks[j] != 0){
-                        ktfs_update_bitmap(direct_blocks[j],0);
-                    }else{
-                        memset(direct_blocks, 0, KTFS_NUM_INDIRECT_BLOCKS_COUNT);
-                        finished = 1;
-                        break;
-                    }
-                }
-                ktfs_update_bitmap(indirect_blocks[i],0);
-                iowriteat(file_sys.vioblk,file_sys.data_blk_pos + indirect_blocks[i] * CACHE_BLKSZ , indirect_block_ptr, CACHE_BLKSZ);
-                cache_release_block(file_sys.cache, indirect_block_ptr, 0);
-            }else{
-                finished = 1;
-                memset(indirect_blocks, 0, KTFS_NUM_INDIRECT_BLOCKS_COUNT);
-                ktfs_update_bitmap(target_inode->dindirect[0],0);
-                break;
-            }
-        }
-        iowriteat(file_sys.vioblk,file_sys.data_blk_pos + target_inode->dindirect[1] * CACHE_BLKSZ , dindirect_block_ptr, CACHE_BLKSZ);
-        cache_release_block(file_sys.cache, dindirect_block_ptr, 0);
-    
-    }
+    elf_cache_invalidate(ktfs_ino_id(fs, index)); // drop cached text of the file
 
-    //free the indirect and double indirect blocks 
-    if(target_inode->indirect!= 0){
-        ktfs_update_bitmap(target_inode->indirect,0);
-    }
-    if(target_inode->dindirect[0] != 0){
-        ktfs_update_bitmap(target_inode->dindirect[0],0);
-    }
-    if(target_inode->dindirect[1] != 0){
-        ktfs_update_bitmap(target_inode->dindirect[1],0);
+    //the flag keeps the inode from being allocated until ktfs_reclaim has freed its blocks
+    struct ktfs_inode * target_inode;
+    if(ktfs_get_inode(fs, index, &inodes, &target_inode) != 0){
+        return -EIO;
     }
-    
-
-    target_inode->indirect = 0;
-    target_inode->dindirect[0] = 0;
-    target_inode->dindirect[1] = 0;
-    target_inode->size = 0;
-    target_inode->block[0] = 0;
-    target_inode->block[1] = 0;
-    target_inode->block[2] = 0;
-    //force a write to disk
-    iowriteat(file_sys.vioblk,file_sys.inode_blk_pos + inode_block * CACHE_BLKSZ , data_inodes, CACHE_BLKSZ);
-    cache_release_block(file_sys.cache, data_inodes, 1);
-    //cache_flush(file_sys.cache);
+    target_inode->flags |= KTFS_FILE_RECLAIM;
+    ktfs_put_inode(fs, index, inodes, 1);
+    ktfs_reclaim_queue(fs, index);
     return 0;
 }
 
@@ -664,6 +741,7 @@ int ktfs_delete(const char *name){
 
 long ktfs_writeat(struct io* io, unsigned long long pos, const void *buf, long len){
     struct ktfs_file *fd = (struct ktfs_file *)((char *)io - offsetof(struct ktfs_file, io));
+    struct ktfs_fs * const fs = fd->fs;
     if (fd == NULL || buf == NULL || len <= 0) {
         return -EINVAL;
     }
@@ -677,48 +755,203 @@ long ktfs_writeat(struct io* io, unsigned long long pos, const void *buf, long l
     //find the inode
     char * new_buf = (char *)buf;
     uint16_t index = fd->dentry->inode;
+    elf_cache_invalidate(ktfs_ino_id(fs, index)); // cached text of the file is stale now
     void * inodes = NULL;
-    int inode_num = index / (CACHE_BLKSZ / sizeof(struct ktfs_inode));
-    int inode_offset = index % (CACHE_BLKSZ / sizeof(struct ktfs_inode));
-    cache_get_block(file_sys.cache, file_sys.inode_blk_pos + inode_num * CACHE_BLKSZ, &inodes);
+    int inode_num = index / (fs->blksz / sizeof(struct ktfs_inode));
+    int inode_offset = index % (fs->blksz / sizeof(struct ktfs_inode));
+    cache_get_block(fs->cache, fs->inode_blk_pos + inode_num * fs->blksz, &inodes);
     struct ktfs_inode * actual_inodes = inodes; 
     struct ktfs_inode target_inode = actual_inodes[inode_offset];
-    cache_release_block(file_sys.cache, inodes, 0);
+    cache_release_block(fs->cache, inodes, 0);
 
     // find the block number to write
-    uint32_t block_num = pos / KTFS_BLKSZ;
-    uint32_t block_offset = pos % KTFS_BLKSZ;
+    uint32_t block_num = pos / fs->blksz;
+    uint32_t block_offset = pos % fs->blksz;
 
     long long bits_wrote = 0;
     // write the block, until reach the len
     while (bits_wrote < len) {
        void *block = NULL;
-       uint32_t i = ktfs_get_data_block(block_num, &target_inode, &block); //use this function to get the actual data block
+       // a block we overwrite completely need not be read from the disk first
+       int i = ktfs_file_block(fs, fd, &target_inode, block_num, block_offset == 0 && len - bits_wrote >= fs->blksz, &block);
        if(i <0){
-        return -EIO;
+        return (bits_wrote > 0) ? bits_wrote : -EIO;
        }
         // read the data from the block
         char * actual_block = block;
-        if(len - bits_wrote < KTFS_BLKSZ-block_offset){
+        if(len - bits_wrote < fs->blksz-block_offset){
             uint32_t copy_length = len - bits_wrote;
             memcpy(actual_block + block_offset, new_buf+bits_wrote, copy_length);
             bits_wrote += copy_length;
         }else{
-            uint32_t copy_length = KTFS_BLKSZ - block_offset;
+            uint32_t copy_length = fs->blksz - block_offset;
             memcpy(actual_block + block_offset, new_buf+bits_wrote, copy_length);
             bits_wrote += copy_length;
-           // cache_release_block(file_sys.cache, block, 0);
+           // cache_release_block(fs->cache, block, 0);
+        }
+        if(i == 0){
+            cache_release_block(fs->cache, block, 1);//releast with dirty since we wrote to it
         }
-        cache_release_block(file_sys.cache, block, 1);//releast with dirty since we wrote to it
         block_offset = 0; 
         block_num++;
     
     }
-
+    // keep the cached pages in step, a mapping sees the write at once
+    struct iovec iov = { .base = (void *)buf, .len = bits_wrote };
+    ktfs_page_xferv(fd, pos, &iov, 1, bits_wrote, 1);
     return bits_wrote;
 
 }
 
+//==============================================================================================
+// long ktfs_preadv(struct io* io, unsigned long long pos, const struct iovec *iov, int iovcnt)
+// inputs: struct io* io: io for the file
+//         unsigned long long pos: position to start reading
+//         const struct iovec *iov: segments to fill
+//         int iovcnt: number of segments
+// outputs: long: number of bytes successfully read
+//              EINVAL: if pos is past the end of the file
+// description:
+//     scatter version of ktfs_readat. uses ktfs_xferv.
+//==============================================================================================
+
+long ktfs_preadv(struct io* io, unsigned long long pos, const struct iovec *iov, int iovcnt){
+    struct ktfs_file *fd = (struct ktfs_file *)((char *)io - offsetof(struct ktfs_file, io));
+    struct ktfs_fs * const fs = fd->fs;
+    if (pos > fd->size) {
+        return -EINVAL;
+    }
+    long result = ktfs_xferv(fs, fd, pos, iov, iovcnt, 0);
+    if (result > 0) {
+        ktfs_page_xferv(fd, pos, iov, iovcnt, result, 0);
+    }
+    return result;
+}
+
+//==============================================================================================
+// long ktfs_pwritev(struct io* io, unsigned long long pos, const struct iovec *iov, int iovcnt)
+// inputs: struct io* io: io for the file
+//         unsigned long long pos: position to start writing
+//         const struct iovec *iov: segments to write
+//         int iovcnt: number of segments
+// outputs: long: number of bytes successfully written
+//              EINVAL: if pos is at or past the end of the file
+// description:
+//     gather version of ktfs_writeat. uses ktfs_xferv.
+//==============================================================================================
+
+long ktfs_pwritev(struct io* io, unsigned long long pos, const struct iovec *iov, int iovcnt){
+    struct ktfs_file *fd = (struct ktfs_file *)((char *)io - offsetof(struct ktfs_file, io));
+    struct ktfs_fs * const fs = fd->fs;
+    if (pos >= fd->size) {
+        return -EINVAL;
+    }
+    long result = ktfs_xferv(fs, fd, pos, iov, iovcnt, 1);
+    if (result > 0) {
+        ktfs_page_xferv(fd, pos, iov, iovcnt, result, 1);
+    }
+    return result;
+}
+
+//==============================================================================================
+// long ktfs_xferv(struct ktfs_fs *fs, struct ktfs_file *fd, unsigned long long pos, const struct iovec *iov, int iovcnt, int write)
+// inputs: struct ktfs_file *fd: open file
+//         unsigned long long pos: position in the file
+//         const struct iovec *iov: segments to transfer
+//         int iovcnt: number of segments
+//         int write: 1 to copy from the segments to the file, 0 for the other way
+// outputs: long: number of bytes transferred, or EIO if no block could be read
+// description:
+//     walks the file blocks and the segments together, so each data block is
+//     looked up in the cache once even when several segments fall in it.
+//     the transfer is truncated at the end of the file.
+//==============================================================================================
+
+static long ktfs_xferv(struct ktfs_fs *fs, struct ktfs_file *fd, unsigned long long pos, const struct iovec *iov, int iovcnt, int write){
+    long total = 0;
+    long done = 0;
+    size_t seg_off = 0;
+    int seg = 0;
+
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].len;
+    }
+    if (pos + total > fd->size) { //truncate length if too long
+        total = fd->size - pos;
+    }
+
+    // find the inode
+    uint16_t index = fd->dentry->inode;
+    if (write) {
+        elf_cache_invalidate(ktfs_ino_id(fs, index)); // cached text of the file is stale now
+    }
+    void * inodes = NULL;
+    int inode_num = index / (fs->blksz / sizeof(struct ktfs_inode));
+    int inode_offset = index % (fs->blksz / sizeof(struct ktfs_inode));
+    cache_get_block(fs->cache, fs->inode_blk_pos + inode_num * fs->blksz, &inodes);
+    struct ktfs_inode * actual_inodes = inodes;
+    struct ktfs_inode target_inode = actual_inodes[inode_offset];
+    cache_release_block(fs->cache, inodes, 0);
+
+    uint32_t block_num = pos / fs->blksz;
+    uint32_t block_offset = pos % fs->blksz;
+
+    while (done < total) {
+        void *block = NULL;
+        // a block we overwrite completely need not be read from the disk first
+        int staged = ktfs_file_block(fs, fd, &target_inode, block_num, write && block_offset == 0 && total - done >= fs->blksz, &block);
+        if (staged < 0) {
+            return (done > 0) ? done : -EIO;
+        }
+        char * actual_block = block;
+
+        // copy between this block and as many segments as it covers
+        while (block_offset < fs->blksz && done < total) {
+            if (seg_off == iov[seg].len) {
+                seg++;
+                seg_off = 0;
+                continue;
+            }
+            long n = fs->blksz - block_offset;
+            if (iov[seg].len - seg_off < n) {
+                n = iov[seg].len - seg_off;
+            }
+            if (total - done < n) {
+                n = total - done;
+            }
+            if (write) {
+                memcpy(actual_block + block_offset, (char *)iov[seg].base + seg_off, n);
+            } else {
+                memcpy((char *)iov[seg].base + seg_off, actual_block + block_offset, n);
+            }
+            block_offset += n;
+            seg_off += n;
+            done += n;
+        }
+
+        if (staged == 0) {
+            cache_release_block(fs->cache, block, write);
+        }
+        block_offset = 0;
+        block_num++;
+    }
+
+    return done;
+}
+
+//==============================================================================================
+// unsigned long long ktfs_ino_id(struct ktfs_fs *fs, uint16_t index)
+// inputs: uint16_t index: inode number
+// outputs: identity of the file, for IOCTL_GETINO and elf_cache_invalidate
+// description:
+//     inode numbers are per image, so the mount is part of the identity: two mounted
+//     images both have an inode 1.
+//==============================================================================================
+
+static unsigned long long ktfs_ino_id(struct ktfs_fs *fs, uint16_t index){
+    return ((unsigned long long)(uintptr_t)fs << 16) | index;
+}
+
 //==============================================================================================
 // int ktfs_cntl(struct io *io, int cmd, void *arg)
 // inputs: struct io * io: io
@@ -735,18 +968,37 @@ int ktfs_cntl(struct io *io, int cmd, void *arg)
 {
     struct ktfs_file * const fd = (void*)io - 
         offsetof(struct ktfs_file, io);
+    struct ktfs_fs * const fs = fd->fs;
+    int result;
 
     if (!fd) return -EINVAL;
 
     switch (cmd) {
     case IOCTL_GETEND:
-		    *(uint32_t*)arg = fd->size;
+        *(unsigned long long*)arg = fd->size;
         return 0;
     case IOCTL_GETBLKSZ:
         return 1;
     case IOCTL_GETPOS:
-        *(uint32_t*)arg = fd->pos;
+        *(unsigned long long*)arg = fd->pos;
         return 0;
+    case IOCTL_GETINO:
+        *(unsigned long long*)arg = ktfs_ino_id(fs, fd->dentry->inode);
+        return 0;
+    case IOCTL_GETPAGE:
+        return ktfs_getpage(fs, fd, arg);
+    case IOCTL_SYNC: // msync: the pages, then the blocks they went to
+        if(arg == NULL){
+            return -EINVAL;
+        }
+        if(ktfs_page_sync(fs, fd, ((struct iopage *)arg)->pos, ((struct iopage *)arg)->len) != 0){
+            return -EIO;
+        }
+        result = ktfs_delalloc_flush(fs, fd);
+        if(result < 0){
+            return result;
+        }
+        return (ktfs_sync(fs) == 0) ? 0 : -EIO;
     case IOCTL_SETEND: //calls ktfs_add_new_block to extend length, but have to make sure the length is valid
         if(arg == NULL){
             return -EINVAL;
@@ -758,7 +1010,11 @@ int ktfs_cntl(struct io *io, int cmd, void *arg)
         if(*(uint32_t*)arg <= fd->size){
             return -EINVAL;
         }
-        return (ktfs_add_new_block(io, arg) >= 0) ? 0 : -EINVAL;
+        ktfs_reclaim_wait(fs, (*(uint32_t*)arg + fs->blksz - 1) / fs->blksz - fd->nalloc);
+        ktfs_journal_begin(fs);
+        result = ktfs_add_new_block(fs, io, arg);
+        ktfs_journal_end(fs);
+        return (result >= 0) ? 0 : result;
 
     case IOCTL_SETPOS:
         if (*(uint32_t*)arg > fd->size) {
@@ -772,29 +1028,45 @@ int ktfs_cntl(struct io *io, int cmd, void *arg)
     return 0;
 }
 //==============================================================================================
-// int ktfs_flush(void)
+// int ktfs_flush(struct filesys *fsys)
 // inputs: None
 // outputs: int 0:success
 //              EINVAL: if cache is NULL or flush fail
 // description:
-//     flushes all dirty cached blocks back to disk using the cache_flush function.
+//     writes back the cached pages and places the delayed blocks of every open file
+//     on the device, finishes freeing the blocks of deleted files, then flushes all
+//     dirty cached blocks back to disk (ktfs_sync).
 //==============================================================================================
 
-int ktfs_flush(void)
+static int ktfs_flush(struct filesys *fsys)
 {
-    if (file_sys.cache == NULL) {
+    struct ktfs_fs * const fs = (void*)fsys - offsetof(struct ktfs_fs, filesys);
+    if (fs->cache == NULL) {
         return -EINVAL;
     }
-    if (cache_flush(file_sys.cache) != 0) {
-        return -EINVAL;
+    int result = 0;
+    for (struct ktfs_file *cur = fs->open_file; cur != NULL; cur = cur->next) {
+        if (ktfs_page_sync(fs, cur, 0, cur->size) != 0) {
+            result = -EIO;
+        }
+        int flushed = ktfs_delalloc_flush(fs, cur);
+        if (flushed < 0 && result == 0) {
+            result = flushed;
+        }
     }
-    return 0;
+    while (ktfs_reclaim(fs) > 0) {
+        continue;
+    }
+    if (ktfs_sync(fs) != 0) {
+        return -EIO;
+    }
+    return result;
 }
 
 
 
 //==============================================================================================
-// uint32_t ktfs_get_data_block(uint32_t block_num, struct ktfs_inode* target_inode, void **block)
+// uint32_t ktfs_get_data_block(struct ktfs_fs *fs, uint32_t block_num, struct ktfs_inode* target_inode, void **block)
 // inputs: uint32_t block_num: block number relative to file
 //         struct ktfs_inode *target_inode: inode of the file
 //         void **block: output buffer for block
@@ -804,69 +1076,137 @@ int ktfs_flush(void)
 //==============================================================================================
 
 
-uint32_t ktfs_get_data_block(uint32_t block_num, struct ktfs_inode* target_inode, void **block){
-    // if in direct block
-    if(block_num < KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT){
-        cache_get_block(file_sys.cache, file_sys.data_blk_pos + target_inode->block[block_num] * CACHE_BLKSZ, block);
-       // cache_release_block(file_sys.cache, block, 0);
-        return 0;
-    // if in indirect block
-    }else if (block_num < KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT + KTFS_NUM_INDIRECT_BLOCKS_COUNT){
-        void * indirect_block_ptr = NULL;
-        cache_get_block(file_sys.cache, file_sys.data_blk_pos + target_inode->indirect * CACHE_BLKSZ, &indirect_block_ptr);
-        uint32_t * direct_blocks = indirect_block_ptr;
-        uint32_t blk_index = block_num - KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT;
-        cache_get_block(file_sys.cache, file_sys.data_blk_pos + direct_blocks[blk_index] * CACHE_BLKSZ, block);
-        cache_release_block(file_sys.cache, indirect_block_ptr, 0);
-       // cache_release_block(file_sys.cache, block, 0);
-        return 0;
-    // if in doubly indirect block
-    }else if (block_num < KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT + KTFS_NUM_INDIRECT_BLOCKS_COUNT + 2 * KTFS_NUM_DINDIRECT_BLOCKS_COUNT){
-        // check if the blocknum is in the second dindirect block
-        void * dindirect_block_ptr = NULL;
+uint32_t ktfs_get_data_block(struct ktfs_fs *fs, uint32_t block_num, struct ktfs_inode* target_inode, void **block){
+    unsigned long long pos;
+    if(ktfs_data_block_pos(fs, block_num, target_inode, &pos) < 0){
+        return -EINVAL;
+    }
+    return cache_get_block(fs->cache, pos, block);
+}
+
+//==============================================================================================
+// int ktfs_claim_data_block(struct ktfs_fs *fs, uint32_t block_num, struct ktfs_inode* target_inode, void **block)
+// inputs: uint32_t block_num: block number relative to file
+//         struct ktfs_inode *target_inode: inode of the file
+//         void **block: output buffer for block
+// outputs: 0 if success, negative on error
+// description:
+//     like ktfs_get_data_block, for a caller that overwrites the whole block. the old
+//     contents are not read from the disk (see cache_claim_block).
+//==============================================================================================
+
+static int ktfs_claim_data_block(struct ktfs_fs *fs, uint32_t block_num, struct ktfs_inode* target_inode, void **block){
+    unsigned long long pos;
+    if(ktfs_data_block_pos(fs, block_num, target_inode, &pos) < 0){
+        return -EINVAL;
+    }
+    return cache_claim_block(fs->cache, pos, block);
+}
+
+//==============================================================================================
+// int ktfs_file_block(struct ktfs_fs *fs, struct ktfs_file *fd, struct ktfs_inode* target_inode, uint32_t block_num, int claim, void **block)
+// inputs: struct ktfs_file *fd: open file
+//         struct ktfs_inode *target_inode: inode of the file
+//         uint32_t block_num: block number relative to file
+//         int claim: 1 if the caller overwrites the whole block
+//         void **block: output buffer for block
+// outputs: 0 for a block in the cache, 1 for a delayed block, negative on error
+// description:
+//     gets a file block to copy to or from. a block whose allocation is delayed lives in
+//     the file's delay buffer and is not released; other blocks come from the cache
+//     through ktfs_get_data_block, or ktfs_claim_data_block when claim is set.
+//==============================================================================================
+
+static int ktfs_file_block(struct ktfs_fs *fs, struct ktfs_file *fd, struct ktfs_inode* target_inode, uint32_t block_num, int claim, void **block){
+    if(block_num >= fd->nalloc){
+        if(block_num - fd->nalloc >= fd->ndelay){
+            return -EINVAL;
+        }
+        *block = fd->delay_buf + (block_num - fd->nalloc) * fs->blksz;
+        return 1;
+    }
+    if(claim){
+        return ktfs_claim_data_block(fs, block_num, target_inode, block);
+    }
+    return (ktfs_get_data_block(fs, block_num, target_inode, block) == 0) ? 0 : -EIO;
+}
+
+//==============================================================================================
+// int ktfs_data_block_pos(struct ktfs_fs *fs, uint32_t block_num, struct ktfs_inode* target_inode, unsigned long long *pos)
+// inputs: uint32_t block_num: block number relative to file
+//         struct ktfs_inode *target_inode: inode of the file
+//         unsigned long long *pos: output device position of the block
+// outputs: 0 if success, negative on error
+// description:
+//     maps a file block number to its position on the device, reading the indirect and
+//     doubly indirect blocks on the way through the cache.
+//==============================================================================================
+
+static int ktfs_data_block_pos(struct ktfs_fs *fs, uint32_t block_num, struct ktfs_inode* target_inode, unsigned long long *pos){
+    uint32_t data_block;
+    // if in direct block
+    if(block_num < KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT){
+        data_block = target_inode->block[block_num];
+    // if in indirect block
+    }else if (block_num < KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT + fs->nptrs){
         void * indirect_block_ptr = NULL;
-        if (block_num>= KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT + KTFS_NUM_INDIRECT_BLOCKS_COUNT + KTFS_NUM_DINDIRECT_BLOCKS_COUNT){
-            cache_get_block(file_sys.cache, file_sys.data_blk_pos + target_inode->dindirect[1] * CACHE_BLKSZ, &dindirect_block_ptr);
-            uint32_t * indirect_blocks = dindirect_block_ptr;
-            uint32_t indir_blk_index = (block_num - KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT - KTFS_NUM_INDIRECT_BLOCKS_COUNT - KTFS_NUM_DINDIRECT_BLOCKS_COUNT) / KTFS_NUM_INDIRECT_BLOCKS_COUNT;
-            cache_get_block(file_sys.cache, file_sys.data_blk_pos + indirect_blocks[indir_blk_index] * CACHE_BLKSZ, &indirect_block_ptr);
-            uint32_t * direct_blocks = indirect_block_ptr;
-            uint32_t blk_index = (block_num - KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT - KTFS_NUM_INDIRECT_BLOCKS_COUNT - KTFS_NUM_DINDIRECT_BLOCKS_COUNT) % KTFS_NUM_INDIRECT_BLOCKS_COUNT;
-            cache_get_block(file_sys.cache, file_sys.data_blk_pos + direct_blocks[blk_index] * CACHE_BLKSZ, block);
-           
-           // cache_release_block(file_sys.cache, block, 0);
-        }else{
-            cache_get_block(file_sys.cache, file_sys.data_blk_pos + target_inode->dindirect[0] * CACHE_BLKSZ, &dindirect_block_ptr);
-            uint32_t * indirect_blocks = dindirect_block_ptr;
-            uint32_t indir_blk_index = (block_num - KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT - KTFS_NUM_INDIRECT_BLOCKS_COUNT) / KTFS_NUM_INDIRECT_BLOCKS_COUNT;
-            cache_get_block(file_sys.cache, file_sys.data_blk_pos + indirect_blocks[indir_blk_index] * CACHE_BLKSZ, &indirect_block_ptr);
-            uint32_t * direct_blocks = indirect_block_ptr;
-            uint32_t blk_index = (block_num - KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT - KTFS_NUM_INDIRECT_BLOCKS_COUNT) % KTFS_NUM_INDIRECT_BLOCKS_COUNT;
-            cache_get_block(file_sys.cache, file_sys.data_blk_pos + direct_blocks[blk_index] * CACHE_BLKSZ, block);
-            //  cache_release_block(file_sys.cache, block, 0);
-        }
-        cache_release_block(file_sys.cache, dindirect_block_ptr, 0);
-        cache_release_block(file_sys.cache, indirect_block_ptr, 0);
-        return 0;
+        if(cache_get_block(fs->cache, fs->data_blk_pos + target_inode->indirect * fs->blksz, &indirect_block_ptr) != 0){
+            return -EIO;
+        }
+        uint32_t * direct_blocks = indirect_block_ptr;
+        uint32_t blk_index = block_num - KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT;
+        data_block = direct_blocks[blk_index];
+        cache_release_block(fs->cache, indirect_block_ptr, 0);
+    // if in doubly indirect block
+    }else if (block_num < KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT + fs->nptrs + 2 * fs->ndptrs){
+        // check if the blocknum is in the second dindirect block
+        void * dindirect_block_ptr = NULL;
+        void * indirect_block_ptr = NULL;
+        uint32_t dblk_index = block_num - KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT - fs->nptrs;
+        int outer = 0;
+        if (dblk_index >= fs->ndptrs){
+            dblk_index -= fs->ndptrs;
+            outer = 1;
+        }
+        if(cache_get_block(fs->cache, fs->data_blk_pos + target_inode->dindirect[outer] * fs->blksz, &dindirect_block_ptr) != 0){
+            return -EIO;
+        }
+        uint32_t * indirect_blocks = dindirect_block_ptr;
+        uint32_t indir_blk_index = dblk_index / fs->nptrs;
+        uint32_t indirect_block = indirect_blocks[indir_blk_index];
+        cache_release_block(fs->cache, dindirect_block_ptr, 0);
+        if(cache_get_block(fs->cache, fs->data_blk_pos + indirect_block * fs->blksz, &indirect_block_ptr) != 0){
+            return -EIO;
+        }
+        uint32_t * direct_blocks = indirect_block_ptr;
+        uint32_t blk_index = dblk_index % fs->nptrs;
+        data_block = direct_blocks[blk_index];
+        cache_release_block(fs->cache, indirect_block_ptr, 0);
     }else{
         return -EINVAL;
     }
-
+    *pos = fs->data_blk_pos + data_block * fs->blksz;
+    return 0;
 }
 
 
 //==============================================================================================
-// int ktfs_add_new_block(struct io *io, void *arg)
+// int ktfs_add_new_block(struct ktfs_fs *fs, struct io *io, void *arg)
 // inputs: struct io * io: io pointer of the file
 //         void *arg: new file size
 // outputs: new file size or error code
+//          ENODATABLKS: the device has no room for the whole extension
 // description:
-//     adds new data blocks to a file to extend its size. Updates bitmap and use iowrite to persist
-//     on disk immediately
+//     extends a file to a new size. new blocks are not allocated here: they are zeroed in
+//     the file's delay buffer and given places on the device by ktfs_delalloc_flush, at
+//     flush or close or when the buffer is full, so a file written in small steps still
+//     gets contiguous blocks. the free blocks they will take are reserved (ktfs_reserve),
+//     so an extension that succeeds is never lost for lack of space later. an extension
+//     larger than the buffer is placed right away.
 //==============================================================================================
 
 
-int ktfs_add_new_block(struct io *io, void *arg){
+int ktfs_add_new_block(struct ktfs_fs *fs, struct io *io, void *arg){
     if(io == NULL || arg == NULL){
         return -EINVAL;
     }
@@ -875,139 +1215,370 @@ int ktfs_add_new_block(struct io *io, void *arg){
     if(new_pos <= fd->size){
         return -EINVAL;
     }
-    if(new_pos >= KTFS_MAX_FILE_SIZE){
-        new_pos = KTFS_MAX_FILE_SIZE;
+    if(new_pos >= fs->max_size){
+        new_pos = fs->max_size;
     }
 
+    uint32_t have = fd->nalloc + fd->ndelay;
+    uint32_t need = (new_pos + fs->blksz - 1) / fs->blksz;
+
     //if the length to be extended is contained in the current blocks, we only change the size
-    if((fd->size / KTFS_BLKSZ) == (new_pos - 1) / KTFS_BLKSZ && fd->size!= 0){
+    if(need <= have){
         fd->size = new_pos;
-        
+        if(fd->ndelay != 0){ //the inode is written when the delayed blocks are placed
+            return 0;
+        }
         uint16_t index = fd->dentry->inode;
         void * inodes = NULL;
-        int inode_num = index / (CACHE_BLKSZ / sizeof(struct ktfs_inode));
-        int inode_offset = index % (CACHE_BLKSZ / sizeof(struct ktfs_inode));
-        cache_get_block(file_sys.cache, file_sys.inode_blk_pos + inode_num * CACHE_BLKSZ, &inodes);
+        int inode_num = index / (fs->blksz / sizeof(struct ktfs_inode));
+        int inode_offset = index % (fs->blksz / sizeof(struct ktfs_inode));
+        cache_get_block(fs->cache, fs->inode_blk_pos + inode_num * fs->blksz, &inodes);
         struct ktfs_inode *actual_inodes = inodes;
         actual_inodes[inode_offset].size = new_pos;
-        iowriteat(file_sys.vioblk,file_sys.inode_blk_pos + inode_num * CACHE_BLKSZ , inodes, CACHE_BLKSZ);
-        cache_release_block(file_sys.cache, inodes, 0);
+        ktfs_meta_release(fs, fs->inode_blk_pos + inode_num * fs->blksz, inodes, 1);
         return 0;
     }
 
+    uint32_t block_needed = need - have;
+    //place what the delay buffer holds if the new blocks do not fit next to it
+    if(fd->ndelay + block_needed > KTFS_DELALLOC_MAX(fs) && ktfs_delalloc_flush(fs, fd) < 0){
+        return -ENODATABLKS;
+    }
 
-    int block_needed = (new_pos + KTFS_BLKSZ - 1) / KTFS_BLKSZ - (fd->size + KTFS_BLKSZ - 1) / KTFS_BLKSZ;
-    if(block_needed <= 0){
-        return -EINVAL;
+    //too large to delay: place zeroed blocks now, in space no delayed block is promised
+    if(block_needed > KTFS_DELALLOC_MAX(fs)){
+        if(fs->nfree < fs->nreserved + block_needed + block_needed / fs->nptrs){
+            return -ENODATABLKS;
+        }
+        uint16_t index = fd->dentry->inode;
+        void * inodes = NULL;
+        int inode_num = index / (fs->blksz / sizeof(struct ktfs_inode));
+        int inode_offset = index % (fs->blksz / sizeof(struct ktfs_inode));
+        if(cache_get_block(fs->cache, fs->inode_blk_pos + inode_num * fs->blksz, &inodes) != 0){
+            return -EIO;
+        }
+        struct ktfs_inode *actual_inodes = inodes;
+        struct ktfs_inode *target_inode = &actual_inodes[inode_offset];
+        long placed = ktfs_place_blocks(fs, target_inode, fd->nalloc, block_needed, NULL);
+        fd->nalloc += placed;
+        //if we can only get some of the blocks, the file ends at the last one
+        fd->size = (placed == block_needed) ? new_pos : fd->nalloc * fs->blksz;
+        target_inode->size = fd->size;
+        ktfs_meta_release(fs, fs->inode_blk_pos + inode_num * fs->blksz, inodes, 0);
+        return (placed == block_needed) ? fd->size : -ENODATABLKS;
     }
-    //calculate the current block number
-    int curr_block_num = (fd->size + KTFS_BLKSZ - 1) / KTFS_BLKSZ;
-    int block_fetched = 0;
-    //find the inode of the file
+
+    if(fd->delay_buf == NULL){
+        fd->delay_buf = alloc_phys_pages(KTFS_DELALLOC_PAGES);
+        if(fd->delay_buf == NULL){
+            return -ENOMEM;
+        }
+    }
+    if(ktfs_reserve(fs, fd, fd->ndelay + block_needed) != 0){
+        return -ENODATABLKS;
+    }
+    memset(fd->delay_buf + fd->ndelay * fs->blksz, 0, block_needed * fs->blksz);
+    fd->ndelay += block_needed;
+    fd->size = new_pos;
+    return new_pos;
+}
+
+//==============================================================================================
+// int ktfs_delalloc_flush(struct ktfs_fs *fs, struct ktfs_file *fd)
+// inputs: struct ktfs_file *fd: open file
+// outputs: 0 if success, ENODATABLKS if the device filled up first
+// description:
+//     gives the delayed blocks of a file places on the device, copies them into the cache
+//     and writes the file size to the inode. both reach the disk at the next cache flush.
+//     if not every block finds a place, the file ends at the last one that did.
+//==============================================================================================
+
+static int ktfs_delalloc_flush(struct ktfs_fs *fs, struct ktfs_file *fd){
+    if(fd->ndelay == 0){
+        return 0;
+    }
+    ktfs_reserve(fs, fd, 0); //the blocks are placed now, so the reservation is given back
+    ktfs_reclaim_wait(fs, fd->ndelay);
     uint16_t index = fd->dentry->inode;
     void * inodes = NULL;
-    int inode_num = index / (CACHE_BLKSZ / sizeof(struct ktfs_inode));
-    int inode_offset = index % (CACHE_BLKSZ / sizeof(struct ktfs_inode));
-    cache_get_block(file_sys.cache, file_sys.inode_blk_pos + inode_num * CACHE_BLKSZ, &inodes);
-    struct ktfs_inode *actual_inodes = inodes; 
+    int inode_num = index / (fs->blksz / sizeof(struct ktfs_inode));
+    int inode_offset = index % (fs->blksz / sizeof(struct ktfs_inode));
+    if(cache_get_block(fs->cache, fs->inode_blk_pos + inode_num * fs->blksz, &inodes) != 0){
+        return -EIO;
+    }
+    struct ktfs_inode *actual_inodes = inodes;
     struct ktfs_inode *target_inode = &actual_inodes[inode_offset];
-    
-    uint32_t *indirect = NULL;
-    uint32_t *data_blocks = NULL;
-    uint32_t *indirect_blocks=NULL;
-
-    int finished = 0;
-    //loop continues as long as there is available block in bitmap and we still need more blocks
-    while(block_fetched < block_needed && finished == 0){
-        int new_block = ktfs_update_bitmap(0, 1);//get empty block num
-        if(new_block < 0){
-            finished = 1;
+
+    ktfs_journal_begin(fs);
+    long placed = ktfs_place_blocks(fs, target_inode, fd->nalloc, fd->ndelay, fd->delay_buf);
+    int result = (placed == fd->ndelay) ? 0 : -ENODATABLKS;
+    fd->nalloc += placed;
+    fd->ndelay = 0;
+    if(fd->size > (unsigned long long)fd->nalloc * fs->blksz){
+        fd->size = fd->nalloc * fs->blksz;
+    }
+    target_inode->size = fd->size;
+    ktfs_meta_release(fs, fs->inode_blk_pos + inode_num * fs->blksz, inodes, 0);
+    ktfs_journal_end(fs);
+    return result;
+}
+
+//==============================================================================================
+// int ktfs_reserve(struct ktfs_fs *fs, struct ktfs_file *fd, uint32_t ndelay)
+// inputs: struct ktfs_file *fd: open file
+//         uint32_t ndelay: delayed blocks the file is to have
+// outputs: 0 if success, ENODATABLKS if the free blocks are promised already
+// description:
+//     sets the free blocks reserved for the delayed blocks of a file: the blocks and the
+//     pointer blocks that may have to map them. other allocations leave reserved blocks
+//     alone, so ktfs_delalloc_flush finds places for all of them. 0 gives them back.
+//==============================================================================================
+
+static int ktfs_reserve(struct ktfs_fs *fs, struct ktfs_file *fd, uint32_t ndelay){
+    uint32_t want = (ndelay == 0) ? 0 : ndelay + ndelay / fs->nptrs + 4;
+    if(want > fd->nresv && fs->nfree < fs->nreserved + (want - fd->nresv)){
+        return -ENODATABLKS;
+    }
+    fs->nreserved = fs->nreserved - fd->nresv + want;
+    fd->nresv = want;
+    return 0;
+}
+
+//==============================================================================================
+// long ktfs_place_blocks(struct ktfs_fs *fs, struct ktfs_inode *target_inode, uint32_t first, uint32_t cnt, const char *data)
+// inputs: struct ktfs_inode *target_inode: inode of the file, in the cache
+//         uint32_t first: first file block to place; the blocks before it have places
+//         uint32_t cnt: number of blocks to place
+//         const char *data: contents of the blocks, or NULL for zeros
+// outputs: number of blocks placed
+// description:
+//     allocates device blocks for a range of file blocks in as few contiguous runs as the
+//     bitmap allows, starting right after the file's last block when that is free. an
+//     indirect block the range needs goes in the run just before the first data block it
+//     maps, so a sequential read of the file moves forward on the device.
+//==============================================================================================
+
+static long ktfs_place_blocks(struct ktfs_fs *fs, struct ktfs_inode *target_inode, uint32_t first, uint32_t cnt, const char *data){
+    uint32_t goal = ktfs_place_goal(fs, target_inode, first);
+    uint32_t placed = 0;
+
+    while(placed < cnt){
+        uint32_t got;
+        int start = ktfs_find_run(fs, goal, ktfs_run_length(fs, target_inode, first + placed, cnt - placed), &got);
+        if(start < 0){
             break;
         }
-        //if length to be extend can be saved in direct
-        if(curr_block_num < KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT){
-            target_inode->block[curr_block_num] = new_block;
-        }else if(curr_block_num < KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT + KTFS_NUM_INDIRECT_BLOCKS_COUNT){ //if length to be extend can be saved in indirect 
-            if(target_inode->indirect == 0){//first check if we have block for indirect
-                int indirect_block = ktfs_update_bitmap(0, 1);
-                if(indirect_block < 0) {
-                    finished = 1;
-                    break;
-                }
-                target_inode->indirect = indirect_block;
+        //take the run before filling it, reading pointer blocks may let another thread allocate
+        ktfs_mark_run(fs, start, got, 1);
+        uint32_t next = start;
+        uint32_t end = start + got;
+        while(next < end && placed < cnt){
+            uint32_t block_num = first + placed;
+            int which = ktfs_meta_missing(fs, target_inode, block_num);
+            if(which < 0){
+                break;
             }
-            void *indirect_ptr = NULL;
-            cache_get_block(file_sys.cache, file_sys.data_blk_pos + target_inode->indirect * CACHE_BLKSZ, &indirect_ptr);
-            indirect = (uint32_t *)indirect_ptr;
-            indirect[curr_block_num - KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT] = new_block;
-            iowriteat(file_sys.vioblk,file_sys.data_blk_pos + target_inode->indirect * CACHE_BLKSZ , indirect_ptr, CACHE_BLKSZ);
-            cache_release_block(file_sys.cache, indirect_ptr, 0);
-        }else{//if length to be extend can be saved in double indirect
-            int dblk_index = curr_block_num - (KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT + KTFS_NUM_INDIRECT_BLOCKS_COUNT);
-            int outer = dblk_index / KTFS_NUM_DINDIRECT_BLOCKS_COUNT;
-            if(outer > 1){ // we only have 2 double indirect
-                return -EINVAL;
-            }else if(outer == 1){// if double indirect[1], we minus everything before to make it behave like double indirect[0]
-                dblk_index = dblk_index - KTFS_NUM_DINDIRECT_BLOCKS_COUNT;
+            if(which != KTFS_META_NONE){
+                ktfs_meta_install(fs, target_inode, block_num, which, next++);
+                continue;
             }
-            int indirect_index = dblk_index / KTFS_NUM_INDIRECT_BLOCKS_COUNT;
-            int direct_index = dblk_index % KTFS_NUM_INDIRECT_BLOCKS_COUNT;
-            if(target_inode->dindirect[outer] == 0){//first check if we have block for double indirect
-                int dindirect_block = ktfs_update_bitmap(0, 1);
-                if (dindirect_block < 0) {
-                    finished = 1;
-                    break;
-                }
-                target_inode->dindirect[outer] = dindirect_block;
+            void *block = NULL;
+            if(cache_claim_block(fs->cache, fs->data_blk_pos + next * fs->blksz, &block) != 0){
+                break;
             }
-            void *dindirect_ptr = NULL;
-            cache_get_block(file_sys.cache, file_sys.data_blk_pos + target_inode->dindirect[outer] * CACHE_BLKSZ, &dindirect_ptr);
-            indirect_blocks = (uint32_t *)dindirect_ptr;
-            if(indirect_blocks[indirect_index] == 0){//second check if we have block for indirect who is in double indirect
-                int new_indirect = ktfs_update_bitmap(0, 1);
-                if (new_indirect < 0) {
-                    cache_release_block(file_sys.cache, dindirect_ptr, 0);
-                    finished = 1;
-                    break;
-                }
-                indirect_blocks[indirect_index] = new_indirect;
-                iowriteat(file_sys.vioblk,file_sys.data_blk_pos + target_inode->dindirect[outer] * CACHE_BLKSZ , dindirect_ptr, CACHE_BLKSZ);
-                cache_release_block(file_sys.cache, dindirect_ptr, 0);
+            if(data != NULL){
+                memcpy(block, data + placed * fs->blksz, fs->blksz);
             }else{
-                cache_release_block(file_sys.cache, dindirect_ptr, 0);
+                memset(block, 0, fs->blksz);
+            }
+            cache_release_block(fs->cache, block, CACHE_DIRTY);
+            ktfs_data_install(fs, target_inode, block_num, next++);
+            placed++;
+        }
+        //give back what the run was estimated to need but did not
+        if(next < end){
+            ktfs_mark_run(fs, next, end - next, 0);
+        }
+        if(next == start){
+            break;
+        }
+        goal = next;
+    }
+    return placed;
+}
+
+//==============================================================================================
+// uint32_t ktfs_place_goal(struct ktfs_fs *fs, struct ktfs_inode *target_inode, uint32_t first)
+// inputs: struct ktfs_inode *target_inode: inode of the file
+//         uint32_t first: first file block to place
+// outputs: data block number where the new blocks should go
+// description:
+//     the data block after the one holding file block first-1, or 0 for an empty file.
+//==============================================================================================
+
+static uint32_t ktfs_place_goal(struct ktfs_fs *fs, struct ktfs_inode *target_inode, uint32_t first){
+    unsigned long long pos;
+    if(first == 0 || ktfs_data_block_pos(fs, first - 1, target_inode, &pos) < 0){
+        return 0;
+    }
+    return (pos - fs->data_blk_pos) / fs->blksz + 1;
+}
+
+//==============================================================================================
+// uint32_t ktfs_run_length(struct ktfs_fs *fs, const struct ktfs_inode *target_inode, uint32_t first, uint32_t cnt)
+// inputs: const struct ktfs_inode *target_inode: inode of the file
+//         uint32_t first: first file block to place
+//         uint32_t cnt: number of blocks to place
+// outputs: number of device blocks the range needs
+// description:
+//     counts the data blocks plus the pointer blocks that start in the range. an estimate
+//     is enough: ktfs_place_blocks returns what it does not use and asks again if short.
+//==============================================================================================
+
+static uint32_t ktfs_run_length(struct ktfs_fs *fs, const struct ktfs_inode *target_inode, uint32_t first, uint32_t cnt){
+    const uint32_t dstart = KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT + fs->nptrs;
+    uint32_t len = cnt;
+    for(uint32_t block_num = first; block_num < first + cnt; block_num++){
+        if(block_num == KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT && target_inode->indirect == 0){
+            len++;
+        }else if(block_num >= dstart){
+            uint32_t dblk_index = block_num - dstart;
+            if(dblk_index % fs->ndptrs == 0 && target_inode->dindirect[dblk_index / fs->ndptrs] == 0){
+                len++;
+            }
+            if(dblk_index % fs->nptrs == 0){
+                len++;
             }
-            void *indirect =NULL;
-            cache_get_block(file_sys.cache, file_sys.data_blk_pos + indirect_blocks[indirect_index] * CACHE_BLKSZ, &indirect);
-            data_blocks = (uint32_t *)indirect;
-            data_blocks[direct_index] = new_block;
-            iowriteat(file_sys.vioblk,file_sys.data_blk_pos + indirect_blocks[indirect_index] * CACHE_BLKSZ , indirect, CACHE_BLKSZ);
-            cache_release_block(file_sys.cache, indirect, 0);
         }
-        curr_block_num++;
-        block_fetched++;
     }
+    return len;
+}
+
+//==============================================================================================
+// int ktfs_meta_missing(struct ktfs_fs *fs, const struct ktfs_inode *target_inode, uint32_t block_num)
+// inputs: const struct ktfs_inode *target_inode: inode of the file
+//         uint32_t block_num: file block about to be placed
+// outputs: KTFS_META_* for the first pointer block the file block still lacks, KTFS_META_NONE
+//          if it can be mapped now, negative on error
+//==============================================================================================
+
+static int ktfs_meta_missing(struct ktfs_fs *fs, const struct ktfs_inode *target_inode, uint32_t block_num){
+    const uint32_t dstart = KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT + fs->nptrs;
+    if(block_num < KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT){
+        return KTFS_META_NONE;
+    }
+    if(block_num < dstart){
+        return (target_inode->indirect == 0) ? KTFS_META_INDIRECT : KTFS_META_NONE;
+    }
+    uint32_t dblk_index = block_num - dstart;
+    int outer = dblk_index / fs->ndptrs;
+    if(outer >= KTFS_NUM_DINDIRECT_BLOCKS){
+        return -EINVAL;
+    }
+    if(target_inode->dindirect[outer] == 0){
+        return KTFS_META_DINDIRECT;
+    }
+    void *dindirect_ptr = NULL;
+    if(cache_get_block(fs->cache, fs->data_blk_pos + target_inode->dindirect[outer] * fs->blksz, &dindirect_ptr) != 0){
+        return -EIO;
+    }
+    uint32_t indirect_block = ((uint32_t *)dindirect_ptr)[(dblk_index % fs->ndptrs) / fs->nptrs];
+    cache_release_block(fs->cache, dindirect_ptr, 0);
+    return (indirect_block == 0) ? KTFS_META_DCHILD : KTFS_META_NONE;
+}
+
+//==============================================================================================
+// void ktfs_meta_install(struct ktfs_fs *fs, struct ktfs_inode *target_inode, uint32_t block_num, int which, uint32_t data_block)
+// inputs: struct ktfs_inode *target_inode: inode of the file
+//         uint32_t block_num: file block the pointer block is needed for
+//         int which: KTFS_META_* returned by ktfs_meta_missing
+//         uint32_t data_block: device block for the pointer block
+// outputs: none
+// description:
+//     zeroes a new pointer block and links it into the inode or its doubly indirect block.
+//==============================================================================================
+
+static void ktfs_meta_install(struct ktfs_fs *fs, struct ktfs_inode *target_inode, uint32_t block_num, int which, uint32_t data_block){
+    uint32_t dblk_index = block_num - KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT - fs->nptrs;
+    int outer = dblk_index / fs->ndptrs;
+    ktfs_zero_new_block(fs, data_block);
+    if(which == KTFS_META_INDIRECT){
+        target_inode->indirect = data_block;
+    }else if(which == KTFS_META_DINDIRECT){
+        target_inode->dindirect[outer] = data_block;
+    }else{
+        void *dindirect_ptr = NULL;
+        if(cache_get_block(fs->cache, fs->data_blk_pos + target_inode->dindirect[outer] * fs->blksz, &dindirect_ptr) != 0){
+            return;
+        }
+        ((uint32_t *)dindirect_ptr)[(dblk_index % fs->ndptrs) / fs->nptrs] = data_block;
+        ktfs_meta_release(fs, fs->data_blk_pos + target_inode->dindirect[outer] * fs->blksz, dindirect_ptr, 0);
+    }
+}
+
+//==============================================================================================
+// void ktfs_data_install(struct ktfs_fs *fs, struct ktfs_inode *target_inode, uint32_t block_num, uint32_t data_block)
+// inputs: struct ktfs_inode *target_inode: inode of the file
+//         uint32_t block_num: file block being placed
+//         uint32_t data_block: device block for it
+// outputs: none
+// description:
+//     maps a file block to its device block. the pointer blocks on the way must exist.
+//==============================================================================================
+
+static void ktfs_data_install(struct ktfs_fs *fs, struct ktfs_inode *target_inode, uint32_t block_num, uint32_t data_block){
+    const uint32_t dstart = KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT + fs->nptrs;
+    uint32_t indirect_block;
+    uint32_t blk_index;
+    if(block_num < KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT){
+        target_inode->block[block_num] = data_block;
+        return;
+    }
+    if(block_num < dstart){
+        indirect_block = target_inode->indirect;
+        blk_index = block_num - KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT;
+    }else{
+        uint32_t dblk_index = block_num - dstart;
+        void *dindirect_ptr = NULL;
+        if(cache_get_block(fs->cache, fs->data_blk_pos + target_inode->dindirect[dblk_index / fs->ndptrs] * fs->blksz, &dindirect_ptr) != 0){
+            return;
+        }
+        dblk_index %= fs->ndptrs;
+        indirect_block = ((uint32_t *)dindirect_ptr)[dblk_index / fs->nptrs];
+        cache_release_block(fs->cache, dindirect_ptr, 0);
+        blk_index = dblk_index % fs->nptrs;
+    }
+    void *indirect_ptr = NULL;
+    if(cache_get_block(fs->cache, fs->data_blk_pos + indirect_block * fs->blksz, &indirect_ptr) != 0){
+        return;
+    }
+    ((uint32_t *)indirect_ptr)[blk_index] = data_block;
+    ktfs_meta_release(fs, fs->data_blk_pos + indirect_block * fs->blksz, indirect_ptr, 0);
+}
+
 
-    //if we were able to extend the length to the asked length, we update size and return
-    if( block_fetched == block_needed){
-        target_inode->size = new_pos;
-        fd->size = target_inode->size;
-        iowriteat(file_sys.vioblk,file_sys.inode_blk_pos + inode_num * CACHE_BLKSZ , inodes, CACHE_BLKSZ);
-        cache_release_block(file_sys.cache, inodes, 0);
-        return new_pos;
+//==============================================================================================
+// void ktfs_zero_new_block(struct ktfs_fs *fs, uint32_t data_block)
+// inputs: uint32_t data_block: data block number just taken from the bitmap
+// outputs: none
+// description:
+//     gives a newly allocated block all-zero contents in the cache without reading its
+//     stale contents from the disk. a new pointer block starts with no entries mapped.
+//==============================================================================================
+
+static void ktfs_zero_new_block(struct ktfs_fs *fs, uint32_t data_block){
+    void *block = NULL;
+    if(cache_claim_block(fs->cache, fs->data_blk_pos + data_block * fs->blksz, &block) != 0){
+        return;
     }
-    //if we can only get block_fetched number of blocks, update size accordingly and return
-    int new_size = block_fetched * KTFS_BLKSZ; 
-    target_inode->size += new_size;
-    fd->size = target_inode->size;
-    iowriteat(file_sys.vioblk,file_sys.inode_blk_pos + inode_num * CACHE_BLKSZ , inodes, CACHE_BLKSZ);
-    cache_release_block(file_sys.cache, inodes, 0);
-    return new_size;
+    memset(block, 0, fs->blksz);
+    ktfs_meta_release(fs, fs->data_blk_pos + data_block * fs->blksz, block, 0);
 }
 
 
 
 //==============================================================================================
-// int ktfs_update_bitmap(uint32_t block_num, int delete_or_add)
+// int ktfs_update_bitmap(struct ktfs_fs *fs, uint32_t block_num, int delete_or_add)
 // inputs: uint32_t block_num: block to free or allocate
 //         int delete_or_add: 0 to free block, 1 to allocate
 // outputs: updated block number or error
@@ -1016,41 +1587,41 @@ int ktfs_add_new_block(struct io *io, void *arg){
 //==============================================================================================
 
 
-int ktfs_update_bitmap(uint32_t block_num, int delete_or_add){
+int ktfs_update_bitmap(struct ktfs_fs *fs, uint32_t block_num, int delete_or_add){
     if(delete_or_add == 0){//if we want to free a block
     
     
-        block_num = 1 + file_sys.super.bitmap_block_count+file_sys.super.inode_block_count+ block_num;
-        int bitmap_block_num = block_num / (KTFS_BLKSZ*8);
-        int bit_index = block_num% (KTFS_BLKSZ*8);
+        block_num = 1 + fs->super.bitmap_block_count+fs->super.inode_block_count+ block_num;
+        int bitmap_block_num = block_num / (fs->blksz*8);
+        int bit_index = block_num% (fs->blksz*8);
             
         void *bitmap_block = NULL;
-        cache_get_block(file_sys.cache, KTFS_BLKSZ+bitmap_block_num * KTFS_BLKSZ, &bitmap_block);
+        cache_get_block(fs->cache, fs->blksz+bitmap_block_num * fs->blksz, &bitmap_block);
         uint8_t *bitmap = (uint8_t*)bitmap_block;
+        fs->nfree += (bitmap[bit_index/8] >> (bit_index%8)) & 1;
         bitmap[bit_index/8] &= ~(1<<(bit_index%8));//zero it
-        iowriteat(file_sys.vioblk,KTFS_BLKSZ+bitmap_block_num * KTFS_BLKSZ , bitmap_block, CACHE_BLKSZ);//force to disk
-        cache_release_block(file_sys.cache, bitmap_block, 0);
+        ktfs_meta_release(fs, fs->blksz + bitmap_block_num * fs->blksz, bitmap_block, 1);//force to disk
         return 0;
     }else{//if we want to find an empty block
         int finished =0;
         uint32_t num_of_blocks = 0;
-        for(int i = 0; i < file_sys.super.bitmap_block_count; i++) {//loop over # of bitmap blocks
+        for(int i = 0; i < fs->super.bitmap_block_count; i++) {//loop over # of bitmap blocks
             void * bitmap_block = NULL;
-            cache_get_block(file_sys.cache, KTFS_BLKSZ + i* KTFS_BLKSZ, &bitmap_block);
+            cache_get_block(fs->cache, fs->blksz + i* fs->blksz, &bitmap_block);
             uint8_t *bitmap =(uint8_t*) bitmap_block;
-            for(int j = 0; j < KTFS_BLKSZ * 8 ; j++) { //loop over all bits in a bitmap block
+            for(int j = 0; j < fs->blksz * 8 ; j++) { //loop over all bits in a bitmap block
                 int byte_index = j / 8;
                 int bit_offset = j % 8;
                 int bit = bitmap[byte_index] >> bit_offset & 1;
                 if(bit ==0){//if not used
-                    num_of_blocks = j + i * (CACHE_BLKSZ * 8);
-                    if(num_of_blocks < file_sys.data_blk_pos / KTFS_BLKSZ){
+                    num_of_blocks = j + i * (fs->blksz * 8);
+                    if(num_of_blocks < fs->data_blk_pos / fs->blksz){
                         continue; 
                     }
-                    num_of_blocks -= file_sys.data_blk_pos / KTFS_BLKSZ; //calculate the block's data block number
+                    num_of_blocks -= fs->data_blk_pos / fs->blksz; //calculate the block's data block number
                     bitmap[byte_index] |= (1 << bit_offset); //set to one
-                    iowriteat(file_sys.vioblk,KTFS_BLKSZ + i* KTFS_BLKSZ , bitmap_block, CACHE_BLKSZ);
-                    cache_release_block(file_sys.cache, bitmap_block, 0);
+                    fs->nfree--;
+                    ktfs_meta_release(fs, fs->blksz + i * fs->blksz, bitmap_block, 1);
                     finished = 1;
                     break;
                 }
@@ -1058,7 +1629,7 @@ int ktfs_update_bitmap(uint32_t block_num, int delete_or_add){
             if(finished == 1){
                 break;
             }
-            cache_release_block(file_sys.cache, bitmap_block, 0);
+            cache_release_block(fs->cache, bitmap_block, 0);
         }
         if(finished == 0){
             return -EINVAL;
@@ -1067,4 +1638,1573 @@ int ktfs_update_bitmap(uint32_t block_num, int delete_or_add){
     }
 }
 
+//==============================================================================================
+// int ktfs_find_run(struct ktfs_fs *fs, uint32_t goal, uint32_t want, uint32_t *got)
+// inputs: uint32_t goal: data block the run should start at
+//         uint32_t want: number of blocks wanted
+//         uint32_t *got: output number of blocks in the run found
+// outputs: first data block of the run, ENODATABLKS if no block is free
+// description:
+//     finds free data blocks for ktfs_place_blocks. takes want blocks at goal if they are
+//     free, else the first run of want free blocks, else the longest free run there is.
+//     the bitmap is not changed; see ktfs_mark_run.
+//==============================================================================================
+
+static int ktfs_find_run(struct ktfs_fs *fs, uint32_t goal, uint32_t want, uint32_t *got){
+    uint32_t nblocks = fs->super.block_count - fs->data_blk_pos / fs->blksz;
+    void *bitmap_block = NULL;
+    int bitmap_num = -1;
+    uint32_t best = 0;
+    uint32_t best_len = 0;
+    uint32_t run = 0;
+    uint32_t run_len = 0;
+
+    //try to continue where the file ends
+    while(goal < nblocks && run_len < want && ktfs_block_used(fs, goal + run_len, &bitmap_block, &bitmap_num) == 0){
+        run_len++;
+        if(goal + run_len == nblocks){
+            break;
+        }
+    }
+    best = goal;
+    best_len = run_len;
+    if(run_len < want){
+        run_len = 0;
+        //first fit, remembering the longest run in case none is long enough
+        for(uint32_t blk = 0; blk < nblocks && best_len < want; blk++){
+            if(ktfs_block_used(fs, blk, &bitmap_block, &bitmap_num) != 0){
+                run_len = 0;
+                continue;
+            }
+            if(run_len == 0){
+                run = blk;
+            }
+            run_len++;
+            if(run_len > best_len){
+                best = run;
+                best_len = run_len;
+            }
+        }
+    }
+    if(bitmap_block != NULL){
+        cache_release_block(fs->cache, bitmap_block, 0);
+    }
+    if(best_len == 0){
+        return -ENODATABLKS;
+    }
+    *got = best_len;
+    return best;
+}
+
+//==============================================================================================
+// int ktfs_block_used(struct ktfs_fs *fs, uint32_t data_block, void **bitmap_block, int *bitmap_num)
+// inputs: uint32_t data_block: data block number
+//         void **bitmap_block: bitmap block held in the cache, NULL for none
+//         int *bitmap_num: number of the bitmap block held
+// outputs: 1 if the block is allocated (or cannot be checked), 0 if free
+// description:
+//     tests a bitmap bit for a scan, keeping the bitmap block it is in until the scan
+//     moves past it. the caller releases the last one.
+//==============================================================================================
+
+static int ktfs_block_used(struct ktfs_fs *fs, uint32_t data_block, void **bitmap_block, int *bitmap_num){
+    uint32_t block_num = fs->data_blk_pos / fs->blksz + data_block;
+    int num = block_num / (fs->blksz * 8);
+    int bit_index = block_num % (fs->blksz * 8);
+    if(num != *bitmap_num){
+        if(*bitmap_block != NULL){
+            cache_release_block(fs->cache, *bitmap_block, 0);
+            *bitmap_block = NULL;
+        }
+        if(cache_get_block(fs->cache, fs->blksz + num * fs->blksz, bitmap_block) != 0){
+            *bitmap_block = NULL;
+            *bitmap_num = -1;
+            return 1;
+        }
+        *bitmap_num = num;
+    }
+    uint8_t *bitmap = *bitmap_block;
+    return (bitmap[bit_index / 8] >> (bit_index % 8)) & 1;
+}
+
+//==============================================================================================
+// void ktfs_mark_run(struct ktfs_fs *fs, uint32_t start, uint32_t cnt, int used)
+// inputs: uint32_t start: first data block
+//         uint32_t cnt: number of blocks
+//         int used: 1 to allocate the blocks, 0 to free them
+// outputs: none
+// description:
+//     sets or clears the bitmap bits of a run of data blocks and writes (or logs) each
+//     bitmap block it touches once, like ktfs_update_bitmap does for a single block.
+//     keeps fs->nfree.
+//==============================================================================================
+
+static void ktfs_mark_run(struct ktfs_fs *fs, uint32_t start, uint32_t cnt, int used){
+    uint32_t block_num = fs->data_blk_pos / fs->blksz + start;
+    uint32_t end = block_num + cnt;
+    while(block_num < end){
+        int bitmap_block_num = block_num / (fs->blksz * 8);
+        void *bitmap_block = NULL;
+        if(cache_get_block(fs->cache, fs->blksz + bitmap_block_num * fs->blksz, &bitmap_block) != 0){
+            return;
+        }
+        uint8_t *bitmap = bitmap_block;
+        for(; block_num < end && block_num / (fs->blksz * 8) == bitmap_block_num; block_num++){
+            int bit_index = block_num % (fs->blksz * 8);
+            int was = (bitmap[bit_index / 8] >> (bit_index % 8)) & 1;
+            if(used){
+                bitmap[bit_index / 8] |= (1 << (bit_index % 8));
+                fs->nfree -= !was;
+            }else{
+                bitmap[bit_index / 8] &= ~(1 << (bit_index % 8));
+                fs->nfree += was;
+            }
+        }
+        ktfs_meta_release(fs, fs->blksz + bitmap_block_num * fs->blksz, bitmap_block, 1);//force to disk
+    }
+}
+
+//==============================================================================================
+// int ktfs_alloc_inode(struct ktfs_fs *fs, uint32_t flags)
+// inputs: uint32_t flags: KTFS_FILE_* flags of the new inode
+// outputs: inode number, or ENOINODEBLKS if none is free
+// description:
+//     finds an inode with no flags and no size, clears it and sets its flags. the
+//     inode block is forced to disk, or logged.
+//==============================================================================================
+
+static int ktfs_alloc_inode(struct ktfs_fs *fs, uint32_t flags){
+    const int per_block = fs->blksz / sizeof(struct ktfs_inode);
+    for(int i = fs->inode_start / per_block; i < fs->super.inode_block_count; i++){
+        void * inodes = NULL;
+        if(cache_get_block(fs->cache, fs->inode_blk_pos + fs->blksz*i, &inodes) != 0){
+            return -EIO;
+        }
+        struct ktfs_inode * inode_block = inodes;
+        for(int j = 0; j < per_block; j++){
+            if(per_block * i + j < fs->inode_start){
+                continue;
+            }
+            if(inode_block[j].flags == 0 && inode_block[j].size == 0){
+                memset(&inode_block[j], 0, sizeof(struct ktfs_inode));
+                inode_block[j].flags = flags;
+                //found inode, force a write to disk
+                ktfs_meta_release(fs, fs->inode_blk_pos + fs->blksz*i, inodes, 1);
+                return per_block * i + j;
+            }
+        }
+        cache_release_block(fs->cache, inodes, 0);
+    }
+    return -ENOINODEBLKS;
+}
+
+//==============================================================================================
+// int ktfs_get_inode(struct ktfs_fs *fs, uint16_t index, void **inodes, struct ktfs_inode **inode)
+// inputs: uint16_t index: inode number
+//         void **inodes: output inode block in the cache
+//         struct ktfs_inode **inode: output pointer to the inode in that block
+// outputs: 0 if success, EIO if the block cannot be read
+// description:
+//     gets the inode block holding an inode. release it with cache_release_block, or
+//     ktfs_put_inode to write it through.
+//==============================================================================================
+
+static int ktfs_get_inode(struct ktfs_fs *fs, uint16_t index, void **inodes, struct ktfs_inode **inode){
+    int inode_num = index / (fs->blksz / sizeof(struct ktfs_inode));
+    int inode_offset = index % (fs->blksz / sizeof(struct ktfs_inode));
+    if(cache_get_block(fs->cache, fs->inode_blk_pos + inode_num * fs->blksz, inodes) != 0){
+        return -EIO;
+    }
+    *inode = &((struct ktfs_inode *)*inodes)[inode_offset];
+    return 0;
+}
+
+//==============================================================================================
+// void ktfs_put_inode(struct ktfs_fs *fs, uint16_t index, void *inodes, int write)
+// inputs: uint16_t index: inode number
+//         void *inodes: inode block from ktfs_get_inode
+//         int write: 1 if the inode was changed
+// outputs: none
+// description:
+//     a changed inode block is written through, or logged (see ktfs_meta_release).
+//==============================================================================================
+
+static void ktfs_put_inode(struct ktfs_fs *fs, uint16_t index, void *inodes, int write){
+    int inode_num = index / (fs->blksz / sizeof(struct ktfs_inode));
+    if(write){
+        ktfs_meta_release(fs, fs->inode_blk_pos + inode_num * fs->blksz, inodes, 1);
+    }else{
+        cache_release_block(fs->cache, inodes, 0);
+    }
+}
+
+//==============================================================================================
+// int ktfs_is_dir(struct ktfs_fs *fs, uint16_t index, const struct ktfs_inode *inode)
+// inputs: uint16_t index: inode number
+//         const struct ktfs_inode *inode: the inode
+// outputs: 1 for a directory, 0 for a file
+// description:
+//     the root directory of an image made by mkfs_ktfs has no flags, it is known by number.
+//==============================================================================================
+
+static int ktfs_is_dir(struct ktfs_fs *fs, uint16_t index, const struct ktfs_inode *inode){
+    return index == fs->super.root_directory_inode || (inode->flags & KTFS_FILE_DIR) != 0;
+}
+
+//==============================================================================================
+// int ktfs_resolve(struct ktfs_fs *fs, const char *path, uint16_t *dir_ino, char *leaf)
+// inputs: const char *path: path such as "bin/shell.elf"; leading, trailing and repeated
+//                           slashes are ignored
+//         uint16_t *dir_ino: output inode of the directory holding the last component
+//         char *leaf: output last component, KTFS_MAX_FILENAME_LEN + 1 bytes
+// outputs: 0 if success
+//          ENOENT: if the path is empty or a directory on it does not exist
+//          EINVAL: if a component is too long
+// description:
+//     walks the directories of a path from the root directory. the last component is not
+//     looked up, so the caller can create it.
+//==============================================================================================
 
+static int ktfs_resolve(struct ktfs_fs *fs, const char *path, uint16_t *dir_ino, char *leaf){
+    uint16_t cur = fs->super.root_directory_inode;
+    const char *p = path;
+    for(;;){
+        while(*p == '/'){
+            p++;
+        }
+        const char *end = p;
+        while(*end != '\0' && *end != '/'){
+            end++;
+        }
+        size_t len = end - p;
+        if(len == 0){
+            return -ENOENT;
+        }
+        if(len > KTFS_MAX_FILENAME_LEN){
+            return -EINVAL;
+        }
+        memcpy(leaf, p, len);
+        leaf[len] = '\0';
+        while(*end == '/'){
+            end++;
+        }
+        if(*end == '\0'){
+            *dir_ino = cur;
+            return 0;
+        }
+
+        //step into the directory
+        uint16_t next;
+        void * inodes = NULL;
+        struct ktfs_inode * inode;
+        if(ktfs_dir_lookup(fs, cur, leaf, &next, 0) != 0 || ktfs_get_inode(fs, next, &inodes, &inode) != 0){
+            return -ENOENT;
+        }
+        int is_dir = ktfs_is_dir(fs, next, inode);
+        cache_release_block(fs->cache, inodes, 0);
+        if(!is_dir){
+            return -ENOENT;
+        }
+        cur = next;
+        p = end;
+    }
+}
+
+//==============================================================================================
+// uint32_t ktfs_dir_hash(const char *name)
+// inputs: const char *name: file name
+// outputs: 32 bit FNV-1a hash of the name
+//==============================================================================================
+
+static uint32_t ktfs_dir_hash(const char *name){
+    uint32_t hash = 2166136261u;
+    for(int i = 0; i < KTFS_MAX_FILENAME_LEN + 1 && name[i] != '\0'; i++){
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+//==============================================================================================
+// uint32_t ktfs_dir_nblocks(struct ktfs_fs *fs, const struct ktfs_inode *dir)
+// inputs: const struct ktfs_inode *dir: directory inode
+// outputs: number of dentry blocks in the directory
+// description:
+//     a hashed directory has one bucket per block of its size. a linear one uses the direct blocks,
+//     up to the first one not allocated.
+//==============================================================================================
+
+static uint32_t ktfs_dir_nblocks(struct ktfs_fs *fs, const struct ktfs_inode *dir){
+    if(dir->flags & KTFS_FILE_HASHED){
+        return dir->size / fs->blksz;
+    }
+    uint32_t nblocks = 1;
+    while(nblocks < KTFS_NUM_DIRECT_DATA_BLOCKS && dir->block[nblocks] != 0){
+        nblocks++;
+    }
+    return nblocks;
+}
+
+//==============================================================================================
+// int ktfs_dir_get(struct ktfs_fs *fs, struct ktfs_inode *dir, uint32_t block_num, unsigned long long *pos, void **block)
+// inputs: struct ktfs_inode *dir: directory inode
+//         uint32_t block_num: dentry block number in the directory
+//         unsigned long long *pos: output device position of the block
+//         void **block: output block in the cache
+// outputs: 0 if success, negative on error
+//==============================================================================================
+
+static int ktfs_dir_get(struct ktfs_fs *fs, struct ktfs_inode *dir, uint32_t block_num, unsigned long long *pos, void **block){
+    if(ktfs_data_block_pos(fs, block_num, dir, pos) < 0){
+        return -EINVAL;
+    }
+    return cache_get_block(fs->cache, *pos, block);
+}
+
+//==============================================================================================
+// int ktfs_dirblk_find(struct ktfs_fs *fs, const struct ktfs_dir_entry *dentries, const char *name)
+// inputs: const struct ktfs_dir_entry *dentries: a dentry block
+//         const char *name: name to find, "" for a free dentry
+// outputs: index of the dentry in the block, or -1
+//==============================================================================================
+
+static int ktfs_dirblk_find(struct ktfs_fs *fs, const struct ktfs_dir_entry *dentries, const char *name){
+    for(int j = 0; j < fs->ndents; j++){
+        if(name[0] == '\0' ? dentries[j].name[0] == '\0'
+            : strncmp(dentries[j].name, name, sizeof(dentries[j].name)) == 0){
+            return j;
+        }
+    }
+    return -1;
+}
+
+//==============================================================================================
+// int ktfs_dir_lookup(struct ktfs_fs *fs, uint16_t dir_ino, const char *name, uint16_t *index, int remove)
+// inputs: uint16_t dir_ino: directory inode
+//         const char *name: name to find
+//         uint16_t *index: output inode number of the entry
+//         int remove: 1 to also clear the dentry
+// outputs: 0 if found, ENOENT if not, EIO on a read error
+// description:
+//     a hashed directory is looked up in the one bucket the name hashes to, a linear one
+//     in all its blocks.
+//==============================================================================================
+
+static int ktfs_dir_lookup(struct ktfs_fs *fs, uint16_t dir_ino, const char *name, uint16_t *index, int remove){
+    void * inodes = NULL;
+    struct ktfs_inode * inode;
+    if(ktfs_get_inode(fs, dir_ino, &inodes, &inode) != 0){
+        return -EIO;
+    }
+    struct ktfs_inode dir = *inode;
+    cache_release_block(fs->cache, inodes, 0);
+
+    uint32_t first = 0;
+    uint32_t last = ktfs_dir_nblocks(fs, &dir);
+    if((dir.flags & KTFS_FILE_HASHED) && last != 0){
+        first = ktfs_dir_hash(name) & (last - 1);
+        last = first + 1;
+    }
+    for(uint32_t b = first; b < last; b++){
+        unsigned long long pos;
+        void * dentries_ptr = NULL;
+        if(ktfs_dir_get(fs, &dir, b, &pos, &dentries_ptr) != 0){
+            return -EIO;
+        }
+        struct ktfs_dir_entry * dentries = dentries_ptr;
+        int j = ktfs_dirblk_find(fs, dentries, name);
+        if(j >= 0){
+            *index = dentries[j].inode;
+            if(remove){
+                memset(&dentries[j], 0, sizeof(struct ktfs_dir_entry));
+                ktfs_meta_release(fs, pos, dentries_ptr, 1);//force to disk
+            }else{
+                cache_release_block(fs->cache, dentries_ptr, 0);
+            }
+            return 0;
+        }
+        cache_release_block(fs->cache, dentries_ptr, 0);
+    }
+    return -ENOENT;
+}
+
+//==============================================================================================
+// int ktfs_dir_insert(struct ktfs_fs *fs, uint16_t dir_ino, const char *name, uint16_t index)
+// inputs: uint16_t dir_ino: directory inode
+//         const char *name: name of the new entry, not in the directory yet
+//         uint16_t index: inode number of the new entry
+// outputs: 0 if success, negative on error
+// description:
+//     puts a dentry in the first free slot of its bucket. a full bucket doubles the
+//     directory (ktfs_dir_split); a full linear directory is converted to a hashed one.
+//==============================================================================================
+
+static int ktfs_dir_insert(struct ktfs_fs *fs, uint16_t dir_ino, const char *name, uint16_t index){
+    for(;;){
+        void * inodes = NULL;
+        struct ktfs_inode * inode;
+        if(ktfs_get_inode(fs, dir_ino, &inodes, &inode) != 0){
+            return -EIO;
+        }
+        struct ktfs_inode dir = *inode;
+        cache_release_block(fs->cache, inodes, 0);
+
+        uint32_t first = 0;
+        uint32_t last = ktfs_dir_nblocks(fs, &dir);
+        if((dir.flags & KTFS_FILE_HASHED) && last != 0){
+            first = ktfs_dir_hash(name) & (last - 1);
+            last = first + 1;
+        }
+        for(uint32_t b = first; b < last; b++){
+            unsigned long long pos;
+            void * dentries_ptr = NULL;
+            if(ktfs_dir_get(fs, &dir, b, &pos, &dentries_ptr) != 0){
+                return -EIO;
+            }
+            struct ktfs_dir_entry * dentries = dentries_ptr;
+            int j = ktfs_dirblk_find(fs, dentries, "");
+            if(j >= 0){
+                strncpy(dentries[j].name, name, sizeof(dentries[j].name) - 1);
+                dentries[j].name[sizeof(dentries[j].name) - 1] = '\0';
+                dentries[j].inode = index;
+                ktfs_meta_release(fs, pos, dentries_ptr, 1);//force to disk
+                return 0;
+            }
+            cache_release_block(fs->cache, dentries_ptr, 0);
+        }
+
+        int result = (dir.flags & KTFS_FILE_HASHED) ? ktfs_dir_split(fs, dir_ino) : ktfs_dir_convert(fs, dir_ino);
+        if(result < 0){
+            return result;
+        }
+    }
+}
+
+//==============================================================================================
+// int ktfs_dir_empty(struct ktfs_fs *fs, uint16_t dir_ino)
+// inputs: uint16_t dir_ino: directory inode
+// outputs: 1 if the directory has no entries, 0 if it has (or cannot be read)
+//==============================================================================================
+
+static int ktfs_dir_empty(struct ktfs_fs *fs, uint16_t dir_ino){
+    void * inodes = NULL;
+    struct ktfs_inode * inode;
+    if(ktfs_get_inode(fs, dir_ino, &inodes, &inode) != 0){
+        return 0;
+    }
+    struct ktfs_inode dir = *inode;
+    cache_release_block(fs->cache, inodes, 0);
+
+    uint32_t nblocks = ktfs_dir_nblocks(fs, &dir);
+    for(uint32_t b = 0; b < nblocks; b++){
+        unsigned long long pos;
+        void * dentries_ptr = NULL;
+        if(ktfs_dir_get(fs, &dir, b, &pos, &dentries_ptr) != 0){
+            return 0;
+        }
+        for(int j = 0; j < fs->ndents; j++){
+            if(((struct ktfs_dir_entry *)dentries_ptr)[j].name[0] != '\0'){
+                cache_release_block(fs->cache, dentries_ptr, 0);
+                return 0;
+            }
+        }
+        cache_release_block(fs->cache, dentries_ptr, 0);
+    }
+    return 1;
+}
+
+//==============================================================================================
+// int ktfs_dir_grow(struct ktfs_fs *fs, struct ktfs_inode *dir, uint32_t from, uint32_t to)
+// inputs: struct ktfs_inode *dir: directory inode, in the cache
+//         uint32_t from: first new dentry block
+//         uint32_t to: number of dentry blocks wanted
+// outputs: 0 if success, ENODATABLKS if the device is full
+// description:
+//     gives the directory zeroed blocks up to to. blocks a failed earlier attempt left
+//     past the end of the directory are used again rather than placed a second time.
+//==============================================================================================
+
+static int ktfs_dir_grow(struct ktfs_fs *fs, struct ktfs_inode *dir, uint32_t from, uint32_t to){
+    unsigned long long pos;
+    while(from < to && ktfs_meta_missing(fs, dir, from) == KTFS_META_NONE
+        && ktfs_data_block_pos(fs, from, dir, &pos) == 0 && pos != fs->data_blk_pos){
+        from++;
+    }
+    if(from < to && ktfs_place_blocks(fs, dir, from, to - from, NULL) != to - from){
+        return -ENODATABLKS;
+    }
+    return 0;
+}
+
+//==============================================================================================
+// int ktfs_dir_split(struct ktfs_fs *fs, uint16_t dir_ino)
+// inputs: uint16_t dir_ino: hashed directory inode
+// outputs: 0 if success, negative on error
+// description:
+//     doubles the buckets of a hashed directory. bucket b keeps the entries whose hash
+//     is b modulo the new count and gives the others to the new bucket b + old count,
+//     so no other bucket is read.
+//==============================================================================================
+
+static int ktfs_dir_split(struct ktfs_fs *fs, uint16_t dir_ino){
+    void * inodes = NULL;
+    struct ktfs_inode * dir;
+    if(ktfs_get_inode(fs, dir_ino, &inodes, &dir) != 0){
+        return -EIO;
+    }
+    uint32_t nblocks = dir->size / fs->blksz;
+    uint32_t grown = (nblocks == 0) ? 1 : 2 * nblocks;
+    if(grown > KTFS_DIR_MAX_BUCKETS){
+        cache_release_block(fs->cache, inodes, 0);
+        return -ENODATABLKS;
+    }
+    int result = ktfs_dir_grow(fs, dir, nblocks, grown);
+    if(result < 0){
+        ktfs_put_inode(fs, dir_ino, inodes, 1); //keep the pointers to what was placed
+        return result;
+    }
+
+    for(uint32_t b = 0; b < nblocks; b++){
+        unsigned long long pos, new_pos;
+        void * dentries_ptr = NULL;
+        void * new_ptr = NULL;
+        if(ktfs_dir_get(fs, dir, b, &pos, &dentries_ptr) != 0){
+            result = -EIO;
+            break;
+        }
+        if(ktfs_dir_get(fs, dir, b + nblocks, &new_pos, &new_ptr) != 0){
+            cache_release_block(fs->cache, dentries_ptr, 0);
+            result = -EIO;
+            break;
+        }
+        struct ktfs_dir_entry * dentries = dentries_ptr;
+        struct ktfs_dir_entry * new_dentries = new_ptr;
+        int k = 0;
+        for(int j = 0; j < fs->ndents; j++){
+            if(dentries[j].name[0] != '\0' && (ktfs_dir_hash(dentries[j].name) & (grown - 1)) != b){
+                new_dentries[k++] = dentries[j];
+                memset(&dentries[j], 0, sizeof(struct ktfs_dir_entry));
+            }
+        }
+        ktfs_meta_release(fs, new_pos, new_ptr, 1);
+        ktfs_meta_release(fs, pos, dentries_ptr, 1);
+    }
+    if(result == 0){
+        dir->size = grown * fs->blksz;
+    }
+    ktfs_put_inode(fs, dir_ino, inodes, 1);
+    return result;
+}
+
+//==============================================================================================
+// int ktfs_dir_convert(struct ktfs_fs *fs, uint16_t dir_ino)
+// inputs: uint16_t dir_ino: linear directory inode
+// outputs: 0 if success, negative on error
+// description:
+//     turns a full linear directory into a hashed one with at least twice its blocks and
+//     enters its entries again. the inodes of the entries get KTFS_FILE_IN_USE so they
+//     are not taken for free ones once the root directory no longer gives their number.
+//==============================================================================================
+
+static int ktfs_dir_convert(struct ktfs_fs *fs, uint16_t dir_ino){
+    void * inodes = NULL;
+    struct ktfs_inode * dir;
+    if(ktfs_get_inode(fs, dir_ino, &inodes, &dir) != 0){
+        return -EIO;
+    }
+    uint32_t nblocks = ktfs_dir_nblocks(fs, dir);
+    uint32_t grown = 1;
+    while(grown < 2 * nblocks){
+        grown <<= 1;
+    }
+    const size_t size = nblocks * fs->blksz;
+    struct ktfs_dir_entry * entries;
+    if(size <= KTFS_HEAP_MAX){
+        entries = kmalloc(size);
+    }else{
+        entries = alloc_phys_pages(ROUND_UP(size, PAGE_SIZE) / PAGE_SIZE);
+    }
+    if(entries == NULL){
+        cache_release_block(fs->cache, inodes, 0);
+        return -ENOMEM;
+    }
+    memset(entries, 0, size);
+    int result = ktfs_dir_grow(fs, dir, nblocks, grown);
+    if(result < 0){
+        ktfs_free_entries(entries, size);
+        ktfs_put_inode(fs, dir_ino, inodes, 1);
+        return result;
+    }
+
+    //take the entries out of the old blocks
+    for(uint32_t b = 0; b < nblocks; b++){
+        unsigned long long pos;
+        void * dentries_ptr = NULL;
+        if(ktfs_dir_get(fs, dir, b, &pos, &dentries_ptr) != 0){
+            continue;
+        }
+        memcpy(entries + b * fs->ndents, dentries_ptr, fs->blksz);
+        memset(dentries_ptr, 0, fs->blksz);
+        ktfs_meta_release(fs, pos, dentries_ptr, 1);
+    }
+    dir->flags |= KTFS_FILE_IN_USE | KTFS_FILE_DIR | KTFS_FILE_HASHED;
+    dir->size = grown * fs->blksz;
+    ktfs_put_inode(fs, dir_ino, inodes, 1);
+    if(dir_ino == fs->super.root_directory_inode){
+        fs->inode_start = 0;
+    }
+
+    for(uint32_t i = 0; i < nblocks * fs->ndents; i++){
+        if(entries[i].name[0] == '\0'){
+            continue;
+        }
+        struct ktfs_inode * inode;
+        if(ktfs_get_inode(fs, entries[i].inode, &inodes, &inode) == 0){
+            inode->flags |= KTFS_FILE_IN_USE;
+            ktfs_put_inode(fs, entries[i].inode, inodes, 1);
+        }
+        if(ktfs_dir_insert(fs, dir_ino, entries[i].name, entries[i].inode) < 0){
+            result = -ENODATABLKS;
+        }
+    }
+    ktfs_free_entries(entries, size);
+    return result;
+}
+
+//==============================================================================================
+// void ktfs_free_entries(struct ktfs_dir_entry *entries, size_t size)
+// inputs: struct ktfs_dir_entry *entries: buffer from ktfs_dir_convert
+//         size_t size: its size in bytes
+// outputs: none
+//==============================================================================================
+
+static void ktfs_free_entries(struct ktfs_dir_entry *entries, size_t size){
+    if(size <= KTFS_HEAP_MAX){
+        kfree(entries);
+    }else{
+        free_phys_pages(entries, ROUND_UP(size, PAGE_SIZE) / PAGE_SIZE);
+    }
+}
+
+//==============================================================================================
+// int ktfs_getpage(struct ktfs_fs *fs, struct ktfs_file *fd, struct iopage *pg)
+// inputs: struct ktfs_file *fd: open file
+//         struct iopage *pg: file offset of the page and whether it will be written,
+//                            or NULL to ask whether files can be mapped
+// outputs: int 0: success, pg->page is the page with a reference for the caller
+//              EINVAL: the offset is not page aligned or is past the end of the file
+//              ENOMEM: no page for the cache
+//              EIO: the page could not be read
+// description:
+//     IOCTL_GETPAGE for mmap. finds the page in the file's page cache or reads it in,
+//     evicting the least recently used page that is not mapped when the cache is full.
+//     the part of the last page past the end of the file reads as zeros.
+//==============================================================================================
+
+static int ktfs_getpage(struct ktfs_fs *fs, struct ktfs_file *fd, struct iopage *pg){
+    if(pg == NULL){
+        return 0;
+    }
+    if(pg->pos % PAGE_SIZE != 0 || pg->pos >= fd->size){
+        return -EINVAL;
+    }
+    uint32_t pgno = pg->pos / PAGE_SIZE;
+    struct ktfs_page *page = fd->pages;
+    while(page != NULL && page->pgno != pgno){
+        page = page->next;
+    }
+
+    if(page == NULL){
+        if(fs->npages >= KTFS_PAGE_CACHE_CNT){
+            ktfs_page_evict(fs);
+        }
+        page = kmalloc(sizeof(struct ktfs_page));
+        void *pp = alloc_phys_page();
+        if(page == NULL || pp == NULL){
+            if(page != NULL){
+                kfree(page);
+            }
+            if(pp != NULL){
+                free_phys_page(pp);
+            }
+            return -ENOMEM;
+        }
+        memset(pp, 0, PAGE_SIZE);
+        struct iovec iov = { .base = pp, .len = PAGE_SIZE };
+        if(ktfs_xferv(fs, fd, pg->pos, &iov, 1, 0) < 0){
+            kfree(page);
+            free_phys_page(pp);
+            return -EIO;
+        }
+        get_phys_page(pp); // the cache's reference
+        page->pp = pp;
+        page->pgno = pgno;
+        page->dirty = 0;
+        page->next = fd->pages;
+        fd->pages = page;
+        fs->npages++;
+    }
+
+    page->stamp = ++fs->page_clock;
+    page->dirty |= (pg->write != 0);
+    get_phys_page(page->pp); // the caller's reference
+    pg->page = page->pp;
+    return 0;
+}
+
+//==============================================================================================
+// int ktfs_page_sync(struct ktfs_fs *fs, struct ktfs_file *fd, unsigned long long pos, unsigned long long len)
+// inputs: struct ktfs_file *fd: open file
+//         unsigned long long pos: file offset
+//         unsigned long long len: bytes from pos
+// outputs: int 0: success
+//              EIO: a page could not be written back
+// description:
+//     writes back the dirty cached pages of the file that overlap the range.
+//==============================================================================================
+
+static int ktfs_page_sync(struct ktfs_fs *fs, struct ktfs_file *fd, unsigned long long pos, unsigned long long len){
+    int result = 0;
+    for(struct ktfs_page *page = fd->pages; page != NULL; page = page->next){
+        unsigned long long ppos = (unsigned long long)page->pgno * PAGE_SIZE;
+        if(ppos < pos + len && pos < ppos + PAGE_SIZE){
+            if(ktfs_page_writeback(fs, fd, page) != 0){
+                result = -EIO;
+            }
+        }
+    }
+    return result;
+}
+
+//==============================================================================================
+// int ktfs_page_writeback(struct ktfs_fs *fs, struct ktfs_file *fd, struct ktfs_page *page)
+// inputs: struct ktfs_file *fd: open file
+//         struct ktfs_page *page: one of its cached pages
+// outputs: int 0: success
+//              EIO: the blocks could not be written
+// description:
+//     copies a dirty page into the file blocks, up to the end of the file. stores
+//     through a mapping are not seen by the kernel, so a page stays dirty while it is
+//     still mapped and is written again by the next sync.
+//==============================================================================================
+
+static int ktfs_page_writeback(struct ktfs_fs *fs, struct ktfs_file *fd, struct ktfs_page *page){
+    unsigned long long pos = (unsigned long long)page->pgno * PAGE_SIZE;
+    if(!page->dirty){
+        return 0;
+    }
+    if(pos < fd->size){
+        struct iovec iov = { .base = page->pp, .len = PAGE_SIZE };
+        if(ktfs_xferv(fs, fd, pos, &iov, 1, 1) < 0){
+            return -EIO;
+        }
+    }
+    if(phys_page_refcnt(page->pp) == 1){
+        page->dirty = 0;
+    }
+    return 0;
+}
+
+//==============================================================================================
+// void ktfs_page_evict(struct ktfs_fs *fs)
+// inputs: none
+// outputs: none
+// description:
+//     writes back and frees the least recently used cached page of any open file that
+//     is not mapped. if every page is mapped, nothing is evicted and the cache grows.
+//==============================================================================================
+
+static void ktfs_page_evict(struct ktfs_fs *fs){
+    struct ktfs_file *victim_fd = NULL;
+    struct ktfs_page *victim = NULL;
+    for(struct ktfs_file *cur = fs->open_file; cur != NULL; cur = cur->next){
+        for(struct ktfs_page *page = cur->pages; page != NULL; page = page->next){
+            if(phys_page_refcnt(page->pp) == 1 && (victim == NULL || page->stamp < victim->stamp)){
+                victim = page;
+                victim_fd = cur;
+            }
+        }
+    }
+    if(victim == NULL){
+        return;
+    }
+
+    ktfs_page_writeback(fs, victim_fd, victim);
+    struct ktfs_page **link = &victim_fd->pages;
+    while(*link != victim){
+        link = &(*link)->next;
+    }
+    *link = victim->next;
+    put_phys_page(victim->pp);
+    kfree(victim);
+    fs->npages--;
+}
+
+//==============================================================================================
+// void ktfs_page_drop(struct ktfs_fs *fs, struct ktfs_file *fd)
+// inputs: struct ktfs_file *fd: file being closed
+// outputs: none
+// description:
+//     writes back and frees every cached page of the file.
+//==============================================================================================
+
+static void ktfs_page_drop(struct ktfs_fs *fs, struct ktfs_file *fd){
+    while(fd->pages != NULL){
+        struct ktfs_page *page = fd->pages;
+        fd->pages = page->next;
+        ktfs_page_writeback(fs, fd, page);
+        put_phys_page(page->pp);
+        kfree(page);
+        fs->npages--;
+    }
+}
+
+//==============================================================================================
+// void ktfs_page_xferv(struct ktfs_file *fd, unsigned long long pos, const struct iovec *iov, int iovcnt, long len, int write)
+// inputs: struct ktfs_file *fd: open file
+//         unsigned long long pos: file offset of the transfer
+//         const struct iovec *iov: segments of the transfer
+//         int iovcnt: number of segments
+//         long len: bytes transferred
+//         int write: 1 if the segments were written to the file, 0 if read from it
+// outputs: none
+// description:
+//     keeps read and write coherent with mappings of the file. a write is copied into
+//     the cached pages it covers as well as the blocks; a read takes the bytes of dirty
+//     pages, which may hold stores not yet written back, over those of the blocks.
+//==============================================================================================
+
+static void ktfs_page_xferv(struct ktfs_file *fd, unsigned long long pos, const struct iovec *iov, int iovcnt, long len, int write){
+    for(struct ktfs_page *page = fd->pages; page != NULL; page = page->next){
+        unsigned long long ppos = (unsigned long long)page->pgno * PAGE_SIZE;
+        if(ppos >= pos + len || ppos + PAGE_SIZE <= pos || (!write && !page->dirty)){
+            continue;
+        }
+        unsigned long long lo = (ppos > pos) ? ppos : pos;
+        unsigned long long hi = (ppos + PAGE_SIZE < pos + len) ? ppos + PAGE_SIZE : pos + len;
+        char *pp = (char *)page->pp + (lo - ppos);
+        unsigned long long skip = lo - pos;
+        long n = hi - lo;
+
+        // find the segment holding offset lo and copy from there
+        for(int seg = 0; seg < iovcnt && n > 0; seg++){
+            if(skip >= iov[seg].len){
+                skip -= iov[seg].len;
+                continue;
+            }
+            long m = iov[seg].len - skip;
+            if(m > n){
+                m = n;
+            }
+            if(write){
+                memcpy(pp, (char *)iov[seg].base + skip, m);
+            }else{
+                memcpy((char *)iov[seg].base + skip, pp, m);
+            }
+            pp += m;
+            n -= m;
+            skip = 0;
+        }
+    }
+}
+
+//==============================================================================================
+// void ktfs_meta_release(struct ktfs_fs *fs, unsigned long long pos, void *block, int through)
+// inputs: unsigned long long pos: device position of the block
+//         void *block: bitmap, inode, directory or pointer block changed in the cache
+//         int through: 1 to write the block to disk now when there is no journal
+// outputs: none
+// description:
+//     releases a changed metadata block. with a journal the block is logged in the running
+//     transaction and stays dirty in the cache, held there until the transaction is
+//     committed. without one it is written through, or left for the next cache flush.
+//==============================================================================================
+
+static void ktfs_meta_release(struct ktfs_fs *fs, unsigned long long pos, void *block, int through){
+    if(fs->jstart != 0){
+        ktfs_journal_log(fs, pos, block);
+    }else if(through){
+        iowriteat(fs->vioblk, pos, block, fs->blksz);
+        cache_release_block(fs->cache, block, 0);
+        return;
+    }
+    cache_release_block(fs->cache, block, CACHE_DIRTY);
+}
+
+//==============================================================================================
+// int ktfs_journal_open(struct ktfs_fs *fs)
+// inputs: none
+// outputs: 0 if success, EINVAL if the superblock places the journal outside the image,
+//          ENOMEM or EIO
+// description:
+//     called by ktfs_mount. an image without a journal gets one of KTFS_JOURNAL_SIZE bytes
+//     if that is not 0 and there is room for it; otherwise its metadata is written
+//     through as before. an existing journal is replayed. the cache is then made to hold
+//     the blocks of the running transaction.
+//==============================================================================================
+
+static int ktfs_journal_open(struct ktfs_fs *fs){
+    const int fresh = (fs->super.journal_block_count == 0);
+    fs->jstart = 0;
+    fs->jcount = 0;
+    fs->jdepth = 0;
+    fs->nlive = 0;
+    if(fresh && ktfs_journal_reserve(fs) != 0){
+        return 0;
+    }
+    const uint32_t first = fs->super.journal_block;
+    const uint32_t blocks = fs->super.journal_block_count;
+    if(first < fs->data_blk_pos / fs->blksz || first >= fs->super.block_count
+        || blocks < 3 || blocks > fs->super.block_count - first){
+        return -EINVAL;
+    }
+
+    //a transaction fits in the buffer, its descriptor and the journal
+    uint32_t jmax = KTFS_JOURNAL_TXSIZE / fs->blksz - 2;
+    if(jmax > (fs->blksz - sizeof(struct ktfs_journal_desc)) / sizeof(uint32_t)){
+        jmax = (fs->blksz - sizeof(struct ktfs_journal_desc)) / sizeof(uint32_t);
+    }
+    if(jmax > blocks - 3){
+        jmax = blocks - 3;
+    }
+    if(fs->jbuf == NULL){
+        fs->jbuf = alloc_phys_pages(KTFS_JOURNAL_PAGES);
+        if(fs->jbuf == NULL){
+            return -ENOMEM;
+        }
+    }
+    if(fs->jlive == NULL){ //the journal holds fewer copies than it has blocks
+        fs->jlive = kcalloc(blocks + jmax, sizeof(uint32_t));
+        if(fs->jlive == NULL){
+            return -ENOMEM;
+        }
+    }
+    fs->jblocks = blocks;
+    fs->jmax = jmax;
+    fs->jstart = first;
+    fs->jseq = 1;
+    if((fresh ? ktfs_journal_reset(fs) : ktfs_journal_replay(fs)) != 0){
+        fs->jstart = 0;
+        return -EIO;
+    }
+    cache_set_hold(fs->cache, ktfs_journal_hold, fs);
+    return 0;
+}
+
+//==============================================================================================
+// int ktfs_journal_reserve(struct ktfs_fs *fs)
+// inputs: none
+// outputs: 0 if success, ENODATABLKS if there is no room, EIO
+// description:
+//     allocates KTFS_JOURNAL_SIZE bytes of contiguous data blocks, at the end of the image
+//     if they are free, and records them in the superblock. nothing is logged yet, so the
+//     bitmap is written through.
+//==============================================================================================
+
+static int ktfs_journal_reserve(struct ktfs_fs *fs){
+    const uint32_t want = KTFS_JOURNAL_SIZE / fs->blksz;
+    const uint32_t nblocks = fs->super.block_count - fs->data_blk_pos / fs->blksz;
+    uint32_t got = 0;
+    if(want < 3 || want >= nblocks){
+        return -ENODATABLKS;
+    }
+    int start = ktfs_find_run(fs, nblocks - want, want, &got);
+    if(start < 0 || got < want){
+        return -ENODATABLKS;
+    }
+    ktfs_mark_run(fs, start, want, 1);
+    fs->super.journal_block = fs->data_blk_pos / fs->blksz + start;
+    fs->super.journal_block_count = want;
+    return ktfs_write_super(fs);
+}
+
+//==============================================================================================
+// int ktfs_journal_replay(struct ktfs_fs *fs)
+// inputs: none
+// outputs: 0 if success, EIO if a block cannot be read or written
+// description:
+//     writes the blocks of each complete transaction after the journal header to their
+//     places, in order, stopping at the first one whose sequence number does not follow
+//     or whose commit block does not match. then starts a new journal after them. the
+//     cache is still empty, so the blocks are written to the device directly.
+//==============================================================================================
+
+static int ktfs_journal_replay(struct ktfs_fs *fs){
+    const unsigned long blksz = fs->blksz;
+    const unsigned long long base = (unsigned long long)fs->jstart * blksz;
+    struct ktfs_journal_header *hdr = (void *)fs->jbuf;
+    struct ktfs_journal_desc *desc = (void *)fs->jbuf;
+
+    if(ioreadat(fs->vioblk, base, fs->jbuf, blksz) != blksz){
+        return -EIO;
+    }
+    if(hdr->magic != KTFS_JOURNAL_MAGIC){ //never written, nothing to replay
+        return ktfs_journal_reset(fs);
+    }
+    fs->jseq = hdr->seq;
+
+    uint32_t blk = 1;
+    while(blk + 2 <= fs->jblocks){
+        if(ioreadat(fs->vioblk, base + blk * blksz, fs->jbuf, blksz) != blksz){
+            return -EIO;
+        }
+        const uint32_t count = desc->count;
+        if(desc->magic != KTFS_JOURNAL_DESC_MAGIC || desc->seq != fs->jseq
+            || count == 0 || count > fs->jmax || blk + count + 2 > fs->jblocks){
+            break;
+        }
+        const long len = (count + 1) * blksz;
+        if(ioreadat(fs->vioblk, base + (blk + 1) * blksz, fs->jbuf + blksz, len) != len){
+            return -EIO;
+        }
+        const struct ktfs_journal_commit *commit = (void *)(fs->jbuf + (count + 1) * blksz);
+        if(commit->magic != KTFS_JOURNAL_COMMIT_MAGIC || commit->seq != fs->jseq || commit->count != count
+            || commit->checksum != ktfs_journal_sum(fs->jbuf, (count + 1) * blksz)){
+            break;
+        }
+        for(uint32_t i = 0; i < count; i++){
+            if(desc->block[i] == 0 || desc->block[i] >= fs->super.block_count){
+                continue;
+            }
+            if(iowriteat(fs->vioblk, (unsigned long long)desc->block[i] * blksz, fs->jbuf + (i + 1) * blksz, blksz) != blksz){
+                return -EIO;
+            }
+        }
+        trace("%s: replayed transaction %u, %u blocks", __func__, fs->jseq, count);
+        blk += count + 2;
+        fs->jseq++;
+    }
+    return ktfs_journal_reset(fs);
+}
+
+//==============================================================================================
+// void ktfs_journal_begin(struct ktfs_fs *fs)
+// void ktfs_journal_end(struct ktfs_fs *fs)
+// inputs: none
+// outputs: none
+// description:
+//     bracket an operation that changes metadata, so the blocks it logs go in the same
+//     transaction. transactions are committed between operations, once there may not be
+//     room for another one (group commit), or by ktfs_sync. operations may nest.
+//==============================================================================================
+
+static void ktfs_journal_begin(struct ktfs_fs *fs){
+    fs->jdepth++;
+}
+
+static void ktfs_journal_end(struct ktfs_fs *fs){
+    fs->jdepth--;
+    if(fs->jstart != 0 && fs->jdepth == 0 && fs->jmax - fs->jcount < KTFS_JOURNAL_OP_BLOCKS){
+        ktfs_journal_commit(fs);
+    }
+}
+
+//==============================================================================================
+// void ktfs_journal_log(struct ktfs_fs *fs, unsigned long long pos, const void *block)
+// inputs: unsigned long long pos: device position of the block
+//         const void *block: its contents
+// outputs: none
+// description:
+//     copies a metadata block into the running transaction, replacing the copy logged
+//     earlier in it if there is one. a full transaction is committed first, even in the
+//     middle of an operation, which then is not atomic.
+//==============================================================================================
+
+static void ktfs_journal_log(struct ktfs_fs *fs, unsigned long long pos, const void *block){
+    struct ktfs_journal_desc *desc = (void *)fs->jbuf;
+    const uint32_t blkno = pos / fs->blksz;
+    uint32_t i = 0;
+    while(i < fs->jcount && desc->block[i] != blkno){
+        i++;
+    }
+    if(i == fs->jcount){
+        if(fs->jcount == fs->jmax){
+            ktfs_journal_commit(fs);
+            i = 0;
+        }
+        desc->block[i] = blkno;
+        fs->jcount++;
+        if(blkno >= fs->data_blk_pos / fs->blksz && !ktfs_journal_logged(fs, blkno)){
+            fs->jlive[fs->nlive++] = blkno;
+        }
+    }
+    memcpy(fs->jbuf + (i + 1) * fs->blksz, block, fs->blksz);
+}
+
+//==============================================================================================
+// int ktfs_journal_commit(struct ktfs_fs *fs)
+// inputs: none
+// outputs: 0 if success, EIO if the transaction could not be written
+// description:
+//     writes the running transaction to the journal in a single request: its descriptor,
+//     the block copies and the commit block, whose checksum of the descriptor and the
+//     copies lets replay tell a complete transaction from a torn one. the logged blocks are then free to go to their places.
+//     a journal without room for another transaction is checkpointed. if the write fails,
+//     the blocks are still released, so they reach the disk unjournaled.
+//==============================================================================================
+
+static int ktfs_journal_commit(struct ktfs_fs *fs){
+    const uint32_t count = fs->jcount;
+    if(count == 0){
+        return 0;
+    }
+    struct ktfs_journal_desc *desc = (void *)fs->jbuf;
+    struct ktfs_journal_commit *commit = (void *)(fs->jbuf + (count + 1) * fs->blksz);
+    desc->magic = KTFS_JOURNAL_DESC_MAGIC;
+    desc->seq = fs->jseq;
+    desc->count = count;
+    memset(&desc->block[count], 0, fs->blksz - sizeof(struct ktfs_journal_desc) - count * sizeof(uint32_t));
+    memset(commit, 0, fs->blksz);
+    commit->magic = KTFS_JOURNAL_COMMIT_MAGIC;
+    commit->seq = fs->jseq;
+    commit->count = count;
+    commit->checksum = ktfs_journal_sum(fs->jbuf, (count + 1) * fs->blksz);
+
+    const long len = (count + 2) * fs->blksz;
+    const unsigned long long pos = (unsigned long long)(fs->jstart + fs->jhead) * fs->blksz;
+    const long written = iowriteat(fs->vioblk, pos, fs->jbuf, len);
+    fs->jcount = 0;
+    if(written != len){
+        return -EIO;
+    }
+    fs->jhead += count + 2;
+    fs->jseq++;
+    if(fs->jblocks - fs->jhead < fs->jmax + 2){
+        return ktfs_journal_checkpoint(fs);
+    }
+    return 0;
+}
+
+//==============================================================================================
+// int ktfs_journal_checkpoint(struct ktfs_fs *fs)
+// inputs: none
+// outputs: 0 if success, EIO
+// description:
+//     writes every dirty block in the cache to its place and starts the journal over. only
+//     called with no running transaction, so nothing is held.
+//==============================================================================================
+
+static int ktfs_journal_checkpoint(struct ktfs_fs *fs){
+    if(cache_flush(fs->cache) != 0){
+        return -EIO;
+    }
+    return ktfs_journal_reset(fs);
+}
+
+//==============================================================================================
+// int ktfs_journal_reset(struct ktfs_fs *fs)
+// inputs: none
+// outputs: 0 if success, EIO
+// description:
+//     writes a journal header naming the next transaction, so the ones before it are not
+//     replayed, and puts the next transaction right after it. no block is logged in the
+//     journal any more.
+//==============================================================================================
+
+static int ktfs_journal_reset(struct ktfs_fs *fs){
+    struct ktfs_journal_header *hdr = (void *)fs->jbuf;
+    memset(fs->jbuf, 0, fs->blksz);
+    hdr->magic = KTFS_JOURNAL_MAGIC;
+    hdr->seq = fs->jseq;
+    fs->jhead = 1;
+    if(iowriteat(fs->vioblk, (unsigned long long)fs->jstart * fs->blksz, fs->jbuf, fs->blksz) != fs->blksz){
+        return -EIO;
+    }
+    fs->nlive = 0;
+    return 0;
+}
+
+//==============================================================================================
+// int ktfs_journal_hold(void *arg, unsigned long long pos)
+// inputs: void *arg: the file system
+//         unsigned long long pos: device position of a dirty block the cache would write
+// outputs: 1 if the block is logged in the running transaction, else 0
+// description:
+//     the hold function of the cache (see cache_set_hold): a block must not reach its place
+//     before the transaction that logs it is committed.
+//==============================================================================================
+
+static int ktfs_journal_hold(void *arg, unsigned long long pos){
+    struct ktfs_fs * const fs = arg;
+    const struct ktfs_journal_desc *desc = (void *)fs->jbuf;
+    const uint32_t blkno = pos / fs->blksz;
+    for(uint32_t i = 0; i < fs->jcount; i++){
+        if(desc->block[i] == blkno){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//==============================================================================================
+// int ktfs_journal_logged(struct ktfs_fs *fs, uint32_t blkno)
+// inputs: uint32_t blkno: device block number of a data region block
+// outputs: 1 if a copy of the block is in the journal, so replay would write it, else 0
+// description:
+//     journal replay knows nothing of later frees, so a directory or pointer block logged
+//     since the last reset must not be freed and reused before a checkpoint (ktfs_reclaim).
+//==============================================================================================
+
+static int ktfs_journal_logged(struct ktfs_fs *fs, uint32_t blkno){
+    for(uint32_t i = 0; i < fs->nlive; i++){
+        if(fs->jlive[i] == blkno){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//==============================================================================================
+// uint32_t ktfs_journal_sum(const char *buf, unsigned long len)
+// inputs: const char *buf: descriptor and block copies of a transaction
+//         unsigned long len: their length
+// outputs: 32-bit FNV-1a hash of the bytes
+//==============================================================================================
+
+static uint32_t ktfs_journal_sum(const char *buf, unsigned long len){
+    uint32_t h = 2166136261u;
+    for(unsigned long i = 0; i < len; i++){
+        h ^= (uint8_t)buf[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+//==============================================================================================
+// int ktfs_write_super(struct ktfs_fs *fs)
+// inputs: none
+// outputs: 0 if success, EIO
+// description:
+//     writes fs->super to the first block of the image, keeping the rest of the block.
+//     the superblock is not in the cache.
+//==============================================================================================
+
+static int ktfs_write_super(struct ktfs_fs *fs){
+    void *buf = alloc_phys_page();
+    int result = -EIO;
+    if(buf == NULL){
+        return -ENOMEM;
+    }
+    if(ioreadat(fs->vioblk, 0, buf, fs->blksz) == fs->blksz){
+        memcpy(buf, &fs->super, sizeof(struct ktfs_superblock));
+        if(iowriteat(fs->vioblk, 0, buf, fs->blksz) == fs->blksz){
+            result = 0;
+        }
+    }
+    free_phys_page(buf);
+    return result;
+}
+
+//==============================================================================================
+// int ktfs_sync(struct ktfs_fs *fs)
+// inputs: none
+// outputs: 0 if success, EIO
+// description:
+//     makes everything in the cache durable: commits the running transaction, then writes
+//     the dirty blocks to their places, which with a journal is a checkpoint.
+//==============================================================================================
+
+static int ktfs_sync(struct ktfs_fs *fs){
+    if(fs->jstart == 0){
+        return (cache_flush(fs->cache) == 0) ? 0 : -EIO;
+    }
+    if(ktfs_journal_commit(fs) != 0){
+        return -EIO;
+    }
+    return ktfs_journal_checkpoint(fs);
+}
+
+//==============================================================================================
+// void ktfs_free_fs(struct ktfs_fs *fs)
+// inputs: struct ktfs_fs *fs: a mount that failed
+// outputs: none
+// description:
+//     frees the state of a mount that ktfs_mount gives up on, with its cache and journal
+//     buffers. nothing of it is dirty yet.
+//==============================================================================================
+
+static void ktfs_free_fs(struct ktfs_fs *fs){
+    if(fs->jbuf != NULL){
+        free_phys_pages(fs->jbuf, KTFS_JOURNAL_PAGES);
+    }
+    if(fs->jlive != NULL){
+        kfree(fs->jlive);
+    }
+    destroy_cache(fs->cache);
+    kfree(fs);
+}
+
+//==============================================================================================
+// void ktfs_reclaim_queue(struct ktfs_fs *fs, uint16_t index)
+// inputs: uint16_t index: inode flagged KTFS_FILE_RECLAIM
+// outputs: none
+// description:
+//     hands a deleted inode to the reclaimer. when the queue is full the inode is left to
+//     ktfs_reclaim_scan, which finds it by its flag.
+//==============================================================================================
+
+static void ktfs_reclaim_queue(struct ktfs_fs *fs, uint16_t index){
+    if(fs->nreclaim < KTFS_RECLAIM_QUEUE){
+        fs->reclaim[fs->nreclaim++] = index;
+    }else{
+        fs->rescan = 1;
+    }
+    condition_broadcast(&fs->reclaim_cond);
+}
+
+//==============================================================================================
+// void ktfs_reclaim_drop(struct ktfs_fs *fs, uint16_t index)
+// inputs: uint16_t index: inode number
+// outputs: none
+// description:
+//     takes an inode off the queue. ktfs_reclaim_queue may have added others behind it
+//     while a step was waiting for the device, so it is looked up.
+//==============================================================================================
+
+static void ktfs_reclaim_drop(struct ktfs_fs *fs, uint16_t index){
+    for(unsigned int i = 0; i < fs->nreclaim; i++){
+        if(fs->reclaim[i] == index){
+            fs->reclaim[i] = fs->reclaim[--fs->nreclaim];
+            return;
+        }
+    }
+}
+
+//==============================================================================================
+// void ktfs_reclaim_scan(struct ktfs_fs *fs)
+// inputs: none
+// outputs: none
+// description:
+//     queues the inodes flagged KTFS_FILE_RECLAIM: the ones a crash or an unmounted image
+//     left behind, and the ones that did not fit in the queue. stops when it is full again.
+//==============================================================================================
+
+static void ktfs_reclaim_scan(struct ktfs_fs *fs){
+    const int per_block = fs->blksz / sizeof(struct ktfs_inode);
+    fs->rescan = 0;
+    for(int i = 0; i < fs->super.inode_block_count && !fs->rescan; i++){
+        void * inodes = NULL;
+        if(cache_get_block(fs->cache, fs->inode_blk_pos + fs->blksz*i, &inodes) != 0){
+            return;
+        }
+        struct ktfs_inode * inode_block = inodes;
+        for(int j = 0; j < per_block; j++){
+            if(inode_block[j].flags & KTFS_FILE_RECLAIM){
+                ktfs_reclaim_queue(fs, per_block * i + j);
+            }
+        }
+        cache_release_block(fs->cache, inodes, 0);
+    }
+}
+
+//==============================================================================================
+// int ktfs_reclaim(struct ktfs_fs *fs)
+// inputs: none
+// outputs: 1 if a step was taken, 0 if nothing is left to reclaim, EIO
+// description:
+//     frees up to KTFS_RECLAIM_BATCH blocks of a deleted inode, from the end of the file
+//     back, with the pointer blocks that map nothing any more. the inode is shrunk to the
+//     blocks left and written before the bitmap, so a crash between the two leaks blocks
+//     but never frees one a file still uses; the next mount carries on where it stopped.
+//     when no block is left the inode is cleared and may be allocated again. the bitmap
+//     blocks the step touches are each written once (ktfs_free_blocks).
+//     with a journal, a freed block must not be reused before the transaction freeing it
+//     is committed, or its new contents could reach the disk while a crash would give it
+//     back to the deleted file. so a step is only taken between operations, and commits.
+//     nor may a block the journal still has a copy of, which replay would write over its
+//     new contents: a step freeing one commits and checkpoints first, with no cache block
+//     held, and only then takes the inode block to shrink it.
+//     must not be called with cache blocks held.
+//==============================================================================================
+
+static int ktfs_reclaim(struct ktfs_fs *fs){
+    const uint32_t ndata = fs->super.block_count - fs->data_blk_pos / fs->blksz;
+    lock_acquire(&fs->reclaim_lock);
+    if(fs->jstart != 0 && fs->jdepth != 0){ //see below
+        lock_release(&fs->reclaim_lock);
+        return 0;
+    }
+    if(fs->nreclaim == 0 && fs->rescan){
+        ktfs_reclaim_scan(fs);
+    }
+    if(fs->nreclaim == 0){
+        lock_release(&fs->reclaim_lock);
+        return 0;
+    }
+    uint16_t index = fs->reclaim[fs->nreclaim - 1];
+    void * inodes = NULL;
+    struct ktfs_inode * inode;
+    if(ktfs_get_inode(fs, index, &inodes, &inode) != 0){
+        ktfs_reclaim_drop(fs, index); //still flagged, the next mount tries again
+        lock_release(&fs->reclaim_lock);
+        return -EIO;
+    }
+    if((inode->flags & KTFS_FILE_RECLAIM) == 0){ //queued by a scan too, already done
+        cache_release_block(fs->cache, inodes, 0);
+        ktfs_reclaim_drop(fs, index);
+        lock_release(&fs->reclaim_lock);
+        return 1;
+    }
+
+    //each file block takes its data block and at most two pointer blocks with it
+    struct ktfs_inode left = *inode; //the inode once the step is taken
+    cache_release_block(fs->cache, inodes, 0);
+    uint32_t nblocks = (left.size + fs->blksz - 1) / fs->blksz;
+    uint32_t cnt = 0;
+    while(nblocks > 0 && cnt + 3 <= KTFS_RECLAIM_BATCH){
+        uint32_t n = --nblocks;
+        uint32_t blk[3] = {0, 0, 0};
+        if(n < KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT){
+            blk[0] = left.block[n];
+            left.block[n] = 0;
+        }else if(n - KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT < fs->nptrs){
+            n -= KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT;
+            blk[0] = ktfs_reclaim_ptr(fs, left.indirect, n);
+            if(n == 0){
+                blk[1] = left.indirect;
+                left.indirect = 0;
+            }
+        }else{
+            n -= KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT + fs->nptrs;
+            uint32_t outer = n / fs->ndptrs;
+            uint32_t r = n % fs->ndptrs;
+            uint32_t child = ktfs_reclaim_ptr(fs, left.dindirect[outer], r / fs->nptrs);
+            blk[0] = ktfs_reclaim_ptr(fs, child, r % fs->nptrs);
+            if(r % fs->nptrs == 0){
+                blk[1] = child;
+            }
+            if(r == 0){
+                blk[2] = left.dindirect[outer];
+                left.dindirect[outer] = 0;
+            }
+        }
+        for(int k = 0; k < 3; k++){
+            if(blk[k] != 0 && blk[k] < ndata){
+                fs->rbatch[cnt++] = blk[k];
+            }
+        }
+    }
+
+    for(uint32_t k = 0; k < cnt && fs->jstart != 0; k++){
+        if(ktfs_journal_logged(fs, fs->data_blk_pos / fs->blksz + fs->rbatch[k])){
+            ktfs_journal_commit(fs);
+            ktfs_journal_checkpoint(fs);
+            break;
+        }
+    }
+    if(ktfs_get_inode(fs, index, &inodes, &inode) != 0){ //nothing written yet
+        ktfs_reclaim_drop(fs, index);
+        lock_release(&fs->reclaim_lock);
+        return -EIO;
+    }
+    ktfs_journal_begin(fs);
+    if(nblocks == 0){
+        memset(inode, 0, sizeof(struct ktfs_inode));
+        ktfs_reclaim_drop(fs, index);
+    }else{
+        *inode = left;
+        inode->size = nblocks * fs->blksz;
+    }
+    ktfs_put_inode(fs, index, inodes, 1);
+    ktfs_free_blocks(fs, fs->rbatch, cnt);
+    ktfs_journal_end(fs);
+    if(fs->jstart != 0 && fs->jdepth == 0){
+        ktfs_journal_commit(fs);
+    }
+    lock_release(&fs->reclaim_lock);
+    return 1;
+}
+
+//==============================================================================================
+// void ktfs_reclaim_wait(struct ktfs_fs *fs, uint32_t want)
+// inputs: uint32_t want: data blocks about to be allocated
+// outputs: none
+// description:
+//     reclaims deleted files until there are free blocks for want data blocks and the
+//     pointer blocks that may map them, or nothing is left to reclaim, so space a delete
+//     gave back can be used before the reclaimer gets to it. does nothing in the middle
+//     of an operation on a journaled image (see ktfs_reclaim).
+//     must not be called with cache blocks held.
+//==============================================================================================
+
+static void ktfs_reclaim_wait(struct ktfs_fs *fs, uint32_t want){
+    want += want / fs->nptrs + 4;
+    while(fs->nfree < fs->nreserved + want && ktfs_reclaim(fs) > 0){
+        continue;
+    }
+}
+
+//==============================================================================================
+// void ktfs_reclaimer(struct ktfs_fs *fs)
+// inputs: struct ktfs_fs *fs: the mount
+// outputs: none, does not return
+// description:
+//     thread that frees the blocks of deleted files one ktfs_reclaim step at a time,
+//     yielding between steps, and sleeps while there are none.
+//==============================================================================================
+
+static void ktfs_reclaimer(struct ktfs_fs *fs){
+    for(;;){
+        while(fs->nreclaim == 0 && !fs->rescan){
+            condition_wait(&fs->reclaim_cond);
+        }
+        ktfs_reclaim(fs);
+        thread_yield();
+    }
+}
+
+//==============================================================================================
+// uint32_t ktfs_reclaim_ptr(struct ktfs_fs *fs, uint32_t data_block, uint32_t index)
+// inputs: uint32_t data_block: indirect or doubly indirect block, 0 for none
+//         uint32_t index: entry in it
+// outputs: the block number in the entry, 0 if there is none or it cannot be read
+//==============================================================================================
+
+static uint32_t ktfs_reclaim_ptr(struct ktfs_fs *fs, uint32_t data_block, uint32_t index){
+    void *block = NULL;
+    if(data_block == 0 || cache_get_block(fs->cache, fs->data_blk_pos + data_block * fs->blksz, &block) != 0){
+        return 0;
+    }
+    uint32_t ptr = ((uint32_t *)block)[index];
+    cache_release_block(fs->cache, block, 0);
+    return ptr;
+}
+
+//==============================================================================================
+// void ktfs_free_blocks(struct ktfs_fs *fs, uint32_t *blocks, uint32_t cnt)
+// inputs: uint32_t *blocks: data blocks to free, sorted in place
+//         uint32_t cnt: number of blocks
+// outputs: none
+// description:
+//     clears the bitmap bits of any set of data blocks, writing (or logging) each bitmap
+//     block they are in once, where ktfs_mark_run does it for a run.
+//==============================================================================================
+
+static void ktfs_free_blocks(struct ktfs_fs *fs, uint32_t *blocks, uint32_t cnt){
+    const uint32_t bits = fs->blksz * 8;
+    const uint32_t first = fs->data_blk_pos / fs->blksz;
+    for(uint32_t i = 1; i < cnt; i++){
+        uint32_t blk = blocks[i];
+        uint32_t j = i;
+        for(; j > 0 && blocks[j - 1] > blk; j--){
+            blocks[j] = blocks[j - 1];
+        }
+        blocks[j] = blk;
+    }
+    uint32_t i = 0;
+    while(i < cnt){
+        uint32_t bitmap_block_num = (first + blocks[i]) / bits;
+        void *bitmap_block = NULL;
+        if(cache_get_block(fs->cache, fs->blksz + bitmap_block_num * fs->blksz, &bitmap_block) != 0){
+            return;
+        }
+        uint8_t *bitmap = bitmap_block;
+        for(; i < cnt && (first + blocks[i]) / bits == bitmap_block_num; i++){
+            uint32_t bit_index = (first + blocks[i]) % bits;
+            if(bitmap[bit_index / 8] & (1 << (bit_index % 8))){
+                bitmap[bit_index / 8] &= ~(1 << (bit_index % 8));
+                fs->nfree++;
+            }
+        }
+        ktfs_meta_release(fs, fs->blksz + bitmap_block_num * fs->blksz, bitmap_block, 1);
+    }
+}
@@ -3,7 +3,8 @@
 #include <stdint.h>
 #include "ioimpl.h"
 
-#define KTFS_BLKSZ              512
+#define KTFS_BLKSZ              512  // block size of images whose superblock has none
+#define KTFS_MAX_BLKSZ          4096
 #define KTFS_INOSZ              32
 #define KTFS_DENSZ              16
 #define KTFS_MAX_FILENAME_LEN        KTFS_DENSZ - sizeof(uint16_t) - sizeof(uint8_t)
@@ -11,12 +12,26 @@
 #define KTFS_NUM_INDIRECT_BLOCKS     1
 #define KTFS_NUM_DINDIRECT_BLOCKS    2
 #define KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT   3
-#define KTFS_NUM_INDIRECT_BLOCKS_COUNT      128  //KTFS_BLKSZ / sizeof(uint32_t)
-#define KTFS_NUM_DINDIRECT_BLOCKS_COUNT     16384 // KTFS_BLKSZ / sizeof(uint32_t) * KTFS_BLKSZ / sizeof(uint32_t)
-#define KTFS_NUM_DIR_ENTRIES_PER_BLOCK      32 // KTFS_BLKSZ / sizeof(struct ktfs_dir_entry)
-#define KTFS_MAX_FILE_SIZE                  16844288 //（ KTFS_NUM_DIRECT_DATA_BLOCKS+KTFS_NUM_INDIRECT_BLOCKS_COUNT+ 2*  KTFS_NUM_DINDIRECT_BLOCKS_COUNT ) * KTFS_BLKSZE
+
+// Geometry for a block size _bs_ (see ktfs_superblock.block_size)
+#define KTFS_NUM_INDIRECT_BLOCKS_COUNT(bs)  ((bs) / sizeof(uint32_t))
+#define KTFS_NUM_DINDIRECT_BLOCKS_COUNT(bs) (KTFS_NUM_INDIRECT_BLOCKS_COUNT(bs) * KTFS_NUM_INDIRECT_BLOCKS_COUNT(bs))
+#define KTFS_NUM_DIR_ENTRIES_PER_BLOCK(bs)  ((bs) / KTFS_DENSZ)
+#define KTFS_MAX_FILE_SIZE(bs)              ((unsigned long long)(bs) * (KTFS_NUM_DIRECT_DATA_BLOCKS_COUNT \
+    + KTFS_NUM_INDIRECT_BLOCKS_COUNT(bs) + KTFS_NUM_DINDIRECT_BLOCKS * KTFS_NUM_DINDIRECT_BLOCKS_COUNT(bs)))
+
 #define KTFS_FILE_IN_USE (1 << 0)
 #define KTFS_FILE_FREE (0 << 0)
+#define KTFS_FILE_DIR (1 << 1)      // inode is a directory
+#define KTFS_FILE_HASHED (1 << 2)   // directory blocks are hash buckets
+#define KTFS_FILE_RECLAIM (1 << 3)  // deleted, its blocks are still being freed
+
+// A hashed directory has a power of two number of blocks. An entry lives in
+// block (hash of its name) mod (number of blocks); a full block doubles the
+// directory. Directories without KTFS_FILE_HASHED (the root of an image made
+// by mkfs_ktfs) are searched linearly until they fill up and are converted.
+
+#define KTFS_DIR_MAX_BUCKETS 4096
 
 /*
 Overall filesystem image layout
@@ -65,12 +80,47 @@ struct ktfs_superblock {
     uint32_t bitmap_block_count;
     uint32_t inode_block_count;
     uint16_t root_directory_inode;
+    uint16_t block_size;    // bytes per block, 512 to 4096; 0 means KTFS_BLKSZ
+    uint32_t journal_block; // device block number of the metadata journal; 0 for none
+    uint32_t journal_block_count;
+} __attribute__((packed));
+
+// Metadata journal. Its first block is a header; transactions follow it, each
+// a descriptor listing the blocks it logs (by block number on the device), a
+// copy of each of them and a commit block. Mounting replays, in order, the
+// transactions whose sequence numbers follow on from the header and whose
+// commit block matches their descriptor, then writes a new header; so does a
+// checkpoint, once every block logged so far is on the disk. There are no
+// revoke records: a block the journal has a copy of is not freed, to be reused
+// for something replay would overwrite, until a checkpoint has been taken.
+
+#define KTFS_JOURNAL_MAGIC          0x4B544A48  // "KTJH"
+#define KTFS_JOURNAL_DESC_MAGIC     0x4B544A44  // "KTJD"
+#define KTFS_JOURNAL_COMMIT_MAGIC   0x4B544A43  // "KTJC"
+
+struct ktfs_journal_header {
+    uint32_t magic;
+    uint32_t seq;       // sequence number of the first transaction after it
+} __attribute__((packed));
+
+struct ktfs_journal_desc {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t count;     // blocks in the transaction
+    uint32_t block[];   // where each of them goes
+} __attribute__((packed));
+
+struct ktfs_journal_commit {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t count;
+    uint32_t checksum;  // FNV-1a of the descriptor block and the copies
 } __attribute__((packed));
 
 // Inode with indirect and doubly-indirect blocks
 struct ktfs_inode {
     uint32_t size;                                  // Size in bytes
-    uint32_t flags;                                 // File type, etc. (unused in MP3)
+    uint32_t flags;                                 // KTFS_FILE_* bits
     uint32_t block[KTFS_NUM_DIRECT_DATA_BLOCKS];    // Direct block indices
     uint32_t indirect;                              // Indirect block index
     uint32_t dindirect[KTFS_NUM_DINDIRECT_BLOCKS];  // Doubly-indirect block indices
@@ -91,9 +141,7 @@ struct ktfs_bitmap {
 struct ktfs_data_block {
     uint8_t data[KTFS_BLKSZ];
 }__attribute__((packed));
-int ktfs_create(const char *name);
-void ktfs_close(struct io* io);
-int ktfs_delete(const char *name);
+int ktfs_close(struct io* io);
 
 
 #endif // KTFS_H
\ No newline at end of file
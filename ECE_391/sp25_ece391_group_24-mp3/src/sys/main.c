@@ -6,6 +6,7 @@
 #include "process.h"
 #include "memory.h"
 #include "fs.h"
+#include "tmpfs.h"
 #include "io.h"
 #include "device.h"
 #include "dev/rtc.h"
@@ -15,6 +16,7 @@
 #include "heap.h"
 #include "string.h"
 #include "timer.h"
+#include "smp.h"
 
 #define VIRTIO_MMIO_STEP (VIRTIO1_MMIO_BASE-VIRTIO0_MMIO_BASE)
 extern char _kimg_end[]; 
@@ -22,17 +24,7 @@ extern char _kimg_end[];
 #define INIT_NAME "trekfib"
 #define NUM_UARTS 3
 
-
-void interrupter(void){
-    struct alarm al;
-    alarm_init(&al, "interrupter");
-    for(;;)
-        alarm_sleep_us(&al, 1000);
-    
-}
-void start_interrupter(void){
-    thread_spawn("interrupter", &interrupter);
-}
+static char blkpaths[NMOUNT][16]; // mount points of vioblk1, vioblk2, ...
 
 
 void main(void) {
@@ -45,6 +37,7 @@ void main(void) {
     devmgr_init();
     intrmgr_init();
     thrmgr_init();
+    timer_init();
     memory_init();
     procmgr_init();
 
@@ -59,6 +52,7 @@ void main(void) {
     for (i = 0; i < 8; i++) {
         virtio_attach ((void*)VIRTIO0_MMIO_BASE + i*VIRTIO_MMIO_STEP, VIRTIO0_INTR_SRCNO + i);
     }
+    smp_init();
     enable_interrupts();
 
     result = open_device("vioblk", 0, &blkio);
@@ -67,12 +61,33 @@ void main(void) {
         panic("Failed to open vioblk\n");
     }
 
-    result = fsmount(blkio);
+    result = fsmount("", blkio);
     if (result < 0) {
         kprintf("Error: %d\n", result);
         panic("Failed to mount filesystem\n");
     }
 
+    // Further block devices (a scratch volume, say) are mounted at vioblk1,
+    // vioblk2, ... Each has its own cache and request queue. A device that
+    // does not hold a KTFS image is left unmounted.
+
+    for (i = 1; i < NMOUNT; i++) {
+        if (open_device("vioblk", i, &blkio) < 0)
+            break;
+        snprintf(blkpaths[i], sizeof(blkpaths[i]), "vioblk%d", i);
+        result = fsmount(blkpaths[i], blkio);
+        if (result < 0) {
+            kprintf("%s: not mounted (%d)\n", blkpaths[i], result);
+            ioclose(blkio);
+        }
+    }
+
+    // Scratch files under tmp stay in memory
+
+    result = tmpfs_mount("tmp");
+    if (result < 0)
+        kprintf("tmp: not mounted (%d)\n", result);
+
 
     // insert testcase below
     // This test case will run fib and trek simultaneously. 
@@ -82,7 +97,6 @@ void main(void) {
     //     kprintf(INIT_NAME ": %s; Unable to open\n");
     //     panic("Failed to open trekfib\n");
     // }
-    // start_interrupter();
     // result = process_exec(trekFibio, 0, NULL);
   
     struct io* shell;
@@ -23,6 +23,7 @@
 #include "thread.h"
 #include "process.h"
 #include "error.h"
+#include "mmap.h"
 
 // COMPILE-TIME CONFIGURATION
 //
@@ -117,6 +118,13 @@ struct pte {
 #define PTE_GLOBAL(pte) (((pte).flags & PTE_G) != 0)
 #define PTE_LEAF(pte) (((pte).flags & (PTE_R | PTE_W | PTE_X)) != 0)
 
+// Software (RSW) bit marking a leaf whose page is shared and reference counted
+// (see map_shared_page). Such pages are released with put_phys_page instead of
+// being freed when unmapped, and are shared instead of copied by clone.
+
+#define PTE_RSW_SHARED 0x1
+#define PTE_SHARED(pte) (((pte).rsw & PTE_RSW_SHARED) != 0)
+
 #define PT_INDEX(lvl, vpn) (((vpn) & (0x1FF << (lvl * (PAGE_ORDER - PTE_ORDER)))) \
                              >> (lvl * (PAGE_ORDER - PTE_ORDER)))
 // INTERNAL FUNCTION DECLARATIONS
@@ -153,6 +161,11 @@ static struct pte main_pt0_0x80000[PTE_CNT]
 
 static struct page_chunk * free_chunk_list;
 
+// Reference counts of shared physical pages, indexed by page number from the
+// start of RAM. Pages that are never shared keep a count of zero.
+
+static uint16_t page_refcnt[RAM_SIZE / PAGE_SIZE];
+
 // EXPORTED FUNCTION DECLARATIONS
 // 
 // ==============================================================================================
@@ -301,6 +314,18 @@ mtag_t active_mspace(void) {
     return active_space_mtag();
 }
 
+// --------------------------------------------------------------
+// mtag_t main_mspace(void)
+// inputs: none
+// outputs: mtag_t: the memory space tag of the kernel (main) page table
+// description: returns the tag of the memory space set up by memory_init. It
+//              maps only the kernel and is safe to leave active on a hart
+//              that is not running any process.
+// ---------------------------------------------------------------
+mtag_t main_mspace(void) {
+    return main_mtag;
+}
+
 // --------------------------------------------------------------
 // mtag_t switch_mspace(mtag_t mtag)
 // inputs: mtag_t mtag: the memory space tag to switch to
@@ -350,7 +375,9 @@ mtag_t clone_active_mspace(void) {
             memcpy(new_pt0, pageptr(new_pt1[i].ppn), PAGE_SIZE);
             // deep copy the pages
             for (uint32_t j = 0; j < PTE_CNT; j++) {
-                if (PTE_VALID(new_pt0[j])) {
+                if (PTE_VALID(new_pt0[j]) && PTE_SHARED(new_pt0[j])) {
+                    get_phys_page(pageptr(new_pt0[j].ppn));
+                } else if (PTE_VALID(new_pt0[j])) {
                     void * new_pt0_page = alloc_phys_page();
                     uint_fast8_t flags = new_pt0[j].flags;
                     memcpy(new_pt0_page, pageptr(new_pt0[j].ppn), PAGE_SIZE);
@@ -365,6 +392,28 @@ mtag_t clone_active_mspace(void) {
     return ptab_to_mtag(new_pt2, 0);
 }
 
+// --------------------------------------------------------------
+// mtag_t create_mspace(void)
+// inputs: none
+// outputs: mtag_t: the new memory space tag
+// description: creates a memory space with the kernel mappings and no user pages
+//              - allocates and clears a new root page table
+//              - shares the kernel entries of the main page table
+//              - returns the new memory space tag
+// ---------------------------------------------------------------
+mtag_t create_mspace(void) {
+    struct pte *new_pt2 = alloc_phys_page();
+    assert(new_pt2 != NULL);
+
+    memset(new_pt2, 0, PAGE_SIZE);
+
+    for (uint32_t i = 0; i < USER_ROOT_INDEX; i++) {
+        new_pt2[i] = main_pt2[i];
+    }
+
+    return ptab_to_mtag(new_pt2, 0);
+}
+
 // --------------------------------------------------------------
 // void reset_active_mspace(void)
 // inputs: none
@@ -473,6 +522,30 @@ void * map_page(uintptr_t vma, void * pp, int rwxug_flags) {
     return (void *)vma;
 }
 
+// ---------------------------------------------------------------
+// void * map_shared_page(uintptr_t vma, void * pp, int rwxug_flags)
+// inputs: uintptr_t vma: the virtual memory address to map
+//         void * pp: the physical page to map
+//         int rwxug_flags: the flags for the mapping
+// outputs: void *: the virtual memory address of the mapped page
+// description: maps a page that other memory spaces may map too
+//              - maps the page like map_page
+//              - marks the PTE shared and takes a reference on the page
+//              - the reference is dropped when the page is unmapped
+// ---------------------------------------------------------------
+void * map_shared_page(uintptr_t vma, void * pp, int rwxug_flags) {
+    struct pte *pt1, *pt0;
+
+    map_page(vma, pp, rwxug_flags);
+
+    pt1 = pageptr(active_space_ptab()[VPN2(vma)].ppn);
+    pt0 = pageptr(pt1[VPN1(vma)].ppn);
+    pt0[VPN0(vma)].rsw |= PTE_RSW_SHARED;
+
+    get_phys_page(pp);
+    return (void *)vma;
+}
+
 // ---------------------------------------------------------------
 // void * map_range(uintptr_t vma, size_t size, void * pp, int rwxug_flags)
 // inputs: uintptr_t vma: the virtual memory address to map
@@ -573,7 +646,10 @@ void unmap_and_free_range(void * vp, size_t size) {
         struct pte * pte = &pt0[VPN0(va)];
 
         if (PTE_VALID(*pte) && PTE_LEAF(*pte)) {
-            free_phys_page(pageptr(pte->ppn));
+            if (PTE_SHARED(*pte))
+                put_phys_page(pageptr(pte->ppn));
+            else
+                free_phys_page(pageptr(pte->ppn));
             *pte = null_pte();
         }
     }
@@ -604,6 +680,50 @@ void free_phys_page(void * pp) {
     free_phys_pages(pp, 1);
 }
 
+// ---------------------------------------------------------------
+// void get_phys_page(void * pp)
+// inputs: void * pp: the physical page
+// outputs: none
+// description: takes a reference on a shared page
+// -------------------------------------------------------------------
+void get_phys_page(void * pp) {
+    const unsigned long idx = pagenum(pp) - pagenum(RAM_START);
+
+    assert (idx < RAM_SIZE / PAGE_SIZE);
+    assert (page_refcnt[idx] != UINT16_MAX);
+    page_refcnt[idx] += 1;
+}
+
+// ---------------------------------------------------------------
+// void put_phys_page(void * pp)
+// inputs: void * pp: the physical page
+// outputs: none
+// description: drops a reference on a shared page, freeing it with the last one
+// -------------------------------------------------------------------
+void put_phys_page(void * pp) {
+    const unsigned long idx = pagenum(pp) - pagenum(RAM_START);
+
+    assert (idx < RAM_SIZE / PAGE_SIZE);
+    assert (page_refcnt[idx] != 0);
+    page_refcnt[idx] -= 1;
+
+    if (page_refcnt[idx] == 0)
+        free_phys_page(pp);
+}
+
+// ---------------------------------------------------------------
+// unsigned int phys_page_refcnt(const void * pp)
+// inputs: const void * pp: the physical page
+// outputs: unsigned int: the number of references to the page
+// description: returns the reference count of a shared page
+// -------------------------------------------------------------------
+unsigned int phys_page_refcnt(const void * pp) {
+    const unsigned long idx = pagenum(pp) - pagenum(RAM_START);
+
+    assert (idx < RAM_SIZE / PAGE_SIZE);
+    return page_refcnt[idx];
+}
+
 // ---------------------------------------------------------------
 // void * alloc_phys_pages(unsigned int cnt)
 // inputs: unsigned int cnt: the number of pages to allocate
@@ -700,6 +820,7 @@ unsigned long free_phys_page_count(void) {
 // description: handles a user mode page fault by allocating a new page and mapping it
 //              - checks if the virtual memory address is well-formed
 //              - checks if the address is in the user memory range
+//              - maps the file page if the address is in a file mapping (mmap.c)
 //              - allocates a new physical page
 //              - maps the new page to the virtual memory address
 //              - returns 1 if the fault was handled, 0 otherwise
@@ -716,6 +837,9 @@ int handle_umode_page_fault(struct trap_frame * tfr, uintptr_t vma) {
 
     if (vma < UMEM_START_VMA || vma >= UMEM_END_VMA) return 0;
 
+    int mapped = mmap_fault(current_process()->mmaps, vma);
+    if (mapped != 0) return (mapped > 0);
+
     void *pp = alloc_phys_page();
     if (!pp) return 0;
 
@@ -723,6 +847,39 @@ int handle_umode_page_fault(struct trap_frame * tfr, uintptr_t vma) {
     return 1;
 }
 
+// ---------------------------------------------------------------
+// void * user_to_phys(const void * vp, int rwxug_flags)
+// inputs: const void * vp: the user virtual address to translate
+//         int rwxug_flags: the flags the mapping must have
+// outputs: void *: the physical address, or NULL if not mapped
+// description: walks the active page table to find the physical address
+//              backing a user virtual address
+//              - checks that the address is well-formed
+//              - follows the three levels of the page table
+//              - checks the leaf PTE has all the requested flags
+// -------------------------------------------------------------------
+void * user_to_phys(const void * vp, int rwxug_flags) {
+    const uintptr_t vma = (uintptr_t)vp;
+    struct pte *pt2, *pt1, *pt0;
+    struct pte pte;
+
+    if (!wellformed(vma)) return NULL;
+
+    pt2 = active_space_ptab();
+    if (!PTE_VALID(pt2[VPN2(vma)]) || PTE_LEAF(pt2[VPN2(vma)])) return NULL;
+
+    pt1 = pageptr(pt2[VPN2(vma)].ppn);
+    if (!PTE_VALID(pt1[VPN1(vma)]) || PTE_LEAF(pt1[VPN1(vma)])) return NULL;
+
+    pt0 = pageptr(pt1[VPN1(vma)].ppn);
+    pte = pt0[VPN0(vma)];
+
+    if (!PTE_VALID(pte)) return NULL;
+    if ((pte.flags & rwxug_flags) != rwxug_flags) return NULL;
+
+    return (char *)pageptr(pte.ppn) + vma % PAGE_SIZE;
+}
+
 // ---------------------------------------------------------------
 // mtag_t active_space_mtag(void)
 // inputs: none
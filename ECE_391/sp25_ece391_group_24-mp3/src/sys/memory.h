@@ -51,16 +51,34 @@ extern void memory_init(void);
 
 extern mtag_t active_mspace(void);
 
+extern mtag_t main_mspace(void);
+
 extern mtag_t switch_mspace(mtag_t mtag);
 
 extern mtag_t clone_active_mspace(void);
 
+extern mtag_t create_mspace(void);
+
 extern void reset_active_mspace(void);
 
 extern mtag_t discard_active_mspace(void);
 
 extern void * map_page(uintptr_t vma, void * pp, int rwxug_flags);
 
+// Shared pages are reference counted. get_phys_page() and put_phys_page() take
+// and drop a reference; the page is freed when the last reference is dropped.
+// map_shared_page() maps a page and takes a reference for the mapping, which
+// unmapping drops. A memory space clone shares such pages instead of copying.
+
+extern void * map_shared_page(uintptr_t vma, void * pp, int rwxug_flags);
+extern void get_phys_page(void * pp);
+extern void put_phys_page(void * pp);
+
+// Returns the number of references to shared page _pp_ (0 if it was never
+// shared). A cache holding the only reference knows the page is not mapped.
+
+extern unsigned int phys_page_refcnt(const void * pp);
+
 extern void * map_range (
     uintptr_t vma, size_t size, void * pp, int rwxug_flags);
 
@@ -83,6 +101,12 @@ extern unsigned long free_phys_page_count(void);
 
 extern int handle_umode_page_fault (
     struct trap_frame * tfr, uintptr_t vma);
+
+// Translates user virtual address _vp_ in the active memory space to a
+// physical address. Returns NULL unless _vp_ is mapped by a valid leaf PTE
+// with all of _rwxug_flags_ set.
+
+extern void * user_to_phys(const void * vp, int rwxug_flags);
 extern uintptr_t read_virt_mem(uintptr_t va); 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,232 @@
+// mmap.c - Memory-mapped files
+//
+// Copyright (c) 2024-2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+#ifdef MMAP_TRACE
+#define TRACE
+#endif
+
+#ifdef MMAP_DEBUG
+#define DEBUG
+#endif
+
+#include "mmap.h"
+#include "conf.h"
+#include "io.h"
+#include "heap.h"
+#include "memory.h"
+#include "console.h"
+#include "error.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static struct mmap_region * mmap_find(struct mmap_region * list, uintptr_t vma);
+static int mmap_pte_flags(int prot);
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+long mmap_map (
+    struct mmap_region ** list, struct io * io,
+    unsigned long long off, size_t len, int prot)
+{
+    struct mmap_region ** link;
+    struct mmap_region * rgn;
+    uintptr_t start;
+
+    if (len == 0 || off % PAGE_SIZE != 0)
+        return -EINVAL;
+    if ((prot & PROT_READ) == 0 || (prot & ~(PROT_READ | PROT_WRITE)) != 0)
+        return -EINVAL;
+    if (len > MMAP_END_VMA - MMAP_START_VMA)
+        return -ENOMEM;
+
+    // only endpoints with a page cache can be mapped
+
+    if (ioctl(io, IOCTL_GETPAGE, NULL) != 0)
+        return -ENOTSUP;
+
+    len = ROUND_UP(len, PAGE_SIZE);
+
+    // First fit in the gaps between the mappings, which are sorted by address
+
+    start = MMAP_START_VMA;
+    link = list;
+
+    while (*link != NULL && (*link)->start - start < len) {
+        start = (*link)->start + (*link)->size;
+        link = &(*link)->next;
+    }
+
+    if (MMAP_END_VMA - start < len)
+        return -ENOMEM;
+
+    rgn = kmalloc(sizeof(struct mmap_region));
+    if (rgn == NULL)
+        return -ENOMEM;
+
+    rgn->start = start;
+    rgn->size = len;
+    rgn->off = off;
+    rgn->prot = prot;
+    rgn->io = ioaddref(io);
+    rgn->next = *link;
+    *link = rgn;
+
+    trace("%s: %lx..%lx at offset %llu", __func__,
+        (unsigned long)start, (unsigned long)(start + len), off);
+
+    return start;
+}
+
+int mmap_sync(struct mmap_region * list, const void * addr, size_t len) {
+    const uintptr_t lo = (uintptr_t)addr;
+    const uintptr_t hi = lo + len;
+    struct mmap_region * rgn;
+    struct iopage pg;
+    int found = 0;
+    int result;
+
+    if (mmap_find(list, lo) == NULL)
+        return -EINVAL;
+
+    for (rgn = list; rgn != NULL; rgn = rgn->next) {
+        if (rgn->start + rgn->size <= lo || hi <= rgn->start)
+            continue;
+        found = 1;
+
+        // a read-only mapping never dirties its pages
+        if ((rgn->prot & PROT_WRITE) == 0)
+            continue;
+
+        pg.pos = rgn->off;
+        pg.len = rgn->size;
+        if (rgn->start < lo) {
+            pg.pos += ROUND_DOWN(lo - rgn->start, PAGE_SIZE);
+            pg.len -= ROUND_DOWN(lo - rgn->start, PAGE_SIZE);
+        }
+        if (hi < rgn->start + rgn->size)
+            pg.len -= ROUND_DOWN(rgn->start + rgn->size - hi, PAGE_SIZE);
+
+        result = ioctl(rgn->io, IOCTL_SYNC, &pg);
+        if (result != 0)
+            return result;
+    }
+
+    return found ? 0 : -EINVAL;
+}
+
+int mmap_unmap(struct mmap_region ** list, void * addr, size_t len) {
+    struct mmap_region ** link;
+    struct mmap_region * rgn;
+
+    for (link = list; *link != NULL; link = &(*link)->next) {
+        if ((*link)->start == (uintptr_t)addr)
+            break;
+    }
+
+    rgn = *link;
+    if (rgn == NULL || ROUND_UP(len, PAGE_SIZE) < rgn->size)
+        return -EINVAL;
+
+    // Unmapping drops the references of the mapped pages (they are shared
+    // PTEs), so the file's page cache may write them back and evict them.
+
+    unmap_and_free_range((void *)rgn->start, rgn->size);
+    *link = rgn->next;
+    ioclose(rgn->io);
+    kfree(rgn);
+    return 0;
+}
+
+int mmap_fault(struct mmap_region * list, uintptr_t vma) {
+    struct mmap_region * const rgn = mmap_find(list, vma);
+    const uintptr_t page = ROUND_DOWN(vma, PAGE_SIZE);
+    struct iopage pg;
+    int result;
+
+    if (rgn == NULL)
+        return 0;
+
+    // The page is there, so the access was not allowed (a store to a
+    // read-only mapping).
+
+    if (user_to_phys((void *)page, 0) != NULL)
+        return -EACCESS;
+
+    pg.pos = rgn->off + (page - rgn->start);
+    pg.len = PAGE_SIZE;
+    pg.write = ((rgn->prot & PROT_WRITE) != 0);
+    pg.page = NULL;
+
+    result = ioctl(rgn->io, IOCTL_GETPAGE, &pg);
+    if (result != 0)
+        return result;
+
+    // The mapping takes a reference of its own, so drop the one we were given
+
+    map_shared_page(page, pg.page, mmap_pte_flags(rgn->prot));
+    put_phys_page(pg.page);
+    return 1;
+}
+
+int mmap_copy(struct mmap_region ** dst, const struct mmap_region * src) {
+    struct mmap_region ** link = dst;
+    struct mmap_region * rgn;
+
+    *dst = NULL;
+
+    while (src != NULL) {
+        rgn = kmalloc(sizeof(struct mmap_region));
+        if (rgn == NULL) {
+            mmap_release(dst);
+            return -ENOMEM;
+        }
+
+        *rgn = *src;
+        rgn->io = ioaddref(src->io);
+        rgn->next = NULL;
+        *link = rgn;
+        link = &rgn->next;
+        src = src->next;
+    }
+
+    return 0;
+}
+
+void mmap_release(struct mmap_region ** list) {
+    struct mmap_region * rgn;
+
+    while (*list != NULL) {
+        rgn = *list;
+        *list = rgn->next;
+        ioclose(rgn->io);
+        kfree(rgn);
+    }
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+static struct mmap_region * mmap_find(struct mmap_region * list, uintptr_t vma) {
+    while (list != NULL && list->start + list->size <= vma)
+        list = list->next;
+
+    if (list == NULL || vma < list->start)
+        return NULL;
+
+    return list;
+}
+
+static int mmap_pte_flags(int prot) {
+    if (prot & PROT_WRITE)
+        return PTE_R | PTE_W | PTE_U;
+    else
+        return PTE_R | PTE_U;
+}
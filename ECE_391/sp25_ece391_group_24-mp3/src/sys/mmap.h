@@ -0,0 +1,75 @@
+// mmap.h - Memory-mapped files
+//
+// Copyright (c) 2024-2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+#ifndef _MMAP_H_
+#define _MMAP_H_
+
+#include "io.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Protection of a mapping (same values in usr/syscall.h)
+
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+
+// EXPORTED TYPE DEFINITIONS
+//
+
+// A process keeps its file mappings in a list sorted by address. Each mapping
+// holds a reference to the file and covers whole pages between MMAP_START_VMA
+// and MMAP_END_VMA. Its pages are not mapped until first touched: the page
+// fault handler asks the file for the page with IOCTL_GETPAGE and maps the
+// page itself, which the file's page cache shares with every mapping of the
+// same file offset. An empty list is NULL.
+
+struct mmap_region {
+    struct mmap_region * next;
+    uintptr_t start;            // user address of the first page
+    size_t size;                // bytes, multiple of PAGE_SIZE
+    unsigned long long off;     // file offset of the first page
+    int prot;                   // PROT_READ, optionally with PROT_WRITE
+    struct io * io;
+};
+
+// EXPORTED FUNCTION DECLARATIONS
+//
+
+// mmap_map() maps _len_ bytes of _io_ starting at file offset _off_ (a
+// multiple of PAGE_SIZE) into the active memory space and returns the user
+// address of the mapping, or -EINVAL, -ENOTSUP if _io_ has no page cache, or
+// -ENOMEM if there is no room. The mapping takes its own reference to _io_.
+//
+// mmap_sync() writes back the pages of the mappings that overlap _len_ bytes
+// at user address _addr_ to their files. mmap_unmap() removes the mapping
+// that starts at _addr_; _len_ must cover all of it. Both return 0, or -EINVAL
+// if _addr_ is not in a mapping.
+
+extern long mmap_map (
+    struct mmap_region ** list, struct io * io,
+    unsigned long long off, size_t len, int prot);
+
+extern int mmap_sync(struct mmap_region * list, const void * addr, size_t len);
+extern int mmap_unmap(struct mmap_region ** list, void * addr, size_t len);
+
+// mmap_fault() maps the page of a file mapping containing user address _vma_.
+// Returns 1 if it did, 0 if _vma_ is not in a mapping, or a negative error
+// code if the page cannot be mapped (past the end of the file, or a store to
+// a read-only mapping).
+
+extern int mmap_fault(struct mmap_region * list, uintptr_t vma);
+
+// mmap_copy() gives empty list _dst_ a copy of every mapping in _src_ for a
+// forked process; the pages themselves are shared by clone_active_mspace().
+// Returns 0 or -ENOMEM (then _dst_ is left empty). mmap_release() drops the
+// mappings of a list whose pages have already been unmapped (exec and exit
+// reset the whole memory space) and closes their files.
+
+extern int mmap_copy(struct mmap_region ** dst, const struct mmap_region * src);
+extern void mmap_release(struct mmap_region ** list);
+
+#endif // _MMAP_H_
@@ -15,6 +15,7 @@
 #include "conf.h"
 #include "plic.h"
 #include "assert.h"
+#include "thread.h" // running_hart()
 
 #include <stdint.h>
 
@@ -79,10 +80,9 @@ static void plic_complete_context_interrupt (
 static void plic_enable_all_sources_for_context(uint_fast32_t ctxno);
 static void plic_disable_all_sources_for_context(uint_fast32_t ctxno);
 
-// We currently only support single-hart operation, sending interrupts to S mode
-// on hart 0 (context 0). The low-level PLIC functions already understand
-// contexts, so we only need to modify the high-level functions (plit_init,
-// plic_claim_request, plic_finish_request)to add support for multiple harts.
+// Interrupts are delivered to the S mode context of each hart. Each source is
+// enabled in the contexts of the harts in its affinity mask (initially hart 0
+// only), and each hart claims and completes interrupts through its own context.
 
 // EXPORTED FUNCTION DEFINITIONS
 // 
@@ -95,11 +95,17 @@ void plic_init(void) {
 	for (i = 0; i < PLIC_SRC_CNT; i++)
 		plic_set_source_priority(i, 0);
 	
-	// Route all sources to S mode on hart 0 only
+	// Route all sources to S mode on hart 0 only. M mode contexts never take
+	// interrupts; S mode contexts accept every priority level.
 
 	for (int i = 0; i < PLIC_CTX_CNT; i++)
 		plic_disable_all_sources_for_context(i);
 	
+	for (i = 0; i < NHART; i++) {
+		plic_set_context_threshold(CTX(i,0), PLIC_PRIO_MAX);
+		plic_set_context_threshold(CTX(i,1), 0);
+	}
+
 	plic_enable_all_sources_for_context(CTX(0,1));
 }
 
@@ -118,16 +124,47 @@ extern void plic_disable_source(int irqno) {
 		debug("plic_disable_irq called with irqno = %d", irqno);
 }
 
+// extern void plic_set_source_affinity(int srcno, unsigned long hartmask)
+// Inputs: int srcno - source number
+//         unsigned long hartmask - bit i set to deliver the source to hart i
+// Outputs: none
+// Description: Enables the source in the S mode context of every hart in the
+//              mask and disables it in all others
+// Side Effects: enable bits of the source are updated for all harts
+extern void plic_set_source_affinity(int srcno, unsigned long hartmask) {
+	int i;
+
+	trace("%s(srcno=%d,hartmask=%lx)", __func__, srcno, hartmask);
+	assert (0 < srcno && srcno < PLIC_SRC_CNT);
+
+	for (i = 0; i < NHART; i++) {
+		if (hartmask & (1UL << i))
+			plic_enable_source_for_context(CTX(i,1), srcno);
+		else
+			plic_disable_source_for_context(CTX(i,1), srcno);
+	}
+}
+
+// extern void plic_set_hart_threshold(int hartid, int level)
+// Inputs: int hartid - hart whose S mode context to configure
+//         int level - priority threshold (sources at or below it are masked)
+// Outputs: none
+// Description: Sets the priority threshold of the S mode context of a hart
+// Side Effects: the context threshold register is written
+extern void plic_set_hart_threshold(int hartid, int level) {
+	assert (0 <= hartid && hartid < NHART);
+	assert (0 <= level && level <= PLIC_PRIO_MAX);
+	plic_set_context_threshold(CTX(hartid,1), level);
+}
+
 extern int plic_claim_interrupt(void) {
-	// FIXME: Hardwired S-mode hart 0
 	trace("%s()", __func__);
-	return plic_claim_context_interrupt(CTX(0,1));
+	return plic_claim_context_interrupt(CTX(running_hart(),1));
 }
 
 extern void plic_finish_interrupt(int irqno) {
-	// FIXME: Hardwired S-mode hart 0
 	trace("%s(irqno=%d)", __func__, irqno);
-	plic_complete_context_interrupt(CTX(0,1), irqno);
+	plic_complete_context_interrupt(CTX(running_hart(),1), irqno);
 }
 
 // INTERNAL FUNCTION DEFINITIONS
@@ -18,6 +18,8 @@ extern void plic_init(void);
 extern void plic_enable_source(int srcno, int prio);
 extern void plic_disable_source(int srcno);
 
+extern void plic_set_source_affinity(int srcno, unsigned long hartmask);
+extern void plic_set_hart_threshold(int hartid, int level);
 extern int plic_claim_interrupt(void);
 extern void plic_finish_interrupt(int srcno);
 
@@ -0,0 +1,182 @@
+// poll.c - Waiting for readiness on several descriptors
+//
+// Copyright (c) 2024-2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+#ifdef POLL_TRACE
+#define TRACE
+#endif
+
+#ifdef POLL_DEBUG
+#define DEBUG
+#endif
+
+#include "poll.h"
+#include "conf.h"
+#include "ioimpl.h"
+#include "timer.h"
+#include "intr.h"
+#include "riscv.h"
+#include "heap.h"
+#include "memory.h"
+#include "string.h"
+#include "console.h"
+#include "error.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// COMPILE-TIME CONSTANT DEFINITIONS
+//
+
+// Entry arrays up to this many bytes come from the heap, larger ones from the
+// page allocator (kmalloc cannot allocate more than a page).
+
+#ifndef POLL_HEAP_MAX
+#define POLL_HEAP_MAX 2048
+#endif
+
+#define TICKS_PER_MS (TIMER_FREQ / 1000)
+
+// INTERNAL TYPE DEFINITIONS
+//
+
+// Kernel copy of one pollfd, so the scans with interrupts disabled do not
+// touch user memory. The poll call holds a reference to each endpoint so a
+// close by another thread cannot free it while _pw_ is on its list.
+
+struct pollent {
+    struct io * io; // NULL if the fd is negative or not open
+    short events; // POLLNVAL if the fd is not open, 0 if it is negative
+    short revents;
+    struct pollwait pw;
+};
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static int poll_scan(struct pollent * ents, int nfds, int doregister);
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+int fdpoll (
+    const struct fdtab * fdt, struct pollfd * fds, int nfds, long timeout_ms)
+{
+    unsigned long long deadline = 0;
+    struct pollent * ents;
+    struct alarm al;
+    size_t size;
+    int ready;
+    int pie;
+    int i;
+
+    trace("%s(nfds=%d,timeout_ms=%ld)", __func__, nfds, timeout_ms);
+
+    if (nfds < 0 || PROCESS_IOMAX < nfds || (0 < nfds && fds == NULL))
+        return -EINVAL;
+
+    // Treat a timeout too large to count in ticks as no timeout
+
+    if (0 < timeout_ms &&
+        (UINT64_MAX - rdtime()) / TICKS_PER_MS <= (unsigned long)timeout_ms)
+        timeout_ms = -1;
+    if (0 < timeout_ms)
+        deadline = rdtime() + timeout_ms * TICKS_PER_MS;
+
+    size = nfds * sizeof(struct pollent);
+
+    if (size == 0)
+        ents = NULL;
+    else if (size <= POLL_HEAP_MAX)
+        ents = kmalloc(size);
+    else
+        ents = alloc_phys_pages(ROUND_UP(size, PAGE_SIZE) / PAGE_SIZE);
+
+    if (size != 0 && ents == NULL)
+        return -ENOMEM;
+
+    alarm_init(&al, "poll");
+
+    for (i = 0; i < nfds; i++) {
+        ents[i].io = fdtab_get(fdt, fds[i].fd);
+        if (ents[i].io != NULL) {
+            ioaddref(ents[i].io);
+            ents[i].events = fds[i].events | POLLERR | POLLHUP;
+        } else
+            ents[i].events = (fds[i].fd < 0) ? 0 : POLLNVAL;
+        ents[i].pw.cond = &al.cond;
+        ents[i].pw.next = NULL;
+        ents[i].pw.pprev = NULL;
+    }
+
+    // Interrupts stay disabled from each scan until the thread is asleep, so
+    // an endpoint cannot become ready unnoticed in between. (The thread may
+    // resume with them enabled, hence the disable on every pass.) The waiters
+    // are registered by the first scan that may be followed by a sleep.
+
+    pie = disable_interrupts();
+
+    for (;;) {
+        disable_interrupts();
+        ready = poll_scan(ents, nfds, timeout_ms != 0);
+
+        if (ready != 0 || timeout_ms == 0)
+            break;
+
+        if (timeout_ms < 0)
+            condition_wait(&al.cond);
+        else if (rdtime() < deadline) {
+            alarm_reset(&al);
+            alarm_sleep(&al, deadline - al.twake);
+            alarm_cancel(&al);
+        } else
+            break;
+    }
+
+    restore_interrupts(pie);
+
+    for (i = 0; i < nfds; i++) {
+        pollwait_remove(&ents[i].pw);
+        if (ents[i].io != NULL)
+            ioclose(ents[i].io);
+        fds[i].revents = ents[i].revents;
+    }
+
+    if (size == 0)
+        ;
+    else if (size <= POLL_HEAP_MAX)
+        kfree(ents);
+    else
+        free_phys_pages(ents, ROUND_UP(size, PAGE_SIZE) / PAGE_SIZE);
+
+    return ready;
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+// Sets _revents_ of every entry and returns how many are non-zero. If
+// _doregister_ is set, waiters that are not yet on their endpoint's list are
+// added to it.
+
+int poll_scan(struct pollent * ents, int nfds, int doregister) {
+    struct pollwait * pw;
+    int ready = 0;
+    int i;
+
+    for (i = 0; i < nfds; i++) {
+        if (ents[i].io == NULL)
+            ents[i].revents = ents[i].events;
+        else {
+            pw = (doregister && ents[i].pw.pprev == NULL) ? &ents[i].pw : NULL;
+            ents[i].revents = iopoll(ents[i].io, pw) & ents[i].events;
+        }
+
+        if (ents[i].revents != 0)
+            ready += 1;
+    }
+
+    return ready;
+}
@@ -0,0 +1,41 @@
+// poll.h - Waiting for readiness on several descriptors
+//
+// Copyright (c) 2024-2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+#ifndef _POLL_H_
+#define _POLL_H_
+
+#include "fdtab.h"
+
+// EXPORTED TYPE DEFINITIONS
+//
+
+// One entry of a poll request (same layout as in usr/syscall.h). _events_
+// holds the POLLIN and POLLOUT bits the caller waits for; _revents_ is set to
+// the bits that hold, plus POLLERR, POLLHUP or POLLNVAL whether asked for or
+// not.
+
+struct pollfd {
+    int fd;
+    short events;
+    short revents;
+};
+
+// EXPORTED FUNCTION DECLARATIONS
+//
+
+// fdpoll() waits until at least one of the _nfds_ entries of _fds_ (in user
+// memory) has a non-zero _revents_, or until _timeout_ms_ milliseconds have
+// passed. A negative timeout waits forever and 0 only checks. Entries with a
+// negative _fd_ are ignored. Returns the number of entries with a non-zero
+// _revents_ (0 on timeout), -EINVAL if _nfds_ is out of range, or -ENOMEM.
+//
+// The thread sleeps on a single condition: that of an alarm for the timeout,
+// which every watched endpoint also wakes through a struct pollwait.
+
+extern int fdpoll (
+    const struct fdtab * fdt, struct pollfd * fds, int nfds, long timeout_ms);
+
+#endif // _POLL_H_
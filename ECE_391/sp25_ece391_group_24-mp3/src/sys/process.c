@@ -26,6 +26,8 @@
 #include "heap.h"
 #include "intr.h"
 #include "error.h"
+#include "smp.h"
+#include "mmap.h"
 
 
 // COMPILE-TIME PARAMETERS
@@ -35,11 +37,27 @@
 #define NPROC 16
 #endif
 
+// INTERNAL TYPE DEFINITIONS
+//
+
+// Handed from process_spawn to the new thread, which loads the executable
+// and reports the result back through _result_ and _loaded_.
+
+struct spawn_args {
+    struct io *exeio;
+    void *arg_page;
+    int argc;
+    int stksz;
+    int result;
+    struct condition loaded;
+};
+
 // INTERNAL FUNCTION DECLARATIONS
 //
 
 static int build_stack(void *stack, int argc, char **argv, uintptr_t *argv_user_ptr);
 static void fork_func(struct condition *forked, struct trap_frame *tfr);
+static void spawn_func(struct spawn_args *args);
 
 // INTERNAL GLOBAL VARIABLES
 //
@@ -117,6 +135,8 @@ int process_exec(struct io *exeio, int argc, char **argv) {
 
     // unmap all pages mapped into user address space
     reset_active_mspace();
+    // the file mappings went with the pages; let go of their files
+    mmap_release(&current_process()->mmaps);
 
 
     // load and map program image
@@ -124,7 +144,8 @@ int process_exec(struct io *exeio, int argc, char **argv) {
     int result = elf_load(exeio, &entry);
     assert(result == 0);
     ioclose(exeio);
-    // main_proc.iotab[PROCESS_IOMAX - 1] = exeio;
+    // descriptors marked close-on-exec do not survive into the new image
+    fdtab_close(&current_process()->fds, FD_CLOEXEC);
     // maps stack page into new memory space
     uintptr_t user_sp = UMEM_END_VMA - PAGE_SIZE;
     map_page(user_sp, arg_page, PTE_R | PTE_W | PTE_U);
@@ -150,6 +171,7 @@ int process_exec(struct io *exeio, int argc, char **argv) {
 
     // kprintf("Debugging user stack contents before trap_frame_jump:\n");
 
+    kernel_unlock(); // leaving the kernel for U mode
     trap_frame_jump(tf, (void *)running_thread_anchor() - sizeof(struct trap_frame));
 
     return 0;
@@ -175,17 +197,20 @@ int process_fork(const struct trap_frame *tfr)
         kprintf("No free process slots");
         return -ENOMEM;
     }
-    
-    for(int i = 0; i < PROCESS_IOMAX; i++)
-    {
-        proc->iotab[i] = NULL;
-    }
+
     // copy the I/O table from the parent process
-    for (int i = 0; i < PROCESS_IOMAX; i++)
-    {
-        if (current_process()->iotab[i] != NULL){
-            proc->iotab[i] = ioaddref(current_process()->iotab[i]);
-        }
+    if (fdtab_copy(&proc->fds, &current_process()->fds, 0) < 0) {
+        proctab[proc->idx] = NULL;
+        kfree(proc);
+        return -ENOMEM;
+    }
+
+    // the mapped pages are shared by the clone; the child needs its own list
+    if (mmap_copy(&proc->mmaps, current_process()->mmaps) < 0) {
+        fdtab_close(&proc->fds, 0);
+        proctab[proc->idx] = NULL;
+        kfree(proc);
+        return -ENOMEM;
     }
 
     struct condition forked;
@@ -208,6 +233,98 @@ int process_fork(const struct trap_frame *tfr)
     return proc->idx;
 }
 
+// ==============================================================================================
+// int process_spawn(struct io *exeio, int argc, char **argv, struct fdtab *fds)
+// inputs: struct io *exeio: executable to run (the caller keeps its reference)
+//         int argc: number of arguments
+//         char **argv: array of argument strings in the caller's memory
+//         struct fdtab *fds: descriptor table for the new process (taken over)
+// outputs: int: thread id of the new process, or negative error code
+// description: starts a program in a new process without copying the caller
+//              - builds the argument stack page while the caller's memory is active
+//              - creates an empty memory space and a process slot
+//              - spawns a thread that loads the program into the new memory space
+//              - waits for the load to finish and returns its result
+//===============================================================================================
+int process_spawn(struct io *exeio, int argc, char **argv, struct fdtab *fds)
+{
+    struct spawn_args args;
+    struct process *proc;
+    uintptr_t argv_user_ptr;
+    uint32_t arg_size;
+    int tid;
+    int pie;
+
+    // check the arguments fit on the stack page
+    arg_size = (argc + 1) * sizeof(char *);
+    if (argc < 0 || arg_size >= PAGE_SIZE) {
+        fdtab_close(fds, 0);
+        return -EINVAL;
+    }
+
+    for (int i = 0; i < argc; ++i) {
+        arg_size += strlen(argv[i]) + 1;
+        if (arg_size >= PAGE_SIZE) {
+            fdtab_close(fds, 0);
+            return -EINVAL;
+        }
+    }
+
+    args.arg_page = alloc_phys_page();
+    if (args.arg_page == NULL) {
+        fdtab_close(fds, 0);
+        return -ENOMEM;
+    }
+    memset(args.arg_page, 0, PAGE_SIZE);
+    args.stksz = build_stack(args.arg_page, argc, argv, &argv_user_ptr);
+    args.argc = argc;
+
+    proc = kmalloc(sizeof(struct process));
+    assert(proc != NULL);
+    proc->idx = -1;
+
+    for (int i = 0; i < NPROC; i++) {
+        if (proctab[i] == NULL) {
+            proc->idx = i;
+            proctab[i] = proc;
+            break;
+        }
+    }
+    if (proc->idx == -1) {
+        kfree(proc);
+        free_phys_page(args.arg_page);
+        fdtab_close(fds, 0);
+        return -EMPROC;
+    }
+
+    proc->mtag = create_mspace();
+    proc->mmaps = NULL;
+
+    // move the descriptors over; the caller's table is left empty
+    proc->fds = *fds;
+    memset(fds, 0, sizeof(struct fdtab));
+
+    args.exeio = ioaddref(exeio);
+    args.result = 0;
+    condition_init(&args.loaded, "spawned");
+
+    tid = thread_spawn("spawned process", (void(*)(void))spawn_func, (uint64_t)&args);
+    assert(tid >= 0);
+    proc->tid = tid;
+    thread_set_process(tid, proc);
+
+    pie = disable_interrupts();
+    condition_wait(&args.loaded);
+    restore_interrupts(pie);
+
+    if (args.result < 0) {
+        thread_join(tid);
+        return args.result;
+    }
+
+    return tid;
+}
+
 // ==============================================================================================
 // void process_exit(void)
 // inputs: none
@@ -224,17 +341,11 @@ void process_exit(void)
 {
     struct process *proc = current_process();
     int pid = proc->idx;
-    
-    for (int i = 0; i < PROCESS_IOMAX; i++)
-    {
-        if (proc->iotab[i])
-        {   
-            ioclose(proc->iotab[i]);
-            proc->iotab[i] = NULL;
-        }
-    }
+
+    fdtab_close(&proc->fds, 0);
     // Reclaim process memory space
     discard_active_mspace();
+    mmap_release(&proc->mmaps);
     
     //close the file of the game this process is running
 
@@ -325,6 +436,52 @@ void fork_func(struct condition *forked, struct trap_frame *tfr)
     tfr->a0 = 0; // child process
     tfr->sepc +=4; // argv
     condition_broadcast(forked);
+    kernel_unlock(); // leaving the kernel for U mode
     trap_frame_jump(tfr, (void *)running_thread_anchor() - sizeof(struct trap_frame));
     return;
-}
\ No newline at end of file
+}
+// ==============================================================================================
+// void spawn_func(struct spawn_args *args)
+// inputs: struct spawn_args *args: load request from process_spawn (on its stack)
+// outputs: does not return
+// description: first code run by a spawned process. The scheduler has already
+//              switched to the new (empty) memory space.
+//              - loads the program image and maps the argument stack page
+//              - reports the result to process_spawn
+//              - exits the process on failure, otherwise jumps to user mode
+//===============================================================================================
+void spawn_func(struct spawn_args *args)
+{
+    void (*entry)(void);
+    const int argc = args->argc;
+    const int stksz = args->stksz;
+    struct trap_frame *tf;
+    int result;
+
+    result = elf_load(args->exeio, &entry);
+    ioclose(args->exeio);
+
+    if (result < 0) {
+        free_phys_page(args->arg_page);
+        args->result = result;
+        condition_broadcast(&args->loaded);
+        process_exit();
+    }
+
+    map_page(UMEM_END_VMA - PAGE_SIZE, args->arg_page, PTE_R | PTE_W | PTE_U);
+
+    // args is on the parent's stack; do not touch it after this
+    condition_broadcast(&args->loaded);
+
+    tf = kmalloc(sizeof(struct trap_frame));
+    memset(tf, 0, sizeof(struct trap_frame));
+    tf->a0 = argc;
+    tf->a1 = UMEM_END_VMA - stksz;
+    tf->sp = (void *) UMEM_END_VMA - stksz;
+    tf->sepc = entry;
+    tf->sstatus = csrr_sstatus();
+    tf->sstatus &= ~RISCV_SSTATUS_SPP;
+
+    kernel_unlock(); // leaving the kernel for U mode
+    trap_frame_jump(tf, (void *)running_thread_anchor() - sizeof(struct trap_frame));
+}
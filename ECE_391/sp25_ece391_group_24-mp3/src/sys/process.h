@@ -10,15 +10,13 @@
 #define _PROCESS_H_
 
 
-#ifndef PROCESS_IOMAX
-#define PROCESS_IOMAX 16
-#endif
-
 #include "conf.h"
 #include "io.h"
+#include "fdtab.h"
 #include "thread.h"
 #include "trap.h"
 #include "memory.h"
+#include "mmap.h"
 
 // EXPORTED TYPE DEFINITIONS
 //
@@ -28,7 +26,8 @@ struct process {
     int idx; // index into proctab
     int tid; // thread id of our thread
     mtag_t mtag; // memory space
-    struct io * iotab[PROCESS_IOMAX]; // IO objects associated with current process
+    struct fdtab fds; // IO objects associated with current process
+    struct mmap_region * mmaps; // file mappings, sorted by address
 };
 
 // EXPORTED FUNCTION DECLARATIONS
@@ -44,6 +43,15 @@ extern int process_exec(struct io * exeio, int argc, char ** argv);
 
 
 extern int process_fork(const struct trap_frame * tfr);
+
+// Creates a process running the executable _exeio_ in a new, empty memory
+// space (no copy of the caller's). The new process takes over the contents of
+// descriptor table _fds_, which is left empty; on failure its descriptors are
+// closed. Returns the thread id of the new process, which _wait_ accepts, or
+// a negative error code if the executable could not be loaded.
+
+extern int process_spawn (
+    struct io * exeio, int argc, char ** argv, struct fdtab * fds);
  
 
 extern void __attribute__ ((noreturn)) process_exit(void);
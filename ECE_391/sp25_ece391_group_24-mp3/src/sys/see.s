@@ -114,11 +114,15 @@ handle_ecall_from_smode:
         bne     a7, t0, 1f
         bnez    a6, unsupported_function
 
-        # Write stcmp_new, a uint64_t, to mtimecmp MMIO register. After this, we
-        # can use a0 and a1 as temporary registers. Just need to zero a0 before
+        # Write stcmp_new, a uint64_t, to the mtimecmp MMIO register of this
+        # hart (each hart has its own at MTCMP_ADDR + 8*mhartid). After this, we
+        # can use a0 and a1 as temporary registers. Just need to zero a0 before
         # returning to indicate success.
 
+        csrr    a1, mhartid
+        slli    a1, a1, 3
         li      t0, MTCMP_ADDR
+        add     t0, t0, a1
         sd      a0, (t0)
 
         # Depending on the value written to mtcmp, the timer interrupt may
@@ -0,0 +1,112 @@
+// smp.c - Multiprocessor (multi-hart) support
+//
+// Copyright (c) 2024-2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+#ifdef SMP_TRACE
+#define TRACE
+#endif
+
+#ifdef SMP_DEBUG
+#define DEBUG
+#endif
+
+#include "smp.h"
+#include "spinlock.h"
+#include "thread.h"
+#include "memory.h"
+#include "timer.h"
+#include "riscv.h"
+#include "intr.h"
+#include "console.h"
+#include "assert.h"
+
+// EXPORTED GLOBAL VARIABLE DEFINITIONS
+//
+
+char smp_initialized = 0;
+
+// Boot handshake with start.s. A secondary hart spins until its entry in
+// _hart_boot_sp is non-zero and then uses it as the stack pointer of its idle
+// thread. Harts with mhartid >= _hart_boot_max are parked.
+
+void * volatile _hart_boot_sp[NHART];
+const unsigned long _hart_boot_max = NHART;
+
+// INTERNAL GLOBAL VARIABLE DEFINITIONS
+//
+
+static struct spinlock kernel_spinlock;
+static volatile int kernel_lock_owner = -1; // hart holding the kernel lock
+static volatile int online_cnt = 1;
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+// Entry point of secondary harts, called from start.s with the stack of the
+// hart's idle thread. Does not return.
+
+extern void __attribute__ ((noreturn)) smp_hart_start(int hartid);
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+void smp_init(void) {
+    int hartid;
+
+    trace("%s()", __func__);
+
+    // The boot hart has been running kernel code all along; from now on it
+    // has to hold the kernel lock to do so.
+
+    spinlock_init(&kernel_spinlock);
+    kernel_lock();
+
+    for (hartid = 1; hartid < NHART; hartid++)
+        _hart_boot_sp[hartid] = thread_hart_init(hartid);
+
+    __sync_synchronize();
+    smp_initialized = 1;
+}
+
+int smp_hart_count(void) {
+    return online_cnt;
+}
+
+void kernel_lock(void) {
+    const int hartid = running_hart();
+
+    assert (kernel_lock_owner != hartid);
+    spinlock_acquire(&kernel_spinlock);
+    kernel_lock_owner = hartid;
+}
+
+void kernel_unlock(void) {
+    assert (kernel_lock_owner == running_hart());
+    kernel_lock_owner = -1;
+    spinlock_release(&kernel_spinlock);
+}
+
+int kernel_lock_held(void) {
+    return (kernel_lock_owner == running_hart());
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+void smp_hart_start(int hartid) {
+    // The boot hart set up the kernel page table. Use it here too, then
+    // become the idle thread of this hart.
+
+    switch_mspace(main_mspace());
+    thread_hart_attach(hartid);
+
+    kernel_lock();
+    timer_init();
+    csrw_sie(RISCV_SIE_SEIE | RISCV_SIE_STIE);
+    online_cnt += 1;
+    trace("hart %d online (%d total)", hartid, online_cnt);
+
+    thread_hart_idle();
+}
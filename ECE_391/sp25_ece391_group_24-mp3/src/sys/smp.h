@@ -0,0 +1,44 @@
+// smp.h - Multiprocessor (multi-hart) support
+//
+// Copyright (c) 2024-2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+#ifndef _SMP_H_
+#define _SMP_H_
+
+#include "conf.h"
+
+// EXPORTED GLOBAL VARIABLES
+//
+
+extern char smp_initialized;
+
+// EXPORTED FUNCTION DECLARATIONS
+//
+
+// Releases the secondary harts parked in start.s. Called once by the boot hart
+// after the thread, memory, and process managers are initialized. Each
+// secondary hart gets its own idle thread and run queue and starts scheduling
+// threads from the other harts' run queues as soon as it is online.
+
+extern void smp_init(void);
+
+// Returns the number of harts that have come online (at least 1).
+
+extern int smp_hart_count(void);
+
+// The kernel lock serializes execution of kernel code across harts: a hart
+// holds it whenever it runs S mode code, except while its idle thread waits
+// in wfi. User code runs on all harts in parallel. The lock is owned by a hart,
+// not a thread, so a thread may block on one hart and resume on another.
+//
+// kernel_lock() spins until the lock is free and must be called with
+// interrupts disabled. kernel_lock_held() returns true if the running hart
+// owns the lock.
+
+extern void kernel_lock(void);
+extern void kernel_unlock(void);
+extern int kernel_lock_held(void);
+
+#endif // _SMP_H_
@@ -0,0 +1,40 @@
+// spinlock.h - Spin locks for data shared between harts
+//
+// Copyright (c) 2024-2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+#ifndef _SPINLOCK_H_
+#define _SPINLOCK_H_
+
+// A spin lock is a single word updated with an atomic swap (amoswap.w.aq), so
+// it works between harts without any help from the scheduler. Spin locks must
+// only be held for short critical sections, and the holder must not sleep
+// (call condition_wait) while holding one. Disable interrupts before acquiring
+// a spin lock that an ISR may also acquire on the same hart.
+
+struct spinlock {
+    volatile int locked;
+};
+
+static inline void spinlock_init(struct spinlock * lk) {
+    lk->locked = 0;
+}
+
+static inline int spinlock_try_acquire(struct spinlock * lk) {
+    return (__sync_lock_test_and_set(&lk->locked, 1) == 0);
+}
+
+static inline void spinlock_acquire(struct spinlock * lk) {
+    while (__sync_lock_test_and_set(&lk->locked, 1) != 0) {
+        // Spin on a plain load so we do not hammer the line with AMOs
+        while (lk->locked)
+            continue;
+    }
+}
+
+static inline void spinlock_release(struct spinlock * lk) {
+    __sync_lock_release(&lk->locked);
+}
+
+#endif // _SPINLOCK_H_
@@ -9,8 +9,11 @@
         .global _mmode_trap_entry # defined in see.s
         .global _smode_trap_entry # defined in trap.s
 
-# QEMU RISC-V virt system zero-stage bootloader jumps to 0x8000'0000 to start
-# kernel. The linker script kernel.ld arranges for start.s to be placed here.
+# QEMU RISC-V virt system zero-stage bootloader jumps to 0x8000'0000 to start
+# kernel. The linker script kernel.ld arranges for start.s to be placed here.
+# With -smp N, all N harts start here at the same time. Every hart performs the
+# M mode setup below (the CSRs are per hart), then hart 0 runs main and the
+# other harts wait in smode_secondary until smp_init() releases them.
  
         .section        .text.start, "xa", @progbits
         .balign         4
@@ -68,6 +71,7 @@ mmode_start:
         csrs    mstatus, t1
         la      t0, smode_start
         csrw    mepc, t0
+        csrr    a0, mhartid # S mode cannot read mhartid, so pass it in a0
         mret
 
 smode_start:
@@ -81,10 +85,12 @@ smode_start:
 
         csrs    scounteren, 7
 
-        # Initialize sscratch (must be zero in S mode)
+        # Initialize sscratch (must be zero in S mode)
 
         csrw    sscratch, zero
 
+        bnez    a0, smode_secondary
+
         # Set initial frame and stack pointer for main thread. Set up ra so we
         # jump to halt_failure if main returns.
 
@@ -93,6 +99,31 @@ smode_start:
         la      ra, halt_failure # see.s
         j       main
 
+smode_secondary:
+
+        # Secondary hart (a0 = hart id). Park harts the kernel was not built
+        # for. Otherwise spin until the boot hart publishes the stack of our
+        # idle thread in _hart_boot_sp[a0] (smp.c), then enter smp_hart_start.
+
+        la      t0, _hart_boot_max
+        ld      t0, (t0)
+        bgeu    a0, t0, smode_park
+
+        la      t0, _hart_boot_sp
+        slli    t1, a0, 3
+        add     t0, t0, t1
+1:      ld      sp, (t0)
+        beqz    sp, 1b
+        fence   r, rw
+
+        mv      fp, zero
+        la      ra, halt_failure # see.s
+        j       smp_hart_start # smp.c
+
+smode_park:
+        wfi
+        j       smode_park
+
         .section        .data.stack, "wa", @progbits
         .balign		16
         
@@ -9,6 +9,28 @@
 #include <stdint.h>
 #include <limits.h>
 
+// INTERNAL CONSTANT DEFINITIONS
+// 
+
+// The memory functions move an aligned 64-bit word at a time where they can.
+// Multiplying a byte by WORD_ONES repeats it in every byte of a word, and
+// WORD_HAS_ZERO(w) is non-zero iff some byte of _w_ is zero. RISC-V makes
+// misaligned word accesses slow or traps them, so the word paths are only
+// taken when the pointers can be aligned together.
+
+typedef uint64_t __attribute__ ((may_alias)) word_t;
+
+#define WORD_SIZE sizeof(word_t)
+#define WORD_ONES 0x0101010101010101ULL
+#define WORD_HIGHS 0x8080808080808080ULL
+#define WORD_HAS_ZERO(w) (((w) - WORD_ONES) & ~(w) & WORD_HIGHS)
+#define WORD_OFFSET(p) ((uintptr_t)(p) & (WORD_SIZE - 1))
+
+// Copies and fills of whole, page-aligned pages take a loop with no head or
+// tail handling.
+
+#define MEM_PAGE_SIZE 4096
+
 // INTERNAL STRUCTURE DEFINITIONS
 // 
 
@@ -34,6 +56,9 @@ size_t format_char (
     void (*putcfn)(char, void*), void * aux,
     int c, unsigned int len);
 
+static void copy_pages(word_t * dst, const word_t * src, size_t n);
+static void fill_pages(word_t * dst, word_t fill, size_t n);
+
 // EXPORTED FUNCTION DEFINITIONS
 // 
 
@@ -77,10 +102,27 @@ int strncmp(const char * s1, const char * s2, size_t n) {
 
 size_t strlen(const char * s) {
     const char * p = s;
+    const word_t * w;
 
     if (s == NULL)
         return 0;
 
+    // Check bytes up to a word boundary, then whole words. An aligned word
+    // never crosses a page boundary, so reading past the terminator is safe.
+
+    while (WORD_OFFSET(p) != 0) {
+        if (*p == '\0')
+            return (p - s);
+        p += 1;
+    }
+
+    w = (const word_t *)p;
+
+    while (!WORD_HAS_ZERO(*w))
+        w += 1;
+
+    p = (const char *)w;
+
     while (*p != '\0')
         p += 1;
     
@@ -126,22 +168,93 @@ char * strrchr(const char * s, int c) {
 }
 
 void * memset(void * s, int c, size_t n) {
-  char * p = s;
+    const word_t fill = (uint8_t)c * WORD_ONES;
+    uint8_t * p = s;
+    word_t * w;
 
-  while (n != 0) {
-    *p++ = c;
-    n -= 1;
-  }
+    if ((((uintptr_t)s | n) & (MEM_PAGE_SIZE - 1)) == 0) {
+        fill_pages(s, fill, n);
+        return s;
+    }
+
+    if (n >= 2 * WORD_SIZE) {
+        while (WORD_OFFSET(p) != 0) {
+            *p++ = c;
+            n -= 1;
+        }
+
+        w = (word_t *)p;
+
+        while (n >= 4 * WORD_SIZE) {
+            w[0] = fill;
+            w[1] = fill;
+            w[2] = fill;
+            w[3] = fill;
+            w += 4;
+            n -= 4 * WORD_SIZE;
+        }
+
+        while (n >= WORD_SIZE) {
+            *w++ = fill;
+            n -= WORD_SIZE;
+        }
+
+        p = (uint8_t *)w;
+    }
+
+    while (n != 0) {
+        *p++ = c;
+        n -= 1;
+    }
 
-  return s;
+    return s;
 }
 
 void * memcpy(void * restrict dst, const void * restrict src, size_t n) {
-    const char * q = src;
-    char *p = dst;
+    const uint8_t * q = src;
+    uint8_t * p = dst;
+    const word_t * wq;
+    word_t * wp;
+    word_t w0, w1, w2, w3;
+
+    if ((((uintptr_t)dst | (uintptr_t)src | n) & (MEM_PAGE_SIZE - 1)) == 0) {
+        copy_pages(dst, src, n);
+        return dst;
+    }
+
+    if (n >= 2 * WORD_SIZE && WORD_OFFSET(p) == WORD_OFFSET(q)) {
+        while (WORD_OFFSET(p) != 0) {
+            *p++ = *q++;
+            n -= 1;
+        }
+
+        wp = (word_t *)p;
+        wq = (const word_t *)q;
+
+        while (n >= 4 * WORD_SIZE) {
+            w0 = wq[0];
+            w1 = wq[1];
+            w2 = wq[2];
+            w3 = wq[3];
+            wp[0] = w0;
+            wp[1] = w1;
+            wp[2] = w2;
+            wp[3] = w3;
+            wp += 4;
+            wq += 4;
+            n -= 4 * WORD_SIZE;
+        }
+
+        while (n >= WORD_SIZE) {
+            *wp++ = *wq++;
+            n -= WORD_SIZE;
+        }
+
+        p = (uint8_t *)wp;
+        q = (const uint8_t *)wq;
+    }
+    
     while (n != 0) {
-        // kprintf("buf_address_dst: %p\n", p);
-        // kprintf("buf_address_src: %p\n", q);
         *p = *q;
         p += 1;
         q += 1;
@@ -154,6 +267,42 @@ void * memcpy(void * restrict dst, const void * restrict src, size_t n) {
 int memcmp(const void * p1, const void * p2, size_t n) {
     const uint8_t * u = p1;
     const uint8_t * v = p2;
+    const word_t * wu;
+    const word_t * wv;
+
+    // Skip over equal words; the byte loop finds the first difference in
+    // the word that differs.
+
+    if (n >= 2 * WORD_SIZE && WORD_OFFSET(u) == WORD_OFFSET(v)) {
+        while (WORD_OFFSET(u) != 0) {
+            if (*u != *v)
+                return (*u - *v);
+            u += 1;
+            v += 1;
+            n -= 1;
+        }
+
+        wu = (const word_t *)u;
+        wv = (const word_t *)v;
+
+        while (n >= 4 * WORD_SIZE &&
+            ((wu[0] ^ wv[0]) | (wu[1] ^ wv[1]) |
+             (wu[2] ^ wv[2]) | (wu[3] ^ wv[3])) == 0)
+        {
+            wu += 4;
+            wv += 4;
+            n -= 4 * WORD_SIZE;
+        }
+
+        while (n >= WORD_SIZE && *wu == *wv) {
+            wu += 1;
+            wv += 1;
+            n -= WORD_SIZE;
+        }
+
+        u = (const uint8_t *)wu;
+        v = (const uint8_t *)wv;
+    }
 
     while (n != 0) {
         if (*u != *v)
@@ -474,4 +623,52 @@ size_t format_char (
     putcfn(c, aux);
 
     return nout;
-}
\ No newline at end of file
+}
+
+// Copies _n_ bytes, a multiple of MEM_PAGE_SIZE, between page-aligned buffers
+// eight words per iteration.
+
+void copy_pages(word_t * dst, const word_t * src, size_t n) {
+    word_t * const end = dst + n / WORD_SIZE;
+    word_t w0, w1, w2, w3, w4, w5, w6, w7;
+
+    while (dst < end) {
+        w0 = src[0];
+        w1 = src[1];
+        w2 = src[2];
+        w3 = src[3];
+        w4 = src[4];
+        w5 = src[5];
+        w6 = src[6];
+        w7 = src[7];
+        dst[0] = w0;
+        dst[1] = w1;
+        dst[2] = w2;
+        dst[3] = w3;
+        dst[4] = w4;
+        dst[5] = w5;
+        dst[6] = w6;
+        dst[7] = w7;
+        dst += 8;
+        src += 8;
+    }
+}
+
+// Fills _n_ bytes, a multiple of MEM_PAGE_SIZE, at page-aligned _dst_ eight
+// words per iteration.
+
+void fill_pages(word_t * dst, word_t fill, size_t n) {
+    word_t * const end = dst + n / WORD_SIZE;
+
+    while (dst < end) {
+        dst[0] = fill;
+        dst[1] = fill;
+        dst[2] = fill;
+        dst[3] = fill;
+        dst[4] = fill;
+        dst[5] = fill;
+        dst[6] = fill;
+        dst[7] = fill;
+        dst += 8;
+    }
+}
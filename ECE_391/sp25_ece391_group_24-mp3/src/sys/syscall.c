@@ -28,6 +28,13 @@
 #include "thread.h"
 #include "process.h"
 #include "ktfs.h"
+#include "futex.h"
+#include "string.h"
+#include "ioring.h"
+#include "poll.h"
+#include "mmap.h"
+
+#include <limits.h>
 
 // EXPORTED FUNCTION DECLARATIONS
 //
@@ -58,6 +65,25 @@ static int syspipe(int * wfdptr, int * rfdptr);
 static int sysfscreate(const char* name); 
 static int sysiodup(int oldfd, int newfd);
 static int sysfsdelete(const char* name);
+static int sysfsmkdir(const char * path);
+static long sysmmap(int fd, unsigned long long off, size_t len, int prot);
+static int sysmsync(const void * addr, size_t len);
+static int sysmunmap(void * addr, size_t len);
+static int sysfutexwait(const int * uaddr, int expected);
+static int sysfutexwake(const int * uaddr, int cnt);
+static long sysreadv(int fd, const struct iovec * uiov, int iovcnt);
+static long syswritev(int fd, const struct iovec * uiov, int iovcnt);
+static long syspreadv(int fd, const struct iovec * uiov, int iovcnt, unsigned long long pos);
+static long syspwritev(int fd, const struct iovec * uiov, int iovcnt, unsigned long long pos);
+static int copy_iovec(struct iovec * iov, const struct iovec * uiov, int iovcnt);
+static long sysioringsetup(void);
+static int sysioringenter(unsigned int to_submit);
+static int64_t ioring_dispatch(const struct ioring_sqe * sqe);
+static int sysspawn(int fd, int argc, char ** argv, const int * fd_map, int mapcnt);
+static int sysfdctl(int fd, int cmd, int arg);
+static int syspoll(struct pollfd * fds, int nfds, long timeout);
+static long nonblock_len(int fd, int cmd, long len);
+static int nonblock_iov(int fd, int cmd, struct iovec * iov, int iovcnt);
 // EXPORTED FUNCTION DEFINITIONS
 //
 
@@ -123,6 +149,40 @@ static int64_t syscall(const struct trap_frame * tfr){
             return sysfsdelete((const char *)tfr->a0);
         case SYSCALL_IODUP:
             return sysiodup((int)tfr->a0, (int)tfr->a1);
+        case SYSCALL_FUTEX_WAIT:
+            return sysfutexwait((const int *)tfr->a0, (int)tfr->a1);
+        case SYSCALL_FUTEX_WAKE:
+            return sysfutexwake((const int *)tfr->a0, (int)tfr->a1);
+        case SYSCALL_READV:
+            return sysreadv((int)tfr->a0, (const struct iovec *)tfr->a1, (int)tfr->a2);
+        case SYSCALL_WRITEV:
+            return syswritev((int)tfr->a0, (const struct iovec *)tfr->a1, (int)tfr->a2);
+        case SYSCALL_PREADV:
+            return syspreadv((int)tfr->a0, (const struct iovec *)tfr->a1, (int)tfr->a2,
+                (unsigned long long)tfr->a3);
+        case SYSCALL_PWRITEV:
+            return syspwritev((int)tfr->a0, (const struct iovec *)tfr->a1, (int)tfr->a2,
+                (unsigned long long)tfr->a3);
+        case SYSCALL_IORING_SETUP:
+            return sysioringsetup();
+        case SYSCALL_IORING_ENTER:
+            return sysioringenter((unsigned int)tfr->a0);
+        case SYSCALL_SPAWN:
+            return sysspawn((int)tfr->a0, (int)tfr->a1, (char **)tfr->a2, (const int *)tfr->a3,
+                (int)tfr->a4);
+        case SYSCALL_FDCTL:
+            return sysfdctl((int)tfr->a0, (int)tfr->a1, (int)tfr->a2);
+        case SYSCALL_POLL:
+            return syspoll((struct pollfd *)tfr->a0, (int)tfr->a1, (long)tfr->a2);
+        case SYSCALL_FSMKDIR:
+            return sysfsmkdir((const char *)tfr->a0);
+        case SYSCALL_MMAP:
+            return sysmmap((int)tfr->a0, (unsigned long long)tfr->a1, (size_t)tfr->a2,
+                (int)tfr->a3);
+        case SYSCALL_MSYNC:
+            return sysmsync((const void *)tfr->a0, (size_t)tfr->a1);
+        case SYSCALL_MUNMAP:
+            return sysmunmap((void *)tfr->a0, (size_t)tfr->a1);
         default:
             return -ENOTSUP;  // syscall not supported
     }
@@ -146,11 +206,10 @@ static int sysexit(void) {
 
 static int sysexec(int fd, int argc, char ** argv) {
     struct process *proc=current_process();
-    if(fd<0||fd>=PROCESS_IOMAX||proc->iotab[fd]==NULL){
+    if(fdtab_get(&proc->fds,fd)==NULL){
         return -EBADFD;
     }
-    struct io *a = proc->iotab[fd];
-    proc->iotab[fd] = NULL;
+    struct io *a = fdtab_remove(&proc->fds,fd);
     int result=process_exec(a, argc, argv);
     return result;
 }
@@ -216,28 +275,21 @@ static int sysusleep(unsigned long us) {
 //==============================================================================================
 static int sysdevopen(int fd, const char * name, int instno) {
     struct process *proc = current_process();
-    //if specify the fd
-    if(fd>=0){
-        if(fd>=PROCESS_IOMAX||proc->iotab[fd]!=NULL){
-            return -EBADFD;
-        }
-        int result = open_device(name, instno, &proc->iotab[fd]);
-        if(result < 0){
-            return result;
-        }
-        return fd;
-    }
-    //if fd == -1
-    for(int i=0;i<PROCESS_IOMAX;i++){
-        if (proc->iotab[i] == NULL) {
-            int result = open_device(name, instno, &proc->iotab[fd]);
-            if(result < 0){
-                return result;
-            }
-            return i;
-        }
+    struct io *io;
+    //if specify the fd, it must be free
+    if(fd>=PROCESS_IOMAX||fdtab_get(&proc->fds,fd)!=NULL){
+        return -EBADFD;
     }
-    return -EMFILE; 
+    int result = open_device(name, instno, &io);
+    if(result < 0){
+        return result;
+    }
+    //if fd == -1 the table picks the lowest free one
+    result = fdtab_install(&proc->fds, fd, io, 0);
+    if(result < 0){
+        ioclose(io);
+    }
+    return result;
 }
 
 //==============================================================================================
@@ -250,26 +302,19 @@ static int sysdevopen(int fd, const char * name, int instno) {
 //==============================================================================================
 static int sysfsopen(int fd, const char * name) {
     struct process *proc = current_process();
-    if(fd>=0){
-        if(fd>=PROCESS_IOMAX||proc->iotab[fd]!=NULL){
-            return -EBADFD;
-        }
-        int result=fsopen(name, &proc->iotab[fd]);
-        if(result<0){
-            return result;
-        }
-        return fd;
+    struct io *io;
+    if(fd>=PROCESS_IOMAX||fdtab_get(&proc->fds,fd)!=NULL){
+        return -EBADFD;
     }
-    for(int i=0;i<PROCESS_IOMAX;i++){
-        if(proc->iotab[i]==NULL){
-            int result = fsopen(name, &proc->iotab[i]);
-            if(result<0){
-                return result;
-            }
-            return i;
-        }
+    int result=fsopen(name, &io);
+    if(result<0){
+        return result;
+    }
+    result=fdtab_install(&proc->fds, fd, io, 0);
+    if(result<0){
+        ioclose(io);
     }
-    return -EMFILE;  
+    return result;
 }
 
 
@@ -283,13 +328,12 @@ static int sysfsopen(int fd, const char * name) {
 //==============================================================================================
 static int sysclose(int fd) {
     struct process *proc=current_process();
-    if(fd<0||fd>=PROCESS_IOMAX||proc->iotab[fd]==NULL){
+    struct io *io=fdtab_remove(&proc->fds,fd);
+    if(io==NULL){
         return -EBADFD;
     }
     // perform the ioclose operation on the device or file
-    ioclose(proc->iotab[fd]);
-    proc->iotab[fd]= NULL;
-    return 0;
+    return ioclose(io);
 }
 
 
@@ -304,14 +348,19 @@ static int sysclose(int fd) {
 //==============================================================================================
 static long sysread(int fd, void * buf, size_t bufsz) {
     struct process *proc=current_process();
-    if(fd<0||fd>=PROCESS_IOMAX||proc->iotab[fd]==NULL){
+    if(fdtab_get(&proc->fds,fd)==NULL){
         return -EBADFD;
     }
     if(buf==NULL||bufsz<0){
         return -EINVAL;
     }
+    // a non-blocking fd only asks for what is already there
+    long len=nonblock_len(fd,IOCTL_GETRDAVAIL,bufsz);
+    if(len<0){
+        return len;
+    }
     // perform the ioread operation on the device or file
-    int result=ioread(proc->iotab[fd],buf,bufsz);
+    int result=ioread(fdtab_get(&proc->fds,fd),buf,len);
     return result;
 }
 
@@ -327,7 +376,7 @@ static long sysread(int fd, void * buf, size_t bufsz) {
 //==============================================================================================
 static long syswrite(int fd, const void * buf, size_t len) {
     struct process *proc=current_process();
-    if(fd<0||fd>=PROCESS_IOMAX||proc->iotab[fd]==NULL){
+    if(fdtab_get(&proc->fds,fd)==NULL){
         return -EBADFD;
     }
     // if(buf==NULL||len<0){
@@ -336,8 +385,13 @@ static long syswrite(int fd, const void * buf, size_t len) {
     if(len <0){
         return -EINVAL;
     }
+    // a non-blocking fd only writes what fits without waiting
+    long wlen=nonblock_len(fd,IOCTL_GETWRAVAIL,len);
+    if(wlen<0){
+        return wlen;
+    }
     // perform the iowrite operation on the device or file
-    int result=iowrite(proc->iotab[fd],buf,len);
+    int result=iowrite(fdtab_get(&proc->fds,fd),buf,wlen);
     return result;
 }
 
@@ -352,7 +406,7 @@ static long syswrite(int fd, const void * buf, size_t len) {
 //==============================================================================================
 static int sysioctl(int fd, int cmd, void * arg) {
     struct process *proc=current_process();
-    if(fd<0||fd>=PROCESS_IOMAX||proc->iotab[fd]==NULL){
+    if(fdtab_get(&proc->fds,fd)==NULL){
         return -EBADFD;
     }
     // if(arg==NULL){
@@ -362,7 +416,7 @@ static int sysioctl(int fd, int cmd, void * arg) {
         return -EINVAL;
     }
     // perform the ioctl operation on the device or file
-    int result=ioctl(proc->iotab[fd],cmd,arg);
+    int result=ioctl(fdtab_get(&proc->fds,fd),cmd,arg);
     return result;
 }
 
@@ -380,50 +434,40 @@ static int syspipe(int * wfdptr, int * rfdptr){
     }
     
     struct process *proc=current_process();
-   
-    int write_index = -1;
-    int read_index = -1;
-    if(*wfdptr <0 && *rfdptr<0){
-        for(int i =0; i < PROCESS_IOMAX; i++){
-            if(proc->iotab[i] ==NULL){
-                if(write_index == -1 ){
-                    write_index = i;
-                }else if( read_index == -1){
-                    read_index = i;
-                }else{
-                    break;
-                }
-            }
-        }
-    }else if( *wfdptr <0 || *rfdptr <0){
-        int i;
-        for( i =0; i < PROCESS_IOMAX; i++){
-            if(proc->iotab[i] == NULL){
-                break;
-            }
-        }
-        if(i== PROCESS_IOMAX){
-            return -EMFILE;
-        }
-        if( *wfdptr<0){
-            write_index = i;
-            read_index = *rfdptr;
-        }else{
-            read_index = i;
-            write_index = *wfdptr;
-        }
-    }else{
-        write_index = *wfdptr;
-        read_index = *rfdptr;
-    }
-    if(write_index < 0 || read_index <0 || write_index == read_index){
+    struct io *wio = NULL;
+    struct io *rio = NULL;
+    int write_index = *wfdptr;
+    int read_index = *rfdptr;
+
+    if(fdtab_get(&proc->fds,write_index) != NULL || fdtab_get(&proc->fds,read_index) != NULL){
         return -EBADFD;
     }
 
-    create_pipe(&proc->iotab[write_index], &proc->iotab[read_index]);
-    if(proc->iotab[write_index] == NULL || proc->iotab[read_index] == NULL){
+    create_pipe(&wio, &rio);
+    if(wio == NULL || rio == NULL){
         return -EINVAL;
     }
+
+    // install a requested fd before picking the lowest free one for the
+    // other end, so the pick cannot take it
+    if(write_index < 0 && read_index >= 0){
+        read_index = fdtab_install(&proc->fds, read_index, rio, 0);
+        if(read_index >= 0)
+            write_index = fdtab_install(&proc->fds, write_index, wio, 0);
+    }else{
+        write_index = fdtab_install(&proc->fds, write_index, wio, 0);
+        if(write_index >= 0)
+            read_index = fdtab_install(&proc->fds, read_index, rio, 0);
+    }
+    if(write_index < 0 || read_index < 0){
+        if(write_index >= 0)
+            fdtab_remove(&proc->fds, write_index);
+        if(read_index >= 0)
+            fdtab_remove(&proc->fds, read_index);
+        ioclose(wio);
+        ioclose(rio);
+        return (write_index < 0) ? write_index : read_index;
+    }
     *wfdptr = write_index;
     *rfdptr = read_index;
     return 0;
@@ -454,31 +498,494 @@ static int sysfsdelete(const char* name) {
     return fsdelete(name);
 }
 
+//==============================================================================================
+// int sysfsmkdir(const char *path)
+// inputs: const char *path: path of the new directory
+// outputs: int: 0 on success, or negative error code
+// description:
+//     creates an empty directory.
+//==============================================================================================
+
+static int sysfsmkdir(const char * path) {
+    return fsmkdir(path);
+}
+
+//==============================================================================================
+// long sysmmap(int fd, unsigned long long off, size_t len, int prot)
+// inputs: int fd: open file descriptor of the file to map
+//         unsigned long long off: file offset of the mapping, multiple of the page size
+//         size_t len: bytes to map, rounded up to whole pages
+//         int prot: PROT_READ, or PROT_READ | PROT_WRITE
+// outputs: long: user address of the mapping, or negative error code
+// description:
+//     maps a file into the calling process. pages are faulted in from the file's page
+//     cache on first access, so reading them costs no copy and no read call. stores
+//     reach the file on msync, munmap, exit, or when the page cache evicts the page.
+//     the mapping keeps the file open after fd is closed.
+//==============================================================================================
+
+static long sysmmap(int fd, unsigned long long off, size_t len, int prot) {
+    struct process *proc=current_process();
+    struct io *io=fdtab_get(&proc->fds,fd);
+    if(io==NULL){
+        return -EBADFD;
+    }
+    return mmap_map(&proc->mmaps,io,off,len,prot);
+}
+
+//==============================================================================================
+// int sysmsync(const void * addr, size_t len)
+// inputs: const void * addr: user address inside a mapping
+//         size_t len: bytes from addr
+// outputs: int: 0 on success, or negative error code
+// description:
+//     writes the mapped pages in the range back to their files.
+//==============================================================================================
+
+static int sysmsync(const void * addr, size_t len) {
+    return mmap_sync(current_process()->mmaps,addr,len);
+}
+
+//==============================================================================================
+// int sysmunmap(void * addr, size_t len)
+// inputs: void * addr: start of a mapping returned by mmap
+//         size_t len: length of the mapping
+// outputs: int: 0 on success, or negative error code
+// description:
+//     removes a whole mapping. its pages are written back when the page cache lets
+//     go of them (at the latest when the file is closed).
+//==============================================================================================
+
+static int sysmunmap(void * addr, size_t len) {
+    return mmap_unmap(&current_process()->mmaps,addr,len);
+}
+
 //==============================================================================================
 // int sysiodup(int oldfd, int newfd)
 // inputs: int oldfd: old file descriptor to duplicate
-//         int newfd: new file descriptor to assign
-// outputs: int 0 on success, or -EBADFD on invalid file descriptors
+//         int newfd: new file descriptor to assign, or -1 for the lowest free one
+// outputs: int newfd on success, or negative error code
 // description:
 //     duplicates a file descriptor by making newfd refer to the same struct io as oldfd.
+//     like dup2, an open newfd is closed first. newfd starts without FD_CLOEXEC.
 //     increments refcnt on the io structure.
 //==============================================================================================
 static int sysiodup(int oldfd, int newfd) {
     struct process *proc = current_process();
-    if(oldfd < 0|| oldfd >= PROCESS_IOMAX){
+    struct io *io = fdtab_get(&proc->fds, oldfd);
+    struct io *oldio;
+    int result;
+    if(io == NULL || newfd >= PROCESS_IOMAX){
         return -EBADFD;
     }
-    if(newfd < 0 || newfd >= PROCESS_IOMAX){
+    if(newfd == oldfd){
+        return newfd;
+    }
+    oldio = fdtab_remove(&proc->fds, newfd);
+    result = fdtab_install(&proc->fds, newfd, ioaddref(io), 0);
+    if(result < 0){
+        ioclose(io);
+    }
+    if(oldio != NULL){
+        ioclose(oldio);
+    }
+    return result;
+}
+
+//==============================================================================================
+// int sysfutexwait(const int * uaddr, int expected)
+// inputs: const int * uaddr: user address of the futex word
+//         int expected: value the word must still hold for the thread to sleep
+// outputs: int 0 once woken, -EAGAIN if the word changed, -EINVAL on bad address
+// description:
+//     blocks the calling thread until futex_wake on the same word.
+//==============================================================================================
+static int sysfutexwait(const int * uaddr, int expected) {
+    return futex_wait(uaddr, expected);
+}
+
+//==============================================================================================
+// int sysfutexwake(const int * uaddr, int cnt)
+// inputs: const int * uaddr: user address of the futex word
+//         int cnt: maximum number of threads to wake
+// outputs: int number of threads woken, or -EINVAL on bad address
+// description:
+//     wakes threads blocked in futex_wait on the same word.
+//==============================================================================================
+static int sysfutexwake(const int * uaddr, int cnt) {
+    return futex_wake(uaddr, cnt);
+}
+
+//==============================================================================================
+// long sysreadv(int fd, const struct iovec * uiov, int iovcnt)
+// inputs: int fd: file descriptor
+//         const struct iovec * uiov: user array of segments to fill
+//         int iovcnt: number of segments (at most IOV_MAX)
+// outputs: long: number of bytes read, or negative error code
+// description:
+//     reads into several buffers with one system call.
+//==============================================================================================
+static long sysreadv(int fd, const struct iovec * uiov, int iovcnt) {
+    struct process *proc=current_process();
+    struct iovec iov[IOV_MAX];
+    int result;
+    if(fdtab_get(&proc->fds,fd)==NULL){
         return -EBADFD;
     }
-    if(proc->iotab[oldfd] == NULL){
+    result=copy_iovec(iov,uiov,iovcnt);
+    if(result<0){
+        return result;
+    }
+    iovcnt=nonblock_iov(fd,IOCTL_GETRDAVAIL,iov,iovcnt);
+    if(iovcnt<0){
+        return iovcnt;
+    }
+    return ioreadv(fdtab_get(&proc->fds,fd),iov,iovcnt);
+}
+
+//==============================================================================================
+// long syswritev(int fd, const struct iovec * uiov, int iovcnt)
+// inputs: int fd: file descriptor
+//         const struct iovec * uiov: user array of segments to write
+//         int iovcnt: number of segments (at most IOV_MAX)
+// outputs: long: number of bytes written, or negative error code
+// description:
+//     writes several buffers with one system call.
+//==============================================================================================
+static long syswritev(int fd, const struct iovec * uiov, int iovcnt) {
+    struct process *proc=current_process();
+    struct iovec iov[IOV_MAX];
+    int result;
+    if(fdtab_get(&proc->fds,fd)==NULL){
         return -EBADFD;
     }
-    if(proc->iotab[newfd] != NULL){
-        return -EBADFD;  
+    result=copy_iovec(iov,uiov,iovcnt);
+    if(result<0){
+        return result;
     }
-    proc->iotab[newfd] = proc->iotab[oldfd];
-    proc->iotab[newfd]->refcnt++;
+    iovcnt=nonblock_iov(fd,IOCTL_GETWRAVAIL,iov,iovcnt);
+    if(iovcnt<0){
+        return iovcnt;
+    }
+    return iowritev(fdtab_get(&proc->fds,fd),iov,iovcnt);
+}
 
+//==============================================================================================
+// long syspreadv(int fd, const struct iovec * uiov, int iovcnt, unsigned long long pos)
+// inputs: int fd: file descriptor
+//         const struct iovec * uiov: user array of segments to fill
+//         int iovcnt: number of segments (at most IOV_MAX)
+//         unsigned long long pos: position to read from
+// outputs: long: number of bytes read, or negative error code
+// description:
+//     like sysreadv, but at the given position; the fd position is not changed.
+//==============================================================================================
+static long syspreadv(int fd, const struct iovec * uiov, int iovcnt, unsigned long long pos) {
+    struct process *proc=current_process();
+    struct iovec iov[IOV_MAX];
+    int result;
+    if(fdtab_get(&proc->fds,fd)==NULL){
+        return -EBADFD;
+    }
+    result=copy_iovec(iov,uiov,iovcnt);
+    if(result<0){
+        return result;
+    }
+    return iopreadv(fdtab_get(&proc->fds,fd),pos,iov,iovcnt);
+}
+
+//==============================================================================================
+// long syspwritev(int fd, const struct iovec * uiov, int iovcnt, unsigned long long pos)
+// inputs: int fd: file descriptor
+//         const struct iovec * uiov: user array of segments to write
+//         int iovcnt: number of segments (at most IOV_MAX)
+//         unsigned long long pos: position to write at
+// outputs: long: number of bytes written, or negative error code
+// description:
+//     like syswritev, but at the given position; the fd position is not changed.
+//==============================================================================================
+static long syspwritev(int fd, const struct iovec * uiov, int iovcnt, unsigned long long pos) {
+    struct process *proc=current_process();
+    struct iovec iov[IOV_MAX];
+    int result;
+    if(fdtab_get(&proc->fds,fd)==NULL){
+        return -EBADFD;
+    }
+    result=copy_iovec(iov,uiov,iovcnt);
+    if(result<0){
+        return result;
+    }
+    return iopwritev(fdtab_get(&proc->fds,fd),pos,iov,iovcnt);
+}
+
+//==============================================================================================
+// int copy_iovec(struct iovec * iov, const struct iovec * uiov, int iovcnt)
+// inputs: struct iovec * iov: kernel array of IOV_MAX entries
+//         const struct iovec * uiov: user array
+//         int iovcnt: number of segments
+// outputs: int: 0 on success, -EINVAL on a bad count or array
+// description:
+//     copies the segment array into the kernel so the user cannot change it
+//     while the request is in progress.
+//==============================================================================================
+static int copy_iovec(struct iovec * iov, const struct iovec * uiov, int iovcnt) {
+    if(iovcnt<0||iovcnt>IOV_MAX){
+        return -EINVAL;
+    }
+    if(iovcnt>0&&uiov==NULL){
+        return -EINVAL;
+    }
+    memcpy(iov,uiov,iovcnt*sizeof(struct iovec));
     return 0;
 }
+
+//==============================================================================================
+// long sysioringsetup(void)
+// inputs: none
+// outputs: long: user address of the ring, -EBUSY if already set up, -ENOMEM
+// description:
+//     allocates the submission/completion ring page and maps it at IORING_VMA
+//     in the calling process. The ring goes away with the address space (exec
+//     or exit); a forked child gets its own copy.
+//==============================================================================================
+static long sysioringsetup(void) {
+    struct ioring *ring;
+    if(user_to_phys((void *)IORING_VMA, 0)!=NULL){
+        return -EBUSY;
+    }
+    ring=alloc_phys_page();
+    if(ring==NULL){
+        return -ENOMEM;
+    }
+    memset(ring,0,PAGE_SIZE);
+    ring->entries=IORING_ENTRIES;
+    map_page(IORING_VMA,ring,PTE_R|PTE_W|PTE_U);
+    return IORING_VMA;
+}
+
+//==============================================================================================
+// int sysioringenter(unsigned int to_submit)
+// inputs: unsigned int to_submit: maximum number of submissions to run
+// outputs: int: number of submissions consumed, or -EINVAL if there is no ring
+// description:
+//     runs up to to_submit queued operations in order, posting a completion
+//     for each. stops early when the submission queue is empty or the
+//     completion queue is full. each entry is copied out of shared memory
+//     before it is looked at, so the process cannot change it underneath us.
+//==============================================================================================
+static int sysioringenter(unsigned int to_submit) {
+    struct ioring *ring;
+    struct ioring_sqe sqe;
+    struct ioring_cqe *cqe;
+    uint32_t sq_head, sq_tail, cq_tail;
+    int done=0;
+
+    ring=user_to_phys((void *)IORING_VMA, PTE_R|PTE_W|PTE_U);
+    if(ring==NULL){
+        return -EINVAL;
+    }
+
+    sq_head=ring->sq_head;
+    cq_tail=ring->cq_tail;
+    __sync_synchronize(); // see user's SQEs before reading them
+
+    while(done<to_submit){
+        sq_tail=ring->sq_tail;
+        if(sq_head==sq_tail){
+            break;
+        }
+        // completion queue full
+        if(cq_tail-ring->cq_head>=IORING_ENTRIES){
+            break;
+        }
+        __sync_synchronize();
+        memcpy(&sqe,&ring->sq[sq_head%IORING_ENTRIES],sizeof(sqe));
+        sq_head++;
+
+        cqe=&ring->cq[cq_tail%IORING_ENTRIES];
+        cqe->user_data=sqe.user_data;
+        cqe->res=ioring_dispatch(&sqe);
+        cq_tail++;
+        done++;
+
+        // publish as we go, so a blocking read late in the batch does not
+        // hold back completions the process could already use
+        __sync_synchronize();
+        ring->sq_head=sq_head;
+        ring->cq_tail=cq_tail;
+    }
+
+    return done;
+}
+
+//==============================================================================================
+// int64_t ioring_dispatch(const struct ioring_sqe * sqe)
+// inputs: const struct ioring_sqe * sqe: kernel copy of a submission
+// outputs: int64_t: result for the completion entry
+// description:
+//     runs one ring operation through the same code as the matching system call.
+//==============================================================================================
+static int64_t ioring_dispatch(const struct ioring_sqe * sqe) {
+    switch(sqe->op){
+        case IORING_OP_NOP:
+            return 0;
+        case IORING_OP_READ:
+            return sysread(sqe->fd,(void *)sqe->addr,(size_t)sqe->len);
+        case IORING_OP_WRITE:
+            return syswrite(sqe->fd,(const void *)sqe->addr,(size_t)sqe->len);
+        case IORING_OP_OPEN:
+            return sysfsopen(sqe->fd,(const char *)sqe->addr);
+        case IORING_OP_CLOSE:
+            return sysclose(sqe->fd);
+        default:
+            return -ENOTSUP;
+    }
+}
+
+//==============================================================================================
+// int sysspawn(int fd, int argc, char ** argv, const int * fd_map, int mapcnt)
+// inputs: int fd: file descriptor of the executable (stays open in the caller)
+//         int argc: number of arguments
+//         char ** argv: argument strings
+//         const int * fd_map: mapcnt entries; entry i is the caller's fd to
+//                             install as fd i of the new process, or -1.
+//                             NULL gives the new process all of the caller's
+//                             fds that are not FD_CLOEXEC.
+//         int mapcnt: number of entries in fd_map (at most PROCESS_IOMAX)
+// outputs: int: thread id of the new process (for _wait), or negative error code
+// description:
+//     starts a program in a new process without fork + exec.
+//==============================================================================================
+static int sysspawn(int fd, int argc, char ** argv, const int * fd_map, int mapcnt) {
+    struct process *proc=current_process();
+    struct io *exeio=fdtab_get(&proc->fds,fd);
+    struct fdtab fds;
+    struct io *io;
+    int result;
+    if(exeio==NULL){
+        return -EBADFD;
+    }
+    if(fd_map==NULL){
+        result=fdtab_copy(&fds,&proc->fds,FD_CLOEXEC);
+        if(result<0){
+            return result;
+        }
+        return process_spawn(exeio,argc,argv,&fds);
+    }
+    if(mapcnt<0||mapcnt>PROCESS_IOMAX){
+        return -EINVAL;
+    }
+    memset(&fds,0,sizeof(struct fdtab));
+    for(int i=0;i<mapcnt;i++){
+        if(fd_map[i]<0){
+            continue;
+        }
+        io=fdtab_get(&proc->fds,fd_map[i]);
+        result=(io==NULL)?-EBADFD:fdtab_install(&fds,i,ioaddref(io),0);
+        if(result<0){
+            if(io!=NULL){
+                ioclose(io);
+            }
+            fdtab_close(&fds,0);
+            return result;
+        }
+    }
+    return process_spawn(exeio,argc,argv,&fds);
+}
+
+//==============================================================================================
+// int sysfdctl(int fd, int cmd, int arg)
+// inputs: int fd: file descriptor
+//         int cmd: FDCTL_GETFL or FDCTL_SETFL
+//         int arg: new flags for FDCTL_SETFL (FD_CLOEXEC, FD_NONBLOCK or 0)
+// outputs: int: flags for FDCTL_GETFL, 0 for FDCTL_SETFL, or negative error code
+// description:
+//     reads or changes the flags of a file descriptor.
+//==============================================================================================
+static int sysfdctl(int fd, int cmd, int arg) {
+    struct process *proc=current_process();
+    switch(cmd){
+        case FDCTL_GETFL:
+            return fdtab_getflags(&proc->fds,fd);
+        case FDCTL_SETFL:
+            if((arg&~(FD_CLOEXEC|FD_NONBLOCK))!=0){
+                return -EINVAL;
+            }
+            return fdtab_setflags(&proc->fds,fd,arg);
+        default:
+            return -EINVAL;
+    }
+}
+
+//==============================================================================================
+// int syspoll(struct pollfd * fds, int nfds, long timeout)
+// inputs: struct pollfd * fds: user array of descriptors and the events to wait for
+//         int nfds: number of entries (at most PROCESS_IOMAX)
+//         long timeout: milliseconds to wait, -1 for no limit, 0 to only check
+// outputs: int: number of entries with events, 0 on timeout, or negative error code
+// description:
+//     waits until one of several descriptors is readable or writable.
+//==============================================================================================
+static int syspoll(struct pollfd * fds, int nfds, long timeout) {
+    struct process *proc=current_process();
+    return fdpoll(&proc->fds,fds,nfds,timeout);
+}
+
+//==============================================================================================
+// long nonblock_len(int fd, int cmd, long len)
+// inputs: int fd: open file descriptor
+//         int cmd: IOCTL_GETRDAVAIL or IOCTL_GETWRAVAIL
+//         long len: length of the transfer
+// outputs: long: length to transfer, or -EAGAIN
+// description:
+//     for an FD_NONBLOCK descriptor, limits len to what the object can transfer without
+//     blocking and returns -EAGAIN if that is nothing. objects that do not report it
+//     (files, block devices) never block, so len is left alone for them.
+//==============================================================================================
+static long nonblock_len(int fd, int cmd, long len) {
+    struct process *proc=current_process();
+    long avail;
+    if((fdtab_getflags(&proc->fds,fd)&FD_NONBLOCK)==0||len==0){
+        return len;
+    }
+    if(ioctl(fdtab_get(&proc->fds,fd),cmd,&avail)!=0){
+        return len;
+    }
+    if(avail==0){
+        return -EAGAIN;
+    }
+    return (avail<len)?avail:len;
+}
+
+//==============================================================================================
+// int nonblock_iov(int fd, int cmd, struct iovec * iov, int iovcnt)
+// inputs: int fd: open file descriptor
+//         int cmd: IOCTL_GETRDAVAIL or IOCTL_GETWRAVAIL
+//         struct iovec * iov: kernel copy of the segments, shortened in place
+//         int iovcnt: number of segments
+// outputs: int: number of segments left, or negative error code
+// description:
+//     nonblock_len for a vectored transfer.
+//==============================================================================================
+static int nonblock_iov(int fd, int cmd, struct iovec * iov, int iovcnt) {
+    long total=0;
+    long len;
+    int i;
+    for(i=0;i<iovcnt;i++){
+        if(LONG_MAX-total<iov[i].len){
+            return -EINVAL;
+        }
+        total+=iov[i].len;
+    }
+    len=nonblock_len(fd,cmd,total);
+    if(len<0){
+        return len;
+    }
+    for(i=0;i<iovcnt&&len>0;i++){
+        if(len<iov[i].len){
+            iov[i].len=len;
+        }
+        len-=iov[i].len;
+    }
+    return (total==0)?iovcnt:i;
+}
@@ -25,6 +25,8 @@
 #include "memory.h"
 #include "error.h"
 #include "process.h"
+#include "timer.h"
+#include "smp.h"
 
 #include <stdarg.h>
 
@@ -85,6 +87,20 @@ struct thread
     struct condition child_exit;
     struct lock *lock_list;
     struct process *proc;
+    int hart; // hart the thread is running on or last ran on
+};
+
+// Per-hart scheduler state. Each hart takes threads from its own ready list
+// and steals from the other harts' lists when its own is empty. The idle
+// thread of a hart is never on a ready list; it runs when nothing else can.
+// Ready lists are protected by the kernel lock (see smp.h) and, since ISRs
+// add threads to them, by disabling interrupts on the local hart.
+
+struct hart
+{
+    struct thread_list ready_list;
+    struct thread *idle_thread;
+    char idling; // idle thread is waiting in wfi
 };
 
 // INTERNAL MACRO DEFINITIONS
@@ -167,6 +183,20 @@ static void tlappend(struct thread_list *l0, struct thread_list *l1);
 
 static void idle_thread_func(void);
 
+// Returns the next thread to run on _hart_: the head of its own ready list, or
+// else a thread stolen from another hart, or else the hart's idle thread.
+
+static struct thread *next_runnable_thread(struct hart *hart);
+
+// Returns 1 if any hart has a thread on its ready list.
+
+static int runnable_thread_exists(void);
+
+// Called after making a thread ready on a busy hart. If another hart is idle,
+// kicks it out of wfi so it can steal the thread.
+
+static void wake_idle_hart(void);
+
 // IMPORTED FUNCTION DECLARATIONS
 // defined in thrasm.s
 //
@@ -215,9 +245,8 @@ static struct thread *thrtab[NTHR] = {
     [MAIN_TID] = &main_thread,
     [IDLE_TID] = &idle_thread};
 
-static struct thread_list ready_list = {
-    .head = &idle_thread,
-    .tail = &idle_thread};
+static struct hart harts[NHART] = {
+    [0] = {.idle_thread = &idle_thread}};
 
 void lock_init(struct lock *lock)
 {
@@ -300,6 +329,11 @@ int running_thread(void)
     return TP->id;
 }
 
+int running_hart(void)
+{
+    return TP->hart;
+}
+
 void thrmgr_init(void)
 {
     trace("%s()", __func__);
@@ -334,7 +368,9 @@ int thread_spawn(
     set_thread_state(child, THREAD_READY);
 
     pie = disable_interrupts();
-    tlinsert(&ready_list, child);
+    child->hart = TP->hart;
+    tlinsert(&harts[TP->hart].ready_list, child);
+    wake_idle_hart();
     restore_interrupts(pie);
 
     // FIXME your code goes here
@@ -498,9 +534,10 @@ void condition_broadcast(struct condition *cond)
         curr = curr->list_next;
     }
 
-    // then append the wait list to the ready list
+    // then append the wait list to the ready list of this hart
     pie = disable_interrupts();
-    tlappend(&ready_list, &cond->wait_list);
+    tlappend(&harts[TP->hart].ready_list, &cond->wait_list);
+    wake_idle_hart();
     restore_interrupts(pie);
 }
 
@@ -544,6 +581,48 @@ void init_idle_thread(void)
     idle_thread.stack_anchor->ktp = &idle_thread;
 }
 
+// void *thread_hart_init(int hartid)
+// Inputs: int hartid - secondary hart to create an idle thread for
+// Outputs: void * - stack anchor of the new idle thread (boot stack of the hart)
+// Description: Creates the idle thread of a secondary hart. The thread is not
+//              placed on any ready list; the hart starts out running it.
+// Side Effects: allocates a thread slot and a stack page
+void *thread_hart_init(int hartid)
+{
+    struct thread *thr;
+
+    assert(0 < hartid && hartid < NHART);
+
+    thr = create_thread("idle");
+    assert(thr != NULL);
+
+    thr->parent = NULL; // not anyone's child, so never joined
+    thr->hart = hartid;
+    set_thread_state(thr, THREAD_READY);
+    harts[hartid].idle_thread = thr;
+    return thr->stack_anchor;
+}
+
+// void thread_hart_attach(int hartid)
+// Inputs: int hartid - id of the calling hart
+// Outputs: none
+// Description: Makes the idle thread of the calling hart the running thread.
+//              Called by a secondary hart while it is still on its boot path.
+// Side Effects: sets tp
+void thread_hart_attach(int hartid)
+{
+    struct thread *const thr = harts[hartid].idle_thread;
+
+    thr->state = THREAD_RUNNING;
+    set_running_thread(thr);
+}
+
+void thread_hart_idle(void)
+{
+    idle_thread_func();
+    halt_failure(); // idle_thread_func does not return
+}
+
 static void set_running_thread(struct thread *thr)
 {
     asm inline("mv tp, %0" ::"r"(thr) : "tp");
@@ -635,22 +714,47 @@ void running_thread_suspend(void)
 {
     int pie;
 
+    struct hart *const hart = &harts[TP->hart];
+
     pie = disable_interrupts();
-    // insert in the back only if the current thread is running
+    // insert in the back only if the current thread is running (the idle
+    // thread is never on a ready list)
     if (TP->state == THREAD_RUNNING)
     {
         TP->state = THREAD_READY;
-        tlinsert(&ready_list, TP);
+        if (TP != hart->idle_thread)
+            tlinsert(&hart->ready_list, TP);
+    }
+
+    struct thread *next = next_runnable_thread(hart);
+
+    // nothing else to run (only happens when the idle thread yields)
+    if (next == TP)
+    {
+        TP->state = THREAD_RUNNING;
+        restore_interrupts(pie);
+        return;
     }
 
-    struct thread *next = tlremove(&ready_list);
+    next->hart = TP->hart;
+
+    // The idle thread sleeps until the next real event, so it runs without a
+    // time slice; every other thread gets a fresh quantum.
+    if (next == hart->idle_thread)
+        timer_disarm_quantum();
+    else
+        timer_arm_quantum();
     restore_interrupts(pie);
 
     // switch to the next thread
     next->state = THREAD_RUNNING;
-    //switch also the memory space
-    if(next->id != IDLE_TID && next->proc != NULL){
+    //switch also the memory space. A hart running a kernel thread goes back
+    //to the main space so it never keeps a (possibly freed) page table of a
+    //process that has since moved to another hart
+    if(next->proc != NULL){
         switch_mspace(next->proc->mtag);
+    }else if(TP->proc != NULL){
+        switch_mspace(main_mspace());
     }
     struct thread *temp = _thread_swtch(next);
 
@@ -751,26 +855,92 @@ void tlappend(struct thread_list *l0, struct thread_list *l1)
 
 void idle_thread_func(void)
 {
-    // The idle thread sleeps using wfi if the ready list is empty. Note that we
-    // need to disable interrupts before checking if the thread list is empty to
-    // avoid a race condition where an ISR marks a thread ready to run between
-    // the call to tlempty() and the wfi instruction.
+    struct hart *const hart = &harts[TP->hart]; // idle threads never migrate
+
+    // The idle thread sleeps using wfi if the ready lists are empty. Note that
+    // we need to disable interrupts before checking if the thread lists are
+    // empty to avoid a race condition where an ISR marks a thread ready to run
+    // between the call to tlempty() and the wfi instruction.
 
     for (;;)
     {
-        // If there are runnable threads, yield to them.
+        // If there are runnable threads on any hart, yield to (or steal) them.
 
-        while (!tlempty(&ready_list))
+        while (runnable_thread_exists())
             thread_yield();
 
         // No runnable threads. Sleep using the wfi instruction. Note that we
         // need to disable interrupts and check the runnable thread list one
         // more time (make sure it is empty) to avoid a race condition where an
-        // ISR marks a thread ready before we call the wfi instruction.
+        // ISR marks a thread ready before we call the wfi instruction. wfi
+        // still wakes on any interrupt enabled in sie, which is taken as soon
+        // as we re-enable interrupts below. The timer is only armed when an
+        // alarm is pending, so the hart stays asleep until a real event.
+
+        // The kernel lock is released while we wait so other harts can run
+        // kernel code; a hart making a thread ready kicks us out of wfi.
 
         disable_interrupts();
-        if (tlempty(&ready_list))
+        if (!runnable_thread_exists())
+        {
+            hart->idling = 1;
+            kernel_unlock();
             asm("wfi");
+            kernel_lock();
+            hart->idling = 0;
+        }
         enable_interrupts();
     }
+}
+
+struct thread *next_runnable_thread(struct hart *hart)
+{
+    struct thread *thr;
+    int i;
+
+    thr = tlremove(&hart->ready_list);
+    if (thr != NULL)
+        return thr;
+
+    // Own list is empty: steal the thread that has waited longest on the
+    // first other hart that has one.
+
+    for (i = 1; i < NHART; i++)
+    {
+        thr = tlremove(&harts[(hart - harts + i) % NHART].ready_list);
+        if (thr != NULL)
+            return thr;
+    }
+
+    return hart->idle_thread;
+}
+
+int runnable_thread_exists(void)
+{
+    int i;
+
+    for (i = 0; i < NHART; i++)
+        if (!tlempty(&harts[i].ready_list))
+            return 1;
+
+    return 0;
+}
+
+void wake_idle_hart(void)
+{
+    int i;
+
+    // An idle hart that makes a thread ready (from an ISR) runs it itself.
+    if (TP == harts[TP->hart].idle_thread)
+        return;
+
+    for (i = 0; i < NHART; i++)
+    {
+        if (harts[i].idling)
+        {
+            harts[i].idling = 0;
+            timer_kick_hart(i);
+            return;
+        }
+    }
 }
\ No newline at end of file
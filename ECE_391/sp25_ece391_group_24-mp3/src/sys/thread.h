@@ -40,6 +40,21 @@ extern void thrmgr_init(void);
 
 extern int running_thread(void);
 
+//  int running_hart(void)
+//  Returns the hart id of the hart executing the caller.
+
+extern int running_hart(void);
+
+//  Per-hart scheduler bring-up, used by smp.c. thread_hart_init() creates the
+//  idle thread of a secondary hart and returns the anchor of its stack, which
+//  the hart uses as its boot stack. thread_hart_attach() is then called on the
+//  secondary hart to make that idle thread the running thread, and
+//  thread_hart_idle() runs the idle loop of the hart (it does not return).
+
+extern void *thread_hart_init(int hartid);
+extern void thread_hart_attach(int hartid);
+extern void __attribute__((noreturn)) thread_hart_idle(void);
+
 //  int thread_spawn(const char * name, void (*start)(void *), ...)
 //  
 //  Creates and starts a new thread. Argument _name_ is the name of the thread
@@ -28,11 +28,28 @@ char timer_initialized = 0;
 // INTERNVAL GLOBAL VARIABLE DEFINITIONS
 //
 
-static struct alarm * sleep_list;
+// Each hart has its own mtimecmp, so each hart keeps its own sleep list and
+// time slice and only ever programs its own timer. An alarm is woken by the
+// hart that put it to sleep.
+
+struct hart_timer {
+    struct alarm * sleep_list;
+    unsigned long long quantum_deadline; // running thread's (UINT64_MAX if none)
+    unsigned long long stcmp_programmed; // last value written to stcmp
+};
+
+static struct hart_timer hart_timers[NHART];
 
 // INTERNAL FUNCTION DECLARATIONS
 //
 
+// Programs stcmp for the earlier of the first alarm on the sleep list and the
+// quantum deadline. If there is neither, the timer interrupt is disabled so
+// an idle hart stays in wfi until a device interrupt arrives. Must be called
+// with interrupts disabled.
+
+static void timer_reprogram(struct hart_timer * ht);
+
 // EXPORTED FUNCTION DEFINITIONS
 //
 extern void enable_timer_interrupt(void){
@@ -44,11 +61,61 @@ extern void disable_timer_interrupt(void){
 }
 
 
+// Called once on each hart, after the thread manager is initialized.
+
 void timer_init(void) {
+    struct hart_timer * const ht = &hart_timers[running_hart()];
+
+    ht->sleep_list = NULL;
+    ht->quantum_deadline = UINT64_MAX;
+    ht->stcmp_programmed = UINT64_MAX;
     set_stcmp(UINT64_MAX);
     timer_initialized = 1;
 }
 
+// Starts a fresh time slice for the thread about to run. Called by the
+// scheduler on every switch to a thread other than the idle thread.
+
+void timer_arm_quantum(void) {
+    int pie;
+
+    struct hart_timer * ht;
+
+    pie = disable_interrupts();
+    ht = &hart_timers[running_hart()];
+    ht->quantum_deadline = rdtime() + QUANTUM_US * (TIMER_FREQ / 1000 / 1000);
+    timer_reprogram(ht);
+    restore_interrupts(pie);
+}
+
+// Cancels the time slice. Called when switching to the idle thread, which
+// needs no preemption: only alarms keep the timer armed while idle.
+
+void timer_disarm_quantum(void) {
+    int pie;
+
+    struct hart_timer * ht;
+
+    pie = disable_interrupts();
+    ht = &hart_timers[running_hart()];
+    if (ht->quantum_deadline != UINT64_MAX) {
+        ht->quantum_deadline = UINT64_MAX;
+        timer_reprogram(ht);
+    }
+    restore_interrupts(pie);
+}
+
+// Forces a timer interrupt on another hart by writing its mtimecmp, which is
+// mapped for S mode, directly. The M mode handler on the target hart runs even
+// if the hart is in wfi with STIE masked, so this wakes an idle hart without an
+// IPI service. The target reprograms its own timer the next time it arms it.
+// The caller must hold the kernel lock.
+
+void timer_kick_hart(int hartid) {
+    hart_timers[hartid].stcmp_programmed = 0; // force a rewrite
+    *(volatile uint64_t *)CLINT_MTIMECMP(hartid) = 0;
+}
+
 
 
 //============================
@@ -126,30 +193,22 @@ void alarm_sleep(struct alarm * al, unsigned long long tcnt) {
         return;
 
     // FIXME your code goes here
-    disable_timer_interrupt();//disable timer interrupt while changing the sleep list
-    if(sleep_list == NULL){ //if nothing on the list, new alarm becomes the head
-        sleep_list = al;
-        al->next = NULL;
-        set_stcmp(sleep_list->twake);//set mtimecmp since we are earliest to be wake up
+    pie = disable_interrupts(); //keep the timer ISR off the list while we insert
+    struct hart_timer * const ht = &hart_timers[running_hart()];
+    if(ht->sleep_list == NULL || ht->sleep_list->twake > al->twake){ //new alarm becomes the head
+        al->next = ht->sleep_list;
+        ht->sleep_list = al;
+        timer_reprogram(ht); //we are earliest to be woken up
     }else{
-        if(sleep_list->twake>al->twake){//if our wake up time is sooner than the first element of the list
-            al->next = sleep_list;
-            sleep_list = al;
-            set_stcmp(sleep_list->twake);//set mtimecmp since we are earliest to be wake up 
-        }else{
-            struct alarm *list = sleep_list;
-            while(list->next != NULL &&list->next->twake <=al->twake) { //find the correct spot in the list
-                
-                list = list->next;
-            }
-            al->next = list->next;
-            list->next = al;
-
+        struct alarm *list = ht->sleep_list;
+        while(list->next != NULL &&list->next->twake <=al->twake) { //find the correct spot in the list
+            
+            list = list->next;
         }
+        al->next = list->next;
+        list->next = al;
     }
-    pie = disable_interrupts(); //disable interrupts before condition wait
-    enable_timer_interrupt(); //enable timer interrupts
-    condition_wait(&al->cond);
+    condition_wait(&al->cond); //interrupts stay disabled so the wakeup cannot be lost
     restore_interrupts(pie);
     
 
@@ -162,6 +221,31 @@ void alarm_reset(struct alarm * al) {
     al->twake = rdtime();
 }
 
+// The thread may have been woken on another hart than the one it went to
+// sleep on, so every hart's list is searched. A hart whose first alarm is
+// removed keeps its old stcmp value and just takes one interrupt for nothing.
+
+void alarm_cancel(struct alarm * al) {
+    struct alarm ** link;
+    int hartid;
+    int pie;
+
+    pie = disable_interrupts();
+    for (hartid = 0; hartid < NHART; hartid++) {
+        link = &hart_timers[hartid].sleep_list;
+        while (*link != NULL && *link != al)
+            link = &(*link)->next;
+        if (*link == al) {
+            *link = al->next;
+            al->next = NULL;
+            if (hartid == running_hart())
+                timer_reprogram(&hart_timers[hartid]);
+            break;
+        }
+    }
+    restore_interrupts(pie);
+}
+
 void alarm_sleep_sec(struct alarm * al, unsigned int sec) {
     alarm_sleep(al, sec * TIMER_FREQ);
 }
@@ -206,16 +290,19 @@ void sleep_us(unsigned long us) {
 //
 //       Side Effects:
 //              -We will delete the woke up alarm from the sleep list
-//              -We will modify mtimecmp to the new sleep list head
+//              -We restart an expired quantum so a thread that keeps running
+//               in S mode is still preempted on its next return to U mode
+//              -We will modify mtimecmp to the earliest remaining deadline
 //              -We broadcast alarms to wake up
 //              -We will disable all interrupt when changing the sleep list
 //
 //       Notes:
-//              -If nothing on the sleep list at the end we disable timer interrupt
+//              -If there is no alarm and no quantum we disable timer interrupt
 // ============================
 
 void handle_timer_interrupt(void) {
-    struct alarm * head = sleep_list;
+    struct hart_timer * const ht = &hart_timers[running_hart()];
+    struct alarm * head = ht->sleep_list;
     struct alarm * next;
     uint64_t now;
 
@@ -231,12 +318,32 @@ void handle_timer_interrupt(void) {
         head = next;
     }
     int pie = disable_interrupts();
-    sleep_list = head;
+    ht->sleep_list = head;
+    if(ht->quantum_deadline <= now) //slice used up; the U mode return path yields
+        ht->quantum_deadline = now + QUANTUM_US * (TIMER_FREQ / 1000 / 1000);
+    // stcmp has fired, so it must be rewritten even if the value is unchanged
+    ht->stcmp_programmed = 0;
+    timer_reprogram(ht);
     restore_interrupts(pie);
-    if(sleep_list != NULL){
-        set_stcmp(sleep_list->twake);
-    }else{
-        set_stcmp(UINT64_MAX);
-        disable_timer_interrupt();
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+void timer_reprogram(struct hart_timer * ht) {
+    unsigned long long next;
+
+    next = ht->quantum_deadline;
+    if (ht->sleep_list != NULL && ht->sleep_list->twake < next)
+        next = ht->sleep_list->twake;
+
+    if (next != ht->stcmp_programmed) {
+        set_stcmp(next);
+        ht->stcmp_programmed = next;
     }
+
+    if (next != UINT64_MAX)
+        enable_timer_interrupt();
+    else
+        disable_timer_interrupt();
 }
\ No newline at end of file
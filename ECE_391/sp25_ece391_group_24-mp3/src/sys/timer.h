@@ -40,6 +40,12 @@ extern void alarm_sleep(struct alarm * al, unsigned long long tcnt);
 
 extern void alarm_reset(struct alarm * al);
 
+// Takes a sleeping alarm off the sleep list of whichever hart it is on, for a
+// thread that was woken through the alarm's condition by someone other than
+// the timer. Does nothing if the alarm has already gone off.
+
+extern void alarm_cancel(struct alarm * al);
+
 extern void alarm_sleep_sec(struct alarm * al, unsigned int sec);
 extern void alarm_sleep_ms(struct alarm * al, unsigned long ms);
 extern void alarm_sleep_us(struct alarm * al, unsigned long us);
@@ -53,4 +59,15 @@ extern void handle_timer_interrupt(void); // called from trap.s
 extern void enable_timer_interrupt(void);
 extern void disable_timer_interrupt(void);
 
+// Starts (or cancels) the preemption time slice of the thread being switched
+// to. The timer is programmed only for the earliest of the quantum deadline and
+// the first pending alarm, so an idle hart takes no timer interrupts at all.
+
+extern void timer_arm_quantum(void);
+extern void timer_disarm_quantum(void);
+
+// Wakes another hart that may be idle in wfi (see timer.c).
+
+extern void timer_kick_hart(int hartid);
+
 #endif // _TIMER_H_
\ No newline at end of file
@@ -0,0 +1,569 @@
+// tmpfs.c - Memory-backed file system
+//
+// Copyright (c) 2024-2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+#ifdef TMPFS_TRACE
+#define TRACE
+#endif
+
+#ifdef TMPFS_DEBUG
+#define DEBUG
+#endif
+
+#include "tmpfs.h"
+#include "fs.h"
+#include "conf.h"
+#include "io.h"
+#include "ioimpl.h"
+#include "heap.h"
+#include "memory.h"
+#include "thread.h"
+#include "string.h"
+#include "console.h"
+#include "error.h"
+#include "elf.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// INTERNAL MACRO DEFINITIONS
+//
+
+#define TMPFS_NAME_MAX 31
+
+// A file's pages are found through a page directory: a page of pointers to
+// page tables, each a page of pointers to data pages. A missing table or page
+// reads as zeros.
+
+#define TMPFS_NPTRS (PAGE_SIZE / sizeof(void *))
+#define TMPFS_MAX_SIZE ((unsigned long long)TMPFS_NPTRS * TMPFS_NPTRS * PAGE_SIZE)
+#define TMPFS_MAX_PAGES (TMPFS_SIZE / PAGE_SIZE)
+
+// INTERNAL TYPE DEFINITIONS
+//
+
+// A file or directory. The directory entry holds one reference and every open
+// file another, so a file deleted while open stays until it is closed.
+
+struct tmpfs_node {
+    struct tmpfs_node * next;       // next entry of the same directory
+    struct tmpfs_node * children;   // entries of a directory
+    char name[TMPFS_NAME_MAX + 1];
+    int dir;
+    unsigned int refcnt;
+    unsigned long long size;
+    void ** pgdir;                  // page directory, NULL until the first page
+};
+
+struct tmpfs {
+    struct filesys filesys;         // mount table entry (see fsattach)
+    struct lock lock;
+    struct tmpfs_node root;
+    unsigned long npages;           // data pages of all files
+};
+
+struct tmpfs_file {
+    struct io io;
+    struct tmpfs * fs;
+    struct tmpfs_node * node;
+};
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static int tmpfs_open(struct filesys * fsys, const char * name, struct io ** ioptr);
+static int tmpfs_create(struct filesys * fsys, const char * name);
+static int tmpfs_delete(struct filesys * fsys, const char * name);
+static int tmpfs_mkdir(struct filesys * fsys, const char * path);
+static int tmpfs_flush(struct filesys * fsys);
+
+static int tmpfs_close(struct io * io);
+static int tmpfs_cntl(struct io * io, int cmd, void * arg);
+static long tmpfs_readat(struct io * io, unsigned long long pos, void * buf, long len);
+
+static long tmpfs_writeat (
+    struct io * io, unsigned long long pos, const void * buf, long len);
+
+static int tmpfs_make(struct tmpfs * fs, const char * path, int dir);
+
+static struct tmpfs_node * tmpfs_resolve (
+    struct tmpfs * fs, const char * path, char * leaf);
+
+static struct tmpfs_node ** tmpfs_find(struct tmpfs_node * dir, const char * name);
+static void * tmpfs_page(struct tmpfs * fs, struct tmpfs_node * node, unsigned long pgno, int alloc);
+static void tmpfs_truncate(struct tmpfs * fs, struct tmpfs_node * node, unsigned long long size);
+static void tmpfs_put_node(struct tmpfs * fs, struct tmpfs_node * node);
+
+// INTERNAL GLOBAL VARIABLES
+//
+
+static const struct fsintf tmpfs_fsintf = {
+    .open = &tmpfs_open,
+    .create = &tmpfs_create,
+    .delete = &tmpfs_delete,
+    .mkdir = &tmpfs_mkdir,
+    .flush = &tmpfs_flush
+};
+
+static const struct iointf tmpfs_iointf = {
+    .close = &tmpfs_close,
+    .cntl = &tmpfs_cntl,
+    .readat = &tmpfs_readat,
+    .writeat = &tmpfs_writeat
+};
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+int tmpfs_mount(const char * path) {
+    struct tmpfs * fs;
+    int result;
+
+    trace("%s(%s)", __func__, path);
+
+    fs = kcalloc(1, sizeof(struct tmpfs));
+    if (fs == NULL)
+        return -ENOMEM;
+
+    fs->filesys.intf = &tmpfs_fsintf;
+    lock_init(&fs->lock);
+    fs->root.dir = 1;
+    fs->root.refcnt = 1;
+
+    result = fsattach(path, &fs->filesys);
+    if (result != 0)
+        kfree(fs);
+    return result;
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+static int tmpfs_open(struct filesys * fsys, const char * name, struct io ** ioptr) {
+    struct tmpfs * const fs = (void*)fsys - offsetof(struct tmpfs, filesys);
+    char leaf[TMPFS_NAME_MAX + 1];
+    struct tmpfs_node ** link;
+    struct tmpfs_node * dir;
+    struct tmpfs_file * file;
+    int result = 0;
+
+    if (name == NULL || ioptr == NULL)
+        return -ENOENT;
+
+    file = kcalloc(1, sizeof(struct tmpfs_file));
+    if (file == NULL)
+        return -ENOMEM;
+
+    lock_acquire(&fs->lock);
+
+    dir = tmpfs_resolve(fs, name, leaf);
+    link = (dir != NULL) ? tmpfs_find(dir, leaf) : NULL;
+
+    if (link == NULL || *link == NULL)
+        result = -ENOENT;
+    else if ((*link)->dir)
+        result = -EINVAL; // directories are not opened as files
+    else {
+        file->fs = fs;
+        file->node = *link;
+        file->node->refcnt += 1;
+    }
+
+    lock_release(&fs->lock);
+
+    if (result != 0) {
+        kfree(file);
+        return result;
+    }
+
+    ioinit0(&file->io, &tmpfs_iointf);
+    *ioptr = create_seekable_io(&file->io);
+    return 0;
+}
+
+static int tmpfs_create(struct filesys * fsys, const char * name) {
+    struct tmpfs * const fs = (void*)fsys - offsetof(struct tmpfs, filesys);
+    return tmpfs_make(fs, name, 0);
+}
+
+static int tmpfs_mkdir(struct filesys * fsys, const char * path) {
+    struct tmpfs * const fs = (void*)fsys - offsetof(struct tmpfs, filesys);
+    return tmpfs_make(fs, path, 1);
+}
+
+static int tmpfs_delete(struct filesys * fsys, const char * name) {
+    struct tmpfs * const fs = (void*)fsys - offsetof(struct tmpfs, filesys);
+    char leaf[TMPFS_NAME_MAX + 1];
+    struct tmpfs_node ** link;
+    struct tmpfs_node * dir;
+    struct tmpfs_node * node;
+    int result = 0;
+
+    if (name == NULL)
+        return -EINVAL;
+
+    lock_acquire(&fs->lock);
+
+    dir = tmpfs_resolve(fs, name, leaf);
+    link = (dir != NULL) ? tmpfs_find(dir, leaf) : NULL;
+
+    if (link == NULL || *link == NULL)
+        result = -EINVAL;
+    else if ((*link)->children != NULL)
+        result = -EBUSY;
+    else {
+        node = *link;
+        *link = node->next;
+        elf_cache_invalidate((uintptr_t)node); // a deleted file is not run again
+        tmpfs_put_node(fs, node);
+    }
+
+    lock_release(&fs->lock);
+    return result;
+}
+
+static int tmpfs_flush(struct filesys * fsys) {
+    return 0; // nothing to write back
+}
+
+static int tmpfs_close(struct io * io) {
+    struct tmpfs_file * const file = (void*)io - offsetof(struct tmpfs_file, io);
+    struct tmpfs * const fs = file->fs;
+
+    lock_acquire(&fs->lock);
+    tmpfs_put_node(fs, file->node);
+    lock_release(&fs->lock);
+
+    kfree(file);
+    return 0;
+}
+
+static int tmpfs_cntl(struct io * io, int cmd, void * arg) {
+    struct tmpfs_file * const file = (void*)io - offsetof(struct tmpfs_file, io);
+    struct tmpfs * const fs = file->fs;
+    struct tmpfs_node * const node = file->node;
+    unsigned long long * const ullarg = arg;
+    struct iopage * const pg = arg;
+    int result = 0;
+
+    switch (cmd) {
+    case IOCTL_GETBLKSZ:
+        return 1;
+    case IOCTL_GETINO:
+        *ullarg = (uintptr_t)node;
+        return 0;
+    case IOCTL_SYNC:
+        return 0; // the pages are the file
+    default:
+        break;
+    }
+
+    lock_acquire(&fs->lock);
+
+    switch (cmd) {
+    case IOCTL_GETEND:
+        *ullarg = node->size;
+        break;
+    case IOCTL_SETEND:
+        if (*ullarg > TMPFS_MAX_SIZE)
+            result = -EINVAL;
+        else {
+            elf_cache_invalidate((uintptr_t)node); // cached text is stale now
+            if (*ullarg < node->size)
+                tmpfs_truncate(fs, node, *ullarg);
+            node->size = *ullarg;
+        }
+        break;
+    case IOCTL_GETPAGE:
+        // A mapping shares the file's own page, so there is nothing to
+        // write back. NULL only asks whether the file can be mapped.
+
+        if (pg == NULL)
+            break;
+        if (pg->pos % PAGE_SIZE != 0 || pg->pos >= node->size) {
+            result = -EINVAL;
+            break;
+        }
+        pg->page = tmpfs_page(fs, node, pg->pos / PAGE_SIZE, 1);
+        if (pg->page == NULL)
+            result = -ENOMEM;
+        else
+            get_phys_page(pg->page); // the caller's reference
+        break;
+    default:
+        result = -ENOTSUP;
+        break;
+    }
+
+    lock_release(&fs->lock);
+    return result;
+}
+
+static long tmpfs_readat(struct io * io, unsigned long long pos, void * buf, long len) {
+    struct tmpfs_file * const file = (void*)io - offsetof(struct tmpfs_file, io);
+    struct tmpfs * const fs = file->fs;
+    struct tmpfs_node * const node = file->node;
+    unsigned long off;
+    long done = 0;
+    long n;
+    void * pp;
+
+    if (buf == NULL || len < 0)
+        return -EINVAL;
+
+    lock_acquire(&fs->lock);
+
+    if (pos >= node->size)
+        len = 0;
+    else if (node->size - pos < len)
+        len = node->size - pos;
+
+    while (done < len) {
+        off = (pos + done) % PAGE_SIZE;
+        n = PAGE_SIZE - off;
+        if (len - done < n)
+            n = len - done;
+
+        pp = tmpfs_page(fs, node, (pos + done) / PAGE_SIZE, 0);
+        if (pp == NULL)
+            memset(buf + done, 0, n);
+        else
+            memcpy(buf + done, pp + off, n);
+        done += n;
+    }
+
+    lock_release(&fs->lock);
+    return done;
+}
+
+static long tmpfs_writeat (
+    struct io * io, unsigned long long pos, const void * buf, long len)
+{
+    struct tmpfs_file * const file = (void*)io - offsetof(struct tmpfs_file, io);
+    struct tmpfs * const fs = file->fs;
+    struct tmpfs_node * const node = file->node;
+    unsigned long off;
+    long done = 0;
+    long n;
+    void * pp;
+
+    if (buf == NULL || len < 0)
+        return -EINVAL;
+
+    lock_acquire(&fs->lock);
+
+    // Like KTFS, a write does not extend the file: the seekable wrapper sets
+    // the new end first.
+
+    if (pos >= node->size) {
+        lock_release(&fs->lock);
+        return (len == 0) ? 0 : -EINVAL;
+    }
+
+    if (node->size - pos < len)
+        len = node->size - pos;
+    if (len != 0)
+        elf_cache_invalidate((uintptr_t)node); // cached text is stale now
+
+    while (done < len) {
+        off = (pos + done) % PAGE_SIZE;
+        n = PAGE_SIZE - off;
+        if (len - done < n)
+            n = len - done;
+
+        pp = tmpfs_page(fs, node, (pos + done) / PAGE_SIZE, 1);
+        if (pp == NULL)
+            break;
+        memcpy(pp + off, buf + done, n);
+        done += n;
+    }
+
+    lock_release(&fs->lock);
+    return (done == 0 && len != 0) ? -ENOMEM : done;
+}
+
+// Makes an empty file or directory at _path_. The name must not exist yet.
+
+static int tmpfs_make(struct tmpfs * fs, const char * path, int dir) {
+    char leaf[TMPFS_NAME_MAX + 1];
+    struct tmpfs_node ** link;
+    struct tmpfs_node * parent;
+    struct tmpfs_node * node;
+    int result = 0;
+
+    if (path == NULL)
+        return -EINVAL;
+
+    node = kcalloc(1, sizeof(struct tmpfs_node));
+    if (node == NULL)
+        return -ENOMEM;
+
+    lock_acquire(&fs->lock);
+
+    parent = tmpfs_resolve(fs, path, leaf);
+    link = (parent != NULL) ? tmpfs_find(parent, leaf) : NULL;
+
+    if (link == NULL)
+        result = -ENOENT;
+    else if (*link != NULL)
+        result = -EINVAL;
+    else {
+        strncpy(node->name, leaf, sizeof(node->name) - 1);
+        node->dir = dir;
+        node->refcnt = 1;
+        node->next = parent->children;
+        parent->children = node;
+    }
+
+    lock_release(&fs->lock);
+
+    if (result != 0)
+        kfree(node);
+    return result;
+}
+
+// Walks _path_ to the directory holding its last component, which is copied
+// to _leaf_. Returns the directory, or NULL if a component is missing, is
+// not a directory or is too long.
+
+static struct tmpfs_node * tmpfs_resolve (
+    struct tmpfs * fs, const char * path, char * leaf)
+{
+    struct tmpfs_node * dir = &fs->root;
+    struct tmpfs_node ** link;
+    const char * end;
+    size_t len;
+
+    for (;;) {
+        while (*path == '/')
+            path += 1;
+
+        for (end = path; *end != '\0' && *end != '/'; end++)
+            continue;
+
+        len = end - path;
+        if (len == 0 || len > TMPFS_NAME_MAX)
+            return NULL;
+
+        memcpy(leaf, path, len);
+        leaf[len] = '\0';
+
+        while (*end == '/')
+            end += 1;
+        if (*end == '\0')
+            return dir;
+
+        link = tmpfs_find(dir, leaf);
+        if (*link == NULL || !(*link)->dir)
+            return NULL;
+
+        dir = *link;
+        path = end;
+    }
+}
+
+// Returns the link to entry _name_ of _dir_, which is NULL if there is none
+
+static struct tmpfs_node ** tmpfs_find(struct tmpfs_node * dir, const char * name) {
+    struct tmpfs_node ** link = &dir->children;
+
+    while (*link != NULL && strcmp((*link)->name, name) != 0)
+        link = &(*link)->next;
+
+    return link;
+}
+
+// Returns data page _pgno_ of _node_. A missing page is NULL unless _alloc_
+// is set; then it is added, zeroed, unless the file system is full.
+
+static void * tmpfs_page(struct tmpfs * fs, struct tmpfs_node * node, unsigned long pgno, int alloc) {
+    void ** table;
+    void * pp;
+
+    if (node->pgdir == NULL) {
+        if (!alloc || (node->pgdir = alloc_phys_page()) == NULL)
+            return NULL;
+        memset(node->pgdir, 0, PAGE_SIZE);
+    }
+
+    table = node->pgdir[pgno / TMPFS_NPTRS];
+    if (table == NULL) {
+        if (!alloc || (table = alloc_phys_page()) == NULL)
+            return NULL;
+        memset(table, 0, PAGE_SIZE);
+        node->pgdir[pgno / TMPFS_NPTRS] = table;
+    }
+
+    pp = table[pgno % TMPFS_NPTRS];
+    if (pp == NULL && alloc && fs->npages < TMPFS_MAX_PAGES) {
+        pp = alloc_phys_page();
+        if (pp == NULL)
+            return NULL;
+        memset(pp, 0, PAGE_SIZE);
+        get_phys_page(pp); // the file's reference, see IOCTL_GETPAGE
+        table[pgno % TMPFS_NPTRS] = pp;
+        fs->npages += 1;
+    }
+
+    return pp;
+}
+
+// Drops the pages of _node_ past _size_ and zeroes the rest of the page that
+// holds the new end, so that growing the file again reads zeros. A page that
+// is still mapped stays until it is unmapped.
+
+static void tmpfs_truncate(struct tmpfs * fs, struct tmpfs_node * node, unsigned long long size) {
+    const unsigned long first = ROUND_UP(size, PAGE_SIZE) / PAGE_SIZE;
+    void ** table;
+    unsigned long i, j;
+    void * pp;
+
+    if (node->pgdir == NULL)
+        return;
+
+    if (size % PAGE_SIZE != 0) {
+        pp = tmpfs_page(fs, node, size / PAGE_SIZE, 0);
+        if (pp != NULL)
+            memset(pp + size % PAGE_SIZE, 0, PAGE_SIZE - size % PAGE_SIZE);
+    }
+
+    for (i = first / TMPFS_NPTRS; i < TMPFS_NPTRS; i++) {
+        table = node->pgdir[i];
+        if (table == NULL)
+            continue;
+
+        for (j = (i == first / TMPFS_NPTRS) ? first % TMPFS_NPTRS : 0; j < TMPFS_NPTRS; j++) {
+            if (table[j] != NULL) {
+                put_phys_page(table[j]);
+                table[j] = NULL;
+                fs->npages -= 1;
+            }
+        }
+
+        if (i * TMPFS_NPTRS >= first) {
+            free_phys_page(table);
+            node->pgdir[i] = NULL;
+        }
+    }
+
+    if (first == 0) {
+        free_phys_page(node->pgdir);
+        node->pgdir = NULL;
+    }
+}
+
+// Drops a reference to _node_ and frees it with the last one. Its address is
+// its identity (IOCTL_GETINO), so text cached from it goes too: a new node
+// may get the address.
+
+static void tmpfs_put_node(struct tmpfs * fs, struct tmpfs_node * node) {
+    node->refcnt -= 1;
+    if (node->refcnt != 0)
+        return;
+
+    elf_cache_invalidate((uintptr_t)node);
+    tmpfs_truncate(fs, node, 0);
+    kfree(node);
+}
@@ -0,0 +1,21 @@
+// tmpfs.h - Memory-backed file system
+//
+// Copyright (c) 2024-2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+#ifndef _TMPFS_H_
+#define _TMPFS_H_
+
+// EXPORTED FUNCTION DECLARATIONS
+//
+
+// tmpfs_mount() mounts an empty memory-backed file system at _path_ (see
+// fsattach). Its files live in physical pages and its directories in the
+// kernel heap; nothing reaches a device and everything is gone at reboot.
+// Files may be open more than once and mapped with mmap, which shares the
+// file's own pages. Returns 0 or a negative error code.
+
+extern int tmpfs_mount(const char * path);
+
+#endif // _TMPFS_H_
@@ -0,0 +1,151 @@
+// vfs.c - Mount table
+//
+// Copyright (c) 2024-2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+#ifdef VFS_TRACE
+#define TRACE
+#endif
+
+#ifdef VFS_DEBUG
+#define DEBUG
+#endif
+
+#include "fs.h"
+#include "conf.h"
+#include "error.h"
+#include "string.h"
+#include "console.h"
+
+#include <stddef.h>
+
+// INTERNAL GLOBAL VARIABLES
+//
+
+static struct {
+    const char * path;
+    size_t len;             // strlen(path)
+    struct filesys * fsys;
+} mnttab[NMOUNT];
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static struct filesys * fs_lookup(const char ** nameptr);
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+int fsattach(const char * path, struct filesys * fsys) {
+    int slot = -1;
+    int i;
+
+    trace("%s(%s)", __func__, path);
+
+    while (*path == '/')
+        path += 1;
+
+    for (i = 0; i < NMOUNT; i++) {
+        if (mnttab[i].fsys == NULL) {
+            if (slot < 0)
+                slot = i;
+        } else if (strcmp(mnttab[i].path, path) == 0)
+            return -EBUSY;
+    }
+
+    if (slot < 0)
+        return -EMFILE;
+
+    mnttab[slot].path = path;
+    mnttab[slot].len = strlen(path);
+    mnttab[slot].fsys = fsys;
+    return 0;
+}
+
+int fsopen(const char * name, struct io ** ioptr) {
+    struct filesys * const fsys = fs_lookup(&name);
+
+    if (fsys == NULL)
+        return -ENOENT;
+    return fsys->intf->open(fsys, name, ioptr);
+}
+
+int fscreate(const char * name) {
+    struct filesys * const fsys = fs_lookup(&name);
+
+    if (fsys == NULL)
+        return -ENOENT;
+    return fsys->intf->create(fsys, name);
+}
+
+int fsdelete(const char * name) {
+    struct filesys * const fsys = fs_lookup(&name);
+
+    // a mount point is not a file of the file system below it
+
+    if (fsys == NULL || *name == '\0')
+        return -EBUSY;
+    return fsys->intf->delete(fsys, name);
+}
+
+int fsmkdir(const char * path) {
+    struct filesys * const fsys = fs_lookup(&path);
+
+    if (fsys == NULL || *path == '\0')
+        return -EBUSY;
+    return fsys->intf->mkdir(fsys, path);
+}
+
+int fsflush(void) {
+    int result = 0;
+    int i;
+
+    for (i = 0; i < NMOUNT; i++) {
+        if (mnttab[i].fsys != NULL && mnttab[i].fsys->intf->flush(mnttab[i].fsys) != 0)
+            result = -EIO;
+    }
+
+    return result;
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+// Finds the mount serving *nameptr and advances *nameptr past the mount path.
+// Returns NULL if nothing is mounted there.
+
+static struct filesys * fs_lookup(const char ** nameptr) {
+    const char * name = *nameptr;
+    int best = -1;
+    size_t len;
+    int i;
+
+    if (name == NULL)
+        return NULL;
+
+    while (*name == '/')
+        name += 1;
+
+    for (i = 0; i < NMOUNT; i++) {
+        if (mnttab[i].fsys == NULL)
+            continue;
+        len = mnttab[i].len;
+        if (strncmp(mnttab[i].path, name, len) != 0)
+            continue;
+        if (len != 0 && name[len] != '/' && name[len] != '\0')
+            continue;
+        if (best < 0 || mnttab[best].len < len)
+            best = i;
+    }
+
+    if (best < 0)
+        return NULL;
+
+    name += mnttab[best].len;
+    while (*name == '/')
+        name += 1;
+
+    *nameptr = name;
+    return mnttab[best].fsys;
+}
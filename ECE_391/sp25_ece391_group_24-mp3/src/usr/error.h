@@ -24,5 +24,6 @@
 #define EPIPE      15
 #define ENODATABLKS  16
 #define ENOINODEBLKS 17
+#define EAGAIN     18
 
 #endif // _ERROR_H_
\ No newline at end of file
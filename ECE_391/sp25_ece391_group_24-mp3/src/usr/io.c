@@ -8,12 +8,29 @@
 
 #include <stddef.h>
 
-// INTERNAL TYPE DEFINITIONS
+// COMPILE-TIME CONSTANT DEFINITIONS
+//
+
+// Output of ioputs and ioprintf is collected in a buffer of IOPRINTF_BUFSZ
+// bytes and written when it fills and at the end of the call. ioterm_write
+// converts line endings into a buffer of IOTERM_WBUFSZ bytes.
+
+#ifndef IOPRINTF_BUFSZ
+#define IOPRINTF_BUFSZ 128
+#endif
+
+#ifndef IOTERM_WBUFSZ
+#define IOTERM_WBUFSZ 128
+#endif
+
+// INTERNAL TYPE DEFINITIONS
 //
 
 struct iovprintf_state {
     struct io * io;
     int err;
+    size_t len;
+    char buf[IOPRINTF_BUFSZ];
 };
 
 // INTERNAL FUNCTION DECLARATIONS
@@ -28,6 +45,7 @@ static long ioterm_write(struct io * io, const void * buf, long len);
 static int ioterm_ioctl(struct io * io, int cmd, void * arg);
 
 static void iovprintf_putc(char c, void * aux);
+static void iovprintf_flush(struct iovprintf_state * state);
 
 // EXPORTED FUNCTION DEFINITIONS
 //
@@ -118,23 +136,16 @@ int ioctl(struct io * io, int cmd, void * arg) {
 }
 
 int ioputs(struct io * io, const char * s) {
-    const char nl = '\n';
-    size_t slen;
-    long wlen;
+    struct iovprintf_state state = { .io = io, .err = 0, .len = 0 };
 
-    slen = strlen(s);
+    // The string and newline usually go out in one write
 
-    wlen = iowrite(io, s, slen);
-    if (wlen < 0)
-        return wlen;
+    while (*s != '\0')
+        iovprintf_putc(*s++, &state);
+    iovprintf_putc('\n', &state);
+    iovprintf_flush(&state);
 
-    // Write newline
-
-    wlen = iowrite(io, &nl, 1);
-    if (wlen < 0)
-        return wlen;
-    
-    return 0;
+    return state.err;
 }
 
 long ioprintf(struct io * io, const char * fmt, ...) {
@@ -149,10 +160,11 @@ long ioprintf(struct io * io, const char * fmt, ...) {
 
 long iovprintf(struct io * io, const char * fmt, va_list ap) {
     // state.nout is number of chars written or negative error code
-    struct iovprintf_state state = { .io = io, .err = 0 };
+    struct iovprintf_state state = { .io = io, .err = 0, .len = 0 };
     size_t nout;
 
 	nout = vgprintf(iovprintf_putc, &state, fmt, ap);
+    iovprintf_flush(&state);
     return state.err ? state.err : nout;
 }
 
@@ -299,110 +311,62 @@ long ioterm_read(struct io * io, void * buf, long len) {
 
 long ioterm_write(struct io * io, const void * buf, long len) {
     struct io_term * const iot = (void*)io - offsetof(struct io_term, io);
-    long acc = 0; // how many bytes from the buffer have been written
-    const char * wp;  // everything up to /wp/ in buffer has been written out
-    const char * rp;  // position in buffer we're reading
+    char out[IOTERM_WBUFSZ]; // converted output not yet written
+    const char * rp = buf;   // position in buffer we're reading
+    size_t olen = 0;
     long cnt;
     char ch;
 
-    // Scan through buffer and look for cases where we need to modify the line
-    // ending: lone \r and lone \n get converted to \r\n, while existing \r\n
-    // are not modified. We can't modify the buffer, so mwe may need to do
-    // partial writes.
-    // The strategy we want to implement is:
-    // if cr_out = 0 and ch == '\r': output \r\n to rawio, cr_out <- 1;
-    // if cr_out = 0 and ch == '\n': output \r\n to rawio;
-    // if cr_out = 0 and ch != '\r' and ch != '\n': output ch to rawio;
-    // if cr_out = 1 and ch == '\r': output \r\n to rawio;
-    // if cr_out = 1 and ch == '\n': no ouput, cr_out <- 0;
-    // if cr_out = 1 and ch != '\r' and ch != '\n': output ch, cr_out <- 0.
-
-    wp = rp = buf;
+    // Convert line endings into /out/ and write it to rawio whenever it is
+    // full, so the output goes out in large writes no matter how many line
+    // endings need fixing. Lone \r and lone \n get converted to \r\n, while
+    // existing \r\n are not modified:
+    // if cr_out = 0 and ch == '\r': output \r\n to rawio, cr_out <- 1;
+    // if cr_out = 0 and ch == '\n': output \r\n to rawio;
+    // if cr_out = 0 and ch != '\r' and ch != '\n': output ch to rawio;
+    // if cr_out = 1 and ch == '\r': output \r\n to rawio;
+    // if cr_out = 1 and ch == '\n': no ouput, cr_out <- 0;
+    // if cr_out = 1 and ch != '\r' and ch != '\n': output ch, cr_out <- 0.
 
     while ((void*)rp < buf+len) {
+        // Every character produces at most two
+        if (olen + 2 > sizeof(out)) {
+            cnt = iowrite(iot->rawio, out, olen);
+            if (cnt < 0)
+                return cnt;
+            olen = 0;
+        }
+
         ch = *rp++;
         switch (ch) {
         case '\r':
-            // We need to emit a \r\n sequence. If it already occurs in the
-            // buffer, we're all set. Otherwise, we need to write what we have
-            // from the buffer so far, then write \n, and then continue.
-            if ((void*)rp < buf+len && *rp == '\n') {
-                // The easy case: buffer already contains \r\n, so keep going.
-                iot->cr_out = 0;
-                rp += 1;
-            } else {
-                // Next character is not '\n' or we're at the end of the buffer.
-                // We need to write out what we have so far and add a \n.
-                cnt = iowrite(iot->rawio, wp, rp - wp);
-                if (cnt < 0)
-                    return cnt;
-                else if (cnt == 0)
-                    return acc;
-                
-                acc += cnt;
-                wp += cnt;
-
-                // Now output \n, which does not count toward /acc/.
-                cnt = ioputc(iot->rawio, '\n');
-                if (cnt < 0)
-                    return cnt;
-                
-                iot->cr_out = 1;
-            }
-                
+            out[olen++] = '\r';
+            out[olen++] = '\n';
+            iot->cr_out = 1;
             break;
         
         case '\n':
-            // If last character was \r, skip the \n. This should only occur at
-            // the beginning of the buffer, because we check for a \n after a
-            // \r, except if \r is the last character in the buffer. Since we're
-            // at the start of the buffer, we don't have to write anything out.
             if (iot->cr_out) {
                 iot->cr_out = 0;
-                wp += 1;
                 break;
             }
-            
-            // Previous character was not \r, so we need to write a \r first,
-            // then the rest of the buffer. But before that, we need to write
-            // out what we have so far, up to, but not including the \n we're
-            // processing.
-            if (wp != rp-1) {
-                cnt = iowrite(iot->rawio, wp, rp-1 - wp);
-                if (cnt < 0)
-                    return cnt;
-                else if (cnt == 0)
-                    return acc;
-                acc += cnt;
-                wp += cnt;
-            }
-            
-            cnt = ioputc(iot->rawio, '\r');
-            if (cnt < 0)
-                return cnt;
-            
-            // wp should now point to \n. We'll write it when we drain the
-            // buffer later.
-
-            iot->cr_out = 0;
+            out[olen++] = '\r';
+            out[olen++] = '\n';
             break;
             
         default:
+            out[olen++] = ch;
             iot->cr_out = 0;
         }
     }
 
-    if (rp != wp) {
-        cnt = iowrite(iot->rawio, wp, rp - wp);
-
+    if (olen != 0) {
+        cnt = iowrite(iot->rawio, out, olen);
         if (cnt < 0)
             return cnt;
-        else if (cnt == 0)
-            return acc;
-        acc += cnt;
     }
 
-    return acc;
+    return len;
 }
 
 int ioterm_ioctl(struct io * io, int cmd, void * arg) {
@@ -418,11 +382,20 @@ int ioterm_ioctl(struct io * io, int cmd, void * arg) {
 
 void iovprintf_putc(char c, void * aux) {
     struct iovprintf_state * const state = aux;
-    int result;
 
-    if (state->err == 0) {
-        result = ioputc(state->io, c);
+    if (state->len == sizeof(state->buf))
+        iovprintf_flush(state);
+    state->buf[state->len++] = c;
+}
+
+void iovprintf_flush(struct iovprintf_state * state) {
+    long result;
+
+    if (state->err == 0 && state->len != 0) {
+        result = iowrite(state->io, state->buf, state->len);
         if (result < 0)
             state->err = result;
     }
+
+    state->len = 0;
 }
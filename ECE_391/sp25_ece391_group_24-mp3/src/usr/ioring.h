@@ -0,0 +1,57 @@
+// ioring.h - Shared submission and completion ring
+//
+// Copyright (c) 2024-2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+#ifndef _IORING_H_
+#define _IORING_H_
+
+#include <stdint.h>
+
+// The ring is one page shared between a process and the kernel, mapped at
+// IORING_VMA by the ioring_setup system call. The process fills submission
+// queue entries (SQEs) and advances sq_tail; ioring_enter makes the kernel
+// run the queued operations in order, advance sq_head, and post one
+// completion queue entry (CQE) per operation at cq_tail. The process consumes
+// CQEs and advances cq_head. Head and tail counters run freely; the slot of
+// counter value _n_ is _n_ % IORING_ENTRIES. The kernel stops consuming SQEs
+// when the completion queue is full.
+//
+// This header is shared with the kernel (sys/ioring.h).
+
+#define IORING_ENTRIES 64
+
+#define IORING_OP_NOP   0 // no operation, res = 0
+#define IORING_OP_READ  1 // res = read(fd, addr, len)
+#define IORING_OP_WRITE 2 // res = write(fd, addr, len)
+#define IORING_OP_OPEN  3 // res = fsopen(fd, (const char *)addr)
+#define IORING_OP_CLOSE 4 // res = close(fd)
+
+struct ioring_sqe {
+    uint8_t op;          // IORING_OP_*
+    uint8_t rsvd[3];
+    int32_t fd;          // file descriptor (-1 to allocate for OPEN)
+    uint64_t addr;       // buffer or file name
+    uint64_t len;        // buffer size
+    uint64_t user_data;  // copied to the CQE
+};
+
+struct ioring_cqe {
+    uint64_t user_data;  // from the SQE
+    int64_t res;         // result of the operation
+};
+
+struct ioring {
+    volatile uint32_t sq_head; // advanced by kernel
+    volatile uint32_t sq_tail; // advanced by user
+    volatile uint32_t cq_head; // advanced by user
+    volatile uint32_t cq_tail; // advanced by kernel
+    uint32_t entries;          // IORING_ENTRIES
+    uint32_t rsvd[11];
+
+    struct ioring_sqe sq[IORING_ENTRIES];
+    struct ioring_cqe cq[IORING_ENTRIES];
+};
+
+#endif // _IORING_H_
@@ -27,4 +27,26 @@
 #define SYSCALL_PIPE    20  // create a pipe
 #define SYSCALL_IODUP   21
 
+#define SYSCALL_FUTEX_WAIT 22 // wait on a user-space word
+#define SYSCALL_FUTEX_WAKE 23 // wake waiters on a user-space word
+
+#define SYSCALL_READV   24  // scatter read from fd
+#define SYSCALL_WRITEV  25  // gather write to fd
+#define SYSCALL_PREADV  26  // scatter read from fd at position
+#define SYSCALL_PWRITEV 27  // gather write to fd at position
+
+#define SYSCALL_IORING_SETUP 28 // map the submission/completion ring
+#define SYSCALL_IORING_ENTER 29 // run queued submissions
+
+#define SYSCALL_SPAWN   30  // start a program in a new process
+
+#define SYSCALL_FDCTL   31  // get or set descriptor flags
+#define SYSCALL_POLL    32  // wait for readiness on several fds
+
+#define SYSCALL_FSMKDIR 33  // create a directory
+
+#define SYSCALL_MMAP    34  // map a file into memory
+#define SYSCALL_MSYNC   35  // write mapped pages back to the file
+#define SYSCALL_MUNMAP  36  // remove a file mapping
+
 #endif // _SCNUM_H_
\ No newline at end of file
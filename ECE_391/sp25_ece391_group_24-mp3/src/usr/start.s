@@ -25,6 +25,6 @@ _start:
         ld      a1, 8(sp)
         addi    sp, sp, 16
         
-        la      ra, _exit
+        la      ra, exit
         j       main
         .end
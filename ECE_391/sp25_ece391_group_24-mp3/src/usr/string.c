@@ -6,6 +6,7 @@
 
 # include "string.h"
 # include "syscall.h"
+# include "error.h"
 
 #include <stdint.h>
 #include <limits.h>
@@ -15,6 +16,34 @@
 #define UART_DESC 2
 #define NDEV     16
 
+// Size of the output buffer of each descriptor
+
+#ifndef STDIO_BUFSZ
+#define STDIO_BUFSZ 256
+#endif
+
+// INTERNAL CONSTANT DEFINITIONS
+// 
+
+// The memory functions move an aligned 64-bit word at a time where they can.
+// Multiplying a byte by WORD_ONES repeats it in every byte of a word, and
+// WORD_HAS_ZERO(w) is non-zero iff some byte of _w_ is zero. RISC-V makes
+// misaligned word accesses slow or traps them, so the word paths are only
+// taken when the pointers can be aligned together.
+
+typedef uint64_t __attribute__ ((may_alias)) word_t;
+
+#define WORD_SIZE sizeof(word_t)
+#define WORD_ONES 0x0101010101010101ULL
+#define WORD_HIGHS 0x8080808080808080ULL
+#define WORD_HAS_ZERO(w) (((w) - WORD_ONES) & ~(w) & WORD_HIGHS)
+#define WORD_OFFSET(p) ((uintptr_t)(p) & (WORD_SIZE - 1))
+
+// Copies and fills of whole, page-aligned pages take a loop with no head or
+// tail handling.
+
+#define MEM_PAGE_SIZE 4096
+
 // INTERNAL STRUCTURE DEFINITIONS
 // 
 
@@ -23,6 +52,22 @@ struct vsnprintf_state {
     size_t rem;
 };
 
+// Output buffer of a descriptor. A zero mode means the default for the
+// descriptor (see fdbuf_mode).
+
+struct fdbuf {
+    char mode;      // STDIO_FULLBUF, STDIO_LINEBUF, STDIO_UNBUF or 0
+    char pcprev;    // last character put, for line ending conversion
+    char nl;        // buffer holds a newline
+    unsigned short len;
+    char data[STDIO_BUFSZ];
+};
+
+// INTERNAL GLOBAL VARIABLE DEFINITIONS
+// 
+
+static struct fdbuf fdbufs[NDEV];
+
 // INTERNAL FUNCTION DECLARATIONS
 // 
 
@@ -40,6 +85,15 @@ static void vprintf_putc(char c, void * __attribute__ ((unused)) aux);
 
 static void dvprintf_putc(char c, void * aux);
 
+static void fdbuf_putc(int fd, char c);
+static void fdbuf_append(int fd, char c);
+static void fdbuf_done(int fd);
+static int fdbuf_flush(int fd);
+static int fdbuf_mode(int fd);
+
+
+static void copy_pages(word_t * dst, const word_t * src, size_t n);
+static void fill_pages(word_t * dst, word_t fill, size_t n);
 
 // EXPORTED FUNCTION DEFINITIONS
 // 
@@ -57,30 +111,18 @@ void puts(const char * str) {
 }
 
 void dputc(int fd, char c) {
-    static char pcprev[NDEV] = {'\0'};
-    
-
-    switch (c) {
-    case '\r':
-        _write(fd, &c, 1);
-        _write(fd, "\n",1);
-        break;
-    case '\n':
-        if (pcprev[fd] != '\r')
-            _write(fd, "\r",1);
-        // nobreak
-    default:
-        _write(fd, &c, 1);
-        break;
-    }
-
-    pcprev[fd] = c;
+    fdbuf_putc(fd, c);
+    fdbuf_done(fd);
 }
 
 char dgetc(int fd) {
     static char gcprev[NDEV] = {'\0'};
     char c;
-    // Convert \r followed by any number of \n to just \n 
+
+    // Make prompts and echoed input visible before blocking
+    dflushall();
+
+    // Convert \r followed by any number of \n to just \n 
 
     do {
         _read(fd,&c,1);
@@ -96,8 +138,9 @@ char dgetc(int fd) {
 
 void dputs(int fd, const char * str) {
     while (*str != '\0')
-        dputc(fd, *str++);
-    dputc(fd, '\n');
+        fdbuf_putc(fd, *str++);
+    fdbuf_putc(fd, '\n');
+    fdbuf_done(fd);
 }
 
 // no echo
@@ -167,6 +210,7 @@ void dprintf(int fd, const char * fmt, ...) {
     va_start(ap, fmt);
     vgprintf(dvprintf_putc, &fd, fmt, ap);
     va_end(ap);
+    fdbuf_done(fd);
 }
 
 void printf(const char * fmt, ...) {
@@ -174,8 +218,39 @@ void printf(const char * fmt, ...) {
     va_start(ap, fmt);
     vgprintf(vprintf_putc, NULL, fmt, ap);
     va_end(ap);
+    fdbuf_done(UART_DESC);
 }
 
+int dsetbuf(int fd, int mode) {
+    if (fd < 0 || NDEV <= fd)
+        return -EBADFD;
+    
+    if (mode != STDIO_FULLBUF && mode != STDIO_LINEBUF && mode != STDIO_UNBUF)
+        return -EINVAL;
+    
+    fdbuf_flush(fd);
+    fdbufs[fd].mode = mode;
+    return 0;
+}
+
+int dflush(int fd) {
+    if (fd < 0 || NDEV <= fd)
+        return -EBADFD;
+    
+    return fdbuf_flush(fd);
+}
+
+void dflushall(void) {
+    int fd;
+
+    for (fd = 0; fd < NDEV; fd++)
+        fdbuf_flush(fd);
+}
+
+void exit(void) {
+    dflushall();
+    _exit();
+}
 
 int strcmp(const char * s1, const char * s2) {
     // A null pointer compares before any non-null pointer
@@ -217,10 +292,27 @@ int strncmp(const char * s1, const char * s2, size_t n) {
 
 size_t strlen(const char * s) {
     const char * p = s;
+    const word_t * w;
 
     if (s == NULL)
         return 0;
 
+    // Check bytes up to a word boundary, then whole words. An aligned word
+    // never crosses a page boundary, so reading past the terminator is safe.
+
+    while (WORD_OFFSET(p) != 0) {
+        if (*p == '\0')
+            return (p - s);
+        p += 1;
+    }
+
+    w = (const word_t *)p;
+
+    while (!WORD_HAS_ZERO(*w))
+        w += 1;
+
+    p = (const char *)w;
+
     while (*p != '\0')
         p += 1;
     
@@ -266,19 +358,91 @@ char * strrchr(const char * s, int c) {
 }
 
 void * memset(void * s, int c, size_t n) {
-  char * p = s;
+    const word_t fill = (uint8_t)c * WORD_ONES;
+    uint8_t * p = s;
+    word_t * w;
 
-  while (n != 0) {
-    *p++ = c;
-    n -= 1;
-  }
+    if ((((uintptr_t)s | n) & (MEM_PAGE_SIZE - 1)) == 0) {
+        fill_pages(s, fill, n);
+        return s;
+    }
+
+    if (n >= 2 * WORD_SIZE) {
+        while (WORD_OFFSET(p) != 0) {
+            *p++ = c;
+            n -= 1;
+        }
+
+        w = (word_t *)p;
+
+        while (n >= 4 * WORD_SIZE) {
+            w[0] = fill;
+            w[1] = fill;
+            w[2] = fill;
+            w[3] = fill;
+            w += 4;
+            n -= 4 * WORD_SIZE;
+        }
+
+        while (n >= WORD_SIZE) {
+            *w++ = fill;
+            n -= WORD_SIZE;
+        }
+
+        p = (uint8_t *)w;
+    }
+
+    while (n != 0) {
+        *p++ = c;
+        n -= 1;
+    }
 
-  return s;
+    return s;
 }
 
 void * memcpy(void * restrict dst, const void * restrict src, size_t n) {
-    const char * q = src;
-    char * p = dst;
+    const uint8_t * q = src;
+    uint8_t * p = dst;
+    const word_t * wq;
+    word_t * wp;
+    word_t w0, w1, w2, w3;
+
+    if ((((uintptr_t)dst | (uintptr_t)src | n) & (MEM_PAGE_SIZE - 1)) == 0) {
+        copy_pages(dst, src, n);
+        return dst;
+    }
+
+    if (n >= 2 * WORD_SIZE && WORD_OFFSET(p) == WORD_OFFSET(q)) {
+        while (WORD_OFFSET(p) != 0) {
+            *p++ = *q++;
+            n -= 1;
+        }
+
+        wp = (word_t *)p;
+        wq = (const word_t *)q;
+
+        while (n >= 4 * WORD_SIZE) {
+            w0 = wq[0];
+            w1 = wq[1];
+            w2 = wq[2];
+            w3 = wq[3];
+            wp[0] = w0;
+            wp[1] = w1;
+            wp[2] = w2;
+            wp[3] = w3;
+            wp += 4;
+            wq += 4;
+            n -= 4 * WORD_SIZE;
+        }
+
+        while (n >= WORD_SIZE) {
+            *wp++ = *wq++;
+            n -= WORD_SIZE;
+        }
+
+        p = (uint8_t *)wp;
+        q = (const uint8_t *)wq;
+    }
     
     while (n != 0) {
         *p = *q;
@@ -293,6 +457,42 @@ void * memcpy(void * restrict dst, const void * restrict src, size_t n) {
 int memcmp(const void * p1, const void * p2, size_t n) {
     const uint8_t * u = p1;
     const uint8_t * v = p2;
+    const word_t * wu;
+    const word_t * wv;
+
+    // Skip over equal words; the byte loop finds the first difference in
+    // the word that differs.
+
+    if (n >= 2 * WORD_SIZE && WORD_OFFSET(u) == WORD_OFFSET(v)) {
+        while (WORD_OFFSET(u) != 0) {
+            if (*u != *v)
+                return (*u - *v);
+            u += 1;
+            v += 1;
+            n -= 1;
+        }
+
+        wu = (const word_t *)u;
+        wv = (const word_t *)v;
+
+        while (n >= 4 * WORD_SIZE &&
+            ((wu[0] ^ wv[0]) | (wu[1] ^ wv[1]) |
+             (wu[2] ^ wv[2]) | (wu[3] ^ wv[3])) == 0)
+        {
+            wu += 4;
+            wv += 4;
+            n -= 4 * WORD_SIZE;
+        }
+
+        while (n >= WORD_SIZE && *wu == *wv) {
+            wu += 1;
+            wv += 1;
+            n -= WORD_SIZE;
+        }
+
+        u = (const uint8_t *)wu;
+        v = (const uint8_t *)wv;
+    }
 
     while (n != 0) {
         if (*u != *v)
@@ -596,9 +796,154 @@ size_t format_str (
 }
 
 void vprintf_putc(char c, void * __attribute__ ((unused)) aux) {
-    putc(c);
+    fdbuf_putc(UART_DESC, c);
 }
 
 void dvprintf_putc(char c, void *  aux) {
-    dputc(*((int*)aux), c);
-}
\ No newline at end of file
+    fdbuf_putc(*((int*)aux), c);
+}
+
+// Appends _c_ to the output buffer of _fd_, converting line endings the way
+// dputc always has: \r becomes \r\n and a \n not preceded by \r becomes \r\n.
+// Descriptors outside the table are written directly.
+
+void fdbuf_putc(int fd, char c) {
+    struct fdbuf * fb;
+
+    if (fd < 0 || NDEV <= fd) {
+        _write(fd, &c, 1);
+        return;
+    }
+
+    fb = &fdbufs[fd];
+
+    switch (c) {
+    case '\r':
+        fdbuf_append(fd, '\r');
+        fdbuf_append(fd, '\n');
+        break;
+    case '\n':
+        if (fb->pcprev != '\r')
+            fdbuf_append(fd, '\r');
+        fdbuf_append(fd, '\n');
+        fb->nl = 1;
+        break;
+    default:
+        fdbuf_append(fd, c);
+        break;
+    }
+
+    fb->pcprev = c;
+}
+
+void fdbuf_append(int fd, char c) {
+    struct fdbuf * const fb = &fdbufs[fd];
+
+    if (fb->len == STDIO_BUFSZ)
+        fdbuf_flush(fd);
+    fb->data[fb->len++] = c;
+}
+
+// Called at the end of every output function. Unbuffered descriptors are
+// flushed after each call, line-buffered ones after a call that wrote a
+// newline, so a printf of several lines is still a single _write.
+
+void fdbuf_done(int fd) {
+    struct fdbuf * fb;
+
+    if (fd < 0 || NDEV <= fd)
+        return;
+    
+    fb = &fdbufs[fd];
+
+    switch (fdbuf_mode(fd)) {
+    case STDIO_UNBUF:
+        fdbuf_flush(fd);
+        break;
+    case STDIO_LINEBUF:
+        if (fb->nl)
+            fdbuf_flush(fd);
+        break;
+    default:
+        break;
+    }
+}
+
+int fdbuf_flush(int fd) {
+    struct fdbuf * const fb = &fdbufs[fd];
+    size_t pos = 0;
+    long cnt;
+
+    while (pos < fb->len) {
+        cnt = _write(fd, fb->data + pos, fb->len - pos);
+        if (cnt <= 0) {
+            // drop the data rather than retry forever
+            fb->len = 0;
+            fb->nl = 0;
+            return (cnt < 0) ? cnt : -EIO;
+        }
+        pos += cnt;
+    }
+
+    fb->len = 0;
+    fb->nl = 0;
+    return 0;
+}
+
+// The console is line-buffered and everything else fully buffered unless
+// dsetbuf says otherwise.
+
+int fdbuf_mode(int fd) {
+    if (fdbufs[fd].mode != 0)
+        return fdbufs[fd].mode;
+    else
+        return (fd == UART_DESC) ? STDIO_LINEBUF : STDIO_FULLBUF;
+}
+
+// Copies _n_ bytes, a multiple of MEM_PAGE_SIZE, between page-aligned buffers
+// eight words per iteration.
+
+void copy_pages(word_t * dst, const word_t * src, size_t n) {
+    word_t * const end = dst + n / WORD_SIZE;
+    word_t w0, w1, w2, w3, w4, w5, w6, w7;
+
+    while (dst < end) {
+        w0 = src[0];
+        w1 = src[1];
+        w2 = src[2];
+        w3 = src[3];
+        w4 = src[4];
+        w5 = src[5];
+        w6 = src[6];
+        w7 = src[7];
+        dst[0] = w0;
+        dst[1] = w1;
+        dst[2] = w2;
+        dst[3] = w3;
+        dst[4] = w4;
+        dst[5] = w5;
+        dst[6] = w6;
+        dst[7] = w7;
+        dst += 8;
+        src += 8;
+    }
+}
+
+// Fills _n_ bytes, a multiple of MEM_PAGE_SIZE, at page-aligned _dst_ eight
+// words per iteration.
+
+void fill_pages(word_t * dst, word_t fill, size_t n) {
+    word_t * const end = dst + n / WORD_SIZE;
+
+    while (dst < end) {
+        dst[0] = fill;
+        dst[1] = fill;
+        dst[2] = fill;
+        dst[3] = fill;
+        dst[4] = fill;
+        dst[5] = fill;
+        dst[6] = fill;
+        dst[7] = fill;
+        dst += 8;
+    }
+}
@@ -26,6 +26,27 @@ extern void dgetsn(int fd, char * buf, size_t n);
 extern void printf(const char * fmt, ...);
 extern void dprintf(int fd, const char * fmt, ...);
 
+// Output to descriptors below NDEV goes through a per-descriptor buffer that
+// is written with one _write when it fills or is flushed. In STDIO_FULLBUF
+// mode that happens only then; in STDIO_LINEBUF mode also after any call
+// that wrote a newline; in STDIO_UNBUF mode after every call. The console
+// (descriptor 2) defaults to line buffering, everything else to full.
+//
+// dsetbuf() flushes _fd_ and changes its mode. dflush() writes out what is
+// buffered for _fd_ and dflushall() does so for every descriptor. Reading
+// with dgetc() and exiting with exit() flush everything. Flush before _fork,
+// _exec or _close, or the buffered data is lost or written twice.
+
+#define STDIO_FULLBUF 1
+#define STDIO_LINEBUF 2
+#define STDIO_UNBUF   3
+
+extern int dsetbuf(int fd, int mode);
+extern int dflush(int fd);
+extern void dflushall(void);
+
+extern void __attribute__ ((noreturn)) exit(void);
+
 extern size_t strlen(const char * s);
 extern int strcmp(const char * s1, const char * s2);
 extern int strncmp(const char * s1, const char * s2, size_t n);
@@ -9,6 +9,50 @@
 
 #include <stddef.h>
 
+struct ioring; // ioring.h
+
+// One segment of a scatter-gather buffer for _readv, _writev, _preadv and
+// _pwritev. At most IOV_MAX segments may be passed in one call.
+
+struct iovec {
+    void * base;
+    size_t len;
+};
+
+#define IOV_MAX 16
+
+// Descriptor flags for _fdctl. A close-on-exec descriptor is closed by _exec
+// and not passed on by _spawn with a NULL fd_map.
+
+#define FDCTL_GETFL 0 // returns the flags of fd
+#define FDCTL_SETFL 1 // sets the flags of fd to arg
+
+#define FD_CLOEXEC  0x1
+#define FD_NONBLOCK 0x2 // _read and _write return -EAGAIN instead of blocking
+
+// One entry of a _poll request. _events_ holds the POLLIN and POLLOUT bits to
+// wait for; _revents_ receives the bits that hold, plus POLLERR, POLLHUP or
+// POLLNVAL. _poll returns the number of entries with a non-zero _revents_,
+// or 0 if _timeout_ms_ (-1 for none) passed first.
+
+struct pollfd {
+    int fd;
+    short events;
+    short revents;
+};
+
+#define POLLIN      0x01 // a read will not block
+#define POLLOUT     0x02 // a write will not block
+#define POLLERR     0x04 // a write will fail (no reader)
+#define POLLHUP     0x08 // the other end is closed
+#define POLLNVAL    0x10 // descriptor not open
+
+// Protection of a file mapping made by _mmap. _mmap returns the address of the
+// mapping, or a negative error code cast to a pointer. Stores to a writable
+// mapping reach the file on _msync, _munmap, or exit.
+
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
 
 extern void __attribute__ ((noreturn)) _exit(void);
 extern int _exec(int fd, int argc, char ** argv);
@@ -26,5 +70,20 @@ extern int _fscreate(const char *name);
 extern int _fsdelete(const char *name);
 extern int _iodup(int oldfs, int newfd);
 extern int _pipe(int * wfdptr, int * rfdptr);
+extern int _futex_wait(const int * uaddr, int expected);
+extern int _futex_wake(const int * uaddr, int cnt);
+extern long _readv(int fd, const struct iovec * iov, int iovcnt);
+extern long _writev(int fd, const struct iovec * iov, int iovcnt);
+extern long _preadv(int fd, const struct iovec * iov, int iovcnt, unsigned long long pos);
+extern long _pwritev(int fd, const struct iovec * iov, int iovcnt, unsigned long long pos);
+extern struct ioring * _ioring_setup(void);
+extern int _ioring_enter(unsigned int to_submit);
+extern int _spawn(int fd, int argc, char ** argv, const int * fd_map, int mapcnt);
+extern int _fdctl(int fd, int cmd, int arg);
+extern int _poll(struct pollfd * fds, int nfds, long timeout_ms);
+extern int _fsmkdir(const char * path);
+extern void * _mmap(int fd, unsigned long long off, size_t len, int prot);
+extern int _msync(const void * addr, size_t len);
+extern int _munmap(void * addr, size_t len);
 
 #endif // _SYSCALL_H_
\ No newline at end of file
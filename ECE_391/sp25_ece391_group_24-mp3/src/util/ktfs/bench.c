@@ -0,0 +1,302 @@
+// bench.c - Replay a file system trace on a KTFS image
+//
+// Copyright (c) 2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+// Usage: bench [-f files] [-s bytes] [-w chunk] image [trace]
+//
+// Mounts an image made by mkfs and runs the operations of _trace_, one per
+// line, through the kernel's KTFS:
+//
+//     create NAME         mkdir NAME          delete NAME
+//     write NAME BYTES    (append BYTES bytes, in chunks of -w bytes)
+//     read NAME           (read the whole file, in chunks of -w bytes)
+//     flush
+//
+// Blank lines and lines starting with # are skipped. Without a trace, it
+// creates -f files, writes -s bytes to each, reads them back and deletes
+// them. Prints the time and throughput of each kind of operation and the
+// requests that reached the image file. Run it under perf or gprof (see
+// the Makefile) to profile the file system.
+
+#include "host.h"
+#include "fs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// INTERNAL TYPE DEFINITIONS
+//
+
+enum op { OP_CREATE, OP_MKDIR, OP_WRITE, OP_READ, OP_DELETE, OP_FLUSH, OP_COUNT };
+
+struct opstat {
+    unsigned long count;
+    unsigned long failed;
+    unsigned long long bytes;
+    double secs;
+};
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static void run(enum op op, const char * name, unsigned long long bytes);
+static long long do_write(const char * name, unsigned long long bytes);
+static long long do_read(const char * name);
+static int replay(FILE * fp);
+static void synthetic(unsigned long files, unsigned long long bytes);
+static double now(void);
+
+// INTERNAL GLOBAL VARIABLES
+//
+
+static const char * const op_names[OP_COUNT] = {
+    "create", "mkdir", "write", "read", "delete", "flush"
+};
+
+static struct opstat stats[OP_COUNT];
+static char * chunk;
+static unsigned long chunksz = 4096;
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+int main(int argc, char ** argv) {
+    unsigned long files = 64;
+    unsigned long long bytes = 65536;
+    struct host_iostat st;
+    struct io * dev;
+    FILE * fp = NULL;
+    double total = 0;
+    int result;
+    int opt;
+    int fd;
+    int i;
+
+    while ((opt = getopt(argc, argv, "f:s:w:")) != -1) {
+        switch (opt) {
+        case 'f':
+            files = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            bytes = strtoull(optarg, NULL, 0);
+            break;
+        case 'w':
+            chunksz = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-f files] [-s bytes] [-w chunk] image [trace]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind < 1 || argc - optind > 2 || chunksz == 0) {
+        fprintf(stderr, "Usage: %s [-f files] [-s bytes] [-w chunk] image [trace]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc - optind == 2) {
+        fp = fopen(argv[optind+1], "r");
+        if (fp == NULL) {
+            fprintf(stderr, "bench: %s: %s\n", argv[optind+1], strerror(errno));
+            return 1;
+        }
+    }
+
+    fd = open(argv[optind], O_RDWR);
+    if (fd < 0) {
+        fprintf(stderr, "bench: %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+
+    chunk = malloc(chunksz);
+    if (chunk == NULL)
+        return 1;
+    for (i = 0; i < chunksz; i++)
+        chunk[i] = 'a' + i % 26;
+
+    dev = create_file_io(fd);
+    result = fsmount("", dev);
+    if (result != 0) {
+        fprintf(stderr, "bench: mount failed (%d)\n", result);
+        return 1;
+    }
+
+    if (fp != NULL) {
+        if (replay(fp) != 0)
+            return 1;
+        fclose(fp);
+    } else
+        synthetic(files, bytes);
+
+    run(OP_FLUSH, NULL, 0);
+
+    printf("%-8s %8s %8s %12s %10s %10s %10s\n",
+        "op", "count", "failed", "bytes", "seconds", "ops/s", "MB/s");
+    for (i = 0; i < OP_COUNT; i++) {
+        if (stats[i].count == 0)
+            continue;
+        printf("%-8s %8lu %8lu %12llu %10.4f %10.0f %10.2f\n",
+            op_names[i], stats[i].count, stats[i].failed, stats[i].bytes, stats[i].secs,
+            (stats[i].secs > 0) ? stats[i].count / stats[i].secs : 0,
+            (stats[i].secs > 0) ? stats[i].bytes / stats[i].secs / 1e6 : 0);
+        total += stats[i].secs;
+    }
+
+    file_io_stat(dev, &st);
+    printf("total %.4f s; device: %lu reads (%llu bytes), %lu writes (%llu bytes)\n",
+        total, st.reads, st.rbytes, st.writes, st.wbytes);
+
+    close(fd);
+    return 0;
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+// Runs and times one operation
+
+void run(enum op op, const char * name, unsigned long long bytes) {
+    const double start = now();
+    long long result;
+
+    switch (op) {
+    case OP_CREATE:
+        result = fscreate(name);
+        break;
+    case OP_MKDIR:
+        result = fsmkdir(name);
+        break;
+    case OP_WRITE:
+        result = do_write(name, bytes);
+        break;
+    case OP_READ:
+        result = do_read(name);
+        break;
+    case OP_DELETE:
+        result = fsdelete(name);
+        break;
+    default:
+        result = fsflush();
+        break;
+    }
+
+    stats[op].secs += now() - start;
+    stats[op].count += 1;
+    if (result < 0)
+        stats[op].failed += 1;
+    else if (op == OP_WRITE || op == OP_READ)
+        stats[op].bytes += result;
+}
+
+// Appends _bytes_ bytes to file _name_; returns the number written
+
+long long do_write(const char * name, unsigned long long bytes) {
+    unsigned long long end;
+    unsigned long long done = 0;
+    struct io * io;
+    long n;
+
+    if (fsopen(name, &io) != 0)
+        return -1;
+
+    ioctl(io, IOCTL_GETEND, &end);
+    ioctl(io, IOCTL_SETPOS, &end);
+
+    while (done < bytes) {
+        n = iowrite(io, chunk, (bytes - done < chunksz) ? bytes - done : chunksz);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+
+    ioclose(io);
+    return done;
+}
+
+// Reads all of file _name_; returns the number of bytes read
+
+long long do_read(const char * name) {
+    long long done = 0;
+    struct io * io;
+    char * buf;
+    long n;
+
+    if (fsopen(name, &io) != 0)
+        return -1;
+
+    buf = malloc(chunksz);
+    while (buf != NULL && (n = ioread(io, buf, chunksz)) > 0)
+        done += n;
+
+    free(buf);
+    ioclose(io);
+    return done;
+}
+
+int replay(FILE * fp) {
+    char line[256];
+    char verb[16];
+    char name[128];
+    unsigned long long bytes;
+    unsigned long lineno = 0;
+    int i, n;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno += 1;
+        bytes = 0;
+        n = sscanf(line, "%15s %127s %llu", verb, name, &bytes);
+        if (n <= 0 || verb[0] == '#')
+            continue;
+
+        for (i = 0; i < OP_COUNT; i++) {
+            if (strcmp(verb, op_names[i]) == 0)
+                break;
+        }
+
+        if (i == OP_COUNT || (i != OP_FLUSH && n < 2) || (i == OP_WRITE && n < 3)) {
+            fprintf(stderr, "bench: line %lu: bad operation\n", lineno);
+            return -1;
+        }
+
+        run(i, name, bytes);
+    }
+
+    return 0;
+}
+
+void synthetic(unsigned long files, unsigned long long bytes) {
+    char name[16];
+    unsigned long i;
+
+    for (i = 0; i < files; i++) {
+        snprintf(name, sizeof(name), "f%lu", i);
+        run(OP_CREATE, name, 0);
+        run(OP_WRITE, name, bytes);
+    }
+
+    run(OP_FLUSH, NULL, 0);
+
+    for (i = 0; i < files; i++) {
+        snprintf(name, sizeof(name), "f%lu", i);
+        run(OP_READ, name, 0);
+    }
+
+    for (i = 0; i < files; i++) {
+        snprintf(name, sizeof(name), "f%lu", i);
+        run(OP_DELETE, name, 0);
+    }
+}
+
+double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
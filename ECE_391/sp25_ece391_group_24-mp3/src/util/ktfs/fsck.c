@@ -0,0 +1,455 @@
+// fsck.c - Check a KTFS image
+//
+// Copyright (c) 2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+// Usage: fsck [-n] image
+//
+// Replays the journal of the image through the kernel's KTFS (unless -n is
+// given), then reads the image directly and checks that every file and
+// directory reachable from the root has valid block pointers that no other
+// file shares, that the bitmap agrees with the blocks in use, and that each
+// directory entry names an inode in use and is in the right bucket. The
+// blocks of deleted files the kernel has not finished freeing are still in
+// use. Blocks that are allocated but unused and inodes in use but unreachable
+// are only reported. Exits with 0 if no errors were found, 1 if some were, 2 if the
+// image could not be checked.
+
+#include "host.h"
+#include "fs.h"
+#include "ktfs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// INTERNAL TYPE DEFINITIONS
+//
+
+struct image {
+    int fd;
+    struct ktfs_superblock sb;
+    unsigned long blksz;
+    uint32_t data_start;    // block number of data block 0
+    uint32_t ninodes;
+    uint32_t inode_start;   // inodes below this may be files of mkfs_ktfs with no flags
+    unsigned char * bitmap;
+    struct ktfs_inode * inodes;
+    unsigned char * owned;  // blocks found in use, by block number
+    unsigned char * seen;   // inodes reached from the root
+    uint32_t * ptrs;        // pointer block being read
+    unsigned long errors;
+    unsigned long warnings;
+};
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static int load(struct image * img);
+static int check_journal(struct image * img, int replay);
+static void check_dir(struct image * img, uint16_t ino, const char * path);
+static uint32_t file_blocks(struct image * img, uint16_t ino);
+static int walk_blocks(struct image * img, uint16_t ino, uint32_t nblocks, uint32_t * out);
+static void claim(struct image * img, uint16_t ino, uint32_t data_block, const char * what);
+static int read_block(struct image * img, uint32_t block, void * buf);
+static int bit(const unsigned char * map, uint32_t n);
+static uint32_t dir_hash(const char * name);
+static void error(struct image * img, const char * fmt, ...);
+static void warning(struct image * img, const char * fmt, ...);
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+int main(int argc, char ** argv) {
+    struct image img;
+    int replay = 1;
+    uint32_t n, nreclaim;
+    uint32_t * fb;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n")) != -1) {
+        if (opt != 'n') {
+            fprintf(stderr, "Usage: %s [-n] image\n", argv[0]);
+            return 2;
+        }
+        replay = 0;
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-n] image\n", argv[0]);
+        return 2;
+    }
+
+    memset(&img, 0, sizeof(img));
+    img.fd = open(argv[optind], replay ? O_RDWR : O_RDONLY);
+    if (img.fd < 0) {
+        fprintf(stderr, "fsck: %s: %s\n", argv[optind], strerror(errno));
+        return 2;
+    }
+
+    if (load(&img) != 0 || check_journal(&img, replay) != 0)
+        return 2;
+
+    // the superblock, bitmap, inode and journal blocks belong to no file
+
+    for (n = 0; n < img.data_start; n++)
+        img.owned[n] = 1;
+    for (n = 0; n < img.sb.journal_block_count; n++)
+        img.owned[img.sb.journal_block + n] = 1;
+
+    img.seen[img.sb.root_directory_inode] = 1;
+    check_dir(&img, img.sb.root_directory_inode, "");
+
+    nreclaim = 0;
+    for (n = 0; n < img.ninodes; n++) {
+        if ((img.inodes[n].flags & KTFS_FILE_RECLAIM) == 0)
+            continue;
+        if (img.seen[n]) {
+            error(&img, "inode %u is deleted but in a directory", n);
+            continue;
+        }
+        fb = calloc(file_blocks(&img, n) + 1, sizeof(uint32_t));
+        if (fb == NULL)
+            exit(2);
+        walk_blocks(&img, n, file_blocks(&img, n), fb);
+        free(fb);
+        nreclaim++;
+    }
+
+    for (n = 0; n < img.sb.block_count; n++) {
+        if (img.owned[n] && !bit(img.bitmap, n))
+            error(&img, "block %u is in use but free in the bitmap", n);
+        else if (!img.owned[n] && bit(img.bitmap, n))
+            warning(&img, "block %u is allocated but not used", n);
+    }
+
+    for (n = 0; n < img.ninodes; n++) {
+        if (!img.seen[n] && (img.inodes[n].flags & (KTFS_FILE_IN_USE | KTFS_FILE_RECLAIM)) == KTFS_FILE_IN_USE)
+            warning(&img, "inode %u is in use but not in any directory", n);
+    }
+
+    if (nreclaim != 0)
+        printf("%s: %u deleted files still hold blocks\n", argv[optind], nreclaim);
+    printf("%s: %u blocks of %lu bytes, %u inodes: %lu errors, %lu warnings\n",
+        argv[optind], img.sb.block_count, img.blksz, img.ninodes,
+        img.errors, img.warnings);
+
+    close(img.fd);
+    return (img.errors != 0);
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+// Reads and checks the superblock, then reads the bitmap and the inodes
+
+int load(struct image * img) {
+    struct ktfs_superblock * const sb = &img->sb;
+    unsigned long long need;
+    size_t len;
+
+    if (pread(img->fd, sb, sizeof(*sb), 0) != sizeof(*sb)) {
+        fprintf(stderr, "fsck: cannot read the superblock\n");
+        return -1;
+    }
+
+    img->blksz = (sb->block_size != 0) ? sb->block_size : KTFS_BLKSZ;
+    if (img->blksz < KTFS_BLKSZ || img->blksz > KTFS_MAX_BLKSZ || (img->blksz & (img->blksz - 1)) != 0) {
+        fprintf(stderr, "fsck: bad block size %lu\n", img->blksz);
+        return -1;
+    }
+
+    img->data_start = 1 + sb->bitmap_block_count + sb->inode_block_count;
+    need = (sb->block_count + img->blksz * 8 - 1) / (img->blksz * 8);
+    if (sb->bitmap_block_count < need || img->data_start >= sb->block_count) {
+        fprintf(stderr, "fsck: bad block counts in the superblock\n");
+        return -1;
+    }
+    if (sb->journal_block_count != 0 && (sb->journal_block < img->data_start
+        || sb->journal_block_count > sb->block_count - sb->journal_block))
+    {
+        fprintf(stderr, "fsck: journal outside the data blocks\n");
+        return -1;
+    }
+
+    img->ninodes = sb->inode_block_count * (img->blksz / sizeof(struct ktfs_inode));
+    if (img->ninodes > UINT16_MAX + 1)
+        img->ninodes = UINT16_MAX + 1;
+    if (sb->root_directory_inode >= img->ninodes) {
+        fprintf(stderr, "fsck: bad root directory inode %u\n", sb->root_directory_inode);
+        return -1;
+    }
+
+    len = sb->bitmap_block_count * img->blksz;
+    img->bitmap = malloc(len);
+    if (img->bitmap == NULL || pread(img->fd, img->bitmap, len, img->blksz) != len) {
+        fprintf(stderr, "fsck: cannot read the bitmap\n");
+        return -1;
+    }
+
+    len = sb->inode_block_count * img->blksz;
+    img->inodes = malloc(len);
+    if (img->inodes == NULL || pread(img->fd, img->inodes, len, (1 + sb->bitmap_block_count) * img->blksz) != len) {
+        fprintf(stderr, "fsck: cannot read the inodes\n");
+        return -1;
+    }
+
+    img->owned = calloc(sb->block_count, 1);
+    img->seen = calloc(img->ninodes, 1);
+    img->ptrs = malloc(img->blksz);
+    if (img->owned == NULL || img->seen == NULL || img->ptrs == NULL)
+        return -1;
+
+    // an mkfs_ktfs root directory gives the number of its files (see ktfs_mount)
+
+    if ((img->inodes[sb->root_directory_inode].flags & KTFS_FILE_HASHED) == 0)
+        img->inode_start = img->inodes[sb->root_directory_inode].size / KTFS_DENSZ;
+
+    return 0;
+}
+
+// Replays the journal by mounting the image, or with -n only reports whether
+// it holds a transaction. The bitmap and inodes are read again afterwards.
+
+int check_journal(struct image * img, int replay) {
+    struct ktfs_journal_header hdr;
+    struct ktfs_journal_desc desc;
+    const off_t base = (off_t)img->sb.journal_block * img->blksz;
+    struct io * dev;
+    int result;
+
+    if (img->sb.journal_block_count == 0)
+        return 0;
+
+    if (!replay) {
+        if (pread(img->fd, &hdr, sizeof(hdr), base) == sizeof(hdr)
+            && pread(img->fd, &desc, sizeof(desc), base + img->blksz) == sizeof(desc)
+            && hdr.magic == KTFS_JOURNAL_MAGIC && desc.magic == KTFS_JOURNAL_DESC_MAGIC
+            && desc.seq == hdr.seq)
+        {
+            warning(img, "journal holds transactions that were not replayed");
+        }
+        return 0;
+    }
+
+    dev = create_file_io(img->fd);
+    result = fsmount("", dev);
+    if (result != 0) {
+        fprintf(stderr, "fsck: mount failed (%d)\n", result);
+        return -1;
+    }
+
+    free(img->bitmap);
+    free(img->inodes);
+    free(img->owned);
+    free(img->seen);
+    free(img->ptrs);
+    return load(img);
+}
+
+// Checks the entries of directory _ino_ and, depth first, what they name
+
+void check_dir(struct image * img, uint16_t ino, const char * path) {
+    const struct ktfs_inode * const dir = &img->inodes[ino];
+    const uint32_t ndents = img->blksz / KTFS_DENSZ;
+    const int hashed = (dir->flags & KTFS_FILE_HASHED) != 0;
+    uint32_t nblocks = file_blocks(img, ino);
+    struct ktfs_dir_entry * dentries;
+    uint32_t * blocks;
+    char sub[256];
+    uint32_t b, j;
+
+    if (hashed && (nblocks & (nblocks - 1)) != 0)
+        error(img, "directory /%s has %u blocks, not a power of two", path, nblocks);
+
+    blocks = calloc(nblocks + 1, sizeof(uint32_t));
+    dentries = malloc(img->blksz);
+    if (blocks == NULL || dentries == NULL)
+        exit(2);
+
+    nblocks = walk_blocks(img, ino, nblocks, blocks);
+
+    for (b = 0; b < nblocks; b++) {
+        if (read_block(img, img->data_start + blocks[b], dentries) != 0) {
+            error(img, "cannot read block %u of directory /%s", b, path);
+            continue;
+        }
+
+        for (j = 0; j < ndents; j++) {
+            const struct ktfs_dir_entry * const de = &dentries[j];
+            const uint16_t child = de->inode;
+
+            if (de->name[0] == '\0')
+                continue;
+
+            if (memchr(de->name, '\0', sizeof(de->name)) == NULL) {
+                error(img, "directory /%s: unterminated name", path);
+                continue;
+            }
+
+            snprintf(sub, sizeof(sub), "%s%s%s", path, (path[0] != '\0') ? "/" : "", de->name);
+
+            if (hashed && (dir_hash(de->name) & (nblocks - 1)) != b)
+                error(img, "/%s is in bucket %u of its directory", sub, b);
+
+            if (child >= img->ninodes) {
+                error(img, "/%s: inode %u out of range", sub, child);
+                continue;
+            }
+            if ((img->inodes[child].flags & KTFS_FILE_IN_USE) == 0 && child >= img->inode_start) {
+                error(img, "/%s: inode %u is free", sub, child);
+                continue;
+            }
+            if (img->seen[child]) {
+                error(img, "/%s: inode %u is already in a directory", sub, child);
+                continue;
+            }
+            img->seen[child] = 1;
+
+            if (img->inodes[child].flags & KTFS_FILE_DIR) {
+                check_dir(img, child, sub);
+            } else {
+                uint32_t n = file_blocks(img, child);
+                uint32_t * fb = calloc(n + 1, sizeof(uint32_t));
+                if (fb == NULL)
+                    exit(2);
+                walk_blocks(img, child, n, fb);
+                free(fb);
+            }
+        }
+    }
+
+    free(dentries);
+    free(blocks);
+}
+
+// Number of data blocks of inode _ino_, the way ktfs.c counts them
+
+uint32_t file_blocks(struct image * img, uint16_t ino) {
+    const struct ktfs_inode * const inode = &img->inodes[ino];
+    uint32_t n;
+
+    if (ino == img->sb.root_directory_inode && (inode->flags & KTFS_FILE_HASHED) == 0) {
+        for (n = 1; n < KTFS_NUM_DIRECT_DATA_BLOCKS && inode->block[n] != 0; n++)
+            continue;
+        return n;
+    }
+
+    return (inode->size + img->blksz - 1) / img->blksz;
+}
+
+// Claims the first _nblocks_ data blocks of inode _ino_ and the pointer blocks
+// that map them, storing the data block numbers in _out_. Returns how many
+// blocks were found.
+
+int walk_blocks(struct image * img, uint16_t ino, uint32_t nblocks, uint32_t * out) {
+    const struct ktfs_inode * const inode = &img->inodes[ino];
+    const uint32_t nptrs = img->blksz / sizeof(uint32_t);
+    uint32_t * const ptrs = img->ptrs;
+    uint32_t * inner;
+    uint32_t n = 0;
+    uint32_t i, k, d;
+
+    for (i = 0; i < KTFS_NUM_DIRECT_DATA_BLOCKS && n < nblocks; i++) {
+        claim(img, ino, inode->block[i], "data");
+        out[n++] = inode->block[i];
+    }
+
+    if (n < nblocks) {
+        claim(img, ino, inode->indirect, "indirect");
+        if (read_block(img, img->data_start + inode->indirect, ptrs) != 0)
+            return n;
+        for (i = 0; i < nptrs && n < nblocks; i++) {
+            claim(img, ino, ptrs[i], "data");
+            out[n++] = ptrs[i];
+        }
+    }
+
+    inner = malloc(img->blksz);
+    if (inner == NULL)
+        exit(2);
+
+    for (d = 0; d < KTFS_NUM_DINDIRECT_BLOCKS && n < nblocks; d++) {
+        claim(img, ino, inode->dindirect[d], "doubly indirect");
+        if (read_block(img, img->data_start + inode->dindirect[d], ptrs) != 0)
+            break;
+        for (k = 0; k < nptrs && n < nblocks; k++) {
+            claim(img, ino, ptrs[k], "indirect");
+            if (read_block(img, img->data_start + ptrs[k], inner) != 0)
+                break;
+            for (i = 0; i < nptrs && n < nblocks; i++) {
+                claim(img, ino, inner[i], "data");
+                out[n++] = inner[i];
+            }
+        }
+    }
+
+    free(inner);
+    return n;
+}
+
+// Records that inode _ino_ uses data block _data_block_
+
+void claim(struct image * img, uint16_t ino, uint32_t data_block, const char * what) {
+    const uint32_t n = img->data_start + data_block;
+
+    if (n >= img->sb.block_count || n < img->data_start) {
+        error(img, "inode %u: %s block %u out of range", ino, what, data_block);
+        return;
+    }
+    if (img->owned[n]) {
+        error(img, "inode %u: %s block %u is used twice", ino, what, data_block);
+        return;
+    }
+    img->owned[n] = 1;
+}
+
+int read_block(struct image * img, uint32_t block, void * buf) {
+    if (block >= img->sb.block_count)
+        return -1;
+    if (pread(img->fd, buf, img->blksz, (off_t)block * img->blksz) != img->blksz)
+        return -1;
+    return 0;
+}
+
+int bit(const unsigned char * map, uint32_t n) {
+    return (map[n / 8] >> (n % 8)) & 1;
+}
+
+// Same hash as ktfs_dir_hash in ktfs.c
+
+uint32_t dir_hash(const char * name) {
+    uint32_t hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < KTFS_MAX_FILENAME_LEN + 1 && name[i] != '\0'; i++)
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+
+    return hash;
+}
+
+void error(struct image * img, const char * fmt, ...) {
+    va_list ap;
+
+    img->errors += 1;
+    fputs("error: ", stdout);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+}
+
+void warning(struct image * img, const char * fmt, ...) {
+    va_list ap;
+
+    img->warnings += 1;
+    fputs("warning: ", stdout);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+}
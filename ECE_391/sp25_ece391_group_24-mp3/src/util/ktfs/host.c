@@ -0,0 +1,509 @@
+// host.c - Kernel services for the host build of KTFS
+//
+// Copyright (c) 2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+// ktfs.c and cache.c are compiled unchanged against the kernel headers. This
+// file gives them what the rest of the kernel would: the heap and physical
+// pages come from malloc, locks are no-ops and no thread can be spawned (the
+// tools run a single thread), and the I/O layer is the part of io.c they use,
+// plus a file endpoint for the image.
+
+#include "host.h"
+#include "ioimpl.h"
+#include "heap.h"
+#include "memory.h"
+#include "thread.h"
+#include "error.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// INTERNAL TYPE DEFINITIONS
+//
+
+struct fileio {
+    struct io io;
+    int fd;
+    struct host_iostat st;
+};
+
+struct seekio {
+    struct io io;
+    struct io * bkgio;
+    unsigned long long pos;
+    unsigned long long end;
+    int blksz;
+};
+
+// Reference counts of shared pages, as in memory.c: a page that was never
+// shared has no entry and a count of zero
+
+struct pageref {
+    struct pageref * next;
+    const void * pp;
+    unsigned int cnt;
+};
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static int fileio_cntl(struct io * io, int cmd, void * arg);
+static long fileio_readat(struct io * io, unsigned long long pos, void * buf, long bufsz);
+static long fileio_writeat(struct io * io, unsigned long long pos, const void * buf, long len);
+static int fileio_close(struct io * io);
+
+static int seekio_close(struct io * io);
+static int seekio_cntl(struct io * io, int cmd, void * arg);
+static long seekio_read(struct io * io, void * buf, long bufsz);
+static long seekio_write(struct io * io, const void * buf, long len);
+static long seekio_readat(struct io * io, unsigned long long pos, void * buf, long bufsz);
+static long seekio_writeat(struct io * io, unsigned long long pos, const void * buf, long len);
+
+static struct pageref ** pageref_find(const void * pp);
+
+// INTERNAL GLOBAL VARIABLES
+//
+
+static struct pageref * pagerefs;
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+void * kmalloc(size_t size) {
+    return malloc(size);
+}
+
+void * kcalloc(size_t nelts, size_t eltsz) {
+    return calloc(nelts, eltsz);
+}
+
+void kfree(void * ptr) {
+    free(ptr);
+}
+
+void * alloc_phys_pages(unsigned int cnt) {
+    return aligned_alloc(PAGE_SIZE, cnt * PAGE_SIZE);
+}
+
+void * alloc_phys_page(void) {
+    return alloc_phys_pages(1);
+}
+
+void free_phys_pages(void * pp, unsigned int cnt) {
+    free(pp);
+}
+
+void free_phys_page(void * pp) {
+    free(pp);
+}
+
+void get_phys_page(void * pp) {
+    struct pageref ** link = pageref_find(pp);
+    struct pageref * ref;
+
+    if (*link != NULL) {
+        (*link)->cnt += 1;
+        return;
+    }
+
+    ref = malloc(sizeof(struct pageref));
+    assert (ref != NULL);
+    ref->pp = pp;
+    ref->cnt = 1;
+    ref->next = pagerefs;
+    pagerefs = ref;
+}
+
+void put_phys_page(void * pp) {
+    struct pageref ** link = pageref_find(pp);
+    struct pageref * ref = *link;
+
+    assert (ref != NULL);
+
+    if (--ref->cnt == 0) {
+        *link = ref->next;
+        free(ref);
+        free_phys_page(pp);
+    }
+}
+
+unsigned int phys_page_refcnt(const void * pp) {
+    struct pageref ** link = pageref_find(pp);
+    return (*link != NULL) ? (*link)->cnt : 0;
+}
+
+void lock_init(struct lock * lock) {
+    lock->tid = -1;
+    lock->waiting_num = 0;
+    lock->next = NULL;
+}
+
+void lock_acquire(struct lock * lock) {
+    assert (lock->tid == -1);
+    lock->tid = 0;
+}
+
+void lock_release(struct lock * lock) {
+    lock->tid = -1;
+}
+
+// There are no other threads: KTFS frees the blocks of deleted files when it
+// runs short of space and at flush instead of in its reclaimer thread.
+
+int thread_spawn(const char * name, void (*entry)(void), ...) {
+    return -EMTHR;
+}
+
+void condition_init(struct condition * cond, const char * name) {
+    cond->name = name;
+}
+
+void condition_wait(struct condition * cond) {
+    abort(); // nothing could ever signal it
+}
+
+void condition_broadcast(struct condition * cond) {
+    // nobody is waiting
+}
+
+void thread_yield(void) {
+    // nothing else to run
+}
+
+void elf_cache_invalidate(unsigned long long ino) {
+    // no program text is cached on the host
+}
+
+void klprintf (
+    const char * label, const char * flname, int lineno, const char * fmt, ...)
+{
+    va_list ap;
+
+    fprintf(stderr, "%s %s:%d: ", label, flname, lineno);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+void kprintf(const char * fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+// I/O layer, as in io.c
+
+struct io * ioinit0(struct io * io, const struct iointf * intf) {
+    io->intf = intf;
+    io->refcnt = 0;
+    return io;
+}
+
+struct io * ioinit1(struct io * io, const struct iointf * intf) {
+    io->intf = intf;
+    io->refcnt = 1;
+    return io;
+}
+
+unsigned long iorefcnt(const struct io * io) {
+    return io->refcnt;
+}
+
+struct io * ioaddref(struct io * io) {
+    io->refcnt += 1;
+    return io;
+}
+
+int ioclose(struct io * io) {
+    assert (io->refcnt != 0);
+    io->refcnt -= 1;
+
+    if (io->refcnt == 0 && io->intf->close != NULL)
+        return io->intf->close(io);
+    return 0;
+}
+
+long ioread(struct io * io, void * buf, long bufsz) {
+    if (io->intf->read == NULL)
+        return -ENOTSUP;
+    if (bufsz < 0)
+        return -EINVAL;
+    return io->intf->read(io, buf, bufsz);
+}
+
+long iowrite(struct io * io, const void * buf, long len) {
+    long bufpos = 0;
+    long n;
+
+    if (io->intf->write == NULL)
+        return -ENOTSUP;
+    if (len < 0)
+        return -EINVAL;
+
+    do {
+        n = io->intf->write(io, buf + bufpos, len - bufpos);
+        if (n <= 0)
+            return (n < 0) ? n : bufpos;
+        bufpos += n;
+    } while (bufpos < len);
+
+    return bufpos;
+}
+
+long ioreadat(struct io * io, unsigned long long pos, void * buf, long bufsz) {
+    if (io->intf->readat == NULL)
+        return -ENOTSUP;
+    if (bufsz < 0)
+        return -EINVAL;
+    return io->intf->readat(io, pos, buf, bufsz);
+}
+
+long iowriteat(struct io * io, unsigned long long pos, const void * buf, long len) {
+    if (io->intf->writeat == NULL)
+        return -ENOTSUP;
+    if (len < 0)
+        return -EINVAL;
+    return io->intf->writeat(io, pos, buf, len);
+}
+
+int ioctl(struct io * io, int cmd, void * arg) {
+    if (io->intf->cntl != NULL)
+        return io->intf->cntl(io, cmd, arg);
+    else if (cmd == IOCTL_GETBLKSZ)
+        return 1;
+    else
+        return -ENOTSUP;
+}
+
+int ioblksz(struct io * io) {
+    return ioctl(io, IOCTL_GETBLKSZ, NULL);
+}
+
+struct io * create_seekable_io(struct io * io) {
+    static const struct iointf seekio_iointf = {
+        .close = &seekio_close,
+        .cntl = &seekio_cntl,
+        .read = &seekio_read,
+        .write = &seekio_write,
+        .readat = &seekio_readat,
+        .writeat = &seekio_writeat
+    };
+    struct seekio * sio;
+    unsigned long long end;
+    int result;
+
+    sio = calloc(1, sizeof(struct seekio));
+    assert (sio != NULL);
+    result = ioctl(io, IOCTL_GETEND, &end);
+    assert (result == 0);
+
+    sio->blksz = ioblksz(io);
+    sio->end = end;
+    sio->bkgio = ioaddref(io);
+    return ioinit1(&sio->io, &seekio_iointf);
+}
+
+struct io * create_file_io(int fd) {
+    static const struct iointf fileio_iointf = {
+        .close = &fileio_close,
+        .cntl = &fileio_cntl,
+        .readat = &fileio_readat,
+        .writeat = &fileio_writeat
+    };
+    struct fileio * fio;
+
+    fio = calloc(1, sizeof(struct fileio));
+    if (fio == NULL)
+        return NULL;
+
+    fio->fd = fd;
+    return ioinit1(&fio->io, &fileio_iointf);
+}
+
+void file_io_stat(struct io * io, struct host_iostat * st) {
+    struct fileio * const fio = (void*)io - offsetof(struct fileio, io);
+    *st = fio->st;
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+int fileio_cntl(struct io * io, int cmd, void * arg) {
+    struct fileio * const fio = (void*)io - offsetof(struct fileio, io);
+    struct stat sb;
+
+    switch (cmd) {
+    case IOCTL_GETBLKSZ:
+        return HOST_BLKSZ;
+    case IOCTL_GETEND:
+        if (fstat(fio->fd, &sb) != 0)
+            return -EIO;
+        *(unsigned long long *)arg = sb.st_size;
+        return 0;
+    default:
+        return -ENOTSUP;
+    }
+}
+
+long fileio_readat (
+    struct io * io, unsigned long long pos, void * buf, long bufsz)
+{
+    struct fileio * const fio = (void*)io - offsetof(struct fileio, io);
+    ssize_t n;
+
+    n = pread(fio->fd, buf, bufsz, pos);
+    if (n < 0)
+        return -EIO;
+
+    fio->st.reads += 1;
+    fio->st.rbytes += n;
+    return n;
+}
+
+long fileio_writeat (
+    struct io * io, unsigned long long pos, const void * buf, long len)
+{
+    struct fileio * const fio = (void*)io - offsetof(struct fileio, io);
+    struct stat sb;
+    ssize_t n;
+
+    // a device does not grow
+
+    if (fstat(fio->fd, &sb) != 0)
+        return -EIO;
+    if (pos > (unsigned long long)sb.st_size)
+        return -EINVAL;
+    if (sb.st_size - pos < len)
+        len = sb.st_size - pos;
+
+    n = pwrite(fio->fd, buf, len, pos);
+    if (n < 0)
+        return -EIO;
+
+    fio->st.writes += 1;
+    fio->st.wbytes += n;
+    return n;
+}
+
+int fileio_close(struct io * io) {
+    struct fileio * const fio = (void*)io - offsetof(struct fileio, io);
+    free(fio);
+    return 0;
+}
+
+int seekio_close(struct io * io) {
+    struct seekio * const sio = (void*)io - offsetof(struct seekio, io);
+    int result = ioclose(sio->bkgio);
+    free(sio);
+    return result;
+}
+
+int seekio_cntl(struct io * io, int cmd, void * arg) {
+    struct seekio * const sio = (void*)io - offsetof(struct seekio, io);
+    unsigned long long * ullarg = arg;
+    int result;
+
+    switch (cmd) {
+    case IOCTL_GETBLKSZ:
+        return sio->blksz;
+    case IOCTL_GETPOS:
+        *ullarg = sio->pos;
+        return 0;
+    case IOCTL_SETPOS:
+        if ((*ullarg & (sio->blksz - 1)) != 0 || *ullarg > sio->end)
+            return -EINVAL;
+        sio->pos = *ullarg;
+        return 0;
+    case IOCTL_GETEND:
+        *ullarg = sio->end;
+        return 0;
+    case IOCTL_SETEND:
+        result = ioctl(sio->bkgio, IOCTL_SETEND, ullarg);
+        if (result == 0)
+            sio->end = *ullarg;
+        return result;
+    default:
+        return ioctl(sio->bkgio, cmd, arg);
+    }
+}
+
+long seekio_read(struct io * io, void * buf, long bufsz) {
+    struct seekio * const sio = (void*)io - offsetof(struct seekio, io);
+    long rcnt;
+
+    if (sio->end - sio->pos < bufsz)
+        bufsz = sio->end - sio->pos;
+    if (bufsz == 0)
+        return 0;
+    if (bufsz < sio->blksz)
+        return -EINVAL;
+    bufsz &= ~(sio->blksz - 1);
+
+    rcnt = ioreadat(sio->bkgio, sio->pos, buf, bufsz);
+    sio->pos += (rcnt < 0) ? 0 : rcnt;
+    return rcnt;
+}
+
+long seekio_write(struct io * io, const void * buf, long len) {
+    struct seekio * const sio = (void*)io - offsetof(struct seekio, io);
+    unsigned long long end;
+    int result;
+    long wcnt;
+
+    if (len == 0)
+        return 0;
+    if (len < sio->blksz)
+        return -EINVAL;
+    len &= ~(sio->blksz - 1);
+
+    // a write past the end extends the file first
+
+    if (sio->end - sio->pos < len) {
+        if (ULLONG_MAX - sio->pos < len)
+            return -EINVAL;
+        end = sio->pos + len;
+        result = ioctl(sio->bkgio, IOCTL_SETEND, &end);
+        if (result != 0)
+            return result;
+        sio->end = end;
+    }
+
+    wcnt = iowriteat(sio->bkgio, sio->pos, buf, len);
+    sio->pos += (wcnt < 0) ? 0 : wcnt;
+    return wcnt;
+}
+
+long seekio_readat (
+    struct io * io, unsigned long long pos, void * buf, long bufsz)
+{
+    struct seekio * const sio = (void*)io - offsetof(struct seekio, io);
+    return ioreadat(sio->bkgio, pos, buf, bufsz);
+}
+
+long seekio_writeat (
+    struct io * io, unsigned long long pos, const void * buf, long len)
+{
+    struct seekio * const sio = (void*)io - offsetof(struct seekio, io);
+    return iowriteat(sio->bkgio, pos, buf, len);
+}
+
+static struct pageref ** pageref_find(const void * pp) {
+    struct pageref ** link = &pagerefs;
+
+    while (*link != NULL && (*link)->pp != pp)
+        link = &(*link)->next;
+
+    return link;
+}
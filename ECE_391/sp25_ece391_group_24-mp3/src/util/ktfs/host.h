@@ -0,0 +1,37 @@
+// host.h - Host build of the kernel's KTFS
+//
+// Copyright (c) 2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include "io.h"
+
+// Block size the image file reports, like a virtio block device
+
+#define HOST_BLKSZ 512
+
+// Requests and bytes that went through a file endpoint
+
+struct host_iostat {
+    unsigned long reads;
+    unsigned long writes;
+    unsigned long long rbytes;
+    unsigned long long wbytes;
+};
+
+// EXPORTED FUNCTION DECLARATIONS
+//
+
+// create_file_io() makes an I/O endpoint of open file descriptor _fd_, the
+// way create_memory_io() does of a buffer: readat and writeat at any position
+// within the file, IOCTL_GETBLKSZ gives HOST_BLKSZ and IOCTL_GETEND the size
+// of the file. Closing the endpoint does not close _fd_. file_io_stat() gets
+// the counts of the endpoint so far.
+
+extern struct io * create_file_io(int fd);
+extern void file_io_stat(struct io * io, struct host_iostat * st);
+
+#endif // _HOST_H_
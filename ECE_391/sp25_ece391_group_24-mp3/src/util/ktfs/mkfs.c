@@ -0,0 +1,263 @@
+// mkfs.c - Make a KTFS image
+//
+// Copyright (c) 2025 University of Illinois
+// SPDX-License-identifier: NCSA
+//
+
+// Usage: mkfs [-b block_size] [-j journal_bytes] image size inodes [file ...]
+//
+// Writes an empty file system of _size_ bytes (K, M or G suffix allowed) with
+// room for _inodes_ inodes and a hashed root directory, then copies each file
+// into its root directory through the kernel's KTFS. The journal goes at the
+// end of the image; -j 0 makes an image without one.
+
+#include "host.h"
+#include "fs.h"
+#include "ktfs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Journal size of a new image. The kernel only journals images that have one.
+
+#define MKFS_JOURNAL_SIZE 131072
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static unsigned long long parse_size(const char * arg);
+static int format(int fd, unsigned long blksz, unsigned long long size,
+    unsigned long inodes, unsigned long jbytes);
+static int copy_in(struct io * dev, const char * path);
+static void usage(const char * prog);
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+int main(int argc, char ** argv) {
+    unsigned long blksz = KTFS_BLKSZ;
+    unsigned long jbytes = MKFS_JOURNAL_SIZE;
+    unsigned long long size;
+    unsigned long inodes;
+    struct io * dev;
+    int result;
+    int opt;
+    int fd;
+    int i;
+
+    while ((opt = getopt(argc, argv, "b:j:")) != -1) {
+        switch (opt) {
+        case 'b':
+            blksz = strtoul(optarg, NULL, 0);
+            break;
+        case 'j':
+            jbytes = parse_size(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (argc - optind < 3)
+        usage(argv[0]);
+
+    if (blksz < KTFS_BLKSZ || blksz > KTFS_MAX_BLKSZ || (blksz & (blksz - 1)) != 0) {
+        fprintf(stderr, "%s: block size must be a power of two from %d to %d\n",
+            argv[0], KTFS_BLKSZ, KTFS_MAX_BLKSZ);
+        return 1;
+    }
+
+    size = parse_size(argv[optind+1]);
+    inodes = strtoul(argv[optind+2], NULL, 0);
+
+    fd = open(argv[optind], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], argv[optind], strerror(errno));
+        return 1;
+    }
+
+    if (format(fd, blksz, size, inodes, jbytes) != 0) {
+        close(fd);
+        return 1;
+    }
+
+    dev = create_file_io(fd);
+    result = fsmount("", dev);
+    if (result != 0) {
+        fprintf(stderr, "%s: mount failed (%d)\n", argv[0], result);
+        return 1;
+    }
+
+    for (i = optind + 3; i < argc; i++) {
+        if (copy_in(dev, argv[i]) != 0)
+            return 1;
+    }
+
+    if (fsflush() != 0) {
+        fprintf(stderr, "%s: flush failed\n", argv[0]);
+        return 1;
+    }
+
+    close(fd);
+    return 0;
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+// Lays out the superblock, bitmap, inodes with the root directory, and journal
+// header in a zeroed file of _size_ bytes.
+
+int format(int fd, unsigned long blksz, unsigned long long size,
+    unsigned long inodes, unsigned long jbytes)
+{
+    const unsigned long per_bitmap = blksz * 8;
+    const unsigned long per_inode_block = blksz / sizeof(struct ktfs_inode);
+    struct ktfs_superblock sb;
+    struct ktfs_journal_header hdr;
+    struct ktfs_inode root;
+    unsigned long long nblocks;
+    unsigned long used;
+    unsigned long jblocks;
+    unsigned char * bitmap;
+    unsigned long b;
+
+    nblocks = size / blksz;
+    if (size % blksz != 0 || nblocks > UINT32_MAX) {
+        fprintf(stderr, "mkfs: size must be a multiple of %lu and at most %llu bytes\n",
+            blksz, (unsigned long long)UINT32_MAX * blksz);
+        return -1;
+    }
+    if (inodes == 0 || inodes > UINT16_MAX + 1UL) {
+        fprintf(stderr, "mkfs: inode count must be from 1 to %d\n", UINT16_MAX + 1);
+        return -1;
+    }
+
+    memset(&sb, 0, sizeof(sb));
+    sb.block_count = nblocks;
+    sb.bitmap_block_count = (nblocks + per_bitmap - 1) / per_bitmap;
+    sb.inode_block_count = (inodes + per_inode_block - 1) / per_inode_block;
+    sb.root_directory_inode = 0;
+    sb.block_size = blksz;
+
+    used = 1 + sb.bitmap_block_count + sb.inode_block_count;
+    jblocks = jbytes / blksz;
+    if (jblocks != 0 && jblocks < 3) {
+        fprintf(stderr, "mkfs: a journal needs at least 3 blocks\n");
+        return -1;
+    }
+    if (used + jblocks >= nblocks) {
+        fprintf(stderr, "mkfs: image too small\n");
+        return -1;
+    }
+    if (jblocks != 0) {
+        sb.journal_block = nblocks - jblocks;
+        sb.journal_block_count = jblocks;
+    }
+
+    if (ftruncate(fd, size) != 0)
+        return -1;
+
+    // superblock, metadata and journal blocks are allocated
+
+    bitmap = calloc(sb.bitmap_block_count, blksz);
+    if (bitmap == NULL)
+        return -1;
+    for (b = 0; b < used; b++)
+        bitmap[b / 8] |= 1 << (b % 8);
+    for (b = sb.journal_block; b < sb.journal_block + jblocks; b++)
+        bitmap[b / 8] |= 1 << (b % 8);
+
+    memset(&root, 0, sizeof(root));
+    root.flags = KTFS_FILE_IN_USE | KTFS_FILE_DIR | KTFS_FILE_HASHED;
+
+    hdr.magic = KTFS_JOURNAL_MAGIC;
+    hdr.seq = 1;
+
+    if (pwrite(fd, &sb, sizeof(sb), 0) != sizeof(sb)
+        || pwrite(fd, bitmap, sb.bitmap_block_count * blksz, blksz) != sb.bitmap_block_count * blksz
+        || pwrite(fd, &root, sizeof(root), (1 + sb.bitmap_block_count) * blksz) != sizeof(root)
+        || (jblocks != 0 && pwrite(fd, &hdr, sizeof(hdr), (off_t)sb.journal_block * blksz) != sizeof(hdr)))
+    {
+        free(bitmap);
+        fprintf(stderr, "mkfs: write failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    free(bitmap);
+    return 0;
+}
+
+// Copies host file _path_ into the root directory under its base name
+
+int copy_in(struct io * dev, const char * path) {
+    const char * name = strrchr(path, '/');
+    char buf[4096];
+    struct io * io;
+    FILE * fp;
+    size_t n;
+    int result;
+
+    name = (name != NULL) ? name + 1 : path;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "mkfs: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    result = fscreate(name);
+    if (result == 0)
+        result = fsopen(name, &io);
+    if (result != 0) {
+        fprintf(stderr, "mkfs: cannot create %s (%d)\n", name, result);
+        fclose(fp);
+        return -1;
+    }
+
+    while ((n = fread(buf, 1, sizeof(buf), fp)) != 0) {
+        if (iowrite(io, buf, n) != n) {
+            fprintf(stderr, "mkfs: no room for %s\n", name);
+            result = -1;
+            break;
+        }
+    }
+
+    ioclose(io);
+    fclose(fp);
+    return result;
+}
+
+unsigned long long parse_size(const char * arg) {
+    char * end;
+    unsigned long long n;
+
+    n = strtoull(arg, &end, 0);
+    switch (*end) {
+    case 'G': case 'g':
+        n <<= 10;
+        // fall through
+    case 'M': case 'm':
+        n <<= 10;
+        // fall through
+    case 'K': case 'k':
+        n <<= 10;
+        break;
+    case '\0':
+        break;
+    default:
+        fprintf(stderr, "mkfs: invalid size: %s\n", arg);
+        exit(1);
+    }
+
+    return n;
+}
+
+void usage(const char * prog) {
+    fprintf(stderr, "Usage: %s [-b block_size] [-j journal_bytes] image size inodes [file ...]\n", prog);
+    exit(1);
+}
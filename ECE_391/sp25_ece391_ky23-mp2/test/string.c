@@ -11,11 +11,23 @@
 static void test_strlen(void);
 static void test_strcmp(void);
 static void test_strtoul(void);
+static void test_memcpy(void);
+static void test_memset(void);
+static void test_memcmp(void);
+
+// Buffers for the memory function tests. Page alignment lets the tests reach
+// the page-sized fast paths as well as the word and byte paths.
+
+static unsigned char tbuf1[2 * 4096] __attribute__ ((aligned (4096)));
+static unsigned char tbuf2[2 * 4096] __attribute__ ((aligned (4096)));
 
 int main(void) {
     test_strlen();
     test_strcmp();
     test_strtoul();
+    test_memcpy();
+    test_memset();
+    test_memcmp();
     FINISH();
 }
 
@@ -34,10 +46,19 @@ static void test_strlen_nzlen(void) {
     TEST_ASSERT (strlen("hello") == 5);
 }
 
+static void test_strlen_unaligned(void) {
+    static const char str[] = "the quick brown fox jumps over the lazy dog";
+    int i;
+
+    for (i = 0; i < 8; i++)
+        TEST_ASSERT (strlen(str + i) == sizeof(str) - 1 - i);
+}
+
 void test_strlen(void) {
     test_strlen_null();
     test_strlen_zlen();
     test_strlen_nzlen();
+    test_strlen_unaligned();
 }
 
 // strcmp
@@ -128,4 +149,81 @@ void test_strtoul(void) {
     test_strtoul_base10_nondigit();
     test_strtoul_base10_small_positive();
     test_strtoul_base10_small_negative();
-}
\ No newline at end of file
+}
+
+// memcpy, memset, memcmp
+
+static void fill_pattern(unsigned char * p, size_t n, unsigned int seed) {
+    while (n != 0) {
+        *p++ = seed;
+        seed = seed * 1103515245 + 12345;
+        n -= 1;
+    }
+}
+
+static int check_fill(const unsigned char * p, size_t n, unsigned char c) {
+    while (n != 0) {
+        if (*p++ != c)
+            return 0;
+        n -= 1;
+    }
+
+    return 1;
+}
+
+static void test_memcpy_offsets(size_t dofs, size_t sofs, size_t n) {
+    size_t i;
+
+    fill_pattern(tbuf1, sizeof(tbuf1), 1);
+    memset(tbuf2, 0xAA, sizeof(tbuf2));
+    TEST_ASSERT (memcpy(tbuf2 + dofs, tbuf1 + sofs, n) == tbuf2 + dofs);
+
+    for (i = 0; i < n; i++)
+        if (tbuf2[dofs + i] != tbuf1[sofs + i])
+            break;
+    TEST_ASSERT (i == n);
+
+    // Bytes around the destination must not change
+    TEST_ASSERT (check_fill(tbuf2, dofs, 0xAA));
+    TEST_ASSERT (check_fill(tbuf2 + dofs + n, sizeof(tbuf2) - dofs - n, 0xAA));
+}
+
+void test_memcpy(void) {
+    test_memcpy_offsets(0, 0, 0);
+    test_memcpy_offsets(0, 0, 7);
+    test_memcpy_offsets(0, 0, 4096);
+    test_memcpy_offsets(3, 3, 1000);
+    test_memcpy_offsets(1, 5, 1000);
+    test_memcpy_offsets(7, 0, 4096);
+}
+
+static void test_memset_range(size_t ofs, size_t n, int c) {
+    memset(tbuf1, 0x55, sizeof(tbuf1));
+    TEST_ASSERT (memset(tbuf1 + ofs, c, n) == tbuf1 + ofs);
+    TEST_ASSERT (check_fill(tbuf1 + ofs, n, c));
+    TEST_ASSERT (check_fill(tbuf1, ofs, 0x55));
+    TEST_ASSERT (check_fill(tbuf1 + ofs + n, sizeof(tbuf1) - ofs - n, 0x55));
+}
+
+void test_memset(void) {
+    test_memset_range(0, 0, 0);
+    test_memset_range(0, 5, 0x12);
+    test_memset_range(0, 4096, 0);
+    test_memset_range(5, 61, 0xFF);
+    test_memset_range(3, 4096, 0x80);
+}
+
+void test_memcmp(void) {
+    fill_pattern(tbuf1, sizeof(tbuf1), 7);
+    memcpy(tbuf2, tbuf1, sizeof(tbuf1));
+
+    TEST_ASSERT (memcmp(tbuf1, tbuf2, sizeof(tbuf1)) == 0);
+    TEST_ASSERT (memcmp(tbuf1 + 3, tbuf2 + 3, 100) == 0);
+
+    // A difference late in a word must be found and ordered as unsigned bytes
+    tbuf1[1000] = 0x01;
+    tbuf2[1000] = 0xF0;
+    TEST_ASSERT (memcmp(tbuf1, tbuf2, sizeof(tbuf1)) < 0);
+    TEST_ASSERT (memcmp(tbuf2, tbuf1, sizeof(tbuf1)) > 0);
+    TEST_ASSERT (memcmp(tbuf1 + 1, tbuf2 + 1, 999) == 0);
+}